@@ -44,8 +44,23 @@
 #include <inttypes.h>
 #include <math.h>
 #include <limits.h>
+#include <float.h>
 #include <signal.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
 #include "config.h"
 // 使用C语言写的代码,如果要在C++中使用,那么需要使用这种方式导入头文件
 #ifdef __cplusplus
@@ -63,6 +78,7 @@ extern "C" {
 #include "libavutil/avassert.h"
 #include "libavutil/time.h"
 #include "libavutil/bprint.h"
+#include "libavutil/cpu.h"
 #include "libavformat/avformat.h"
 #include "libavdevice/avdevice.h"
 #include "libswscale/swscale.h"
@@ -96,6 +112,8 @@ extern "C" {
 #define SDL_AUDIO_MIN_BUFFER_SIZE 512
 /* Calculate actual buffer size keeping in mind not cause too frequent audio callbacks */
 #define SDL_AUDIO_MAX_CALLBACKS_PER_SEC 30
+/* In callback mode we can't measure the device fill level, assume the driver has this many periods */
+#define SDL_AUDIO_DRIVER_PERIODS 2
 
 /* Step size for volume control in dB */
 #define SDL_VOLUME_STEP (0.75)
@@ -117,18 +135,149 @@ extern "C" {
 #define EXTERNAL_CLOCK_SPEED_MAX  1.010
 #define EXTERNAL_CLOCK_SPEED_STEP 0.001
 
-/* we use about AUDIO_DIFF_AVG_NB A-V differences to make the average */
-#define AUDIO_DIFF_AVG_NB   20
+/* jitter buffer defaults, target delay is JITTER_DELAY_FACTOR times the measured jitter */
+#define JITTER_MIN_DELAY 0.02
+#define JITTER_MAX_DELAY 1.0
+#define JITTER_DELAY_FACTOR 4.0
+/* extra delay added on every underflow, and how fast the delay shrinks back, per second */
+#define JITTER_UNDERFLOW_STEP 0.01
+#define JITTER_DELAY_DECAY 0.05
+/* how fast the transit time reference follows a slower sender clock, seconds per second */
+#define JITTER_TRANSIT_LEAK 0.0005
+/* timestamp jumps larger than this restart the transit time reference */
+#define JITTER_RESYNC_THRESHOLD 10.0
+
+/* datagram size of the loopback sender, 7 mpegts packets like udp:// uses */
+#define LOOPBACK_PACKET_SIZE 1316
+/* give the player time to open the udp socket before the first datagram */
+#define LOOPBACK_START_DELAY 500000
+
+/* default gains of the A-V drift controller, per second of A-V difference */
+#define AVSYNC_KP 0.5
+#define AVSYNC_KI 0.05
+/* weight of a new A-V difference measurement in the smoothed error */
+#define AVSYNC_ERROR_SMOOTHING 0.2
+/* fast-lock phase after a serial change: gain multiplier, speed limit and maximum length;
+ * the limit stays at what is inaudible, without swr the correction drops or repeats that share of samples */
+#define AVSYNC_FAST_LOCK_GAIN 4.0
+#define AVSYNC_FAST_LOCK_CORRECTION_PERCENT_MAX 10
+#define AVSYNC_FAST_LOCK_MAX_TIME 2.0
+/* the fast-lock phase ends once the A-V difference is below this */
+#define AVSYNC_LOCK_THRESHOLD 0.01
+
+/* number of resampler contexts kept alive across audio format changes */
+#define SWR_CACHE_SIZE 4
+
+/* buffer pools kept by each decoder frame allocator, one pool per distinct plane size */
+#define FRAME_POOL_NB 8
+/* alignment of pooled planes and video strides, enough for SIMD and texture uploads */
+#define FRAME_POOL_ALIGN 64
+/* audio plane sizes are rounded up to this so frames with slightly different sample counts share a pool */
+#define FRAME_POOL_AUDIO_GRANULE 4096
+/* with -frame_pool_thp buffers at least this large are backed by transparent huge pages */
+#define FRAME_POOL_HUGE_PAGE (2 * 1024 * 1024)
+
+/* decoder load (decode time / media time) above which the degradation ladder steps up, and below which it steps down */
+#define DEGRADE_LOAD_HIGH 0.85
+#define DEGRADE_LOAD_LOW 0.5
+/* weight of a new per-frame load measurement */
+#define DEGRADE_LOAD_SMOOTHING 0.05
+/* minimum time at a level before stepping up, and before the first step down */
+#define DEGRADE_HOLD_TIME 0.5
+#define DEGRADE_RECOVER_TIME 2.0
+/* a step down that has to be undone quickly doubles the time before the next one, up to this */
+#define DEGRADE_RECOVER_TIME_MAX 32.0
+
+/* non-reference video packets are dropped before decoding when their dts is this far behind the master clock */
+#define PACKET_DROP_LATE_THRESHOLD 0.1
+/* or, for realtime inputs, when the video packet queue holds more than this many seconds */
+#define PACKET_DROP_QUEUE_DURATION 1.0
+
+/* consumed packets kept for seeking back (-seek_buffer) are also limited to this many bytes per queue */
+#define SEEK_BUFFER_MAX_SIZE (64 * 1024 * 1024)
+/* audio may start this much after the video keyframe of a seek served from the buffer */
+#define SEEK_BUFFER_SLACK 0.1
+
+/* -infbuf: packet data held in memory per queue before new packets go to the spill file, in MiB (-spill_mem) */
+#define SPILL_MEM_DEFAULT 128
+/* size of the spill file per queue, in MiB (-spill_size); when it is full packets stay in memory */
+#define SPILL_SIZE_DEFAULT 4096
+/* the spill file is written back and read ahead in chunks of this many bytes */
+#define SPILL_CHUNK (1024 * 1024)
+/* chunks read ahead of the packet being read back */
+#define SPILL_PREFETCH_CHUNKS 4
+
+/* at most this many decoder contexts decode video units in parallel */
+#define PDEC_MAX_WORKERS 16
+/* units waiting or being decoded per decoder context, keeps every context busy without reading far ahead */
+#define PDEC_UNITS_PER_WORKER 2
+/* decoded frames a unit holds ahead of the video thread before its decoder waits */
+#define PDEC_UNIT_MAX_FRAMES 16
+
+/* -seek_bench gives up on a seek whose first frame doesn't show up within this many microseconds */
+#define SEEK_BENCH_TIMEOUT 10000000
+/* and lets playback run this long after each seek, like a user looking at the result */
+#define SEEK_BENCH_SETTLE 100000
+
+/* -zap_list: packets of the latest GOP kept per standby channel, more and it waits for the next keyframe */
+#define ZAP_GOP_MAX_SIZE (16 * 1024 * 1024)
+/* without video a standby channel keeps this many seconds of audio */
+#define ZAP_AUDIO_BUFFER 0.5
+/* a standby channel that failed to connect is retried after this many microseconds */
+#define ZAP_RETRY_DELAY 2000000
+/* a standby reader is interrupted if it doesn't stop between two packets within this many microseconds */
+#define ZAP_HANDOVER_TIMEOUT 500000
+
+/* -timeshift: keyframes remembered for seeking in the ring, the oldest are forgotten first */
+#define TIMESHIFT_INDEX_SIZE 65536
+/* without video an audio packet is indexed every this many seconds */
+#define TIMESHIFT_AUDIO_KEY_INTERVAL 1.0
+
+/* decoded frames held for reverse playback and backward stepping, in MiB (-reverse_cache) */
+#define REVERSE_CACHE_DEFAULT 256
+
+/* the thread tuner wants the decoder to run this much faster than the frame rate */
+#define THREAD_TUNE_HEADROOM 1.5
+/* and gives threads back when it runs this many times faster than wanted */
+#define THREAD_TUNE_SPARE 4.0
+#define THREAD_TUNE_MAX_PROBES 3
+/* frame threads of a live input, each one adds a frame of delay */
+#define THREAD_TUNE_LIVE_FRAME_THREADS 2
+/* libavcodec doesn't use more than this with threads=auto either */
+#define THREAD_TUNE_MAX_THREADS 16
+
+#define WORKER_POOL_MAX_THREADS 64
+/* tasks queued per worker, a batch that doesn't fit runs the rest on the submitting thread */
+#define WORKER_POOL_DEQUE_SIZE 64
+/* parallel sws conversions: at most this many bands, none shorter than this many lines */
+#define SWS_BANDS_MAX 8
+#define SWS_BAND_MIN_HEIGHT 64
 
 /* polls for possible required screen refresh at least this often, should be less than 1/fps */
 #define REFRESH_RATE 0.01
 
+/* accepted range of the display refresh period learned from vsync'ed presents */
+#define PRESENT_PERIOD_MIN 0.004
+#define PRESENT_PERIOD_MAX 0.05
+/* weight of a new refresh period measurement */
+#define PRESENT_PERIOD_SMOOTHING 0.02
+/* the cadence histogram counts frames held for 1 .. PRESENT_CADENCE_MAX refresh periods */
+#define PRESENT_CADENCE_MAX 4
+
 /* NOTE: the size must be big enough to compensate the hardware audio buffersize size */
 /* TODO: We assume that a decoded and resampled frame fits into this buffer */
 #define SAMPLE_ARRAY_SIZE (8 * 65536)
 
+/* VideoState blocks written by different threads start on their own cache line */
+#define CACHE_LINE_SIZE 64
+
 #define CURSOR_HIDE_DELAY 1000000 // 1秒
 
+/* commands from the event loop to the render thread, must be a power of two */
+#define RENDER_COMMAND_QUEUE_SIZE 64
+/* how long the event loop waits for input when a render thread draws the video, in ms */
+#define EVENT_WAIT_TIMEOUT 100
+
 #define USE_ONEPASS_SUBTITLE_RENDER 1
 
 #define OS_ANDROID
@@ -142,13 +291,59 @@ enum {
     AV_SYNC_EXTERNAL_CLOCK, /* synchronize to an external clock */
 };
 
+/* audio output latency modes, they choose the SDL period size */
+enum {
+    AUDIO_LATENCY_ULTRA_LOW,
+    AUDIO_LATENCY_NORMAL, /* default choice */
+    AUDIO_LATENCY_POWER_SAVE,
+    AUDIO_LATENCY_NB,
+};
+
+static const struct AudioLatencyMode {
+    const char *name;
+    int min_buffer_size;        /* in samples */
+    int max_callbacks_per_sec;
+    int push_queue_periods;     /* periods kept queued ahead of the device in push mode */
+} audio_latency_modes[AUDIO_LATENCY_NB] = {
+        {"ultralow",  128, 200, 1},
+        {"normal",    SDL_AUDIO_MIN_BUFFER_SIZE, SDL_AUDIO_MAX_CALLBACKS_PER_SEC, 2},
+        {"powersave", 2048, 8, 2},
+};
+
+/* resampler quality/cost tiers */
+enum {
+    RESAMPLE_QUALITY_FAST,   /* short filter, linear interpolation, for weak hosts */
+    RESAMPLE_QUALITY_NORMAL, /* default choice, swresample defaults */
+    RESAMPLE_QUALITY_HIGH,
+};
+
 // 就是一个节点(node)
 typedef struct MyAVPacketList {
     AVPacket pkt;
     struct MyAVPacketList *next;
     int serial;
+    int64_t spill_offset;   /* of the data in the spill file, pkt has no buffer then; -1 when in memory */
 } MyAVPacketList;
 
+// -infbuf时队列里的数据超过spill_mem, 新来的包的数据写进磁盘上的环形文件(mmap), packet_queue_get时按顺序读回来
+typedef struct PacketSpill {
+    int fd;
+    uint8_t *base;
+    int64_t size;
+    int64_t head, tail;     /* written at head, the oldest spilled data starts at tail */
+    int64_t used;           /* bytes from tail to head, skipped ends of the file included */
+    int64_t synced;         /* chunks before this offset were handed to sync_file_range */
+    int64_t gen;            /* bumped by packet_queue_flush, a copy running outside the lock checks it */
+    int writing;            /* a writer is copying into its reserved space without q->pmutex */
+    int64_t read_chunk;     /* the chunk read back last, -1 at first */
+    int64_t nb_spilled;
+    int64_t spilled_bytes;
+    int64_t nb_full;        /* packets kept in memory because the file was full or busy */
+    int64_t nb_read;
+    int64_t read_time;      /* microseconds spent copying data back */
+    int64_t max_read_time;
+} PacketSpill;
+
 typedef struct PacketQueue {
     // first_pkt是flush_pkt,在packet_queue_start中实现
     MyAVPacketList *first_pkt, *last_pkt;
@@ -166,8 +361,65 @@ typedef struct PacketQueue {
     pthread_mutex_t pmutex;
     // packet_queue_init
     pthread_cond_t pcond;
+    // 已经取走, 为往回的短seek保留的包(-seek_buffer), 接在first_pkt前面
+    MyAVPacketList *hist_first, *hist_last;
+    int hist_nb_packets;
+    int hist_size;
+    // stream_component_open, 保留多少秒, 0表示不保留
+    double hist_window;
+    AVRational time_base;
+    // stream_open, 队列在内存里的数据超过这个字节数就写进spill文件, 0表示不写
+    int64_t spill_limit;
+    int64_t spill_bytes;    /* data of the queued packets that is in the spill file */
+    PacketSpill *spill;     /* created with the first spilled packet */
 } PacketQueue;
 
+// 实时流(rtp/udp)的抖动缓冲, 按到达时间和时间戳估计网络抖动, 延迟后再放入PacketQueue
+typedef struct JitterPacket {
+    AVPacket pkt;
+    double ts;       /* dts in seconds, that of the packet before it when there is none */
+    double arrival;  /* wall clock when read_thread got the packet */
+    struct JitterPacket *next;
+} JitterPacket;
+
+typedef struct JitterStream {
+    // 按ts排序
+    JitterPacket *first_pkt;
+    int nb_packets;
+    PacketQueue *queue;
+    double transit_min;      /* smallest arrival - ts seen, NAN before the first packet */
+    double last_transit;
+    double last_arrival;
+    double jitter;           /* RFC 3550 interarrival jitter estimate in seconds */
+    double next_ts;          /* expected ts of the next packet, for loss detection */
+    double last_released_ts;
+    int64_t nb_received;
+    int64_t nb_reordered;
+    int64_t nb_late;
+    int64_t nb_lost;
+} JitterStream;
+
+enum {
+    JITTER_STREAM_AUDIO,
+    JITTER_STREAM_VIDEO,
+    JITTER_STREAM_NB,
+};
+
+typedef struct JitterBuffer {
+    JitterStream streams[JITTER_STREAM_NB];
+    double target_delay;     /* how long a packet is held after its expected arrival */
+    double min_delay;
+    double max_delay;
+    int abort_request;
+    pthread_mutex_t pmutex;
+    pthread_cond_t pcond;
+    SDL_Thread *release_tid;
+    int64_t nb_underflows;
+    int64_t nb_released;
+    double hold_time_sum;    /* for the average time a packet spent in the buffer */
+    double last_report;
+} JitterBuffer;
+
 // 保存解码帧的个数
 #define VIDEO_PICTURE_QUEUE_SIZE 3
 #define SAMPLE_QUEUE_SIZE 9
@@ -183,6 +435,399 @@ typedef struct AudioParams {
     int bytes_per_sec;
 } AudioParams;
 
+// 缓存的重采样上下文, 以(源格式 -> 目标格式)为key
+typedef struct SwrCacheEntry {
+    struct SwrContext *swr_ctx;
+    int64_t src_channel_layout;
+    enum AVSampleFormat src_fmt;
+    int src_freq;
+    int64_t tgt_channel_layout;
+    enum AVSampleFormat tgt_fmt;
+    int tgt_freq;
+    int64_t last_used;
+} SwrCacheEntry;
+
+typedef struct FramePoolEntry {
+    AVBufferPool *pool;
+    int size;               /* size of every buffer of the pool */
+    int64_t last_used;
+} FramePoolEntry;
+
+// 解码器get_buffer2用的缓冲池, 按平面大小分池; 解码线程取缓冲, 释放帧的线程归还
+typedef struct FrameAllocator {
+    FramePoolEntry pools[FRAME_POOL_NB];
+    int use_thp;
+    // 保护pools和取缓冲的统计
+    pthread_mutex_t pmutex;
+    int64_t tick;
+    int64_t nb_gets;        /* buffers handed to the decoder */
+    int64_t nb_fallbacks;   /* frames left to the default allocator */
+    int64_t nb_pools_created;
+    int64_t nb_pools_evicted;
+    // 保护下面的内存统计, 缓冲在池里分配和释放时更新
+    pthread_mutex_t stats_mutex;
+    int64_t nb_allocs;      /* buffers the pools had to allocate */
+    int64_t nb_huge;        /* allocations backed by transparent huge pages */
+    int64_t cur_bytes;
+    int64_t peak_bytes;
+} FrameAllocator;
+
+/* steps of the decoder degradation ladder, each one keeps the savings of the ones before */
+enum {
+    DEGRADE_NONE,
+    DEGRADE_SKIP_LOOP_FILTER,
+    DEGRADE_SKIP_IDCT,
+    DEGRADE_SKIP_NONREF,
+    DEGRADE_SKIP_BIDIR,
+    DEGRADE_LOWRES,         /* only for decoders with lowres support, applied at the next keyframe */
+    DEGRADE_NB,
+};
+
+static const char *const degrade_level_names[DEGRADE_NB] = {
+        "none", "noloopfilter", "noidct", "nonref", "bidir", "lowres",
+};
+
+// 根据解码耗时和帧时长逐级降低解码质量, 有余量时再逐级恢复
+typedef struct DecodeLadder {
+    int enabled;
+    int level;
+    int max_level;
+    double load;            /* smoothed decode time / media time */
+    int64_t last_busy;      /* Decoder.busy_time at the previous frame */
+    double last_pts;
+    double frame_duration;  /* fallback media time per frame */
+    double level_start;     /* time the current level was entered */
+    double recover_delay;
+    int last_step;          /* +1 or -1, 0 before the first change */
+    enum AVDiscard base_skip_loop_filter; /* settings the decoder was opened with */
+    enum AVDiscard base_skip_idct;
+    enum AVDiscard base_skip_frame;
+    int base_lowres;
+    int64_t nb_frames;
+    int64_t nb_steps_up;
+    int64_t nb_steps_down;
+    double level_time[DEGRADE_NB];
+} DecodeLadder;
+
+typedef struct FilterGraphStats {
+    int64_t nb_builds;
+    int64_t nb_reuses;      /* serial changes (seeks) that kept the graph */
+    int64_t nb_prebuilt;    /* filter switches served by a graph built in the background */
+    double build_time_sum;  /* in seconds */
+    double build_time_max;
+} FilterGraphStats;
+
+#if CONFIG_AVFILTER
+// 一个配置好的视频滤镜图, 以及它是按什么输入建的
+typedef struct VideoFilterGraph {
+    AVFilterGraph *graph;
+    AVFilterContext *in;
+    AVFilterContext *out;
+    AVFilterContext *downscale; /* the -downscale scale filter, nullptr without it */
+    int width, height, format;  /* input frames the graph was built for */
+    int box_w, box_h;           /* window size the downscale filter was set up for */
+    int stateless;              /* no filter keeps state, the graph can stay across seeks */
+    int failed;                 /* building it in the background failed, don't retry for this input */
+} VideoFilterGraph;
+
+// 在后台为vfilters_list中的其他滤镜链预先建好图, 按w键切换时直接拿来用
+typedef struct FilterPrebuilder {
+    SDL_Thread *tid;
+    pthread_mutex_t pmutex;
+    pthread_cond_t pcond;
+    int abort_request;
+    VideoFilterGraph *graphs;   /* one per vfilters_list entry */
+    int width, height, format;  /* input to build for, 0 x 0 while unknown */
+    int current;                /* entry the video thread is using, nothing is built for it */
+    FilterGraphStats stats;     /* only touched by the prebuild thread */
+} FilterPrebuilder;
+#endif
+
+// 解码之前丢弃不作参考的视频包, 只看包头或者NAL头, 不解析码流的其他部分
+typedef struct PacketDropper {
+    enum AVCodecID codec_id;
+    int nal_length_size;    /* NAL units are length prefixed (avcC/hvcC), 0 for annex b start codes */
+    int hevc_max_tid;       /* highest HEVC temporal sub-layer, -1 while unknown */
+    int reorder;            /* the stream has B-frames, from codecpar->video_delay */
+    int64_t nb_dropped_late;
+    int64_t nb_dropped_queue;
+} PacketDropper;
+
+// -parallel_decode: 帧内编码的流每个包一个单位, 闭合GOP的流每个GOP一个单位, 分给多个解码器上下文并行解码
+enum {
+    PDEC_OFF,
+    PDEC_INTRA,
+    PDEC_GOP,
+    PDEC_AUTO,
+};
+
+enum {
+    PDEC_UNIT_QUEUED,
+    PDEC_UNIT_DECODING,
+    PDEC_UNIT_DONE,
+};
+
+// 一次独立解码的包序列, 第一个包是关键帧(gop模式下是IDR或闭合GOP的开头); 按读入的顺序排队, 解出的帧也按这个顺序输出
+typedef struct DecodeUnit {
+    AVPacket *pkts;
+    int nb_pkts;
+    AVFrame **frames;
+    int nb_frames;
+    int rindex;             /* next frame to return */
+    int serial;
+    int state;
+    struct DecodeUnit *next;
+} DecodeUnit;
+
+struct VideoState;
+
+typedef struct ParallelDecoderWorker {
+    struct VideoState *is;
+    AVCodecContext *avctx;
+    SDL_Thread *tid;
+} ParallelDecoderWorker;
+
+typedef struct ParallelDecoder {
+    int mode;               /* PDEC_OFF when video is decoded by viddec alone */
+    int nb_workers;
+    ParallelDecoderWorker workers[PDEC_MAX_WORKERS];
+    pthread_mutex_t pmutex;
+    pthread_cond_t work_cond;   /* a unit was queued */
+    pthread_cond_t done_cond;   /* a unit produced frames or finished */
+    pthread_cond_t read_cond;   /* the video thread took a frame, or the serial changed */
+    int abort_request;
+    DecodeUnit *first, *last;   /* dispatched units in stream order */
+    int nb_units;
+    DecodeUnit *open;           /* unit still collecting packets, only touched by the video thread */
+    int eof_serial;             /* serial whose last unit has been dispatched, -1 otherwise */
+    int64_t nb_decoded_units;
+    int64_t nb_decoded_frames;
+    int64_t nb_skipped_packets; /* before the first keyframe of a serial */
+    int64_t busy_time;          /* summed over the workers, microseconds */
+    int64_t start_time;
+} ParallelDecoder;
+
+// 视频解码器的线程类型和线程数; 线程和工作线程池一起从全局的-thread_budget里预留, 关闭时归还
+typedef struct ThreadTuner {
+    int live;               /* latency matters more than throughput: slice threads, few frame threads */
+    int reserved;           /* threads taken from the budget, 0 when the user set -threads */
+    double frame_rate;
+    int nb_probes;
+    double probe_start;     /* NAN until the first frame of the probe */
+    int64_t probe_blocked;  /* viddec.blocked_time at probe_start */
+    int64_t probe_frames;
+} ThreadTuner;
+
+// 线程的角色, 每个角色可以单独设置调度和CPU
+enum {
+    THREAD_ROLE_AUDIO,      /* audio output and audio decoding */
+    THREAD_ROLE_RENDER,     /* render_thread, or the event loop without it */
+    THREAD_ROLE_VIDEO,      /* video and subtitle decoding */
+    THREAD_ROLE_DEMUX,      /* read_thread and the jitter buffer */
+    THREAD_ROLE_FILTER,     /* worker pool and filter graph prebuilding */
+    THREAD_ROLE_NB,
+};
+
+static const char *const thread_role_names[THREAD_ROLE_NB] = {"audio", "render", "video", "demux", "filter"};
+
+enum {
+    THREAD_SCHED_DEFAULT,
+    THREAD_SCHED_FIFO,
+    THREAD_SCHED_RR,
+    THREAD_SCHED_NICE,
+    THREAD_SCHED_SDL,       /* priority is a SDL_ThreadPriority */
+};
+
+typedef struct ThreadRole {
+    int sched;
+    int priority;           /* realtime priority, nice value or SDL_ThreadPriority */
+    uint64_t cpu_mask;      /* cpus the threads may run on, 0 for any */
+    int nb_threads;         /* threads that finished, with their cpu time */
+    int64_t cpu_time;
+} ThreadRole;
+
+// 工作线程池的一批任务, 提交的线程等到pending为0
+typedef int (*WorkerJobFunc)(void *priv, int jobnr, int nb_jobs);
+
+typedef struct WorkerBatch {
+    WorkerJobFunc func;
+    void *priv;
+    int *ret;               /* result of every job, may be null */
+    int nb_jobs;
+    SDL_atomic_t pending;   /* jobs not finished yet */
+} WorkerBatch;
+
+typedef struct WorkerTask {
+    WorkerBatch *batch;
+    int jobnr;
+} WorkerTask;
+
+// 每个工作线程一个任务队列, 自己从队尾取, 空闲的线程从队头偷
+typedef struct WorkerDeque {
+    alignas(CACHE_LINE_SIZE) pthread_mutex_t pmutex;
+    WorkerTask tasks[WORKER_POOL_DEQUE_SIZE];
+    int head;
+    int nb_tasks;
+    SDL_Thread *tid;
+    int64_t nb_jobs;        /* only written by the owner */
+    int64_t nb_steals;
+} WorkerDeque;
+
+typedef struct WorkerPool {
+    int nb_threads;
+    int reserved;           /* threads taken from the -thread_budget counter the decoders also use */
+    WorkerDeque deques[WORKER_POOL_MAX_THREADS];
+    alignas(CACHE_LINE_SIZE) pthread_mutex_t pmutex;
+    pthread_cond_t work_cond;   /* tasks were queued */
+    pthread_cond_t done_cond;   /* a batch finished */
+    int abort_request;
+    SDL_atomic_t nb_queued;     /* tasks in all deques */
+    SDL_atomic_t next_deque;    /* spreads the batches over the workers */
+    SDL_atomic_t nb_batches;
+    SDL_atomic_t nb_jobs;
+    SDL_atomic_t nb_inline;     /* run by the submitting threads */
+    int64_t start_time;
+} WorkerPool;
+
+// seek从请求到新位置的第一帧出来的时间, 分回缓冲命中和没命中两类
+typedef struct SeekStats {
+    int64_t request_time;
+    int hit;
+    SDL_atomic_t pending_serial;    /* serial of the first frame after the seek, -1 when it was seen */
+    int64_t nb_hits, nb_misses;
+    int64_t hit_time, miss_time;    /* summed, microseconds */
+    int64_t max_hit_time, max_miss_time;
+    int64_t nb_requests;            /* written under seek_mutex */
+    int64_t nb_coalesced;           /* replaced by a newer request before read_thread got to them */
+    int64_t nb_cancelled;           /* interrupted or made obsolete while the demuxer was seeking */
+    int64_t nb_reads_interrupted;
+} SeekStats;
+
+// -seek_bench的一次seek, 时间都从stream_seek()算起
+typedef struct SeekBenchResult {
+    double target;          /* seconds */
+    int hit;                /* served from the seek buffer */
+    int timed_out;
+    int64_t packet_time;    /* first packet of the measured stream, microseconds, 0 if not seen */
+    int64_t frame_time;     /* first decoded frame */
+    int64_t display_time;   /* first frame video_refresh (or the audio callback) would show */
+    double landed_pts;
+} SeekBenchResult;
+
+typedef struct SeekBench {
+    SDL_Thread *tid;
+    int abort_request;
+    double *targets;
+    int nb_targets;
+    SeekBenchResult *results;
+    int nb_results;
+    SeekBenchResult cur;
+    int64_t request_time;
+    int armed;              /* the next seek read_thread executes is the measured one */
+    int packet_pending;     /* only touched by read_thread */
+    SDL_atomic_t serial;    /* serial of the measured seek, -1 when nothing is measured */
+    SDL_atomic_t done;      /* the first frame was shown */
+} SeekBench;
+
+// -zap_list: 当前频道两边的频道保持连接, 输入已经探测好, 解码器已经打开, 并缓存着最近的GOP
+enum {
+    ZAP_CONNECTING,
+    ZAP_READY,
+    ZAP_FAILED,
+};
+
+typedef struct ZapChannel {
+    char *url;
+    SDL_Thread *tid;
+    pthread_mutex_t pmutex;
+    pthread_cond_t pcond;       /* the reader stopped, or was asked to */
+    int abort_request;          /* interrupts the I/O of the reader */
+    int stop_req;               /* stop between two packets and keep the input */
+    int stopped;
+    int state;
+    // 下面的只由standby的读线程使用, 它停下之后交给stream_open
+    AVFormatContext *ic;
+    int stream_index[AVMEDIA_TYPE_NB];
+    AVCodecContext *avctx[AVMEDIA_TYPE_NB];
+    MyAVPacketList *gop_first, *gop_last;   /* from the latest video keyframe on */
+    int64_t gop_size;
+    int64_t connect_time;       /* microseconds to open, probe and open the decoders */
+} ZapChannel;
+
+typedef struct ZapList {
+    ZapChannel *channels;
+    int nb_channels;
+    int current;
+    int64_t nb_warm, nb_cold;   /* switches to a ready standby channel and to an unprepared one */
+    int64_t warm_time, cold_time;
+    int64_t max_warm_time, max_cold_time;
+    int64_t switch_time;        /* when the switch in progress was requested, for the next stream_open */
+    // 换台时在这个线程里打开新的频道, event_loop不用等连接
+    SDL_Thread *switch_tid;
+    int switch_target;
+    int switch_prev;
+    int switch_width, switch_height;
+} ZapList;
+
+// A-V同步的PI控制器, 音频不是主时钟时用来计算音频的变速比例
+typedef struct AVSyncController {
+    double kp;
+    double ki;
+    double max_correction;  /* allowed speed change as a fraction, 0.1 = 10% */
+    double dead_band;       /* the proportional term ignores smoothed errors below this, in seconds */
+    double error;           /* smoothed A-V difference in seconds */
+    double integral;        /* accumulated error, in seconds * seconds */
+    double correction;      /* last output as a fraction of the frame length */
+    int serial;             /* the state belongs to packets with this serial */
+    int fast_lock;
+    double fast_lock_time;  /* time spent in the current fast-lock phase */
+    double lock_time;       /* time the last fast-lock phase needed */
+    int64_t nb_updates;
+    int64_t nb_resets;
+} AVSyncController;
+
+// 根据SDL_RenderPresent的返回时间学习显示器的刷新周期, 把视频帧对齐到vblank
+typedef struct PresentScheduler {
+    int enabled;            /* the renderer waits for vsync and the refresh period is known */
+    double period;          /* estimated refresh period in seconds */
+    double last_vsync;      /* time the last present returned, which is right after a vblank */
+    double last_frame_vsync;
+    double frame_slot;      /* vblank the pending frame was scheduled for, NAN if none */
+    int64_t nb_period_samples;
+    int64_t nb_frames;
+    int64_t nb_missed;
+    int64_t cadence[PRESENT_CADENCE_MAX + 1]; /* frames held for 1, 2, ... refresh periods */
+    double last_report;
+} PresentScheduler;
+
+enum {
+    RENDER_CMD_REFRESH,
+    RENDER_CMD_RESIZE,              /* pos = width, rel = height */
+    RENDER_CMD_TOGGLE_PAUSE,
+    RENDER_CMD_STEP,
+    RENDER_CMD_SEEK,                /* pos, rel, arg = seek_by_bytes */
+    RENDER_CMD_SEEK_CHAPTER,        /* arg = chapter increment */
+    RENDER_CMD_TOGGLE_AUDIO_DISPLAY,
+    RENDER_CMD_REVERSE,             /* arg = REVERSE_PLAY or REVERSE_STEP */
+    RENDER_CMD_SEEK_PREVIEW,        /* pos, arg = seek_by_bytes */
+    RENDER_CMD_SEEK_PREVIEW_END,
+};
+
+typedef struct RenderCommand {
+    int type;
+    int64_t pos;
+    int64_t rel;
+    int arg;
+    Uint32 event_ticks;             /* SDL timestamp of the input event, for the input latency */
+} RenderCommand;
+
+// 单生产者(event_loop)单消费者(render_thread)的无锁环形队列
+typedef struct RenderCommandQueue {
+    RenderCommand cmds[RENDER_COMMAND_QUEUE_SIZE];
+    SDL_atomic_t windex;
+    SDL_atomic_t rindex;
+} RenderCommandQueue;
+
 typedef struct Clock {
     double pts;           /* clock base */
     double pts_drift;     /* clock base minus time at which we updated the clock */
@@ -193,6 +838,8 @@ typedef struct Clock {
     // init(0)
     int paused;
     int *queue_serial;    /* pointer to the current packet queue serial, used for obsolete clock detection */
+    // 顺序锁: 写的时候为奇数, 读者拿到前后相同的偶数值才算读到完整的数据
+    SDL_atomic_t seq;
 } Clock;
 
 /* Common struct for handling all types of decoded data and allocated render buffers. */
@@ -229,6 +876,89 @@ typedef struct FrameQueue {
     pthread_cond_t pcond;
 } FrameQueue;
 
+// 倒放和向后单步: 从当前位置往前一段一段解码, 解出的帧按pts从大到小排进缓存再显示
+enum {
+    REVERSE_OFF,
+    REVERSE_PLAY,
+    REVERSE_STEP,           /* reverse playback paused, every step request shows the previous frame */
+};
+
+typedef struct ReverseFrame {
+    AVFrame *frame;
+    int64_t ts;             /* in the time base of the stream */
+    double pts;
+    int64_t size;
+    struct ReverseFrame *next;
+} ReverseFrame;
+
+typedef struct ReversePlayer {
+    int mode;               /* only written by the thread running video_refresh */
+    int was_paused;         /* forward playback goes back to this state */
+    // 自己的demuxer和解码器, seek时不影响read_thread
+    AVFormatContext *ic;
+    AVCodecContext *avctx;
+    SDL_Thread *tid;
+    pthread_mutex_t pmutex;
+    pthread_cond_t pcond;   /* a segment was queued, a frame was taken or the worker finished */
+    int abort_request;
+    ReverseFrame *first, *last;     /* decoded frames, decreasing pts */
+    int64_t queued_size;
+    int64_t max_size;       /* queued frames and the segment being decoded share this */
+    int eof;                /* the worker reached the start of the stream or failed */
+    double start_pts;       /* the worker decodes the frames before this one */
+    double frame_duration;  /* used when two frames are too far apart */
+    Frame shown;            /* on screen, shown.frame has no buffer until the first frame */
+    double frame_timer;
+    int step_req;
+    // 退出倒放时正向播放从shown接着播, read_thread在seek之后填上新的serial
+    int resume_req;
+    int resume_gen;         /* seek_gen of the seek back to shown */
+    double resume_pts;
+    SDL_atomic_t resume_serial;
+    SDL_atomic_t audio_resume_serial;   /* audioq serial of the seek back, audio before resume_pts is dropped */
+    int64_t nb_segments;
+    int64_t nb_decoded_frames;
+    int64_t nb_shown_frames;
+    int64_t decode_time;    /* microseconds */
+} ReversePlayer;
+
+// -timeshift: 直播的包先由read_thread录进磁盘上的环形文件(mmap), timeshift_thread按播放进度读出来;
+// 暂停, 回退和追直播都在环里进行, 占用的内存和时移的长度无关
+typedef struct TimeshiftRecord {
+    int32_t size;           /* the whole record, header included; 0 marks the unused end of the ring */
+    int32_t stream_index;
+    int32_t flags;
+    int32_t data_size;      /* 0 for the empty packets recorded at the end of the input */
+    int64_t pts, dts, duration, pos;
+} TimeshiftRecord;
+
+typedef struct TimeshiftKey {
+    int64_t offset;         /* of the record in the ring */
+    double ts;              /* seconds, on the scale of the clocks */
+    int64_t pos;            /* byte position in the input, for byte seeks */
+} TimeshiftKey;
+
+typedef struct TimeshiftRing {
+    int fd;
+    uint8_t *base;          /* nullptr when timeshift is off */
+    int64_t size;
+    SDL_Thread *tid;
+    pthread_mutex_t pmutex;
+    pthread_cond_t pcond;   /* a record was written */
+    // 写在head, 最早的记录在tail, 播放读到read
+    int64_t head, tail, read;
+    int64_t used;           /* bytes from tail to head, skipped ends of the ring included */
+    int64_t unread;         /* bytes from read to head */
+    int need_key;           /* the recorder overwrote the next record to play, wait for a keyframe */
+    TimeshiftKey *keys;     /* TIMESHIFT_INDEX_SIZE entries, circular, in ring order */
+    int first_key, nb_keys;
+    double last_audio_key;  /* only written by the recorder */
+    int64_t nb_records;
+    int64_t nb_dropped;     /* too big for the ring */
+    int64_t nb_overruns;
+    int64_t nb_seeks;
+} TimeshiftRing;
+
 typedef struct Decoder {
     AVPacket pkt;
     PacketQueue *queue;
@@ -246,111 +976,193 @@ typedef struct Decoder {
     pthread_cond_t *pempty_queue_cond;
     // decoder_start
     SDL_Thread *decoder_tid;
+    // 在avcodec_send_packet/avcodec_receive_frame中花的时间(微秒)
+    int64_t busy_time;
+    // 等包和等pictq空位的时间(微秒), 解码线程自己写
+    int64_t blocked_time;
+    // 返回非0时包在送进解码器之前被丢掉, 只对视频设置
+    int (*packet_filter)(void *opaque, AVPacket *pkt);
+    void *packet_filter_opaque;
+    // 包是否是IDR或闭合GOP的开头, 之后的帧不参考它前面的帧; 为空时看AV_PKT_FLAG_KEY. opaque同packet_filter
+    int (*packet_switch_point)(void *opaque, const AVPacket *pkt);
+    // 重新打开前正在把旧的上下文冲干净, 切换点的包放在pkt里等着
+    int draining;
+    // 与lowres不同时, 在下一个切换点(IDR或闭合GOP)按lowres_request重新打开解码器
+    int lowres;
+    int lowres_request;
+    // 非0时在下一个切换点按这个线程数和线程类型(FF_THREAD_*)重新打开解码器
+    int thread_count_request;
+    int thread_type_request;
+    // 重新打开后旧的上下文留到下一次重新打开或关闭时再释放, 其他线程可能还在读它的统计
+    AVCodecContext *retired_avctx;
 } Decoder;
 
+// 按写入的线程分块, 每块从新的cache line开始, 避免不同线程写同一个cache line(false sharing)
 typedef struct VideoState {
+    // region 打开时设置, 之后各线程只读
     AVFormatContext *ic;
     AVInputFormat *iformat;
+    // 媒体播放路径
+    char *filename;
+    int realtime;
+    // init(以audio为基准进行音视频同步)
+    int av_sync_type;// AV_SYNC_AUDIO_MASTER
+    double max_frame_duration;      // maximum duration of a frame - above this, we consider the jump a timestamp discontinuity
+    // stream_component_open
+    // 对应的值都是相等的
+    int video_stream, audio_stream, subtitle_stream;
+    int last_video_stream, last_audio_stream, last_subtitle_stream;
+    // stream_component_open
+    AVStream *video_st, *audio_st, *subtitle_st;
+    // stream_open按-jitbuf和这个输入是否实时决定, 不写回全局的jitter_buffer
+    int jitbuf_enabled;
+    // SDL
+    SDL_Thread *read_tid;
+    // endregion
+
+    // region event_loop(或render_thread)写的控制状态
     // 是否强制停止(0运行1停止) init(0) stream_close(1)
-    int abort_request;
+    alignas(CACHE_LINE_SIZE) int abort_request;
     int force_refresh;
     int paused;
-    int last_paused;
-    int queue_attachments_req;
+    int step;
     // 需要seek时为1,否则为0
     int seek_req;
     int seek_flags;
     int64_t seek_pos;
     int64_t seek_rel;
+    int64_t seek_req_time;
+    // 保护上面的seek请求; 新的请求直接覆盖还没执行的, seek_gen每个请求加一
+    pthread_mutex_t seek_mutex;
+    SDL_atomic_t seek_gen;
+    // 拖动进度时只读关键帧, 松开后按seek_preview_pos再正常seek一次
+    int seek_preview;
+    int64_t seek_preview_pos;
+    int seek_preview_by_bytes;
+    enum ShowMode {
+        SHOW_MODE_NONE = -1, SHOW_MODE_VIDEO = 0, SHOW_MODE_WAVES, SHOW_MODE_RDFT, SHOW_MODE_NB
+    } show_mode;
+    // 音量大小
+    int audio_volume;
+    // init(0)
+    int muted;
+    // endregion
+
+    // region read_thread写
+    alignas(CACHE_LINE_SIZE) int last_paused;
+    SeekStats seek_stats;
+    int seek_exec_gen;              /* seek_gen of the seek executed last, a newer one interrupts I/O */
+    int queue_attachments_req;
     int read_pause_return;
-    int realtime;
     // stream_component_open(0)
     int eof;
-    // init(以audio为基准进行音视频同步)
-    int av_sync_type;// AV_SYNC_AUDIO_MASTER
+    // stream_open
+    pthread_cond_t pcontinue_read_thread;
+    // endregion
 
-    Clock vidclk;
-    Clock audclk;
-    Clock extclk;
+    // 时钟分别由音频回调, 视频刷新和read_thread写, 各占一块
+    alignas(CACHE_LINE_SIZE) Clock vidclk;
+    alignas(CACHE_LINE_SIZE) Clock audclk;
+    alignas(CACHE_LINE_SIZE) Clock extclk;
 
-    FrameQueue pictq;
-    FrameQueue sampq;
-    FrameQueue subpq;
+    // 队列的生产者和消费者在不同的线程, 每个队列各占一块
+    alignas(CACHE_LINE_SIZE) FrameQueue pictq;
+    alignas(CACHE_LINE_SIZE) FrameQueue sampq;
+    alignas(CACHE_LINE_SIZE) FrameQueue subpq;
 
-    PacketQueue videoq;
-    PacketQueue audioq;
-    PacketQueue subtitleq;
+    alignas(CACHE_LINE_SIZE) PacketQueue videoq;
+    alignas(CACHE_LINE_SIZE) PacketQueue audioq;
+    alignas(CACHE_LINE_SIZE) PacketQueue subtitleq;
 
-    Decoder viddec;
-    Decoder auddec;
-    Decoder subdec;
+    // region video_thread写
+    alignas(CACHE_LINE_SIZE) Decoder viddec;
+    int frame_drops_early;
+    DecodeLadder ladder;
+    PacketDropper pktdrop;
+    ParallelDecoder pdec;
+    ThreadTuner vtune;
+    double frame_last_returned_time;
+    double frame_last_filter_delay;
+#if CONFIG_AVFILTER
+    int vfilter_idx;
+    AVFilterContext *in_video_filter;   // the first filter in the video chain
+    AVFilterContext *out_video_filter;  // the last filter in the video chain
+    // -downscale时图的最后一个scale滤镜
+    AVFilterContext *downscale_filter;
+    FilterPrebuilder vfilter_prebuilder;
+#endif
+    FilterGraphStats vfilter_stats;
+    // -downscale时当前缩放到的窗口大小, 0表示还没有窗口
+    int downscale_w, downscale_h;
+    // endregion
 
-    // stream_component_open
-    // 对应的值都是相等的
-    int video_stream, audio_stream, subtitle_stream;
-    int last_video_stream, last_audio_stream, last_subtitle_stream;
-    // stream_component_open
-    AVStream *video_st, *audio_st, *subtitle_st;
+    // region audio_thread写
+    alignas(CACHE_LINE_SIZE) Decoder auddec;
+#if CONFIG_AVFILTER
+    struct AudioParams audio_filter_src;
+    AVFilterContext *in_audio_filter;   // the first filter in the audio chain
+    AVFilterContext *out_audio_filter;  // the last filter in the audio chain
+    AVFilterGraph *agraph;              // audio filter graph
+#endif
+    FilterGraphStats afilter_stats;
+    // endregion
+
+    // region subtitle_thread写
+    alignas(CACHE_LINE_SIZE) Decoder subdec;
+    // endregion
 
+    // region 解码线程取缓冲, 释放帧的线程归还
+    alignas(CACHE_LINE_SIZE) FrameAllocator video_pool;
+    alignas(CACHE_LINE_SIZE) FrameAllocator audio_pool;
+    // endregion
 
-    double audio_clock;
+    // region 音频回调(或audio_push_thread)写
+    alignas(CACHE_LINE_SIZE) double audio_clock;
     // stream_open(-1)
     int audio_clock_serial;
-    double audio_diff_cum; /* used for AV difference average computation */
-    double audio_diff_avg_coef;
     double audio_diff_threshold;
-    int audio_diff_avg_count;
     int audio_hw_buf_size;
+    // 最近一次测得的设备中还未播放的数据时长(秒)
+    double audio_device_delay;
     uint8_t *audio_buf;
     uint8_t *audio_buf1;
     unsigned int audio_buf_size; /* in bytes */
     unsigned int audio_buf1_size;
     int audio_buf_index; /* in bytes */
     int audio_write_buf_size;
-    // 音量大小
-    int audio_volume;
-    // init(0)
-    int muted;
     struct AudioParams audio_src;
-#if CONFIG_AVFILTER
-    struct AudioParams audio_filter_src;
-#endif
     struct AudioParams audio_tgt;
+    // 指向swr_cache中当前使用的上下文, 为nullptr时表示不需要转换
     struct SwrContext *swr_ctx;
-    int frame_drops_early;
-    int frame_drops_late;
-
-
-    int16_t sample_array[SAMPLE_ARRAY_SIZE];
+    int swr_cache_hits;
+    int swr_cache_misses;
     int sample_array_index;
+    AVSyncController avsync;
+    // push模式(SDL_QueueAudio)的喂数据线程
+    SDL_Thread *audio_push_tid;
+    int audio_push_abort;
+    // SDL音频回调线程用掉的CPU时间, 每次回调结束时在那个线程里取; 没有回调过时为-1
+    int64_t audio_cb_cpu_time;
+    // endregion
+
+    // region video_refresh(event_loop或render_thread)写
+    alignas(CACHE_LINE_SIZE) double frame_timer;
+    int frame_drops_late;
+    int width, height, xleft, ytop;
     int last_i_start;
-    RDFTContext *rdft;
+    // 每个声道一个, 两个声道在工作线程池上同时计算
+    RDFTContext *rdft[2];
     int rdft_bits;
     FFTSample *rdft_data;
     int xpos;
     double last_vis_time;
-
-    double frame_timer;
-    double frame_last_returned_time;
-    double frame_last_filter_delay;
-    double max_frame_duration;      // maximum duration of a frame - above this, we consider the jump a timestamp discontinuity
-    struct SwsContext *img_convert_ctx;
-    struct SwsContext *sub_convert_ctx;
-
-    // 媒体播放路径
-    char *filename;
-    int width, height, xleft, ytop;
-    int step;
-
-#if CONFIG_AVFILTER
-    int vfilter_idx;
-    AVFilterContext *in_video_filter;   // the first filter in the video chain
-    AVFilterContext *out_video_filter;  // the last filter in the video chain
-    AVFilterContext *in_audio_filter;   // the first filter in the audio chain
-    AVFilterContext *out_audio_filter;  // the last filter in the audio chain
-    AVFilterGraph *agraph;              // audio filter graph
-#endif
-
+    // 每个条带一个, 见sws_convert_bands
+    struct SwsContext *img_convert_ctx[SWS_BANDS_MAX];
+    struct SwsContext *sub_convert_ctx[SWS_BANDS_MAX];
+    SDL_Texture *vis_texture;
+    SDL_Texture *sub_texture;
+    SDL_Texture *vid_texture;
+    PresentScheduler present;
 #ifdef OS_ANDROID
     // audio
     unsigned char *audioOutBuffer = nullptr;
@@ -360,19 +1172,53 @@ typedef struct VideoState {
     size_t videoOutBufferSize = 0;
     AVFrame *rgbAVFrame = nullptr;
 #endif
+    // endregion
 
-    enum ShowMode {
-        SHOW_MODE_NONE = -1, SHOW_MODE_VIDEO = 0, SHOW_MODE_WAVES, SHOW_MODE_RDFT, SHOW_MODE_NB
-    } show_mode;
+    // region -render_thread时由event_loop创建, 只用renderer画, 不碰窗口
+    alignas(CACHE_LINE_SIZE) SDL_Thread *render_tid;
+    int render_abort;
+    SDL_sem *render_wakeup;
+    // render_thread在video_refresh期间持有, event_loop切换流时关旧流期间持有
+    pthread_mutex_t render_mutex;
+    RenderCommandQueue render_cmdq;
+    int64_t nb_render_commands;
+    int64_t nb_render_commands_dropped;
+    int64_t render_latency_sum;     /* ms from the input event to the command being executed */
+    int render_latency_max;
+    int64_t frame_deadline_misses;
+    // endregion
 
-    // SDL
-    SDL_Thread *read_tid;
-    SDL_Texture *vis_texture;
-    SDL_Texture *sub_texture;
-    SDL_Texture *vid_texture;
-    // stream_open
-    pthread_cond_t pcontinue_read_thread;
+    // region 倒放, mode和shown由video_refresh写, 缓存和shown由rev.pmutex保护
+    alignas(CACHE_LINE_SIZE) ReversePlayer rev;
+    // endregion
+
+    // region 时移环, read_thread写, timeshift_thread读, 环的状态由tshift.pmutex保护
+    alignas(CACHE_LINE_SIZE) TimeshiftRing tshift;
+    // endregion
+
+    // region 刷新循环的唤醒统计
+    alignas(CACHE_LINE_SIZE) SDL_atomic_t wakeup_pending;    /* a FF_WAKEUP_EVENT is queued and not handled yet */
+    int64_t nb_displays;
+    int64_t nb_wakeups;
+    int64_t nb_idle_wakeups;        /* timeouts after which nothing was drawn */
+    int wakeups_window;
+    int idle_wakeups_window;
+    double wakeup_report_time;
+    double wakeup_start_time;
+    // endregion
 
+    // region 冷数据和大块缓冲
+    alignas(CACHE_LINE_SIZE) JitterBuffer jitbuf;
+    SeekBench seek_bench;
+    // 换台时交给stream_open的standby频道, 打开之后为nullptr
+    ZapChannel *zap;
+    // 换台的时间, 第一帧显示后为0
+    int64_t zap_start;
+    int zap_warm;
+    SwrCacheEntry swr_cache[SWR_CACHE_SIZE];
+    // 可视化用的样本环形缓冲(1MiB), stream_open中分配
+    int16_t *sample_array;
+    // endregion
 } VideoState;
 
 static VideoState *video_state;
@@ -399,6 +1245,54 @@ static int alwaysontop;
 static int startup_volume = 100;
 static int show_status = -1;
 static int av_sync_type = AV_SYNC_AUDIO_MASTER;
+static int resample_quality = RESAMPLE_QUALITY_NORMAL;
+static int audio_latency_mode = AUDIO_LATENCY_NORMAL;
+static double avsync_kp = AVSYNC_KP;
+static double avsync_ki = AVSYNC_KI;
+static double avsync_max_correction = SAMPLE_CORRECTION_PERCENT_MAX;
+static int avsync_sim = 0;
+static double avsync_sim_drift = 500;
+static double avsync_sim_jitter = 5;
+static double clock_stress = 0;
+static double audio_clock_test = 0;
+static int perf_stats = 0;
+static int frame_pool = 1;
+static int frame_pool_thp = 0;
+static int decoder_degrade = -1;
+static int parallel_decode = PDEC_AUTO;
+static int parallel_decoders = 0;
+static int thread_tune = 1;
+static int thread_budget = 0;
+static double thread_probe = 0;
+static int worker_pool_enable = 1;
+static double seek_buffer = 30;
+static int reverse_cache = REVERSE_CACHE_DEFAULT;
+static int seek_preview = 1;
+static int seek_bench = 0;
+static int seek_bench_seed = 1;
+static const char *seek_bench_script;
+static const char *seek_bench_log;
+static const char *zap_list;
+static int zap_standby = 1;
+static ZapList zap;
+static int timeshift = 0;
+static const char *timeshift_file;
+static int spill_mem = SPILL_MEM_DEFAULT;
+static int spill_size = SPILL_SIZE_DEFAULT;
+static const char *spill_dir = "/tmp";
+static double thread_role_start_time;
+// -perf_stats: 显示(上传)的视频帧数
+static int64_t perf_frames_shown;
+static int downscale = 1;
+static int audio_push = 0;
+static int jitter_buffer = -1;
+static int present_sched = 1;
+static int render_thread_enable = 0;
+static double jitter_min_delay = JITTER_MIN_DELAY * 1000;
+static double jitter_max_delay = JITTER_MAX_DELAY * 1000;
+static int loopback_port = 0;
+static double loopback_jitter = 20;
+static double loopback_loss = 0;
 // 开始播放时需要seek到的那个时间点
 static int64_t start_time = AV_NOPTS_VALUE;
 static int64_t duration = AV_NOPTS_VALUE;
@@ -432,6 +1326,8 @@ static int filter_nbthreads = 0;
 /* current context */
 static int is_full_screen;
 static int64_t audio_callback_time;
+/* bytes of silence handed to the device by -audio_clock_test */
+static int64_t audio_clock_test_bytes;
 
 static AVPacket flush_pkt;
 
@@ -441,6 +1337,12 @@ static int video_packets = 0;
 static int subtitle_packets = 0;
 
 #define FF_QUIT_EVENT    (SDL_USEREVENT + 2)
+/* wakes refresh_loop_wait_event up before its timeout, e.g. when a new picture is queued */
+#define FF_WAKEUP_EVENT  (SDL_USEREVENT + 3)
+/* the zap thread opened the next channel, data1 is its VideoState */
+#define FF_ZAP_EVENT     (SDL_USEREVENT + 4)
+/* render_thread has the first picture, show the window: data1 is the VideoState, code and data2 the size */
+#define FF_WINDOW_EVENT  (SDL_USEREVENT + 5)
 
 static SDL_Window *window;
 static SDL_Renderer *renderer;
@@ -509,71 +1411,286 @@ int64_t get_valid_channel_layout(int64_t channel_layout, int channels) {
         return 0;
 }
 
-static int packet_queue_put_private(PacketQueue *q, AVPacket *pkt) {
-    if (q->abort_request)
-        return -1;
+// 节点的时间(秒), 没有时间戳或者不是数据包时返回NAN
+static double packet_queue_node_ts(PacketQueue *q, MyAVPacketList *n) {
+    int64_t ts = n->pkt.pts != AV_NOPTS_VALUE ? n->pkt.pts : n->pkt.dts;
 
-    MyAVPacketList *pkt1;
-    pkt1 = static_cast<MyAVPacketList *>(av_malloc(sizeof(MyAVPacketList)));
-    if (!pkt1)
-        return -1;
+    if (ts == AV_NOPTS_VALUE || !n->pkt.data || n->pkt.data == flush_pkt.data || !q->time_base.den)
+        return NAN;
+    return ts * av_q2d(q->time_base);
+}
 
-    pkt1->pkt = *pkt;
-    pkt1->next = nullptr;
-    if (pkt == &flush_pkt) {
-        q->serial++;
-        printf("packet_queue_put_private() q->serial = %d\n", q->serial);
-    }
-    pkt1->serial = q->serial;
+// 保留的包和队列里的包按读入的顺序连在一起, 最后一个就是demuxer读到的位置
+static MyAVPacketList *packet_queue_node_next(PacketQueue *q, MyAVPacketList *n) {
+    if (!n)
+        return q->hist_first ? q->hist_first : q->first_pkt;
+    return n == q->hist_last ? q->first_pkt : n->next;
+}
 
-    if (!q->last_pkt)
-        q->first_pkt = pkt1;
+// 取走的包放到保留列表的末尾, 超出-seek_buffer的时间或者SEEK_BUFFER_MAX_SIZE时从头丢弃
+static void packet_queue_retain(PacketQueue *q, MyAVPacketList *n) {
+    n->next = nullptr;
+    if (q->hist_last)
+        q->hist_last->next = n;
     else
-        q->last_pkt->next = pkt1;
+        q->hist_first = n;
+    q->hist_last = n;
+    q->hist_nb_packets++;
+    q->hist_size += n->pkt.size + sizeof(*n);
 
-    q->last_pkt = pkt1;
-    q->nb_packets++;
-    q->size += pkt1->pkt.size + sizeof(*pkt1);
-    q->duration += pkt1->pkt.duration;
-    /* XXX: should duplicate packet data in DV case */
-    pthread_cond_signal(&q->pcond);
+    while (q->hist_first != q->hist_last) {
+        MyAVPacketList *first = q->hist_first;
+        double span = packet_queue_node_ts(q, q->hist_last) - packet_queue_node_ts(q, first);
 
-    return 0;
+        if (q->hist_size <= SEEK_BUFFER_MAX_SIZE && !(span > q->hist_window))
+            break;
+        q->hist_first = first->next;
+        q->hist_nb_packets--;
+        q->hist_size -= first->pkt.size + sizeof(*first);
+        av_packet_unref(&first->pkt);
+        av_free(first);
+    }
 }
 
-static int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
-    int ret;
-
+static void packet_queue_set_history(PacketQueue *q, AVRational time_base, double window) {
     pthread_mutex_lock(&q->pmutex);
-    // 停止播放或者申请内存失败时返回-1,否则返回0
-    ret = packet_queue_put_private(q, pkt);
-    if (seek_by_bytes && pkt != &flush_pkt) {
-        if (pkt->stream_index == video_state->audio_stream
-            && audio_packets != q->nb_packets
-            && q->nb_packets % 100 == 0) {
-            audio_packets = q->nb_packets;
-            printf("packet_queue_put() audio    packets = %d\n", q->nb_packets);
-        } else if (pkt->stream_index == video_state->video_stream
-                   && video_packets != q->nb_packets
-                   && q->nb_packets % 100 == 0) {
-            video_packets = q->nb_packets;
-            printf("packet_queue_put() video    packets = %d\n", q->nb_packets);
-        } else if (pkt->stream_index == video_state->subtitle_stream
-                   && subtitle_packets != q->nb_packets
-                   && q->nb_packets % 100 == 0) {
-            subtitle_packets = q->nb_packets;
-            printf("packet_queue_put() subtitle packets = %d\n", q->nb_packets);
-        }
-    }
+    q->time_base = time_base;
+    q->hist_window = window;
     pthread_mutex_unlock(&q->pmutex);
-
-    if (pkt != &flush_pkt && ret < 0)
-        av_packet_unref(pkt);
-
-    return ret;
 }
 
-static int packet_queue_put_nullpacket(PacketQueue *q, int stream_index) {
+static PacketSpill *packet_spill_open(void) {
+    PacketSpill *sp = static_cast<PacketSpill *>(av_mallocz(sizeof(PacketSpill)));
+    char *path = av_asprintf("%s/ffplay-spill-XXXXXX", spill_dir);
+    void *base;
+
+    if (!sp || !path || (sp->fd = mkstemp(path)) < 0)
+        goto fail;
+    /* the file goes away with the process */
+    unlink(path);
+    sp->size = (int64_t) spill_size << 20;
+    if (ftruncate(sp->fd, sp->size) < 0 ||
+        (base = mmap(nullptr, sp->size, PROT_READ | PROT_WRITE, MAP_SHARED, sp->fd, 0)) == MAP_FAILED) {
+        close(sp->fd);
+        goto fail;
+    }
+    sp->base = static_cast<uint8_t *>(base);
+    sp->read_chunk = -1;
+    av_free(path);
+    return sp;
+
+    fail:
+    av_log(nullptr, AV_LOG_WARNING, "spill: cannot create a %d MiB file in %s, packets stay in memory\n",
+           spill_size, spill_dir);
+    av_free(path);
+    av_free(sp);
+    return nullptr;
+}
+
+// 把已经写进去的一段交给内核开始写回, 不等它完成; sync_file_range只有Linux有, 别的系统用msync(MS_ASYNC)
+static void packet_spill_writeback(PacketSpill *sp, int64_t offset, int64_t len) {
+    if (len <= 0)
+        return;
+#ifdef __linux__
+    sync_file_range(sp->fd, offset, len, SYNC_FILE_RANGE_WRITE);
+#else
+    msync(sp->base + offset, len, MS_ASYNC);
+#endif
+}
+
+// 把包的数据写到spill文件的head, 只留下节点和side data; 调用时持有q->pmutex, 拷贝和写回时放开
+static int packet_queue_spill(PacketQueue *q, MyAVPacketList *n) {
+    PacketSpill *sp = q->spill;
+    int64_t len = FFALIGN((int64_t) n->pkt.size, 8);
+    int64_t offset, gen, skip_start = -1, sync_start, sync_end;
+    int wrap;
+
+    if (!sp && !(sp = q->spill = packet_spill_open())) {
+        q->spill_limit = 0;
+        return -1;
+    }
+    /* another writer is copying in, its space is not published yet */
+    if (sp->writing) {
+        sp->nb_full++;
+        return -1;
+    }
+    wrap = sp->size - sp->head < len;
+    if (sp->size - sp->used < (wrap ? sp->size - sp->head : 0) + len) {
+        sp->nb_full++;
+        return -1;
+    }
+    if (wrap) {
+        /* the rest of the file is skipped */
+        if (sp->synced < sp->size)
+            skip_start = sp->synced;
+        sp->used += sp->size - sp->head;
+        sp->head = 0;
+        sp->synced = 0;
+    }
+    offset = sp->head;
+    sp->head += len;
+    sp->used += len;
+    /* written back early, the pages are clean and cheap to reclaim before they are read again;
+     * msync(MS_ASYNC) does not start any I/O on Linux, sync_file_range does without waiting for it */
+    sync_start = sp->synced;
+    while (sp->head - sp->synced >= SPILL_CHUNK)
+        sp->synced += SPILL_CHUNK;
+    sync_end = sp->synced;
+    gen = sp->gen;
+    sp->writing = 1;
+
+    // 空间已经占下, 节点还没入队, 读的一方碰不到这一段; 缺页和写回不挡住同一个队列上的解码线程
+    pthread_mutex_unlock(&q->pmutex);
+    if (skip_start >= 0)
+        packet_spill_writeback(sp, skip_start, sp->size - skip_start);
+    memcpy(sp->base + offset, n->pkt.data, n->pkt.size);
+    packet_spill_writeback(sp, sync_start, sync_end - sync_start);
+    pthread_mutex_lock(&q->pmutex);
+
+    sp->writing = 0;
+    /* flushed while copying, the space is gone and the packet stays in memory */
+    if (gen != sp->gen)
+        return -1;
+    n->spill_offset = offset;
+    av_buffer_unref(&n->pkt.buf);
+    n->pkt.data = nullptr;
+    q->spill_bytes += n->pkt.size;
+    sp->nb_spilled++;
+    sp->spilled_bytes += n->pkt.size;
+    return 0;
+}
+
+// 读回spill文件里最早的包, 写入的顺序就是读回的顺序; 调用时持有q->pmutex, 拷贝时放开.
+// 空间读完才还给写的一方, 所以拷贝时不会被覆盖; 每个队列只有一个读的线程, 还的顺序和写的顺序一样
+static int packet_queue_unspill(PacketQueue *q, MyAVPacketList *n) {
+    PacketSpill *sp = q->spill;
+    int64_t len = FFALIGN((int64_t) n->pkt.size, 8);
+    int64_t offset = n->spill_offset, chunk = offset / SPILL_CHUNK, prev_chunk = sp->read_chunk;
+    int64_t gen = sp->gen;
+    int64_t start, t;
+    AVBufferRef *buf;
+
+    q->spill_bytes -= n->pkt.size;
+    n->spill_offset = -1;
+    sp->read_chunk = chunk;
+    pthread_mutex_unlock(&q->pmutex);
+
+    start = av_gettime_relative();
+    buf = av_buffer_alloc(n->pkt.size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (buf) {
+        if (chunk != prev_chunk) {
+            int64_t nb_chunks = sp->size / SPILL_CHUNK;
+            // 读完的块不用再映射, 后面几块让内核提前读进来; 一个大包或者跳过的文件尾可以一次越过好几块
+            for (int64_t c = prev_chunk; c >= 0 && c != chunk; c = (c + 1) % nb_chunks)
+                madvise(sp->base + c * SPILL_CHUNK, SPILL_CHUNK, MADV_DONTNEED);
+            for (int i = 1; i <= SPILL_PREFETCH_CHUNKS; i++)
+                madvise(sp->base + (chunk + i) % nb_chunks * SPILL_CHUNK, SPILL_CHUNK, MADV_WILLNEED);
+        }
+        memcpy(buf->data, sp->base + offset, n->pkt.size);
+        memset(buf->data + n->pkt.size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    }
+    t = av_gettime_relative() - start;
+
+    pthread_mutex_lock(&q->pmutex);
+    /* the space is free either way; after a flush there is nothing left to give back */
+    if (gen == sp->gen) {
+        if (offset != sp->tail) {
+            /* the writer skipped the end of the file */
+            sp->used -= sp->size - sp->tail;
+            sp->tail = 0;
+        }
+        sp->tail += len;
+        sp->used -= len;
+    }
+    if (!buf)
+        return AVERROR(ENOMEM);
+    n->pkt.buf = buf;
+    n->pkt.data = buf->data;
+
+    sp->nb_read++;
+    sp->read_time += t;
+    sp->max_read_time = FFMAX(sp->max_read_time, t);
+    return 0;
+}
+
+static void packet_queue_spill_report(PacketQueue *q, const char *name, int level) {
+    PacketSpill *sp = q->spill;
+
+    if (!sp)
+        return;
+    av_log(nullptr, level, "spill %s: packets=%" PRId64" %0.1fMiB read back=%" PRId64" avg=%0.1fus max=%" PRId64
+           "us kept in memory when full=%" PRId64"\n", name, sp->nb_spilled, sp->spilled_bytes / 1048576.0,
+           sp->nb_read, sp->nb_read ? (double) sp->read_time / sp->nb_read : 0.0, sp->max_read_time, sp->nb_full);
+}
+
+static int packet_queue_put_private(PacketQueue *q, AVPacket *pkt) {
+    if (q->abort_request)
+        return -1;
+
+    MyAVPacketList *pkt1;
+    pkt1 = static_cast<MyAVPacketList *>(av_malloc(sizeof(MyAVPacketList)));
+    if (!pkt1)
+        return -1;
+
+    pkt1->pkt = *pkt;
+    pkt1->next = nullptr;
+    pkt1->spill_offset = -1;
+    if (q->spill_limit && pkt1->pkt.buf && pkt1->pkt.size && q->size - q->spill_bytes > q->spill_limit)
+        packet_queue_spill(q, pkt1);
+    if (pkt == &flush_pkt) {
+        q->serial++;
+        printf("packet_queue_put_private() q->serial = %d\n", q->serial);
+    }
+    pkt1->serial = q->serial;
+
+    if (!q->last_pkt)
+        q->first_pkt = pkt1;
+    else
+        q->last_pkt->next = pkt1;
+
+    q->last_pkt = pkt1;
+    q->nb_packets++;
+    q->size += pkt1->pkt.size + sizeof(*pkt1);
+    q->duration += pkt1->pkt.duration;
+    /* XXX: should duplicate packet data in DV case */
+    pthread_cond_signal(&q->pcond);
+
+    return 0;
+}
+
+static int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
+    int ret;
+
+    pthread_mutex_lock(&q->pmutex);
+    // 停止播放或者申请内存失败时返回-1,否则返回0
+    ret = packet_queue_put_private(q, pkt);
+    if (seek_by_bytes && pkt != &flush_pkt) {
+        if (pkt->stream_index == video_state->audio_stream
+            && audio_packets != q->nb_packets
+            && q->nb_packets % 100 == 0) {
+            audio_packets = q->nb_packets;
+            printf("packet_queue_put() audio    packets = %d\n", q->nb_packets);
+        } else if (pkt->stream_index == video_state->video_stream
+                   && video_packets != q->nb_packets
+                   && q->nb_packets % 100 == 0) {
+            video_packets = q->nb_packets;
+            printf("packet_queue_put() video    packets = %d\n", q->nb_packets);
+        } else if (pkt->stream_index == video_state->subtitle_stream
+                   && subtitle_packets != q->nb_packets
+                   && q->nb_packets % 100 == 0) {
+            subtitle_packets = q->nb_packets;
+            printf("packet_queue_put() subtitle packets = %d\n", q->nb_packets);
+        }
+    }
+    pthread_mutex_unlock(&q->pmutex);
+
+    if (pkt != &flush_pkt && ret < 0)
+        av_packet_unref(pkt);
+
+    return ret;
+}
+
+static int packet_queue_put_nullpacket(PacketQueue *q, int stream_index) {
     AVPacket pkt1, *pkt = &pkt1;
     av_init_packet(pkt);
     pkt->data = nullptr;
@@ -602,16 +1719,37 @@ static void packet_queue_flush(PacketQueue *q) {
         av_packet_unref(&pkt->pkt);
         av_freep(&pkt);
     }
+    for (pkt = q->hist_first; pkt; pkt = pkt1) {
+        pkt1 = pkt->next;
+        av_packet_unref(&pkt->pkt);
+        av_freep(&pkt);
+    }
     q->first_pkt = nullptr;
     q->last_pkt = nullptr;
     q->nb_packets = 0;
     q->size = 0;
     q->duration = 0;
+    q->hist_first = nullptr;
+    q->hist_last = nullptr;
+    q->hist_nb_packets = 0;
+    q->hist_size = 0;
+    q->spill_bytes = 0;
+    if (q->spill) {
+        q->spill->head = q->spill->tail = q->spill->used = 0;
+        q->spill->synced = 0;
+        q->spill->read_chunk = -1;
+        q->spill->gen++;
+    }
     pthread_mutex_unlock(&q->pmutex);
 }
 
 static void packet_queue_destroy(PacketQueue *q) {
     packet_queue_flush(q);
+    if (q->spill) {
+        munmap(q->spill->base, q->spill->size);
+        close(q->spill->fd);
+        av_freep(&q->spill);
+    }
     pthread_mutex_destroy(&q->pmutex);
     pthread_cond_destroy(&q->pcond);
 }
@@ -653,10 +1791,21 @@ static int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block, int *seria
             q->nb_packets--;
             q->size -= pkt1->pkt.size + sizeof(*pkt1);
             q->duration -= pkt1->pkt.duration;
-            *pkt = pkt1->pkt;
+            if (pkt1->spill_offset >= 0 && packet_queue_unspill(q, pkt1) < 0) {
+                av_log(nullptr, AV_LOG_ERROR, "spill: cannot read a packet back, dropped\n");
+                av_packet_unref(&pkt1->pkt);
+                av_free(pkt1);
+                continue;
+            }
             if (serial)
                 *serial = pkt1->serial;
-            av_free(pkt1);
+            if (q->hist_window > 0 && pkt1->pkt.data && pkt1->pkt.data != flush_pkt.data &&
+                av_packet_ref(pkt, &pkt1->pkt) >= 0) {
+                packet_queue_retain(q, pkt1);
+            } else {
+                *pkt = pkt1->pkt;
+                av_free(pkt1);
+            }
             ret = 1;
             break;
         } else if (!block) {
@@ -690,742 +1839,3334 @@ static int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block, int *seria
     return ret;
 }
 
-static void decoder_init(Decoder *d, AVCodecContext *avctx, PacketQueue *queue, pthread_cond_t *empty_queue_cond) {
-    memset(d, 0, sizeof(Decoder));
-    d->avctx = avctx;
-    d->queue = queue;
-    d->pempty_queue_cond = empty_queue_cond;
-    d->start_pts = AV_NOPTS_VALUE;
-    d->pkt_serial = -1;
+// -thread_sched/-thread_affinity: 按角色设置线程的调度策略, 优先级和可用的CPU, 在线程开始时应用; 退出时记下线程的CPU时间
+static ThreadRole thread_roles[THREAD_ROLE_NB];
+static pthread_mutex_t thread_role_mutex = PTHREAD_MUTEX_INITIALIZER;
+static thread_local int thread_role_current = -1;
+
+static int thread_role_find(const char *name, size_t len) {
+    for (int i = 0; i < THREAD_ROLE_NB; i++)
+        if (strlen(thread_role_names[i]) == len && !strncmp(name, thread_role_names[i], len))
+            return i;
+    return -1;
 }
 
-// 解码
-static int decoder_decode_frame(Decoder *d, AVFrame *frame, AVSubtitle *sub) {
-    int ret = AVERROR(EAGAIN);
+static int64_t thread_cpu_time(clockid_t clock) {
+    struct timespec ts;
 
-    for (;;) {
-        AVPacket pkt;
+    if (clock_gettime(clock, &ts) < 0)
+        return 0;
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
 
-        if (d->queue->serial == d->pkt_serial) {
-            do {
-                if (d->queue->abort_request)
-                    return -1;
+static void thread_role_enter(int role) {
+    ThreadRole *r = &thread_roles[role];
+    struct sched_param sp;
+    int ret = 0;
 
-                switch (d->avctx->codec_type) {
-                    case AVMEDIA_TYPE_VIDEO:
-                        ret = avcodec_receive_frame(d->avctx, frame);
-                        if (ret >= 0) {
-                            if (decoder_reorder_pts == -1) {
-                                frame->pts = frame->best_effort_timestamp;
-                            } else if (!decoder_reorder_pts) {
-                                frame->pts = frame->pkt_dts;
-                            }
-                        }
-                        break;
-                    case AVMEDIA_TYPE_AUDIO:
-                        ret = avcodec_receive_frame(d->avctx, frame);
-                        if (ret >= 0) {
-                            AVRational tb = (AVRational) {1, frame->sample_rate};
-                            if (frame->pts != AV_NOPTS_VALUE)
-                                frame->pts = av_rescale_q(frame->pts, d->avctx->pkt_timebase, tb);
-                            else if (d->next_pts != AV_NOPTS_VALUE)
-                                frame->pts = av_rescale_q(d->next_pts, d->next_pts_tb, tb);
-                            if (frame->pts != AV_NOPTS_VALUE) {
-                                d->next_pts = frame->pts + frame->nb_samples;
-                                d->next_pts_tb = tb;
-                            }
-                        }
-                        break;
-                }
-                if (ret == AVERROR_EOF) {
-                    d->finished = d->pkt_serial;
-                    avcodec_flush_buffers(d->avctx);
-                    return 0;
-                }
-                if (ret >= 0)
-                    return 1;
-            } while (ret != AVERROR(EAGAIN));
-        }
+    thread_role_current = role;
+    switch (r->sched) {
+        case THREAD_SCHED_FIFO:
+        case THREAD_SCHED_RR:
+            memset(&sp, 0, sizeof(sp));
+            sp.sched_priority = r->priority;
+            ret = pthread_setschedparam(pthread_self(), r->sched == THREAD_SCHED_FIFO ? SCHED_FIFO : SCHED_RR, &sp);
+            break;
+        case THREAD_SCHED_NICE:
+#ifdef __linux__
+            /* on Linux the nice value is per thread */
+            if (setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), r->priority) < 0)
+                ret = errno;
+#else
+            ret = ENOSYS;
+#endif
+            break;
+        case THREAD_SCHED_SDL:
+            if (SDL_SetThreadPriority(static_cast<SDL_ThreadPriority>(r->priority)) < 0)
+                ret = EPERM;
+            break;
+        default:
+            break;
+    }
+    if (ret)
+        av_log(nullptr, AV_LOG_WARNING, "Could not set the scheduling of a %s thread: %s\n",
+               thread_role_names[role], strerror(ret));
+#ifdef __linux__
+    if (r->cpu_mask) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        for (int i = 0; i < 64; i++)
+            if (r->cpu_mask & (1ULL << i))
+                CPU_SET(i, &set);
+        if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)))
+            av_log(nullptr, AV_LOG_WARNING, "Could not set the cpu affinity of a %s thread: %s\n",
+                   thread_role_names[role], strerror(ret));
+    }
+#endif
+}
 
-        do {
-            if (d->queue->nb_packets == 0)
-                pthread_cond_signal(d->pempty_queue_cond);
-            if (d->packet_pending) {
-                av_packet_move_ref(&pkt, &d->pkt);
-                d->packet_pending = 0;
-            } else {
-                if (packet_queue_get(d->queue, &pkt, 1, &d->pkt_serial) < 0)
-                    return -1;
-            }
-            if (d->queue->serial == d->pkt_serial)
-                break;
-            av_packet_unref(&pkt);
-        } while (1);
+static void thread_role_add_time(int role, int64_t cpu_time) {
+    pthread_mutex_lock(&thread_role_mutex);
+    thread_roles[role].nb_threads++;
+    thread_roles[role].cpu_time += cpu_time;
+    pthread_mutex_unlock(&thread_role_mutex);
+}
 
-        if (pkt.data == flush_pkt.data) {
-            avcodec_flush_buffers(d->avctx);
-            d->finished = 0;
-            d->next_pts = d->start_pts;
-            d->next_pts_tb = d->start_pts_tb;
-        } else {
-            if (d->avctx->codec_type == AVMEDIA_TYPE_SUBTITLE) {
-                int got_frame = 0;
-                ret = avcodec_decode_subtitle2(d->avctx, sub, &got_frame, &pkt);
-                if (ret < 0) {
-                    ret = AVERROR(EAGAIN);
-                } else {
-                    if (got_frame && !pkt.data) {
-                        d->packet_pending = 1;
-                        av_packet_move_ref(&d->pkt, &pkt);
-                    }
-                    ret = got_frame ? 0 : (pkt.data ? AVERROR(EAGAIN) : AVERROR_EOF);
-                }
-            } else {
-                if (avcodec_send_packet(d->avctx, &pkt) == AVERROR(EAGAIN)) {
-                    printf("decoder_decode_frame() "
-                           "Receive_frame and send_packet both returned EAGAIN, which is an API violation.\n");
-                    d->packet_pending = 1;
-                    av_packet_move_ref(&d->pkt, &pkt);
-                }
-            }
-            av_packet_unref(&pkt);
-        }
-    }// for (;;) end
+static void thread_role_leave(void) {
+    if (thread_role_current < 0)
+        return;
+    thread_role_add_time(thread_role_current, thread_cpu_time(CLOCK_THREAD_CPUTIME_ID));
+    thread_role_current = -1;
 }
 
-static void decoder_destroy(Decoder *d) {
-    av_packet_unref(&d->pkt);
-    avcodec_free_context(&d->avctx);
+typedef struct ThreadStart {
+    int (*fn)(void *);
+    void *arg;
+    int role;
+} ThreadStart;
+
+static int thread_role_main(void *arg) {
+    ThreadStart ts = *static_cast<ThreadStart *>(arg);
+    int ret;
+
+    av_free(arg);
+    thread_role_enter(ts.role);
+    ret = ts.fn(ts.arg);
+    thread_role_leave();
+    return ret;
 }
 
-static void frame_queue_unref_item(Frame *vp) {
-    av_frame_unref(vp->frame);
-    avsubtitle_free(&vp->sub);
+// SDL_CreateThread, 线程先按role设置调度和CPU
+static SDL_Thread *thread_create(int (*fn)(void *), const char *name, void *arg, int role) {
+    ThreadStart *ts = static_cast<ThreadStart *>(av_malloc(sizeof(ThreadStart)));
+    SDL_Thread *tid;
+
+    if (!ts)
+        return nullptr;
+    ts->fn = fn;
+    ts->arg = arg;
+    ts->role = role;
+    if (!(tid = SDL_CreateThread(thread_role_main, name, ts)))
+        av_free(ts);
+    return tid;
 }
 
-static int frame_queue_init(FrameQueue *f, PacketQueue *pktq, int max_size, int keep_last) {
-    memset(f, 0, sizeof(FrameQueue));
-    f->pmutex = PTHREAD_MUTEX_INITIALIZER;
-    f->pcond = PTHREAD_COND_INITIALIZER;
-    f->pktq = pktq;
-    f->max_size = FFMIN(max_size, FRAME_QUEUE_SIZE);
-    f->keep_last = !!keep_last;
-    printf("frame_queue_init()  max_size = %d\n", f->max_size);
-    printf("frame_queue_init() keep_last = %d\n", f->keep_last);
-    for (int i = 0; i < f->max_size; i++)
-        if (!(f->queue[i].frame = av_frame_alloc()))
-            return AVERROR(ENOMEM);// -12
-    return 0;
+static void thread_role_report(void) {
+    double elapsed = av_gettime_relative() / 1000000.0 - thread_role_start_time;
+    int configured = 0;
+    AVBPrint buf;
+
+    for (int i = 0; i < THREAD_ROLE_NB; i++)
+        configured |= thread_roles[i].sched || thread_roles[i].cpu_mask;
+    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
+    for (int i = 0; i < THREAD_ROLE_NB; i++) {
+        ThreadRole *r = &thread_roles[i];
+        if (r->nb_threads)
+            av_bprintf(&buf, " %s=%0.2fs/%d (%0.1f%%)", thread_role_names[i], r->cpu_time / 1000000.0,
+                       r->nb_threads, elapsed > 0 ? 100.0 * r->cpu_time / 1000000.0 / elapsed : 0.0);
+    }
+    av_log(nullptr, configured || perf_stats ? AV_LOG_INFO : AV_LOG_VERBOSE, "thread cpu time:%s\n", buf.str);
+    av_bprint_finalize(&buf, nullptr);
 }
 
-static void frame_queue_destory(FrameQueue *f) {
-    int i;
-    for (i = 0; i < f->max_size; i++) {
-        Frame *vp = &f->queue[i];
-        frame_queue_unref_item(vp);
-        av_frame_free(&vp->frame);
-    }
-    pthread_mutex_destroy(&f->pmutex);
-    pthread_cond_destroy(&f->pcond);
+static JitterStream *jitter_buffer_stream(VideoState *is, int stream_index) {
+    if (stream_index == is->audio_stream)
+        return &is->jitbuf.streams[JITTER_STREAM_AUDIO];
+    if (stream_index == is->video_stream)
+        return &is->jitbuf.streams[JITTER_STREAM_VIDEO];
+    return nullptr;
 }
 
-static void frame_queue_signal(FrameQueue *f) {
-    pthread_mutex_lock(&f->pmutex);
-    pthread_cond_signal(&f->pcond);
-    pthread_mutex_unlock(&f->pmutex);
+static void jitter_buffer_reset_stream(JitterStream *js) {
+    js->transit_min = NAN;
+    js->last_transit = NAN;
+    js->last_arrival = NAN;
+    js->next_ts = NAN;
+    js->last_released_ts = NAN;
+    js->jitter = 0;
 }
 
-static Frame *frame_queue_peek(FrameQueue *f) {
-    return &f->queue[(f->rindex + f->rindex_shown) % f->max_size];
+static void jitter_buffer_init(VideoState *is) {
+    JitterBuffer *jb = &is->jitbuf;
+    memset(jb, 0, sizeof(JitterBuffer));
+    jb->pmutex = PTHREAD_MUTEX_INITIALIZER;
+    jb->pcond = PTHREAD_COND_INITIALIZER;
+    jb->min_delay = jitter_min_delay / 1000.0;
+    jb->max_delay = FFMAX(jb->min_delay, jitter_max_delay / 1000.0);
+    jb->target_delay = jb->min_delay;
+    jb->streams[JITTER_STREAM_AUDIO].queue = &is->audioq;
+    jb->streams[JITTER_STREAM_VIDEO].queue = &is->videoq;
+    for (int i = 0; i < JITTER_STREAM_NB; i++)
+        jitter_buffer_reset_stream(&jb->streams[i]);
 }
 
-static Frame *frame_queue_peek_next(FrameQueue *f) {
-    return &f->queue[(f->rindex + f->rindex_shown + 1) % f->max_size];
+/* must be called with jb->pmutex held */
+static void jitter_buffer_release(JitterBuffer *jb, JitterStream *js, double now) {
+    JitterPacket *jp = js->first_pkt;
+
+    js->first_pkt = jp->next;
+    js->nb_packets--;
+    js->last_released_ts = jp->ts;
+    jb->nb_released++;
+    jb->hold_time_sum += now - jp->arrival;
+    packet_queue_put(js->queue, &jp->pkt);
+    av_free(jp);
 }
 
-static Frame *frame_queue_peek_last(FrameQueue *f) {
-    return &f->queue[f->rindex];
+/* drop the held packets, or hand them all to the packet queues when release is set */
+static void jitter_buffer_flush(VideoState *is, int release) {
+    JitterBuffer *jb = &is->jitbuf;
+    double now = av_gettime_relative() / 1000000.0;
+
+    pthread_mutex_lock(&jb->pmutex);
+    for (int i = 0; i < JITTER_STREAM_NB; i++) {
+        JitterStream *js = &jb->streams[i];
+        while (js->first_pkt) {
+            if (release) {
+                jitter_buffer_release(jb, js, now);
+            } else {
+                JitterPacket *jp = js->first_pkt;
+                js->first_pkt = jp->next;
+                av_packet_unref(&jp->pkt);
+                av_free(jp);
+            }
+        }
+        js->nb_packets = 0;
+        jitter_buffer_reset_stream(js);
+    }
+    pthread_mutex_unlock(&jb->pmutex);
 }
 
-static Frame *frame_queue_peek_writable(FrameQueue *f) {
-    /* wait until we have space to put a new frame */
-    pthread_mutex_lock(&f->pmutex);
-    while (f->size >= f->max_size &&
-           !f->pktq->abort_request) {
-        pthread_cond_wait(&f->pcond, &f->pmutex);
+// 没有dts的包不能按pts排序或者判断迟到(有B帧时pts在解码顺序里不是单调的): 按到达顺序排在已有的包后面, 和前一个包一起放出
+static int jitter_buffer_put_untimed(JitterBuffer *jb, JitterStream *js, AVPacket *pkt, double now) {
+    JitterPacket *jp, **next, *last = nullptr;
+
+    pthread_mutex_lock(&jb->pmutex);
+    js->nb_received++;
+    /* nothing held, nothing to keep the order behind */
+    if (!js->first_pkt || !(jp = static_cast<JitterPacket *>(av_malloc(sizeof(JitterPacket))))) {
+        pthread_mutex_unlock(&jb->pmutex);
+        return -1;
     }
-    pthread_mutex_unlock(&f->pmutex);
+    for (next = &js->first_pkt; *next; next = &(*next)->next)
+        last = *next;
+    jp->pkt = *pkt;
+    jp->ts = last->ts;
+    jp->arrival = now;
+    jp->next = nullptr;
+    *next = jp;
+    js->nb_packets++;
+    pthread_cond_signal(&jb->pcond);
+    pthread_mutex_unlock(&jb->pmutex);
+    return 0;
+}
 
-    if (f->pktq->abort_request)
-        return nullptr;
+/* take over pkt, return 0 if it was buffered and < 0 if the caller keeps it */
+static int jitter_buffer_put(VideoState *is, AVPacket *pkt) {
+    JitterBuffer *jb = &is->jitbuf;
+    JitterStream *js;
+    JitterPacket *jp, **next;
+    AVRational tb;
+    double now = av_gettime_relative() / 1000000.0;
+    double ts, transit, wanted_delay;
 
-    return &f->queue[f->windex];
-}
+    if (!(js = jitter_buffer_stream(is, pkt->stream_index)))
+        return -1;
+    if (pkt->dts == AV_NOPTS_VALUE)
+        return jitter_buffer_put_untimed(jb, js, pkt, now);
+    tb = is->ic->streams[pkt->stream_index]->time_base;
+    ts = pkt->dts * av_q2d(tb);
+    transit = now - ts;
+
+    pthread_mutex_lock(&jb->pmutex);
+    js->nb_received++;
+    if (isnan(js->transit_min) || fabs(transit - js->transit_min) > JITTER_RESYNC_THRESHOLD) {
+        jitter_buffer_reset_stream(js);
+        js->transit_min = transit;
+    } else if (transit < js->transit_min) {
+        js->transit_min = transit;
+    } else {
+        js->transit_min += JITTER_TRANSIT_LEAK * (now - js->last_arrival);
+    }
 
-static Frame *frame_queue_peek_readable(FrameQueue *f) {
-    /* wait until we have a readable a new frame */
-    pthread_mutex_lock(&f->pmutex);
-    while (f->size - f->rindex_shown <= 0 &&
-           !f->pktq->abort_request) {
-        pthread_cond_wait(&f->pcond, &f->pmutex);
+    if (!isnan(js->last_released_ts) && ts <= js->last_released_ts) {
+        /* its successors were already handed to the decoder, too late to reorder */
+        js->nb_late++;
+        pthread_mutex_unlock(&jb->pmutex);
+        av_packet_unref(pkt);
+        return 0;
     }
-    pthread_mutex_unlock(&f->pmutex);
 
-    if (f->pktq->abort_request)
-        return nullptr;
+    if (!isnan(js->last_transit)) {
+        /* RFC 3550 interarrival jitter */
+        js->jitter += (fabs(transit - js->last_transit) - js->jitter) / 16.0;
+        wanted_delay = av_clipd(JITTER_DELAY_FACTOR * js->jitter, jb->min_delay, jb->max_delay);
+        if (wanted_delay > jb->target_delay)
+            jb->target_delay = wanted_delay;
+        else
+            jb->target_delay -= (jb->target_delay - wanted_delay) *
+                                FFMIN(1.0, JITTER_DELAY_DECAY * (now - js->last_arrival));
+    }
+    js->last_transit = transit;
+    js->last_arrival = now;
+
+    if (transit - js->transit_min > jb->target_delay) {
+        /* the packet missed its playout time, the queue ran dry waiting for it */
+        jb->nb_underflows++;
+        jb->target_delay = FFMIN(jb->max_delay,
+                                 transit - js->transit_min + JITTER_UNDERFLOW_STEP);
+    }
 
-    return &f->queue[(f->rindex + f->rindex_shown) % f->max_size];
+    if (pkt->duration > 0) {
+        double pkt_duration = pkt->duration * av_q2d(tb);
+        if (!isnan(js->next_ts) && ts > js->next_ts + pkt_duration / 2)
+            js->nb_lost += lrint((ts - js->next_ts) / pkt_duration);
+        if (isnan(js->next_ts) || ts + pkt_duration > js->next_ts)
+            js->next_ts = ts + pkt_duration;
+    }
+
+    if (!(jp = static_cast<JitterPacket *>(av_malloc(sizeof(JitterPacket))))) {
+        pthread_mutex_unlock(&jb->pmutex);
+        return -1;
+    }
+    jp->pkt = *pkt;
+    jp->ts = ts;
+    jp->arrival = now;
+    for (next = &js->first_pkt; *next && (*next)->ts <= ts; next = &(*next)->next);
+    if (*next)
+        js->nb_reordered++;
+    jp->next = *next;
+    *next = jp;
+    js->nb_packets++;
+    pthread_cond_signal(&jb->pcond);
+    pthread_mutex_unlock(&jb->pmutex);
+    return 0;
 }
 
-static void frame_queue_push(FrameQueue *f) {
-    if (++f->windex == f->max_size)
-        f->windex = 0;
-    pthread_mutex_lock(&f->pmutex);
-    f->size++;
-    pthread_cond_signal(&f->pcond);
-    pthread_mutex_unlock(&f->pmutex);
+static void jitter_buffer_report(JitterBuffer *jb, int level) {
+    JitterStream *as = &jb->streams[JITTER_STREAM_AUDIO];
+    JitterStream *vs = &jb->streams[JITTER_STREAM_VIDEO];
+
+    av_log(nullptr, level,
+           "jitbuf: delay=%0.3f hold=%0.3f jitter a=%0.4f v=%0.4f held=%d/%d underflows=%" PRId64
+           " late=%" PRId64" reordered=%" PRId64" lost=%" PRId64"\n",
+           jb->target_delay, jb->nb_released ? jb->hold_time_sum / jb->nb_released : 0.0,
+           as->jitter, vs->jitter, as->nb_packets, vs->nb_packets, jb->nb_underflows,
+           as->nb_late + vs->nb_late, as->nb_reordered + vs->nb_reordered, as->nb_lost + vs->nb_lost);
 }
 
-static void frame_queue_next(FrameQueue *f) {
-    if (f->keep_last && !f->rindex_shown) {
-        f->rindex_shown = 1;
-        return;
+// 到了播放时间的包从抖动缓冲放入PacketQueue
+static int jitter_buffer_thread(void *arg) {
+    printf("jitter_buffer_thread() start\n");
+    VideoState *is = static_cast<VideoState *>(arg);
+    JitterBuffer *jb = &is->jitbuf;
+    struct timespec abstime;
+
+    pthread_mutex_lock(&jb->pmutex);
+    while (!jb->abort_request) {
+        double now = av_gettime_relative() / 1000000.0;
+        double next_release = now + 0.01;
+        int64_t wait_us;
+
+        for (int i = 0; i < JITTER_STREAM_NB; i++) {
+            JitterStream *js = &jb->streams[i];
+            while (js->first_pkt) {
+                double release_time = js->first_pkt->ts + js->transit_min + jb->target_delay;
+                if (release_time > now) {
+                    next_release = FFMIN(next_release, release_time);
+                    break;
+                }
+                jitter_buffer_release(jb, js, now);
+            }
+        }
+        if (now - jb->last_report >= 1.0) {
+            jitter_buffer_report(jb, AV_LOG_DEBUG);
+            jb->last_report = now;
+        }
+
+        /* pthread_cond_timedwait wants the realtime clock */
+        wait_us = av_gettime() + (int64_t) ((next_release - now) * 1000000.0);
+        abstime.tv_sec = wait_us / 1000000;
+        abstime.tv_nsec = (wait_us % 1000000) * 1000;
+        pthread_cond_timedwait(&jb->pcond, &jb->pmutex, &abstime);
     }
-    frame_queue_unref_item(&f->queue[f->rindex]);
-    if (++f->rindex == f->max_size)
-        f->rindex = 0;
-    pthread_mutex_lock(&f->pmutex);
-    f->size--;
-    pthread_cond_signal(&f->pcond);
-    pthread_mutex_unlock(&f->pmutex);
+    pthread_mutex_unlock(&jb->pmutex);
+    printf("jitter_buffer_thread() end\n");
+    return 0;
 }
 
-/* return the number of undisplayed frames in the queue */
-static int frame_queue_nb_remaining(FrameQueue *f) {
-    return f->size - f->rindex_shown;
+static int jitter_buffer_start(VideoState *is) {
+    if (!(is->jitbuf.release_tid = thread_create(jitter_buffer_thread, "jitter_buffer", is, THREAD_ROLE_DEMUX))) {
+        av_log(nullptr, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    return 0;
 }
 
-/* return last shown position */
-static int64_t frame_queue_last_pos(FrameQueue *f) {
-    Frame *fp = &f->queue[f->rindex];
-    if (f->rindex_shown && fp->serial == f->pktq->serial)
-        return fp->pos;
-    else
-        return -1;
+static void jitter_buffer_destroy(VideoState *is) {
+    JitterBuffer *jb = &is->jitbuf;
+
+    if (jb->release_tid) {
+        pthread_mutex_lock(&jb->pmutex);
+        jb->abort_request = 1;
+        pthread_cond_signal(&jb->pcond);
+        pthread_mutex_unlock(&jb->pmutex);
+        SDL_WaitThread(jb->release_tid, nullptr);
+        jb->release_tid = nullptr;
+    }
+    is->jitbuf_enabled = 0;
+    jitter_buffer_report(jb, AV_LOG_VERBOSE);
+    jitter_buffer_flush(is, 0);
+    pthread_mutex_destroy(&jb->pmutex);
+    pthread_cond_destroy(&jb->pcond);
 }
 
-static void decoder_abort(Decoder *d, FrameQueue *fq) {
-    packet_queue_abort(d->queue);
-    frame_queue_signal(fq);
-    SDL_WaitThread(d->decoder_tid, nullptr);
-    d->decoder_tid = nullptr;
-    packet_queue_flush(d->queue);
+static void decoder_init(Decoder *d, AVCodecContext *avctx, PacketQueue *queue, pthread_cond_t *empty_queue_cond) {
+    memset(d, 0, sizeof(Decoder));
+    d->avctx = avctx;
+    d->queue = queue;
+    d->pempty_queue_cond = empty_queue_cond;
+    d->start_pts = AV_NOPTS_VALUE;
+    d->pkt_serial = -1;
+    d->lowres = d->lowres_request = avctx->lowres;
 }
 
-static inline void fill_rectangle(int x, int y, int w, int h) {
-    SDL_Rect rect;
-    rect.x = x;
-    rect.y = y;
-    rect.w = w;
-    rect.h = h;
-    if (w && h)
-        SDL_RenderFillRect(renderer, &rect);
+// 按src的参数和设置打开一个新的解码器上下文, lowres和线程数由调用者指定
+static int codec_context_clone(AVCodecContext **pavctx, const AVCodecContext *src, int lowres, int threads,
+                               const char *thread_type) {
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    AVCodecContext *avctx = avcodec_alloc_context3(nullptr);
+    AVDictionary *opts = nullptr;
+    int ret;
+
+    if (!par || !avctx) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if ((ret = avcodec_parameters_from_context(par, src)) < 0 ||
+        (ret = avcodec_parameters_to_context(avctx, par)) < 0)
+        goto fail;
+    avctx->pkt_timebase = src->pkt_timebase;
+    avctx->flags2 = src->flags2;
+    avctx->skip_loop_filter = src->skip_loop_filter;
+    avctx->skip_idct = src->skip_idct;
+    avctx->skip_frame = src->skip_frame;
+    avctx->opaque = src->opaque;
+    avctx->get_buffer2 = src->get_buffer2;
+    avctx->lowres = lowres;
+    av_dict_set_int(&opts, "threads", threads, 0);
+    if (thread_type)
+        av_dict_set(&opts, "thread_type", thread_type, 0);
+    av_dict_set_int(&opts, "lowres", lowres, 0);
+    av_dict_set(&opts, "refcounted_frames", "1", 0);
+    if ((ret = avcodec_open2(avctx, src->codec, &opts)) < 0)
+        goto fail;
+    av_dict_free(&opts);
+    avcodec_parameters_free(&par);
+    *pavctx = avctx;
+    return 0;
+
+    fail:
+    av_dict_free(&opts);
+    avcodec_parameters_free(&par);
+    avcodec_free_context(&avctx);
+    return ret;
 }
 
-static int
-realloc_texture(SDL_Texture **texture, Uint32 new_format, int new_width, int new_height, SDL_BlendMode blendmode,
-                int init_texture) {
-    Uint32 format;
-    int access, w, h;
-    if (!*texture || SDL_QueryTexture(*texture, &format, &access, &w, &h) < 0 || new_width != w || new_height != h ||
-        new_format != format) {
-        void *pixels;
-        int pitch;
-        if (*texture)
-            SDL_DestroyTexture(*texture);
-        if (!(*texture = SDL_CreateTexture(renderer, new_format, SDL_TEXTUREACCESS_STREAMING, new_width, new_height)))
-            return -1;
-        if (SDL_SetTextureBlendMode(*texture, blendmode) < 0)
-            return -1;
-        if (init_texture) {
-            if (SDL_LockTexture(*texture, nullptr, &pixels, &pitch) < 0)
-                return -1;
-            memset(pixels, 0, pitch * new_height);
-            SDL_UnlockTexture(*texture);
-        }
-        av_log(nullptr, AV_LOG_VERBOSE, "Created %dx%d texture with %s.\n", new_width, new_height,
-               SDL_GetPixelFormatName(new_format));
+static const char *thread_type_name(int thread_type) {
+    if (thread_type & FF_THREAD_FRAME)
+        return "frame";
+    if (thread_type & FF_THREAD_SLICE)
+        return "slice";
+    return nullptr;
+}
+
+// 用新的lowres或线程设置重新打开解码器, 解码器设置都从旧的上下文复制; 在切换点把旧的上下文冲干净之后调用, 之后的帧不依赖旧的参考帧
+static int decoder_reopen(Decoder *d) {
+    AVCodecContext *avctx;
+    int threads = d->thread_count_request ? d->thread_count_request : d->avctx->thread_count;
+    int thread_type = d->thread_type_request ? d->thread_type_request : d->avctx->active_thread_type;
+    int ret;
+
+    d->thread_count_request = d->thread_type_request = 0;
+    if ((ret = codec_context_clone(&avctx, d->avctx, d->lowres_request, threads, thread_type_name(thread_type))) < 0) {
+        av_log(nullptr, AV_LOG_WARNING, "Could not reopen the decoder with lowres %d, %d %s threads\n",
+               d->lowres_request, threads, (const char *) av_x_if_null(thread_type_name(thread_type), "no"));
+        /* stay at the current resolution */
+        d->lowres_request = d->lowres;
+        return ret;
     }
+
+    av_log(nullptr, AV_LOG_VERBOSE, "decoder reopened with lowres %d, %d %s threads\n",
+           d->lowres_request, avctx->thread_count,
+           (const char *) av_x_if_null(thread_type_name(avctx->active_thread_type), "no"));
+    avcodec_free_context(&d->retired_avctx);
+    d->retired_avctx = d->avctx;
+    d->avctx = avctx;
+    d->lowres = d->lowres_request;
     return 0;
 }
 
-static void calculate_display_rect(SDL_Rect *rect,
-                                   int scr_xleft, int scr_ytop, int scr_width, int scr_height,
-                                   int pic_width, int pic_height, AVRational pic_sar) {
-    AVRational aspect_ratio = pic_sar;
-    int64_t width, height, x, y;
+// 全局的解码线程预算, 多个解码器(和多个播放实例的同一进程)一起不超过核数
+static pthread_mutex_t thread_budget_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int thread_budget_used;
+
+// 把*reserved个预留的线程换成wanted个, 预算不够时少给, 但至少一个; wanted为0时全部归还
+static int thread_budget_resize(int *reserved, int wanted) {
+    int total = thread_budget > 0 ? thread_budget : av_cpu_count();
+    int n = 0;
+
+    pthread_mutex_lock(&thread_budget_mutex);
+    thread_budget_used -= *reserved;
+    if (wanted > 0)
+        n = FFMAX(1, FFMIN(wanted, total - thread_budget_used));
+    thread_budget_used += n;
+    *reserved = n;
+    pthread_mutex_unlock(&thread_budget_mutex);
+    return n;
+}
 
-    if (av_cmp_q(aspect_ratio, av_make_q(0, 1)) <= 0) {
-        aspect_ratio = av_make_q(1, 1);
+// 用户没有给-threads时选择视频解码的线程类型和线程数: 实时输入用slice线程(不增加延迟), 文件用frame线程
+static void thread_tune_open(VideoState *is, AVStream *st, AVCodecContext *avctx, const AVCodec *codec,
+                             AVDictionary **opts) {
+    ThreadTuner *tt = &is->vtune;
+    AVRational frame_rate = av_guess_frame_rate(is->ic, st, nullptr);
+    int frame_threads = codec->capabilities & AV_CODEC_CAP_FRAME_THREADS;
+    int slice_threads = codec->capabilities & AV_CODEC_CAP_SLICE_THREADS;
+    int wanted = FFMIN(av_cpu_count(), THREAD_TUNE_MAX_THREADS);
+    int thread_type = 0;
+
+    thread_budget_resize(&tt->reserved, 0);
+    memset(tt, 0, sizeof(ThreadTuner));
+    tt->live = is->realtime || (avctx->flags & AV_CODEC_FLAG_LOW_DELAY);
+    tt->frame_rate = frame_rate.num && frame_rate.den ? av_q2d(frame_rate) : 25.0;
+    tt->probe_start = NAN;
+
+    if (slice_threads && (tt->live || !frame_threads)) {
+        thread_type = FF_THREAD_SLICE;
+    } else if (frame_threads) {
+        thread_type = FF_THREAD_FRAME;
+        if (tt->live)
+            wanted = FFMIN(wanted, THREAD_TUNE_LIVE_FRAME_THREADS);
+    } else {
+        wanted = 1;
     }
+    wanted = thread_budget_resize(&tt->reserved, wanted);
+    av_dict_set_int(opts, "threads", wanted, 0);
+    if (thread_type)
+        av_dict_set(opts, "thread_type", thread_type_name(thread_type), 0);
+    av_log(nullptr, AV_LOG_VERBOSE, "video decoding with %d %s threads (%s input)\n",
+           wanted, (const char *) av_x_if_null(thread_type_name(thread_type), "no"), tt->live ? "live" : "file");
+}
 
-    aspect_ratio = av_mul_q(aspect_ratio, av_make_q(pic_width, pic_height));
+// -thread_probe: 用开始几秒的解码速度(不等包也不等pictq的墙上时间里解出的帧数)检查线程数, 太慢就多要线程, 富余很多就还一些, 在下一个关键帧处生效
+static void thread_tune_update(VideoState *is) {
+    ThreadTuner *tt = &is->vtune;
+    Decoder *d = &is->viddec;
+    AVCodecContext *avctx = d->avctx;
+    double now = av_gettime_relative() / 1000000.0;
+    double active, fps, target;
+    int count = avctx->thread_count;
+    int thread_type = avctx->active_thread_type;
+    int wanted = count;
+
+    if (!tt->reserved || thread_probe <= 0 || tt->nb_probes >= THREAD_TUNE_MAX_PROBES ||
+        d->thread_count_request || d->lowres_request != d->lowres || is->pdec.mode != PDEC_OFF)
+        return;
+    if (isnan(tt->probe_start)) {
+        tt->probe_start = now;
+        tt->probe_blocked = d->blocked_time;
+        tt->probe_frames = 0;
+        return;
+    }
+    tt->probe_frames++;
+    if (now - tt->probe_start < thread_probe)
+        return;
 
-    /* XXX: we suppose the screen has a 1.0 pixel ratio */
-    height = scr_height;
-    width = av_rescale(height, aspect_ratio.num, aspect_ratio.den) & ~1;
-    if (width > scr_width) {
-        width = scr_width;
-        height = av_rescale(width, aspect_ratio.den, aspect_ratio.num) & ~1;
+    tt->nb_probes++;
+    /* frame threads decode in the background, the time inside the decode calls says little about
+     * throughput; wall time the decoder could run is what a faster decoder would save */
+    active = now - tt->probe_start - (d->blocked_time - tt->probe_blocked) / 1000000.0;
+    tt->probe_start = NAN;
+    fps = active > 0 ? tt->probe_frames / active : INFINITY;
+    target = tt->frame_rate * THREAD_TUNE_HEADROOM;
+    if (fps < target) {
+        if (!tt->live && !(thread_type & FF_THREAD_FRAME) && (avctx->codec->capabilities & AV_CODEC_CAP_FRAME_THREADS))
+            thread_type = FF_THREAD_FRAME;
+        wanted = FFMIN(count * 2, THREAD_TUNE_MAX_THREADS);
+        if (tt->live && (thread_type & FF_THREAD_FRAME))
+            wanted = FFMIN(wanted, THREAD_TUNE_LIVE_FRAME_THREADS);
+    } else if (fps > target * THREAD_TUNE_SPARE && count > 1) {
+        wanted = FFMAX(1, count / 2);
+    }
+    if (wanted != count)
+        wanted = thread_budget_resize(&tt->reserved, wanted);
+    av_log(nullptr, AV_LOG_VERBOSE, "thread probe: %0.1f fps decoded on %d %s threads, %0.1f wanted%s\n",
+           fps, count, (const char *) av_x_if_null(thread_type_name(avctx->active_thread_type), "no"), target,
+           wanted != count || thread_type != avctx->active_thread_type ? ", reopening" : "");
+    if (wanted != count || thread_type != avctx->active_thread_type) {
+        d->thread_type_request = thread_type;
+        d->thread_count_request = wanted;
+    } else {
+        /* settled */
+        tt->nb_probes = THREAD_TUNE_MAX_PROBES;
     }
-    x = (scr_width - width) / 2;
-    y = (scr_height - height) / 2;
-    rect->x = scr_xleft + x;
-    rect->y = scr_ytop + y;
-    rect->w = FFMAX((int) width, 1);
-    rect->h = FFMAX((int) height, 1);
 }
 
-static void get_sdl_pix_fmt_and_blendmode(int format, Uint32 *sdl_pix_fmt, SDL_BlendMode *sdl_blendmode) {
-    int i;
-    *sdl_blendmode = SDL_BLENDMODE_NONE;
-    *sdl_pix_fmt = SDL_PIXELFORMAT_UNKNOWN;
-    if (format == AV_PIX_FMT_RGB32 ||
-        format == AV_PIX_FMT_RGB32_1 ||
-        format == AV_PIX_FMT_BGR32 ||
-        format == AV_PIX_FMT_BGR32_1)
-        *sdl_blendmode = SDL_BLENDMODE_BLEND;
-    for (i = 0; i < FF_ARRAY_ELEMS(sdl_texture_format_map) - 1; i++) {
-        if (format == sdl_texture_format_map[i].format) {
-            *sdl_pix_fmt = sdl_texture_format_map[i].texture_fmt;
-            return;
+// 进程共用的工作线程池, 工作线程和解码线程从同一个-thread_budget里预留(提交任务的线程自己不算)
+static WorkerPool worker_pool;
+
+static int worker_deque_push(WorkerDeque *dq, WorkerBatch *b, int jobnr) {
+    int ret = -1;
+
+    pthread_mutex_lock(&dq->pmutex);
+    if (dq->nb_tasks < WORKER_POOL_DEQUE_SIZE) {
+        WorkerTask *t = &dq->tasks[(dq->head + dq->nb_tasks++) % WORKER_POOL_DEQUE_SIZE];
+        t->batch = b;
+        t->jobnr = jobnr;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&dq->pmutex);
+    return ret;
+}
+
+// 自己的队列取最新的任务(数据还在cache里), 偷别人的取最早的
+static int worker_deque_pop(WorkerDeque *dq, WorkerTask *t, int steal) {
+    int got = 0;
+
+    pthread_mutex_lock(&dq->pmutex);
+    if (dq->nb_tasks) {
+        if (steal) {
+            *t = dq->tasks[dq->head];
+            dq->head = (dq->head + 1) % WORKER_POOL_DEQUE_SIZE;
+        } else {
+            *t = dq->tasks[(dq->head + dq->nb_tasks - 1) % WORKER_POOL_DEQUE_SIZE];
         }
+        dq->nb_tasks--;
+        got = 1;
     }
+    pthread_mutex_unlock(&dq->pmutex);
+    if (got)
+        SDL_AtomicAdd(&worker_pool.nb_queued, -1);
+    return got;
 }
 
-// 渲染
-static int upload_texture(SDL_Texture **tex, AVFrame *frame, struct SwsContext **img_convert_ctx) {
-    int ret = 0;
-    Uint32 sdl_pix_fmt;
-    SDL_BlendMode sdl_blendmode;
-    get_sdl_pix_fmt_and_blendmode(frame->format, &sdl_pix_fmt, &sdl_blendmode);
-    if (realloc_texture(tex,
-                        sdl_pix_fmt == SDL_PIXELFORMAT_UNKNOWN ? SDL_PIXELFORMAT_ARGB8888 : sdl_pix_fmt,
-                        frame->width, frame->height, sdl_blendmode, 0) < 0) {
-        return -1;
+// self为-1时是提交任务的线程
+static int worker_pool_steal(WorkerPool *wp, int self, WorkerTask *t) {
+    int n = wp->nb_threads;
+
+    for (int i = 1; i <= n; i++) {
+        if (worker_deque_pop(&wp->deques[(self + i + n) % n], t, 1)) {
+            if (self >= 0)
+                wp->deques[self].nb_steals++;
+            return 1;
+        }
     }
-    switch (sdl_pix_fmt) {
-        case SDL_PIXELFORMAT_UNKNOWN:
-            /* This should only happen if we are not using avfilter... */
-            *img_convert_ctx = sws_getCachedContext(*img_convert_ctx,
-                                                    frame->width, frame->height,
-                                                    static_cast<AVPixelFormat>(frame->format), frame->width,
-                                                    frame->height,
-                                                    AV_PIX_FMT_BGRA, sws_flags, nullptr, nullptr, nullptr);
-            if (*img_convert_ctx != nullptr) {
-                uint8_t *pixels[4];
-                int pitch[4];
-                if (!SDL_LockTexture(*tex, nullptr, (void **) pixels, pitch)) {
-                    sws_scale(*img_convert_ctx, (const uint8_t *const *) frame->data, frame->linesize,
-                              0, frame->height, pixels, pitch);
-                    SDL_UnlockTexture(*tex);
-                }
-            } else {
-                av_log(nullptr, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
-                ret = -1;
-            }
+    return 0;
+}
+
+static void worker_task_run(WorkerPool *wp, WorkerTask *t) {
+    WorkerBatch *b = t->batch;
+    int ret = b->func(b->priv, t->jobnr, b->nb_jobs);
+
+    if (b->ret)
+        b->ret[t->jobnr] = ret;
+    /* the submitter may return as soon as pending is 0, b must not be touched after this */
+    if (SDL_AtomicAdd(&b->pending, -1) == 1) {
+        pthread_mutex_lock(&wp->pmutex);
+        pthread_cond_broadcast(&wp->done_cond);
+        pthread_mutex_unlock(&wp->pmutex);
+    }
+}
+
+static int worker_pool_thread(void *arg) {
+    WorkerPool *wp = &worker_pool;
+    WorkerDeque *dq = static_cast<WorkerDeque *>(arg);
+    int self = (int) (dq - wp->deques);
+    WorkerTask t;
+    int abort_request;
+
+    for (;;) {
+        if (worker_deque_pop(dq, &t, 0) || worker_pool_steal(wp, self, &t)) {
+            worker_task_run(wp, &t);
+            dq->nb_jobs++;
+            continue;
+        }
+        pthread_mutex_lock(&wp->pmutex);
+        while (!SDL_AtomicGet(&wp->nb_queued) && !wp->abort_request)
+            pthread_cond_wait(&wp->work_cond, &wp->pmutex);
+        abort_request = wp->abort_request;
+        pthread_mutex_unlock(&wp->pmutex);
+        if (abort_request)
             break;
-        case SDL_PIXELFORMAT_IYUV:
-            if (frame->linesize[0] > 0 && frame->linesize[1] > 0 && frame->linesize[2] > 0) {
-                ret = SDL_UpdateYUVTexture(*tex, nullptr, frame->data[0], frame->linesize[0],
-                                           frame->data[1], frame->linesize[1],
-                                           frame->data[2], frame->linesize[2]);
-            } else if (frame->linesize[0] < 0 && frame->linesize[1] < 0 && frame->linesize[2] < 0) {
-                ret = SDL_UpdateYUVTexture(*tex, nullptr, frame->data[0] + frame->linesize[0] * (frame->height - 1),
-                                           -frame->linesize[0],
-                                           frame->data[1] + frame->linesize[1] * (AV_CEIL_RSHIFT(frame->height, 1) - 1),
-                                           -frame->linesize[1],
-                                           frame->data[2] + frame->linesize[2] * (AV_CEIL_RSHIFT(frame->height, 1) - 1),
-                                           -frame->linesize[2]);
+    }
+    return 0;
+}
+
+// 执行nb_jobs个任务, 都完成后返回; 提交的线程执行第一个任务, 然后帮着偷别的任务, 不会闲等
+static void worker_pool_execute(WorkerJobFunc func, void *priv, int *ret, int nb_jobs) {
+    WorkerPool *wp = &worker_pool;
+    WorkerBatch b = {func, priv, ret, nb_jobs};
+    WorkerTask t;
+    int first, queued = 0;
+
+    if (!wp->nb_threads || nb_jobs <= 1) {
+        for (int i = 0; i < nb_jobs; i++) {
+            int r = func(priv, i, nb_jobs);
+            if (ret)
+                ret[i] = r;
+        }
+        return;
+    }
+    SDL_AtomicSet(&b.pending, nb_jobs);
+    SDL_AtomicAdd(&wp->nb_batches, 1);
+    SDL_AtomicAdd(&wp->nb_jobs, nb_jobs);
+    first = SDL_AtomicAdd(&wp->next_deque, 1);
+    for (int i = 1; i < nb_jobs; i++) {
+        /* counted before it is visible, a worker popping it right away must not take nb_queued below 0 */
+        SDL_AtomicAdd(&wp->nb_queued, 1);
+        if (worker_deque_push(&wp->deques[(first + i) % wp->nb_threads], &b, i) < 0) {
+            SDL_AtomicAdd(&wp->nb_queued, -1);
+            /* that worker is far behind, do it here */
+            t.batch = &b;
+            t.jobnr = i;
+            worker_task_run(wp, &t);
+            SDL_AtomicAdd(&wp->nb_inline, 1);
+        } else {
+            queued++;
+        }
+    }
+    if (queued) {
+        pthread_mutex_lock(&wp->pmutex);
+        pthread_cond_broadcast(&wp->work_cond);
+        pthread_mutex_unlock(&wp->pmutex);
+    }
+    t.batch = &b;
+    t.jobnr = 0;
+    worker_task_run(wp, &t);
+    SDL_AtomicAdd(&wp->nb_inline, 1);
+    while (SDL_AtomicGet(&b.pending)) {
+        if (worker_pool_steal(wp, -1, &t)) {
+            worker_task_run(wp, &t);
+            SDL_AtomicAdd(&wp->nb_inline, 1);
+            continue;
+        }
+        pthread_mutex_lock(&wp->pmutex);
+        while (SDL_AtomicGet(&b.pending) && !SDL_AtomicGet(&wp->nb_queued))
+            pthread_cond_wait(&wp->done_cond, &wp->pmutex);
+        pthread_mutex_unlock(&wp->pmutex);
+    }
+}
+
+static int worker_pool_size(void) {
+    return worker_pool.nb_threads + 1;
+}
+
+/* must run before the player threads are created; takes half of the budget, the decoders share the rest */
+static void worker_pool_start(void) {
+    WorkerPool *wp = &worker_pool;
+    int total = thread_budget > 0 ? thread_budget : av_cpu_count();
+    int nb_threads = thread_budget_resize(&wp->reserved, FFMIN(total / 2, WORKER_POOL_MAX_THREADS));
+
+    wp->pmutex = PTHREAD_MUTEX_INITIALIZER;
+    wp->work_cond = PTHREAD_COND_INITIALIZER;
+    wp->done_cond = PTHREAD_COND_INITIALIZER;
+    for (int i = 0; i < nb_threads; i++)
+        wp->deques[i].pmutex = PTHREAD_MUTEX_INITIALIZER;
+    /* the deques all exist before any worker steals from them */
+    wp->nb_threads = nb_threads;
+    for (int i = 0; i < nb_threads; i++) {
+        if (!(wp->deques[i].tid = thread_create(worker_pool_thread, "worker_pool", &wp->deques[i], THREAD_ROLE_FILTER))) {
+            av_log(nullptr, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+            /* the deque of a missing worker is still drained by stealing */
+            break;
+        }
+    }
+    wp->start_time = av_gettime_relative();
+    av_log(nullptr, AV_LOG_VERBOSE, "worker pool with %d threads\n", wp->nb_threads);
+}
+
+static void worker_pool_stop(void) {
+    WorkerPool *wp = &worker_pool;
+    int64_t nb_steals = 0;
+
+    thread_budget_resize(&wp->reserved, 0);
+    if (!wp->nb_threads)
+        return;
+    pthread_mutex_lock(&wp->pmutex);
+    wp->abort_request = 1;
+    pthread_cond_broadcast(&wp->work_cond);
+    pthread_mutex_unlock(&wp->pmutex);
+    for (int i = 0; i < wp->nb_threads; i++) {
+        SDL_WaitThread(wp->deques[i].tid, nullptr);
+        nb_steals += wp->deques[i].nb_steals;
+        pthread_mutex_destroy(&wp->deques[i].pmutex);
+    }
+    av_log(nullptr, perf_stats ? AV_LOG_INFO : AV_LOG_VERBOSE,
+           "worker pool: threads=%d batches=%d jobs=%d (%0.1f/s) steals=%" PRId64" on submitter=%d\n",
+           wp->nb_threads, SDL_AtomicGet(&wp->nb_batches), SDL_AtomicGet(&wp->nb_jobs),
+           SDL_AtomicGet(&wp->nb_jobs) / FFMAX((av_gettime_relative() - wp->start_time) / 1000000.0, 0.001),
+           nb_steals, SDL_AtomicGet(&wp->nb_inline));
+    pthread_mutex_destroy(&wp->pmutex);
+    pthread_cond_destroy(&wp->work_cond);
+    pthread_cond_destroy(&wp->done_cond);
+    wp->nb_threads = 0;
+}
+
+#if CONFIG_AVFILTER
+typedef struct FilterJobs {
+    AVFilterContext *ctx;
+    avfilter_action_func *func;
+    void *arg;
+} FilterJobs;
+
+static int worker_pool_filter_job(void *priv, int jobnr, int nb_jobs) {
+    FilterJobs *fj = static_cast<FilterJobs *>(priv);
+    return fj->func(fj->ctx, fj->arg, jobnr, nb_jobs);
+}
+
+static int worker_pool_filter_execute(AVFilterContext *ctx, avfilter_action_func *func, void *arg, int *ret,
+                                      int nb_jobs) {
+    FilterJobs fj = {ctx, func, arg};
+
+    worker_pool_execute(worker_pool_filter_job, &fj, ret, nb_jobs);
+    return 0;
+}
+
+// 滤镜图的切片任务交给工作线程池, 不再每个图创建自己的线程; -filter_threads给了时仍用libavfilter自己的线程
+static void worker_pool_attach_graph(AVFilterGraph *graph) {
+    if (filter_nbthreads || !worker_pool.nb_threads) {
+        graph->nb_threads = filter_nbthreads;
+        return;
+    }
+    /* has to be set before the filters are created, they copy it */
+    graph->execute = worker_pool_filter_execute;
+    graph->nb_threads = worker_pool_size();
+}
+#endif
+
+typedef struct SwsBands {
+    struct SwsContext **ctx;
+    int band_height;
+    int height;
+    const AVPixFmtDescriptor *src_desc, *dst_desc;
+    int src_planes, dst_planes;
+    const uint8_t *const *src;
+    const int *src_linesize;
+    uint8_t *const *dst;
+    const int *dst_linesize;
+} SwsBands;
+
+static int sws_band_job(void *priv, int jobnr, int nb_jobs) {
+    SwsBands *sb = static_cast<SwsBands *>(priv);
+    int y = jobnr * sb->band_height;
+    const uint8_t *src[4] = {nullptr};
+    uint8_t *dst[4] = {nullptr};
+
+    for (int p = 0; p < 4; p++) {
+        int src_shift = p == 1 || p == 2 ? sb->src_desc->log2_chroma_h : 0;
+        int dst_shift = p == 1 || p == 2 ? sb->dst_desc->log2_chroma_h : 0;
+
+        /* planes past the image planes (palettes) are not offset */
+        src[p] = sb->src[p] && p < sb->src_planes ? sb->src[p] + (y >> src_shift) * sb->src_linesize[p] : sb->src[p];
+        dst[p] = sb->dst[p] && p < sb->dst_planes ? sb->dst[p] + (y >> dst_shift) * sb->dst_linesize[p] : sb->dst[p];
+    }
+    return sws_scale(sb->ctx[jobnr], src, sb->src_linesize, 0, FFMIN(sb->band_height, sb->height - y),
+                     dst, sb->dst_linesize);
+}
+
+// 不缩放的格式转换分成水平条带在工作线程池上并行做, 每个条带用自己的SwsContext(ctx是SWS_BANDS_MAX个的数组)
+static int sws_convert_bands(struct SwsContext **ctx, int width, int height, enum AVPixelFormat src_fmt,
+                             const uint8_t *const src[], const int src_linesize[], enum AVPixelFormat dst_fmt,
+                             uint8_t *const dst[], const int dst_linesize[], int flags) {
+    SwsBands sb = {ctx, 0, height, av_pix_fmt_desc_get(src_fmt), av_pix_fmt_desc_get(dst_fmt),
+                   av_pix_fmt_count_planes(src_fmt), av_pix_fmt_count_planes(dst_fmt),
+                   src, src_linesize, dst, dst_linesize};
+    int nb_bands = av_clip(height / SWS_BAND_MIN_HEIGHT, 1, FFMIN(SWS_BANDS_MAX, worker_pool_size()));
+    int align;
+
+    if (!sb.src_desc || !sb.dst_desc)
+        return AVERROR(EINVAL);
+    /* bands start on a chroma line */
+    align = 1 << FFMAX(sb.src_desc->log2_chroma_h, sb.dst_desc->log2_chroma_h);
+    sb.band_height = FFALIGN((height + nb_bands - 1) / nb_bands, align);
+    nb_bands = (height + sb.band_height - 1) / sb.band_height;
+    for (int i = 0; i < nb_bands; i++) {
+        int h = FFMIN(sb.band_height, height - i * sb.band_height);
+        ctx[i] = sws_getCachedContext(ctx[i], width, h, src_fmt, width, h, dst_fmt, flags, nullptr, nullptr, nullptr);
+        if (!ctx[i])
+            return AVERROR(EINVAL);
+    }
+    worker_pool_execute(sws_band_job, &sb, nullptr, nb_bands);
+    return 0;
+}
+
+// 解码
+static int decoder_decode_frame(Decoder *d, AVFrame *frame, AVSubtitle *sub) {
+    int ret = AVERROR(EAGAIN);
+    int64_t start;
+
+    for (;;) {
+        AVPacket pkt;
+
+        if (d->queue->serial == d->pkt_serial) {
+            do {
+                if (d->queue->abort_request)
+                    return -1;
+
+                switch (d->avctx->codec_type) {
+                    case AVMEDIA_TYPE_VIDEO:
+                        start = av_gettime_relative();
+                        ret = avcodec_receive_frame(d->avctx, frame);
+                        d->busy_time += av_gettime_relative() - start;
+                        if (ret >= 0) {
+                            if (decoder_reorder_pts == -1) {
+                                frame->pts = frame->best_effort_timestamp;
+                            } else if (!decoder_reorder_pts) {
+                                frame->pts = frame->pkt_dts;
+                            }
+                        }
+                        break;
+                    case AVMEDIA_TYPE_AUDIO:
+                        ret = avcodec_receive_frame(d->avctx, frame);
+                        if (ret >= 0) {
+                            AVRational tb = (AVRational) {1, frame->sample_rate};
+                            if (frame->pts != AV_NOPTS_VALUE)
+                                frame->pts = av_rescale_q(frame->pts, d->avctx->pkt_timebase, tb);
+                            else if (d->next_pts != AV_NOPTS_VALUE)
+                                frame->pts = av_rescale_q(d->next_pts, d->next_pts_tb, tb);
+                            if (frame->pts != AV_NOPTS_VALUE) {
+                                d->next_pts = frame->pts + frame->nb_samples;
+                                d->next_pts_tb = tb;
+                            }
+                        }
+                        break;
+                }
+                if (ret == AVERROR_EOF && d->draining) {
+                    /* the old context gave out its last frame, the pending packet goes to the new one */
+                    d->draining = 0;
+                    if (decoder_reopen(d) < 0)
+                        avcodec_flush_buffers(d->avctx);
+                    ret = AVERROR(EAGAIN);
+                    break;
+                }
+                if (ret == AVERROR_EOF) {
+                    d->finished = d->pkt_serial;
+                    avcodec_flush_buffers(d->avctx);
+                    return 0;
+                }
+                if (ret >= 0)
+                    return 1;
+            } while (ret != AVERROR(EAGAIN));
+        }
+
+        do {
+            if (d->queue->nb_packets == 0)
+                pthread_cond_signal(d->pempty_queue_cond);
+            if (d->packet_pending) {
+                av_packet_move_ref(&pkt, &d->pkt);
+                d->packet_pending = 0;
             } else {
-                av_log(nullptr, AV_LOG_ERROR, "Mixed negative and positive linesizes are not supported.\n");
-                return -1;
+                start = av_gettime_relative();
+                if (packet_queue_get(d->queue, &pkt, 1, &d->pkt_serial) < 0)
+                    return -1;
+                d->blocked_time += av_gettime_relative() - start;
+            }
+            if (d->queue->serial == d->pkt_serial)
+                break;
+            av_packet_unref(&pkt);
+        } while (1);
+
+        if (pkt.data != flush_pkt.data && d->packet_filter && d->packet_filter(d->packet_filter_opaque, &pkt)) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+
+        if (pkt.data == flush_pkt.data) {
+            avcodec_flush_buffers(d->avctx);
+            /* the packet held for the drain belonged to the old serial */
+            d->draining = 0;
+            d->finished = 0;
+            d->next_pts = d->start_pts;
+            d->next_pts_tb = d->start_pts_tb;
+        } else {
+            if (d->avctx->codec_type == AVMEDIA_TYPE_SUBTITLE) {
+                int got_frame = 0;
+                ret = avcodec_decode_subtitle2(d->avctx, sub, &got_frame, &pkt);
+                if (ret < 0) {
+                    ret = AVERROR(EAGAIN);
+                } else {
+                    if (got_frame && !pkt.data) {
+                        d->packet_pending = 1;
+                        av_packet_move_ref(&d->pkt, &pkt);
+                    }
+                    ret = got_frame ? 0 : (pkt.data ? AVERROR(EAGAIN) : AVERROR_EOF);
+                }
+            } else {
+                if ((d->lowres_request != d->lowres || d->thread_count_request) &&
+                    (d->packet_switch_point ? d->packet_switch_point(d->packet_filter_opaque, &pkt)
+                                            : (pkt.flags & AV_PKT_FLAG_KEY))) {
+                    /* frames still inside the old context (thread_count of them with frame threads) come
+                     * out before the switch, the packet waits for the new context */
+                    d->draining = 1;
+                    d->packet_pending = 1;
+                    av_packet_move_ref(&d->pkt, &pkt);
+                    avcodec_send_packet(d->avctx, nullptr);
+                    continue;
+                }
+                start = av_gettime_relative();
+                ret = avcodec_send_packet(d->avctx, &pkt);
+                d->busy_time += av_gettime_relative() - start;
+                if (ret == AVERROR(EAGAIN)) {
+                    printf("decoder_decode_frame() "
+                           "Receive_frame and send_packet both returned EAGAIN, which is an API violation.\n");
+                    d->packet_pending = 1;
+                    av_packet_move_ref(&d->pkt, &pkt);
+                }
+            }
+            av_packet_unref(&pkt);
+        }
+    }// for (;;) end
+}
+
+static void decoder_destroy(Decoder *d) {
+    av_packet_unref(&d->pkt);
+    avcodec_free_context(&d->avctx);
+    avcodec_free_context(&d->retired_avctx);
+}
+
+static void frame_queue_unref_item(Frame *vp) {
+    av_frame_unref(vp->frame);
+    avsubtitle_free(&vp->sub);
+}
+
+static int frame_queue_init(FrameQueue *f, PacketQueue *pktq, int max_size, int keep_last) {
+    memset(f, 0, sizeof(FrameQueue));
+    f->pmutex = PTHREAD_MUTEX_INITIALIZER;
+    f->pcond = PTHREAD_COND_INITIALIZER;
+    f->pktq = pktq;
+    f->max_size = FFMIN(max_size, FRAME_QUEUE_SIZE);
+    f->keep_last = !!keep_last;
+    printf("frame_queue_init()  max_size = %d\n", f->max_size);
+    printf("frame_queue_init() keep_last = %d\n", f->keep_last);
+    for (int i = 0; i < f->max_size; i++)
+        if (!(f->queue[i].frame = av_frame_alloc()))
+            return AVERROR(ENOMEM);// -12
+    return 0;
+}
+
+static void frame_queue_destory(FrameQueue *f) {
+    int i;
+    for (i = 0; i < f->max_size; i++) {
+        Frame *vp = &f->queue[i];
+        frame_queue_unref_item(vp);
+        av_frame_free(&vp->frame);
+    }
+    pthread_mutex_destroy(&f->pmutex);
+    pthread_cond_destroy(&f->pcond);
+}
+
+static void frame_queue_signal(FrameQueue *f) {
+    pthread_mutex_lock(&f->pmutex);
+    pthread_cond_signal(&f->pcond);
+    pthread_mutex_unlock(&f->pmutex);
+}
+
+static Frame *frame_queue_peek(FrameQueue *f) {
+    return &f->queue[(f->rindex + f->rindex_shown) % f->max_size];
+}
+
+static Frame *frame_queue_peek_next(FrameQueue *f) {
+    return &f->queue[(f->rindex + f->rindex_shown + 1) % f->max_size];
+}
+
+static Frame *frame_queue_peek_last(FrameQueue *f) {
+    return &f->queue[f->rindex];
+}
+
+static Frame *frame_queue_peek_writable(FrameQueue *f) {
+    /* wait until we have space to put a new frame */
+    pthread_mutex_lock(&f->pmutex);
+    while (f->size >= f->max_size &&
+           !f->pktq->abort_request) {
+        pthread_cond_wait(&f->pcond, &f->pmutex);
+    }
+    pthread_mutex_unlock(&f->pmutex);
+
+    if (f->pktq->abort_request)
+        return nullptr;
+
+    return &f->queue[f->windex];
+}
+
+static Frame *frame_queue_peek_readable(FrameQueue *f) {
+    /* wait until we have a readable a new frame */
+    pthread_mutex_lock(&f->pmutex);
+    while (f->size - f->rindex_shown <= 0 &&
+           !f->pktq->abort_request) {
+        pthread_cond_wait(&f->pcond, &f->pmutex);
+    }
+    pthread_mutex_unlock(&f->pmutex);
+
+    if (f->pktq->abort_request)
+        return nullptr;
+
+    return &f->queue[(f->rindex + f->rindex_shown) % f->max_size];
+}
+
+static void frame_queue_push(FrameQueue *f) {
+    if (++f->windex == f->max_size)
+        f->windex = 0;
+    pthread_mutex_lock(&f->pmutex);
+    f->size++;
+    pthread_cond_signal(&f->pcond);
+    pthread_mutex_unlock(&f->pmutex);
+}
+
+static void frame_queue_next(FrameQueue *f) {
+    if (f->keep_last && !f->rindex_shown) {
+        f->rindex_shown = 1;
+        return;
+    }
+    frame_queue_unref_item(&f->queue[f->rindex]);
+    if (++f->rindex == f->max_size)
+        f->rindex = 0;
+    pthread_mutex_lock(&f->pmutex);
+    f->size--;
+    pthread_cond_signal(&f->pcond);
+    pthread_mutex_unlock(&f->pmutex);
+}
+
+/* return the number of undisplayed frames in the queue */
+static int frame_queue_nb_remaining(FrameQueue *f) {
+    return f->size - f->rindex_shown;
+}
+
+/* return last shown position */
+static int64_t frame_queue_last_pos(FrameQueue *f) {
+    Frame *fp = &f->queue[f->rindex];
+    if (f->rindex_shown && fp->serial == f->pktq->serial)
+        return fp->pos;
+    else
+        return -1;
+}
+
+static void decoder_abort(Decoder *d, FrameQueue *fq) {
+    packet_queue_abort(d->queue);
+    frame_queue_signal(fq);
+    SDL_WaitThread(d->decoder_tid, nullptr);
+    d->decoder_tid = nullptr;
+    packet_queue_flush(d->queue);
+}
+
+static inline void fill_rectangle(int x, int y, int w, int h) {
+    SDL_Rect rect;
+    rect.x = x;
+    rect.y = y;
+    rect.w = w;
+    rect.h = h;
+    if (w && h)
+        SDL_RenderFillRect(renderer, &rect);
+}
+
+static int
+realloc_texture(SDL_Texture **texture, Uint32 new_format, int new_width, int new_height, SDL_BlendMode blendmode,
+                int init_texture) {
+    Uint32 format;
+    int access, w, h;
+    if (!*texture || SDL_QueryTexture(*texture, &format, &access, &w, &h) < 0 || new_width != w || new_height != h ||
+        new_format != format) {
+        void *pixels;
+        int pitch;
+        if (*texture)
+            SDL_DestroyTexture(*texture);
+        if (!(*texture = SDL_CreateTexture(renderer, new_format, SDL_TEXTUREACCESS_STREAMING, new_width, new_height)))
+            return -1;
+        if (SDL_SetTextureBlendMode(*texture, blendmode) < 0)
+            return -1;
+        if (init_texture) {
+            if (SDL_LockTexture(*texture, nullptr, &pixels, &pitch) < 0)
+                return -1;
+            memset(pixels, 0, pitch * new_height);
+            SDL_UnlockTexture(*texture);
+        }
+        av_log(nullptr, AV_LOG_VERBOSE, "Created %dx%d texture with %s.\n", new_width, new_height,
+               SDL_GetPixelFormatName(new_format));
+    }
+    return 0;
+}
+
+static void calculate_display_rect(SDL_Rect *rect,
+                                   int scr_xleft, int scr_ytop, int scr_width, int scr_height,
+                                   int pic_width, int pic_height, AVRational pic_sar) {
+    AVRational aspect_ratio = pic_sar;
+    int64_t width, height, x, y;
+
+    if (av_cmp_q(aspect_ratio, av_make_q(0, 1)) <= 0) {
+        aspect_ratio = av_make_q(1, 1);
+    }
+
+    aspect_ratio = av_mul_q(aspect_ratio, av_make_q(pic_width, pic_height));
+
+    /* XXX: we suppose the screen has a 1.0 pixel ratio */
+    height = scr_height;
+    width = av_rescale(height, aspect_ratio.num, aspect_ratio.den) & ~1;
+    if (width > scr_width) {
+        width = scr_width;
+        height = av_rescale(width, aspect_ratio.den, aspect_ratio.num) & ~1;
+    }
+    x = (scr_width - width) / 2;
+    y = (scr_height - height) / 2;
+    rect->x = scr_xleft + x;
+    rect->y = scr_ytop + y;
+    rect->w = FFMAX((int) width, 1);
+    rect->h = FFMAX((int) height, 1);
+}
+
+static void get_sdl_pix_fmt_and_blendmode(int format, Uint32 *sdl_pix_fmt, SDL_BlendMode *sdl_blendmode) {
+    int i;
+    *sdl_blendmode = SDL_BLENDMODE_NONE;
+    *sdl_pix_fmt = SDL_PIXELFORMAT_UNKNOWN;
+    if (format == AV_PIX_FMT_RGB32 ||
+        format == AV_PIX_FMT_RGB32_1 ||
+        format == AV_PIX_FMT_BGR32 ||
+        format == AV_PIX_FMT_BGR32_1)
+        *sdl_blendmode = SDL_BLENDMODE_BLEND;
+    for (i = 0; i < FF_ARRAY_ELEMS(sdl_texture_format_map) - 1; i++) {
+        if (format == sdl_texture_format_map[i].format) {
+            *sdl_pix_fmt = sdl_texture_format_map[i].texture_fmt;
+            return;
+        }
+    }
+}
+
+// 渲染
+static int upload_texture(SDL_Texture **tex, AVFrame *frame, struct SwsContext **img_convert_ctx) {
+    int ret = 0;
+    Uint32 sdl_pix_fmt;
+    SDL_BlendMode sdl_blendmode;
+    get_sdl_pix_fmt_and_blendmode(frame->format, &sdl_pix_fmt, &sdl_blendmode);
+    if (realloc_texture(tex,
+                        sdl_pix_fmt == SDL_PIXELFORMAT_UNKNOWN ? SDL_PIXELFORMAT_ARGB8888 : sdl_pix_fmt,
+                        frame->width, frame->height, sdl_blendmode, 0) < 0) {
+        return -1;
+    }
+    switch (sdl_pix_fmt) {
+        case SDL_PIXELFORMAT_UNKNOWN:
+            /* This should only happen if we are not using avfilter... */
+        {
+            uint8_t *pixels[4] = {nullptr};
+            int pitch[4] = {0};
+            if (!SDL_LockTexture(*tex, nullptr, (void **) pixels, pitch)) {
+                ret = sws_convert_bands(img_convert_ctx, frame->width, frame->height,
+                                        static_cast<AVPixelFormat>(frame->format),
+                                        (const uint8_t *const *) frame->data, frame->linesize,
+                                        AV_PIX_FMT_BGRA, pixels, pitch, sws_flags);
+                SDL_UnlockTexture(*tex);
+                if (ret < 0) {
+                    av_log(nullptr, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
+                    ret = -1;
+                }
+            }
+            break;
+        }
+        case SDL_PIXELFORMAT_IYUV:
+            if (frame->linesize[0] > 0 && frame->linesize[1] > 0 && frame->linesize[2] > 0) {
+                ret = SDL_UpdateYUVTexture(*tex, nullptr, frame->data[0], frame->linesize[0],
+                                           frame->data[1], frame->linesize[1],
+                                           frame->data[2], frame->linesize[2]);
+            } else if (frame->linesize[0] < 0 && frame->linesize[1] < 0 && frame->linesize[2] < 0) {
+                ret = SDL_UpdateYUVTexture(*tex, nullptr, frame->data[0] + frame->linesize[0] * (frame->height - 1),
+                                           -frame->linesize[0],
+                                           frame->data[1] + frame->linesize[1] * (AV_CEIL_RSHIFT(frame->height, 1) - 1),
+                                           -frame->linesize[1],
+                                           frame->data[2] + frame->linesize[2] * (AV_CEIL_RSHIFT(frame->height, 1) - 1),
+                                           -frame->linesize[2]);
+            } else {
+                av_log(nullptr, AV_LOG_ERROR, "Mixed negative and positive linesizes are not supported.\n");
+                return -1;
+            }
+            break;
+        default:
+            if (frame->linesize[0] < 0) {
+                ret = SDL_UpdateTexture(*tex, nullptr, frame->data[0] + frame->linesize[0] * (frame->height - 1),
+                                        -frame->linesize[0]);
+            } else {
+                ret = SDL_UpdateTexture(*tex, nullptr, frame->data[0], frame->linesize[0]);
+            }
+            break;
+    }
+    return ret;
+}
+
+static void set_sdl_yuv_conversion_mode(AVFrame *frame) {
+#if SDL_VERSION_ATLEAST(2, 0, 8)
+    SDL_YUV_CONVERSION_MODE mode = SDL_YUV_CONVERSION_AUTOMATIC;
+    if (frame && (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUYV422 ||
+                  frame->format == AV_PIX_FMT_UYVY422)) {
+        if (frame->color_range == AVCOL_RANGE_JPEG)
+            mode = SDL_YUV_CONVERSION_JPEG;
+        else if (frame->colorspace == AVCOL_SPC_BT709)
+            mode = SDL_YUV_CONVERSION_BT709;
+        else if (frame->colorspace == AVCOL_SPC_BT470BG || frame->colorspace == AVCOL_SPC_SMPTE170M ||
+                 frame->colorspace == AVCOL_SPC_SMPTE240M)
+            mode = SDL_YUV_CONVERSION_BT601;
+    }
+    SDL_SetYUVConversionMode(mode);
+#endif
+}
+
+static void video_image_display(VideoState *is) {
+    Frame *vp = nullptr;
+    Frame *sp = nullptr;
+    SDL_Rect rect;
+    // 取要显示的视频帧, 倒放时是倒放显示的帧
+    if (is->rev.mode != REVERSE_OFF && is->rev.shown.frame->buf[0])
+        vp = &is->rev.shown;
+    else
+        vp = frame_queue_peek_last(&is->pictq);
+
+    // region is->subtitle_st
+    if (is->subtitle_st && vp != &is->rev.shown) {
+        if (frame_queue_nb_remaining(&is->subpq) > 0) {
+            sp = frame_queue_peek(&is->subpq);
+
+            if (vp->pts >= sp->pts + ((float) sp->sub.start_display_time / 1000)) {
+                if (!sp->uploaded) {
+                    uint8_t *pixels[4] = {nullptr};
+                    int pitch[4] = {0};
+                    int i;
+                    if (!sp->width || !sp->height) {
+                        sp->width = vp->width;
+                        sp->height = vp->height;
+                    }
+                    if (realloc_texture(&is->sub_texture, SDL_PIXELFORMAT_ARGB8888, sp->width, sp->height,
+                                        SDL_BLENDMODE_BLEND, 1) < 0)
+                        return;
+
+                    for (i = 0; i < sp->sub.num_rects; i++) {
+                        AVSubtitleRect *sub_rect = sp->sub.rects[i];
+
+                        sub_rect->x = av_clip(sub_rect->x, 0, sp->width);
+                        sub_rect->y = av_clip(sub_rect->y, 0, sp->height);
+                        sub_rect->w = av_clip(sub_rect->w, 0, sp->width - sub_rect->x);
+                        sub_rect->h = av_clip(sub_rect->h, 0, sp->height - sub_rect->y);
+
+                        if (!SDL_LockTexture(is->sub_texture, (SDL_Rect *) sub_rect, (void **) pixels, pitch)) {
+                            int ret = sws_convert_bands(is->sub_convert_ctx, sub_rect->w, sub_rect->h, AV_PIX_FMT_PAL8,
+                                                        (const uint8_t *const *) sub_rect->data, sub_rect->linesize,
+                                                        AV_PIX_FMT_BGRA, pixels, pitch, 0);
+                            SDL_UnlockTexture(is->sub_texture);
+                            if (ret < 0) {
+                                av_log(nullptr, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
+                                return;
+                            }
+                        }
+                    }
+                    sp->uploaded = 1;
+                }
+            } else
+                sp = nullptr;
+        }
+    }
+    // endregion
+
+    calculate_display_rect(&rect, is->xleft, is->ytop, is->width, is->height, vp->width, vp->height, vp->sar);
+    // 如果是重复显示上一帧，那么uploaded就是1
+    if (!vp->uploaded) {
+        // 渲染
+        if (upload_texture(&is->vid_texture, vp->frame, is->img_convert_ctx) < 0) {
+            return;
+        }
+        perf_frames_shown++;
+        vp->uploaded = 1;
+        vp->flip_v = vp->frame->linesize[0] < 0;
+    }
+
+    // region SDL_RenderCopyEx
+    set_sdl_yuv_conversion_mode(vp->frame);
+    SDL_RenderCopyEx(renderer, is->vid_texture, nullptr, &rect, 0, nullptr,
+                     static_cast<const SDL_RendererFlip>(vp->flip_v ? SDL_FLIP_VERTICAL : 0));
+    set_sdl_yuv_conversion_mode(nullptr);
+    // endregion
+
+    // region sp is null
+    if (sp) {
+#if USE_ONEPASS_SUBTITLE_RENDER
+        SDL_RenderCopy(renderer, is->sub_texture, nullptr, &rect);
+#else
+        int i;
+        double xratio = (double)rect.w / (double)sp->width;
+        double yratio = (double)rect.h / (double)sp->height;
+        for (i = 0; i < sp->sub.num_rects; i++) {
+            SDL_Rect *sub_rect = (SDL_Rect*)sp->sub.rects[i];
+            SDL_Rect target = {.x = rect.x + sub_rect->x * xratio,
+                               .y = rect.y + sub_rect->y * yratio,
+                               .w = sub_rect->w * xratio,
+                               .h = sub_rect->h * yratio};
+            SDL_RenderCopy(renderer, is->sub_texture, sub_rect, &target);
+        }
+#endif
+    }
+    // endregion
+}
+
+static inline int compute_mod(int a, int b) {
+    return a < 0 ? a % b + b : a % b;
+}
+
+typedef struct RdftJobs {
+    VideoState *s;
+    FFTSample **data;
+    int nb_freq;
+    int i_start;
+    int channels;
+} RdftJobs;
+
+// 一个声道的加窗和RDFT, 每个声道用自己的RDFTContext
+static int rdft_channel_job(void *priv, int ch, int nb_jobs) {
+    RdftJobs *rj = static_cast<RdftJobs *>(priv);
+    VideoState *s = rj->s;
+    FFTSample *data = rj->data[ch];
+    int i = rj->i_start + ch;
+
+    for (int x = 0; x < 2 * rj->nb_freq; x++) {
+        double w = (x - rj->nb_freq) * (1.0 / rj->nb_freq);
+        data[x] = s->sample_array[i] * (1.0 - w * w);
+        i += rj->channels;
+        if (i >= SAMPLE_ARRAY_SIZE)
+            i -= SAMPLE_ARRAY_SIZE;
+    }
+    av_rdft_calc(s->rdft[ch], data);
+    return 0;
+}
+
+static void video_audio_display(VideoState *s) {
+    int i, i_start, x, y1, y, ys, delay, n, nb_display_channels;
+    int ch, channels, h, h2;
+    int64_t time_diff;
+    int rdft_bits, nb_freq;
+
+    for (rdft_bits = 1; (1 << rdft_bits) < 2 * s->height; rdft_bits++);
+    nb_freq = 1 << (rdft_bits - 1);
+
+    /* compute display index : center on currently output samples */
+    channels = s->audio_tgt.channels;
+    nb_display_channels = channels;
+    if (!s->paused) {
+        int data_used = s->show_mode == VideoState::SHOW_MODE_WAVES ? s->width : (2 * nb_freq);
+        n = 2 * channels;
+        delay = s->audio_write_buf_size;
+        delay /= n;
+
+        /* to be more precise, we take into account the time spent since
+           the last buffer computation */
+        if (audio_callback_time) {
+            time_diff = av_gettime_relative() - audio_callback_time;
+            delay -= (time_diff * s->audio_tgt.freq) / 1000000;
+        }
+
+        delay += 2 * data_used;
+        if (delay < data_used)
+            delay = data_used;
+
+        i_start = x = compute_mod(s->sample_array_index - delay * channels, SAMPLE_ARRAY_SIZE);
+        if (s->show_mode == VideoState::SHOW_MODE_WAVES) {
+            h = INT_MIN;
+            for (i = 0; i < 1000; i += channels) {
+                int idx = (SAMPLE_ARRAY_SIZE + x - i) % SAMPLE_ARRAY_SIZE;
+                int a = s->sample_array[idx];
+                int b = s->sample_array[(idx + 4 * channels) % SAMPLE_ARRAY_SIZE];
+                int c = s->sample_array[(idx + 5 * channels) % SAMPLE_ARRAY_SIZE];
+                int d = s->sample_array[(idx + 9 * channels) % SAMPLE_ARRAY_SIZE];
+                int score = a - d;
+                if (h < score && (b ^ c) < 0) {
+                    h = score;
+                    i_start = idx;
+                }
+            }
+        }
+
+        s->last_i_start = i_start;
+    } else {
+        i_start = s->last_i_start;
+    }
+
+    if (s->show_mode == VideoState::SHOW_MODE_WAVES) {
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+
+        /* total height for one channel */
+        h = s->height / nb_display_channels;
+        /* graph height / 2 */
+        h2 = (h * 9) / 20;
+        for (ch = 0; ch < nb_display_channels; ch++) {
+            i = i_start + ch;
+            y1 = s->ytop + ch * h + (h / 2); /* position of center line */
+            for (x = 0; x < s->width; x++) {
+                y = (s->sample_array[i] * h2) >> 15;
+                if (y < 0) {
+                    y = -y;
+                    ys = y1 - y;
+                } else {
+                    ys = y1;
+                }
+                fill_rectangle(s->xleft + x, ys, 1, y);
+                i += channels;
+                if (i >= SAMPLE_ARRAY_SIZE)
+                    i -= SAMPLE_ARRAY_SIZE;
+            }
+        }
+
+        SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
+
+        for (ch = 1; ch < nb_display_channels; ch++) {
+            y = s->ytop + ch * h;
+            fill_rectangle(s->xleft, y, s->width, 1);
+        }
+    } else {
+        if (realloc_texture(&s->vis_texture, SDL_PIXELFORMAT_ARGB8888, s->width, s->height, SDL_BLENDMODE_NONE, 1) < 0)
+            return;
+
+        nb_display_channels = FFMIN(nb_display_channels, 2);
+        if (rdft_bits != s->rdft_bits) {
+            for (ch = 0; ch < 2; ch++) {
+                av_rdft_end(s->rdft[ch]);
+                s->rdft[ch] = av_rdft_init(rdft_bits, DFT_R2C);
+            }
+            av_free(s->rdft_data);
+            s->rdft_bits = rdft_bits;
+            s->rdft_data = static_cast<FFTSample *>(av_malloc_array(nb_freq, 4 * sizeof(*s->rdft_data)));
+        }
+        if (!s->rdft[0] || !s->rdft[1] || !s->rdft_data) {
+            av_log(nullptr, AV_LOG_ERROR, "Failed to allocate buffers for RDFT, switching to waves display\n");
+            s->show_mode = VideoState::SHOW_MODE_WAVES;
+        } else {
+            FFTSample *data[2];
+            RdftJobs rj = {s, data, nb_freq, i_start, channels};
+            SDL_Rect rect = {.x = s->xpos, .y = 0, .w = 1, .h = s->height};
+            uint32_t *pixels;
+            int pitch;
+            for (ch = 0; ch < nb_display_channels; ch++)
+                data[ch] = s->rdft_data + 2 * nb_freq * ch;
+            worker_pool_execute(rdft_channel_job, &rj, nullptr, nb_display_channels);
+            /* Least efficient way to do this, we should of course
+             * directly access it but it is more than fast enough. */
+            if (!SDL_LockTexture(s->vis_texture, &rect, (void **) &pixels, &pitch)) {
+                pitch >>= 2;
+                pixels += pitch * s->height;
+                for (y = 0; y < s->height; y++) {
+                    double w = 1 / sqrt(nb_freq);
+                    int a = sqrt(w * sqrt(data[0][2 * y + 0] * data[0][2 * y + 0] +
+                                          data[0][2 * y + 1] * data[0][2 * y + 1]));
+                    int b = (nb_display_channels == 2)
+                            ? sqrt(w * hypot(data[1][2 * y + 0], data[1][2 * y + 1]))
+                            : a;
+                    a = FFMIN(a, 255);
+                    b = FFMIN(b, 255);
+                    pixels -= pitch;
+                    *pixels = (a << 16) + (b << 8) + ((a + b) >> 1);
+                }
+                SDL_UnlockTexture(s->vis_texture);
+            }
+            SDL_RenderCopy(renderer, s->vis_texture, nullptr, nullptr);
+        }
+        if (!s->paused)
+            s->xpos++;
+        if (s->xpos >= s->width)
+            s->xpos = s->xleft;
+    }
+}
+
+static void avsync_init(AVSyncController *c, double dead_band) {
+    memset(c, 0, sizeof(AVSyncController));
+    c->kp = avsync_kp;
+    c->ki = avsync_ki;
+    c->max_correction = avsync_max_correction / 100.0;
+    c->dead_band = dead_band;
+    c->serial = -1;
+}
+
+static void avsync_reset(AVSyncController *c, int serial) {
+    c->error = 0;
+    c->integral = 0;
+    c->correction = 0;
+    c->serial = serial;
+    c->fast_lock = 1;
+    c->fast_lock_time = 0;
+    c->nb_resets++;
+}
+
+/* feed the A-V difference measured for a frame lasting dt seconds,
+ * return the wanted speed change as a fraction of the frame length */
+static double avsync_update(AVSyncController *c, double diff, double dt, int serial) {
+    double kp = c->kp;
+    double max_correction = c->max_correction;
+    double p_error, out;
+
+    if (serial != c->serial)
+        avsync_reset(c, serial);
+    if (isnan(diff) || fabs(diff) >= AV_NOSYNC_THRESHOLD) {
+        /* too big difference : may be initial PTS errors, so
+           start locking again once it is sane */
+        if (!c->fast_lock || c->fast_lock_time > 0)
+            avsync_reset(c, serial);
+        return 0;
+    }
+
+    if (c->fast_lock) {
+        c->error = diff;
+        kp *= AVSYNC_FAST_LOCK_GAIN;
+        max_correction = FFMAX(max_correction, AVSYNC_FAST_LOCK_CORRECTION_PERCENT_MAX / 100.0);
+        p_error = c->error;
+    } else {
+        c->error += AVSYNC_ERROR_SMOOTHING * (diff - c->error);
+        p_error = fabs(c->error) > c->dead_band ? c->error - copysign(c->dead_band, c->error) : 0;
+    }
+
+    out = kp * p_error + c->ki * c->integral;
+    /* anti-windup: stop integrating while the output is saturated */
+    if (fabs(out) < max_correction)
+        c->integral += c->error * dt;
+    out = av_clipd(out, -max_correction, max_correction);
+
+    if (c->fast_lock) {
+        c->fast_lock_time += dt;
+        if (fabs(c->error) < AVSYNC_LOCK_THRESHOLD || c->fast_lock_time >= AVSYNC_FAST_LOCK_MAX_TIME) {
+            c->fast_lock = 0;
+            c->lock_time = c->fast_lock_time;
+        }
+    }
+    c->correction = out;
+    c->nb_updates++;
+    return out;
+}
+
+static void print_avsync_stats(AVSyncController *c) {
+    av_log(nullptr, AV_LOG_VERBOSE,
+           "A-V sync: error=%0.4f integral=%0.5f correction=%0.4f lock_time=%0.3f updates=%" PRId64" resets=%" PRId64"\n",
+           c->error, c->integral, c->correction, c->lock_time, c->nb_updates, c->nb_resets);
+}
+
+/* run the A-V drift controller against a synthetic device with clock drift and
+ * measurement jitter, report convergence time and residual error */
+static void avsync_simulate(void) {
+    const int freq = 48000;
+    const int nb_samples = 1024;
+    const double sim_duration = 60.0;
+    const double seek_time = 30.0;
+    double drift = avsync_sim_drift / 1000000.0;
+    double jitter = avsync_sim_jitter / 1000.0;
+    double now = 0;
+    double audio_pts = 0.2;  /* audio starts 200 ms ahead of the master clock */
+    double phase_start = 0, locked_since = -1, lock_time = -1;
+    double sq_error = 0, max_error = 0;
+    int64_t nb_error = 0;
+    int serial = 1;
+    int phase = 1;
+    AVSyncController c;
+
+    srand(1);
+    avsync_init(&c, 0.02);
+    av_log(nullptr, AV_LOG_INFO, "A-V sync simulation: kp=%f ki=%f drift=%0.0fppm jitter=%0.1fms\n",
+           avsync_kp, avsync_ki, avsync_sim_drift, avsync_sim_jitter);
+    while (phase <= 2) {
+        double noise = jitter * ((double) rand() / RAND_MAX * 2.0 - 1.0);
+        double correction = avsync_update(&c, audio_pts - now + noise, (double) nb_samples / freq, serial);
+        int wanted_nb_samples = nb_samples + (int) lrint(nb_samples * correction);
+        double error;
+
+        /* the device plays the stretched frame at its own slightly wrong rate */
+        now += wanted_nb_samples / (freq * (1.0 + drift));
+        audio_pts += (double) nb_samples / freq;
+        error = audio_pts - now;
+
+        if (fabs(error) < AVSYNC_LOCK_THRESHOLD) {
+            if (locked_since < 0)
+                locked_since = now;
+            if (lock_time < 0 && now - locked_since >= 1.0)
+                lock_time = locked_since - phase_start;
+        } else {
+            locked_since = -1;
+        }
+        if (lock_time >= 0) {
+            sq_error += error * error;
+            max_error = FFMAX(max_error, fabs(error));
+            nb_error++;
+        }
+
+        if (now >= (phase == 1 ? seek_time : sim_duration)) {
+            av_log(nullptr, AV_LOG_INFO,
+                   "phase %d: convergence=%0.3fs residual rms=%0.2fms max=%0.2fms fast_lock=%0.3fs\n",
+                   phase, lock_time, nb_error ? sqrt(sq_error / nb_error) * 1000 : NAN, max_error * 1000,
+                   c.lock_time);
+            /* simulate a seek which leaves audio 150 ms behind */
+            serial++;
+            audio_pts -= 0.15;
+            phase_start = now;
+            locked_since = lock_time = -1;
+            sq_error = max_error = 0;
+            nb_error = 0;
+            phase++;
+        }
+    }
+}
+
+static void swr_apply_quality(struct SwrContext *swr_ctx) {
+    switch (resample_quality) {
+        case RESAMPLE_QUALITY_FAST:
+            av_opt_set_int(swr_ctx, "filter_size", 8, 0);
+            av_opt_set_int(swr_ctx, "phase_shift", 6, 0);
+            av_opt_set_int(swr_ctx, "linear_interp", 1, 0);
+            break;
+        case RESAMPLE_QUALITY_HIGH:
+            av_opt_set_int(swr_ctx, "filter_size", 64, 0);
+            av_opt_set_int(swr_ctx, "phase_shift", 12, 0);
+            av_opt_set_int(swr_ctx, "linear_interp", 0, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+/* return a resampler converting the given source format to is->audio_tgt,
+ * reusing a cached one when the same conversion was needed before */
+static struct SwrContext *swr_cache_get(VideoState *is,
+                                        int64_t src_channel_layout, enum AVSampleFormat src_fmt, int src_freq) {
+    SwrCacheEntry *entry = nullptr;
+    int i;
+
+    for (i = 0; i < SWR_CACHE_SIZE; i++) {
+        SwrCacheEntry *e = &is->swr_cache[i];
+        if (e->swr_ctx &&
+            e->src_channel_layout == src_channel_layout &&
+            e->src_fmt == src_fmt &&
+            e->src_freq == src_freq &&
+            e->tgt_channel_layout == is->audio_tgt.channel_layout &&
+            e->tgt_fmt == is->audio_tgt.fmt &&
+            e->tgt_freq == is->audio_tgt.freq) {
+            // 上次用完时里面还缓存着旧片段的尾巴(滤波器延迟和补偿状态), 重新init清掉, 否则会混进新的片段
+            if (swr_init(e->swr_ctx) < 0) {
+                swr_free(&e->swr_ctx);
+                break;
+            }
+            e->last_used = av_gettime_relative();
+            is->swr_cache_hits++;
+            return e->swr_ctx;
+        }
+    }
+
+    /* take a free slot, otherwise evict the least recently used one */
+    for (i = 0; i < SWR_CACHE_SIZE; i++) {
+        SwrCacheEntry *e = &is->swr_cache[i];
+        if (!e->swr_ctx) {
+            entry = e;
+            break;
+        }
+        if (!entry || e->last_used < entry->last_used)
+            entry = e;
+    }
+    swr_free(&entry->swr_ctx);
+    is->swr_cache_misses++;
+
+    entry->swr_ctx = swr_alloc_set_opts(nullptr,
+                                        is->audio_tgt.channel_layout, is->audio_tgt.fmt, is->audio_tgt.freq,
+                                        src_channel_layout, src_fmt, src_freq,
+                                        0, nullptr);
+    if (!entry->swr_ctx)
+        return nullptr;
+    swr_apply_quality(entry->swr_ctx);
+    if (swr_init(entry->swr_ctx) < 0) {
+        swr_free(&entry->swr_ctx);
+        return nullptr;
+    }
+    entry->src_channel_layout = src_channel_layout;
+    entry->src_fmt = src_fmt;
+    entry->src_freq = src_freq;
+    entry->tgt_channel_layout = is->audio_tgt.channel_layout;
+    entry->tgt_fmt = is->audio_tgt.fmt;
+    entry->tgt_freq = is->audio_tgt.freq;
+    entry->last_used = av_gettime_relative();
+    return entry->swr_ctx;
+}
+
+static void swr_cache_free(VideoState *is) {
+    av_log(nullptr, AV_LOG_VERBOSE, "Resampler cache: %d hits, %d misses\n",
+           is->swr_cache_hits, is->swr_cache_misses);
+    for (int i = 0; i < SWR_CACHE_SIZE; i++)
+        swr_free(&is->swr_cache[i].swr_ctx);
+    is->swr_ctx = nullptr;
+}
+
+static void audio_push_stop(VideoState *is) {
+    if (!is->audio_push_tid)
+        return;
+    is->audio_push_abort = 1;
+    SDL_WaitThread(is->audio_push_tid, nullptr);
+    is->audio_push_tid = nullptr;
+    SDL_ClearQueuedAudio(audio_dev);
+}
+
+static void stream_component_close(VideoState *is, int stream_index) {
+    AVFormatContext *ic = is->ic;
+    AVCodecParameters *codecpar;
+
+    if (stream_index < 0 || stream_index >= ic->nb_streams)
+        return;
+    codecpar = ic->streams[stream_index]->codecpar;
+    /* held packets belong to the stream being closed */
+    if (is->jitbuf_enabled)
+        jitter_buffer_flush(is, 0);
+
+    switch (codecpar->codec_type) {
+        case AVMEDIA_TYPE_AUDIO:
+            decoder_abort(&is->auddec, &is->sampq);
+            audio_push_stop(is);
+            SDL_CloseAudioDevice(audio_dev);
+            /* the callback thread is gone, its last sample is final */
+            if (is->audio_cb_cpu_time >= 0) {
+                thread_role_add_time(THREAD_ROLE_AUDIO, is->audio_cb_cpu_time);
+                is->audio_cb_cpu_time = -1;
+            }
+            decoder_destroy(&is->auddec);
+            print_avsync_stats(&is->avsync);
+            swr_cache_free(is);
+            av_freep(&is->audio_buf1);
+            is->audio_buf1_size = 0;
+            is->audio_buf = nullptr;
+
+            if (is->rdft[0] || is->rdft[1]) {
+                for (int ch = 0; ch < 2; ch++) {
+                    av_rdft_end(is->rdft[ch]);
+                    is->rdft[ch] = nullptr;
+                }
+                av_freep(&is->rdft_data);
+                is->rdft_bits = 0;
+            }
+            break;
+        case AVMEDIA_TYPE_VIDEO:
+            decoder_abort(&is->viddec, &is->pictq);
+            decoder_destroy(&is->viddec);
+            thread_budget_resize(&is->vtune.reserved, 0);
+            break;
+        case AVMEDIA_TYPE_SUBTITLE:
+            decoder_abort(&is->subdec, &is->subpq);
+            decoder_destroy(&is->subdec);
+            break;
+        default:
+            break;
+    }
+
+    ic->streams[stream_index]->discard = AVDISCARD_ALL;
+    switch (codecpar->codec_type) {
+        case AVMEDIA_TYPE_AUDIO:
+            is->audio_st = nullptr;
+            is->audio_stream = -1;
+            break;
+        case AVMEDIA_TYPE_VIDEO:
+            is->video_st = nullptr;
+            is->video_stream = -1;
+            break;
+        case AVMEDIA_TYPE_SUBTITLE:
+            is->subtitle_st = nullptr;
+            is->subtitle_stream = -1;
+            break;
+        default:
+            break;
+    }
+}
+
+// 池里没有空闲缓冲时分配新的, 数据前面留出一个对齐单位记录大小, 释放时更新统计
+static void frame_pool_buffer_free(void *opaque, uint8_t *data) {
+    FrameAllocator *fa = static_cast<FrameAllocator *>(opaque);
+    uint8_t *ptr = data - FRAME_POOL_ALIGN;
+    int size;
+
+    memcpy(&size, ptr, sizeof(size));
+    pthread_mutex_lock(&fa->stats_mutex);
+    fa->cur_bytes -= size;
+    pthread_mutex_unlock(&fa->stats_mutex);
+    free(ptr);
+}
+
+static AVBufferRef *frame_pool_buffer_alloc(void *opaque, int size) {
+    FrameAllocator *fa = static_cast<FrameAllocator *>(opaque);
+    size_t total = (size_t) size + FRAME_POOL_ALIGN;
+    int huge = fa->use_thp && size >= FRAME_POOL_HUGE_PAGE;
+    void *ptr = nullptr;
+    AVBufferRef *buf;
+
+    if (posix_memalign(&ptr, huge ? FRAME_POOL_HUGE_PAGE : FRAME_POOL_ALIGN, total))
+        return nullptr;
+#ifdef MADV_HUGEPAGE
+    if (huge && madvise(ptr, total, MADV_HUGEPAGE) < 0)
+        huge = 0;
+#else
+    huge = 0;
+#endif
+    memcpy(ptr, &size, sizeof(size));
+    buf = av_buffer_create(static_cast<uint8_t *>(ptr) + FRAME_POOL_ALIGN, size, frame_pool_buffer_free, fa, 0);
+    if (!buf) {
+        free(ptr);
+        return nullptr;
+    }
+
+    pthread_mutex_lock(&fa->stats_mutex);
+    fa->nb_allocs++;
+    fa->nb_huge += huge;
+    fa->cur_bytes += size;
+    fa->peak_bytes = FFMAX(fa->peak_bytes, fa->cur_bytes);
+    pthread_mutex_unlock(&fa->stats_mutex);
+    return buf;
+}
+
+// 从大小相同的池中取一个缓冲, 没有这个大小的池时替换最久没用的池
+static AVBufferRef *frame_pool_get(FrameAllocator *fa, int size) {
+    FramePoolEntry *entry = nullptr;
+    FramePoolEntry *lru = nullptr;
+    AVBufferRef *buf;
+
+    pthread_mutex_lock(&fa->pmutex);
+    fa->tick++;
+    for (int i = 0; i < FRAME_POOL_NB; i++) {
+        FramePoolEntry *e = &fa->pools[i];
+        if (e->pool && e->size == size) {
+            entry = e;
+            break;
+        }
+        if (!lru || (lru->pool && (!e->pool || e->last_used < lru->last_used)))
+            lru = e;
+    }
+    if (!entry) {
+        entry = lru;
+        if (entry->pool) {
+            /* buffers still in use keep the old pool alive until they are returned */
+            av_log(nullptr, AV_LOG_DEBUG, "frame pool: dropping the pool of %d byte buffers\n", entry->size);
+            av_buffer_pool_uninit(&entry->pool);
+            fa->nb_pools_evicted++;
+        }
+        if (!(entry->pool = av_buffer_pool_init2(size, fa, frame_pool_buffer_alloc, nullptr))) {
+            pthread_mutex_unlock(&fa->pmutex);
+            return nullptr;
+        }
+        av_log(nullptr, AV_LOG_DEBUG, "frame pool: new pool of %d byte buffers\n", size);
+        entry->size = size;
+        fa->nb_pools_created++;
+    }
+    entry->last_used = fa->tick;
+    if ((buf = av_buffer_pool_get(entry->pool)))
+        fa->nb_gets++;
+    pthread_mutex_unlock(&fa->pmutex);
+    return buf;
+}
+
+static int frame_pool_video_buffer(FrameAllocator *fa, AVCodecContext *avctx, AVFrame *frame) {
+    AVPixelFormat format = static_cast<AVPixelFormat>(frame->format);
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    uint8_t *data[4] = {nullptr};
+    int linesize[4];
+    int w = frame->width;
+    int h = frame->height;
+    int size;
+
+    if (!desc || desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL) || w <= 0 || h <= 0)
+        return AVERROR(ENOSYS);
+    avcodec_align_dimensions2(avctx, &w, &h, linesize_align);
+    if (av_image_fill_linesizes(linesize, format, w) < 0)
+        return AVERROR(ENOSYS);
+    // 行宽对齐到FRAME_POOL_ALIGN, 上传纹理和SIMD都能按整行处理, 也满足解码器要求的对齐
+    for (int i = 0; i < 4; i++)
+        linesize[i] = FFALIGN(linesize[i], FRAME_POOL_ALIGN);
+    // ptr为空时data中是各平面相对于第一个平面的偏移
+    if ((size = av_image_fill_pointers(data, format, h, nullptr, linesize)) < 0)
+        return AVERROR(ENOSYS);
+
+    for (int i = 0; i < 4 && linesize[i]; i++) {
+        int start = static_cast<int>(data[i] - data[0]);
+        int end = i < 3 && linesize[i + 1] ? static_cast<int>(data[i + 1] - data[0]) : size;
+        /* some decoders read or write a little past the last line, like the default allocator allows */
+        if (!(frame->buf[i] = frame_pool_get(fa, end - start + 16 + FRAME_POOL_ALIGN - 1))) {
+            for (int j = 0; j < i; j++)
+                av_buffer_unref(&frame->buf[j]);
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+        frame->linesize[i] = linesize[i];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+static int frame_pool_audio_buffer(FrameAllocator *fa, AVCodecContext *avctx, AVFrame *frame) {
+    AVSampleFormat format = static_cast<AVSampleFormat>(frame->format);
+    int channels = frame->channels ? frame->channels : avctx->channels;
+    int nb_planes = av_sample_fmt_is_planar(format) ? channels : 1;
+    int linesize;
+
+    /* more planes than data[] has would need extended_buf, leave those to the default allocator */
+    if (channels <= 0 || nb_planes > AV_NUM_DATA_POINTERS)
+        return AVERROR(ENOSYS);
+    if (av_samples_get_buffer_size(&linesize, channels, frame->nb_samples, format, FRAME_POOL_ALIGN) < 0)
+        return AVERROR(ENOSYS);
+    linesize = FFALIGN(linesize, FRAME_POOL_AUDIO_GRANULE);
+
+    for (int i = 0; i < nb_planes; i++) {
+        if (!(frame->buf[i] = frame_pool_get(fa, linesize))) {
+            for (int j = 0; j < i; j++)
+                av_buffer_unref(&frame->buf[j]);
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+    }
+    frame->linesize[0] = linesize;
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+// 视频和音频解码器的get_buffer2, 硬件解码, 调色板格式和不支持直接渲染的解码器仍用默认分配器
+static int frame_pool_get_buffer2(AVCodecContext *avctx, AVFrame *frame, int flags) {
+    FrameAllocator *fa = static_cast<FrameAllocator *>(avctx->opaque);
+    int ret = AVERROR(ENOSYS);
+
+    /* a hardware-backed decoder is told apart by its context, the frame has no hw_frames_ctx yet */
+    if ((avctx->codec->capabilities & AV_CODEC_CAP_DR1) && !avctx->hw_frames_ctx && !avctx->hw_device_ctx) {
+        if (avctx->codec_type == AVMEDIA_TYPE_VIDEO)
+            ret = frame_pool_video_buffer(fa, avctx, frame);
+        else if (avctx->codec_type == AVMEDIA_TYPE_AUDIO)
+            ret = frame_pool_audio_buffer(fa, avctx, frame);
+    }
+    if (ret == AVERROR(ENOSYS)) {
+        pthread_mutex_lock(&fa->pmutex);
+        fa->nb_fallbacks++;
+        pthread_mutex_unlock(&fa->pmutex);
+        return avcodec_default_get_buffer2(avctx, frame, flags);
+    }
+    return ret;
+}
+
+static void frame_pool_init(FrameAllocator *fa) {
+    fa->pmutex = PTHREAD_MUTEX_INITIALIZER;
+    fa->stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+    fa->use_thp = frame_pool_thp;
+}
+
+static void frame_pool_report(FrameAllocator *fa, const char *name, int level) {
+    int nb_pools = 0;
+
+    pthread_mutex_lock(&fa->pmutex);
+    pthread_mutex_lock(&fa->stats_mutex);
+    for (int i = 0; i < FRAME_POOL_NB; i++)
+        nb_pools += !!fa->pools[i].pool;
+    if (fa->nb_gets || fa->nb_fallbacks)
+        av_log(nullptr, level,
+               "frame pool %s: gets=%" PRId64" allocs=%" PRId64" reuse=%0.1f%% fallbacks=%" PRId64
+               " pools=%d created=%" PRId64" evicted=%" PRId64" huge=%" PRId64" peak=%0.1fMiB\n",
+               name, fa->nb_gets, fa->nb_allocs,
+               fa->nb_gets ? 100.0 * (fa->nb_gets - fa->nb_allocs) / fa->nb_gets : 0.0,
+               fa->nb_fallbacks, nb_pools, fa->nb_pools_created, fa->nb_pools_evicted, fa->nb_huge,
+               fa->peak_bytes / (1024.0 * 1024.0));
+    pthread_mutex_unlock(&fa->stats_mutex);
+    pthread_mutex_unlock(&fa->pmutex);
+}
+
+// 所有帧都已归还后调用, 否则最后归还的缓冲会访问已经释放的统计
+static void frame_pool_destroy(FrameAllocator *fa) {
+    for (int i = 0; i < FRAME_POOL_NB; i++)
+        av_buffer_pool_uninit(&fa->pools[i].pool);
+    pthread_mutex_destroy(&fa->pmutex);
+    pthread_mutex_destroy(&fa->stats_mutex);
+}
+
+static void present_scheduler_init(PresentScheduler *ps) {
+    SDL_DisplayMode mode;
+
+    memset(ps, 0, sizeof(PresentScheduler));
+    ps->last_vsync = NAN;
+    ps->last_frame_vsync = NAN;
+    ps->frame_slot = NAN;
+    ps->period = NAN;
+    if (!present_sched || !renderer || !(renderer_info.flags & SDL_RENDERER_PRESENTVSYNC))
+        return;
+    /* a first guess, refined by the present timestamps */
+    if (window && !SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) && mode.refresh_rate > 0)
+        ps->period = 1.0 / mode.refresh_rate;
+    ps->enabled = 1;
+}
+
+/* the vblank a frame presented at time would appear at */
+static double present_next_vsync(PresentScheduler *ps, double time) {
+    if (!ps->enabled || isnan(ps->period) || isnan(ps->last_vsync) || time < ps->last_vsync)
+        return time;
+    return ps->last_vsync + ceil((time - ps->last_vsync) / ps->period) * ps->period;
+}
+
+/* return how long to wait before a frame due at target should be presented,
+ * frames go to the vblank nearest to their due time */
+static double present_time_until_due(PresentScheduler *ps, double target, double time) {
+    double slot;
+
+    if (!ps->enabled || isnan(ps->period) || isnan(ps->last_vsync))
+        return target - time;
+    if (target <= present_next_vsync(ps, time) + ps->period / 2)
+        return 0;
+    /* wake up right after the vblank preceding the wanted slot */
+    slot = present_next_vsync(ps, target - ps->period / 2);
+    return FFMAX(slot - ps->period - time, 0.001);
+}
+
+static void present_scheduler_report(PresentScheduler *ps, int level) {
+    if (!ps->enabled)
+        return;
+    av_log(nullptr, level,
+           "present: period=%0.3fms (%0.2fHz) frames=%" PRId64" missed=%" PRId64
+           " cadence 1:%" PRId64" 2:%" PRId64" 3:%" PRId64" 4+:%" PRId64"\n",
+           ps->period * 1000, 1.0 / ps->period, ps->nb_frames, ps->nb_missed,
+           ps->cadence[1], ps->cadence[2], ps->cadence[3], ps->cadence[4]);
+}
+
+/* called right after SDL_RenderPresent, which returns at a vblank with vsync on */
+static void present_scheduler_update(PresentScheduler *ps) {
+    double time = av_gettime_relative() / 1000000.0;
+    double interval = time - ps->last_vsync;
+
+    if (!ps->enabled)
+        return;
+    if (!isnan(interval) && interval >= PRESENT_PERIOD_MIN) {
+        /* presents may skip vblanks, divide by the number of periods that passed */
+        int nb_periods = isnan(ps->period) ? 1 : FFMAX(1, (int) lrint(interval / ps->period));
+        double sample = interval / nb_periods;
+        if (sample >= PRESENT_PERIOD_MIN && sample <= PRESENT_PERIOD_MAX &&
+            (isnan(ps->period) || fabs(sample - ps->period) < ps->period / 4)) {
+            ps->period = isnan(ps->period) ? sample : ps->period + PRESENT_PERIOD_SMOOTHING * (sample - ps->period);
+            ps->nb_period_samples++;
+        }
+    }
+    ps->last_vsync = time;
+
+    if (!isnan(ps->frame_slot)) {
+        ps->nb_frames++;
+        if (!isnan(ps->period)) {
+            if (time > ps->frame_slot + ps->period / 2)
+                ps->nb_missed++;
+            if (!isnan(ps->last_frame_vsync)) {
+                int nb_periods = (int) lrint((time - ps->last_frame_vsync) / ps->period);
+                ps->cadence[av_clip(nb_periods, 1, PRESENT_CADENCE_MAX)]++;
+            }
+        }
+        ps->last_frame_vsync = time;
+        ps->frame_slot = NAN;
+    }
+    if (time - ps->last_report >= 1.0) {
+        present_scheduler_report(ps, AV_LOG_DEBUG);
+        ps->last_report = time;
+    }
+}
+
+/* wake the video refresh up early, from the decoder and read threads */
+static void refresh_wakeup(VideoState *is) {
+    SDL_Event event;
+
+    if (is->render_tid) {
+        SDL_SemPost(is->render_wakeup);
+    } else if (SDL_AtomicCAS(&is->wakeup_pending, 0, 1)) {
+        event.type = FF_WAKEUP_EVENT;
+        event.user.data1 = is;
+        SDL_PushEvent(&event);
+    }
+}
+
+static void refresh_count_wakeup(VideoState *is, int idle) {
+    double time = av_gettime_relative() / 1000000.0;
+
+    if (!is->wakeup_start_time)
+        is->wakeup_start_time = is->wakeup_report_time = time;
+    is->nb_wakeups++;
+    is->wakeups_window++;
+    if (idle) {
+        is->nb_idle_wakeups++;
+        is->idle_wakeups_window++;
+    }
+    if (time - is->wakeup_report_time >= 1.0) {
+        av_log(nullptr, AV_LOG_DEBUG, "refresh: wakeups=%0.1f/s idle=%0.1f/s\n",
+               is->wakeups_window / (time - is->wakeup_report_time),
+               is->idle_wakeups_window / (time - is->wakeup_report_time));
+        is->wakeups_window = is->idle_wakeups_window = 0;
+        is->wakeup_report_time = time;
+    }
+}
+
+static void refresh_report_wakeups(VideoState *is) {
+    double elapsed = av_gettime_relative() / 1000000.0 - is->wakeup_start_time;
+
+    if (!is->wakeup_start_time || elapsed <= 0)
+        return;
+    av_log(nullptr, AV_LOG_VERBOSE, "refresh: wakeups=%" PRId64" (%0.1f/s) idle=%" PRId64" (%0.1f/s)\n",
+           is->nb_wakeups, is->nb_wakeups / elapsed, is->nb_idle_wakeups, is->nb_idle_wakeups / elapsed);
+}
+
+static void render_thread_stop(VideoState *is) {
+    if (is->render_tid) {
+        is->render_abort = 1;
+        SDL_SemPost(is->render_wakeup);
+        SDL_WaitThread(is->render_tid, nullptr);
+        is->render_tid = nullptr;
+    }
+    if (is->render_wakeup) {
+        SDL_DestroySemaphore(is->render_wakeup);
+        is->render_wakeup = nullptr;
+    }
+    av_log(nullptr, AV_LOG_VERBOSE,
+           "render: commands=%" PRId64" dropped=%" PRId64" input latency avg=%0.1fms max=%dms deadline misses=%" PRId64"\n",
+           is->nb_render_commands, is->nb_render_commands_dropped,
+           is->nb_render_commands ? (double) is->render_latency_sum / is->nb_render_commands : 0.0,
+           is->render_latency_max, is->frame_deadline_misses);
+}
+
+static void seek_stats_report(SeekStats *ss, int level) {
+    if (!ss->nb_requests)
+        return;
+    av_log(nullptr, level, "seek requests=%" PRId64" coalesced=%" PRId64" cancelled=%" PRId64
+           " interrupted reads=%" PRId64"\n", ss->nb_requests, ss->nb_coalesced, ss->nb_cancelled,
+           ss->nb_reads_interrupted);
+    if (!ss->nb_hits && !ss->nb_misses)
+        return;
+    av_log(nullptr, level,
+           "seeks: buffer hits=%" PRId64" (%0.1f%%) latency hit=%0.1f/%0.1fms miss=%0.1f/%0.1fms (avg/max)\n",
+           ss->nb_hits, 100.0 * ss->nb_hits / (ss->nb_hits + ss->nb_misses),
+           ss->nb_hits ? ss->hit_time / 1000.0 / ss->nb_hits : 0.0, ss->max_hit_time / 1000.0,
+           ss->nb_misses ? ss->miss_time / 1000.0 / ss->nb_misses : 0.0, ss->max_miss_time / 1000.0);
+}
+
+static int reverse_interrupt_cb(void *ctx) {
+    ReversePlayer *rp = static_cast<ReversePlayer *>(ctx);
+    return rp->abort_request;
+}
+
+static void reverse_frame_free(ReverseFrame **prf) {
+    ReverseFrame *rf = *prf;
+
+    if (!rf)
+        return;
+    av_frame_free(&rf->frame);
+    av_freep(prf);
+}
+
+static void reverse_flush(ReversePlayer *rp) {
+    ReverseFrame *rf, *next;
+
+    pthread_mutex_lock(&rp->pmutex);
+    for (rf = rp->first; rf; rf = next) {
+        next = rf->next;
+        reverse_frame_free(&rf);
+    }
+    rp->first = rp->last = nullptr;
+    rp->queued_size = 0;
+    pthread_mutex_unlock(&rp->pmutex);
+}
+
+// 第一次倒放时打开自己的demuxer, 只读视频流; 解码器每次按viddec当前的设置重新打开
+static int reverse_open(VideoState *is) {
+    ReversePlayer *rp = &is->rev;
+    AVCodecContext *src = is->viddec.avctx;
+    AVCodecParameters *par;
+    int ret;
+
+    if (!rp->ic) {
+        AVFormatContext *ic = avformat_alloc_context();
+        if (!ic)
+            return AVERROR(ENOMEM);
+        ic->interrupt_callback.callback = reverse_interrupt_cb;
+        ic->interrupt_callback.opaque = rp;
+        /* avformat_open_input frees ic when it fails */
+        if ((ret = avformat_open_input(&ic, is->filename, is->iformat, nullptr)) < 0)
+            return ret;
+        if (ic->nb_streams <= (unsigned) is->video_stream && (ret = avformat_find_stream_info(ic, nullptr)) < 0) {
+            avformat_close_input(&ic);
+            return ret;
+        }
+        rp->ic = ic;
+    }
+    if ((unsigned) is->video_stream >= rp->ic->nb_streams)
+        return AVERROR_STREAM_NOT_FOUND;
+    par = rp->ic->streams[is->video_stream]->codecpar;
+    if (par->codec_type != AVMEDIA_TYPE_VIDEO || par->codec_id != src->codec_id)
+        return AVERROR_STREAM_NOT_FOUND;
+    for (unsigned i = 0; i < rp->ic->nb_streams; i++)
+        rp->ic->streams[i]->discard = (int) i == is->video_stream ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    return codec_context_clone(&rp->avctx, src, src->lowres, src->thread_count,
+                               thread_type_name(src->active_thread_type));
+}
+
+// 按pts插到段里, 解码器基本按显示顺序出帧, 大多数时候接在最后
+static void reverse_segment_insert(ReverseFrame **pfirst, ReverseFrame **plast, ReverseFrame *rf) {
+    ReverseFrame **prf;
+
+    if (!*plast || (*plast)->ts <= rf->ts) {
+        if (*plast)
+            (*plast)->next = rf;
+        else
+            *pfirst = rf;
+        *plast = rf;
+        return;
+    }
+    for (prf = pfirst; (*prf)->ts <= rf->ts; prf = &(*prf)->next);
+    rf->next = *prf;
+    *prf = rf;
+}
+
+// 解码end之前的一段: seek到end之前最近的关键帧, 解到解码器输出end或之后的帧为止, 只留最后不超过缓存一半的帧.
+// GOP比缓存的一半大时, 下一段再从同一个关键帧解到这一段的开头. *seg_start返回这一段最早的帧, 不小于end表示到了开头
+static int reverse_decode_segment(VideoState *is, AVFrame *frame, int64_t end, int64_t *seg_start) {
+    ReversePlayer *rp = &is->rev;
+    AVStream *st = rp->ic->streams[is->video_stream];
+    AVPacket pkt1, *pkt = &pkt1;
+    ReverseFrame *first = nullptr, *last = nullptr, *rf, *prev, *next;
+    int64_t key_ts = AV_NOPTS_VALUE, segment_size = 0;
+    int eof = 0, done = 0, ret;
+
+    *seg_start = end;
+    if ((ret = av_seek_frame(rp->ic, is->video_stream, end - 1, AVSEEK_FLAG_BACKWARD)) < 0)
+        return ret;
+    avcodec_flush_buffers(rp->avctx);
+    while (!done && !rp->abort_request) {
+        if (!eof) {
+            if ((ret = av_read_frame(rp->ic, pkt)) < 0) {
+                eof = 1;
+            } else if (pkt->stream_index != is->video_stream) {
+                av_packet_unref(pkt);
+                continue;
+            } else if (key_ts == AV_NOPTS_VALUE) {
+                /* some demuxers land before the keyframe */
+                if (!(pkt->flags & AV_PKT_FLAG_KEY)) {
+                    av_packet_unref(pkt);
+                    continue;
+                }
+                key_ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+                if (key_ts == AV_NOPTS_VALUE || key_ts >= end) {
+                    /* no keyframe before end: this is the start of the stream */
+                    av_packet_unref(pkt);
+                    break;
+                }
             }
+        }
+        if (key_ts == AV_NOPTS_VALUE)
             break;
-        default:
-            if (frame->linesize[0] < 0) {
-                ret = SDL_UpdateTexture(*tex, nullptr, frame->data[0] + frame->linesize[0] * (frame->height - 1),
-                                        -frame->linesize[0]);
-            } else {
-                ret = SDL_UpdateTexture(*tex, nullptr, frame->data[0], frame->linesize[0]);
+        ret = avcodec_send_packet(rp->avctx, eof ? nullptr : pkt);
+        if (!eof)
+            av_packet_unref(pkt);
+        if (ret < 0 && ret != AVERROR_EOF)
+            continue;
+        while ((ret = avcodec_receive_frame(rp->avctx, frame)) >= 0) {
+            int64_t ts = frame->best_effort_timestamp;
+
+            rp->nb_decoded_frames++;
+            /* leading pictures of an open GOP belong to the segment before */
+            if (ts == AV_NOPTS_VALUE || ts < key_ts || ts >= end) {
+                /* frames come out in presentation order, nothing before end follows */
+                if (ts != AV_NOPTS_VALUE && ts >= end)
+                    done = 1;
+                av_frame_unref(frame);
+                continue;
+            }
+            if (!(rf = static_cast<ReverseFrame *>(av_mallocz(sizeof(ReverseFrame)))) ||
+                !(rf->frame = av_frame_alloc())) {
+                av_freep(&rf);
+                av_frame_unref(frame);
+                ret = AVERROR(ENOMEM);
+                goto end;
             }
+            frame->sample_aspect_ratio = av_guess_sample_aspect_ratio(rp->ic, st, frame);
+            rf->ts = ts;
+            rf->pts = ts * av_q2d(st->time_base);
+            rf->size = FFMAX(av_image_get_buffer_size((AVPixelFormat) frame->format, frame->width,
+                                                      frame->height, 1), 0);
+            av_frame_move_ref(rf->frame, frame);
+            reverse_segment_insert(&first, &last, rf);
+            segment_size += rf->size;
+            /* keep the latest frames, the ones before are decoded again for the next segment */
+            while (segment_size > rp->max_size / 2 && first != last) {
+                rf = first;
+                first = rf->next;
+                segment_size -= rf->size;
+                reverse_frame_free(&rf);
+            }
+        }
+        if (ret == AVERROR_EOF)
             break;
     }
+    ret = rp->abort_request ? AVERROR_EXIT : 0;
+    if (!first) {
+        if (key_ts != AV_NOPTS_VALUE && key_ts < end)
+            *seg_start = key_ts;
+        goto end;
+    }
+    *seg_start = first->ts;
+
+    /* the cache wants decreasing pts */
+    for (prev = nullptr, rf = first; rf; rf = next) {
+        next = rf->next;
+        rf->next = prev;
+        prev = rf;
+    }
+    pthread_mutex_lock(&rp->pmutex);
+    if (rp->last)
+        rp->last->next = last;
+    else
+        rp->first = last;
+    rp->last = first;
+    rp->queued_size += segment_size;
+    pthread_cond_signal(&rp->pcond);
+    pthread_mutex_unlock(&rp->pmutex);
+    return ret;
+
+    end:
+    for (rf = first; rf; rf = next) {
+        next = rf->next;
+        reverse_frame_free(&rf);
+    }
     return ret;
 }
 
-static void set_sdl_yuv_conversion_mode(AVFrame *frame) {
-#if SDL_VERSION_ATLEAST(2, 0, 8)
-    SDL_YUV_CONVERSION_MODE mode = SDL_YUV_CONVERSION_AUTOMATIC;
-    if (frame && (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUYV422 ||
-                  frame->format == AV_PIX_FMT_UYVY422)) {
-        if (frame->color_range == AVCOL_RANGE_JPEG)
-            mode = SDL_YUV_CONVERSION_JPEG;
-        else if (frame->colorspace == AVCOL_SPC_BT709)
-            mode = SDL_YUV_CONVERSION_BT709;
-        else if (frame->colorspace == AVCOL_SPC_BT470BG || frame->colorspace == AVCOL_SPC_SMPTE170M ||
-                 frame->colorspace == AVCOL_SPC_SMPTE240M)
-            mode = SDL_YUV_CONVERSION_BT601;
+// 倒放的解码线程: 缓存里的帧少于一半时解码前一段, 显示的同时准备好更早的一段
+static int reverse_thread(void *arg) {
+    VideoState *is = static_cast<VideoState *>(arg);
+    ReversePlayer *rp = &is->rev;
+    AVFrame *frame = av_frame_alloc();
+    int64_t end, seg_start, start;
+    int ret;
+
+    if (!frame) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
     }
-    SDL_SetYUVConversionMode(mode);
-#endif
+    if ((ret = reverse_open(is)) < 0)
+        goto fail;
+    end = llrint(rp->start_pts / av_q2d(rp->ic->streams[is->video_stream]->time_base));
+    for (;;) {
+        pthread_mutex_lock(&rp->pmutex);
+        while (!rp->abort_request && rp->queued_size > rp->max_size / 2)
+            pthread_cond_wait(&rp->pcond, &rp->pmutex);
+        pthread_mutex_unlock(&rp->pmutex);
+        if (rp->abort_request)
+            break;
+
+        start = av_gettime_relative();
+        ret = reverse_decode_segment(is, frame, end, &seg_start);
+        rp->decode_time += av_gettime_relative() - start;
+        rp->nb_segments++;
+        if (ret < 0 || seg_start >= end)
+            break;
+        end = seg_start;
+    }
+
+    fail:
+    if (ret < 0 && ret != AVERROR_EXIT)
+        av_log(nullptr, AV_LOG_WARNING, "Reverse playback stopped: %s\n", av_err2str(ret));
+    av_frame_free(&frame);
+    pthread_mutex_lock(&rp->pmutex);
+    rp->eof = 1;
+    pthread_cond_signal(&rp->pcond);
+    pthread_mutex_unlock(&rp->pmutex);
+    return 0;
 }
 
-static void video_image_display(VideoState *is) {
-    Frame *vp = nullptr;
-    Frame *sp = nullptr;
-    SDL_Rect rect;
-    // 取要显示的视频帧
-    vp = frame_queue_peek_last(&is->pictq);
+static void reverse_thread_stop(ReversePlayer *rp) {
+    if (!rp->tid)
+        return;
+    pthread_mutex_lock(&rp->pmutex);
+    rp->abort_request = 1;
+    pthread_cond_signal(&rp->pcond);
+    pthread_mutex_unlock(&rp->pmutex);
+    SDL_WaitThread(rp->tid, nullptr);
+    rp->tid = nullptr;
+    avcodec_free_context(&rp->avctx);
+}
 
-    // region is->subtitle_st
-    if (is->subtitle_st) {
-        if (frame_queue_nb_remaining(&is->subpq) > 0) {
-            sp = frame_queue_peek(&is->subpq);
+static void reverse_destroy(ReversePlayer *rp, int level) {
+    reverse_thread_stop(rp);
+    reverse_flush(rp);
+    av_frame_free(&rp->shown.frame);
+    if (rp->ic)
+        avformat_close_input(&rp->ic);
+    if (!rp->nb_segments)
+        return;
+    av_log(nullptr, level, "reverse: segments=%" PRId64" decoded=%" PRId64" shown=%" PRId64
+           " decode time per shown frame=%0.1fms\n", rp->nb_segments, rp->nb_decoded_frames, rp->nb_shown_frames,
+           rp->nb_shown_frames ? rp->decode_time / 1000.0 / rp->nb_shown_frames : 0.0);
+}
 
-            if (vp->pts >= sp->pts + ((float) sp->sub.start_display_time / 1000)) {
-                if (!sp->uploaded) {
-                    uint8_t *pixels[4];
-                    int pitch[4];
-                    int i;
-                    if (!sp->width || !sp->height) {
-                        sp->width = vp->width;
-                        sp->height = vp->height;
-                    }
-                    if (realloc_texture(&is->sub_texture, SDL_PIXELFORMAT_ARGB8888, sp->width, sp->height,
-                                        SDL_BLENDMODE_BLEND, 1) < 0)
-                        return;
+static void seek_bench_stop(VideoState *is) {
+    SeekBench *sb = &is->seek_bench;
 
-                    for (i = 0; i < sp->sub.num_rects; i++) {
-                        AVSubtitleRect *sub_rect = sp->sub.rects[i];
+    if (sb->tid) {
+        sb->abort_request = 1;
+        SDL_WaitThread(sb->tid, nullptr);
+        sb->tid = nullptr;
+    }
+    av_freep(&sb->targets);
+    av_freep(&sb->results);
+}
+
+static int timeshift_open(VideoState *is) {
+    TimeshiftRing *ts = &is->tshift;
+    char path[] = "/tmp/ffplay-timeshift-XXXXXX";
+    int64_t size = (int64_t) timeshift << 20;
+    void *base;
+    int fd, ret;
+
+    if (timeshift_file) {
+        fd = open(timeshift_file, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    } else if ((fd = mkstemp(path)) >= 0) {
+        /* the ring goes away with the process */
+        unlink(path);
+    }
+    if (fd < 0) {
+        ret = AVERROR(errno);
+        av_log(nullptr, AV_LOG_ERROR, "timeshift: cannot create %s\n", timeshift_file ? timeshift_file : path);
+        return ret;
+    }
+    if (ftruncate(fd, size) < 0 ||
+        (base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        ret = AVERROR(errno);
+        av_log(nullptr, AV_LOG_ERROR, "timeshift: cannot map a %d MiB ring\n", timeshift);
+        close(fd);
+        return ret;
+    }
+    if (!(ts->keys = static_cast<TimeshiftKey *>(av_malloc_array(TIMESHIFT_INDEX_SIZE, sizeof(*ts->keys))))) {
+        munmap(base, size);
+        close(fd);
+        return AVERROR(ENOMEM);
+    }
+    ts->fd = fd;
+    ts->base = static_cast<uint8_t *>(base);
+    ts->size = size;
+    ts->last_audio_key = NAN;
+    // 回退由环负责, 队列不用再留着播放过的包
+    packet_queue_set_history(&is->videoq, is->videoq.time_base, 0);
+    packet_queue_set_history(&is->audioq, is->audioq.time_base, 0);
+    packet_queue_set_history(&is->subtitleq, is->subtitleq.time_base, 0);
+    av_log(nullptr, AV_LOG_VERBOSE, "timeshift: recording into a %d MiB ring\n", timeshift);
+    return 0;
+}
+
+// 环剩下的部分放不下一条记录时跳回开头
+static int timeshift_wraps(TimeshiftRing *ts, int64_t offset) {
+    return ts->size - offset < (int64_t) sizeof(TimeshiftRecord) ||
+           reinterpret_cast<TimeshiftRecord *>(ts->base + offset)->size == 0;
+}
+
+// 丢掉最早的一条记录, 调用时持有pmutex
+static void timeshift_evict(TimeshiftRing *ts) {
+    int wraps = timeshift_wraps(ts, ts->tail);
+    int64_t n = wraps ? ts->size - ts->tail : reinterpret_cast<TimeshiftRecord *>(ts->base + ts->tail)->size;
+
+    if (ts->nb_keys && ts->keys[ts->first_key].offset == ts->tail) {
+        ts->first_key = (ts->first_key + 1) % TIMESHIFT_INDEX_SIZE;
+        ts->nb_keys--;
+    }
+    if (ts->unread == ts->used) {
+        /* playback is that far behind, it goes on from the next record */
+        ts->read = ts->tail + n == ts->size ? 0 : ts->tail + n;
+        ts->unread -= n;
+        if (!wraps) {
+            ts->need_key = 1;
+            ts->nb_overruns++;
+        }
+    }
+    ts->tail = ts->tail + n == ts->size ? 0 : ts->tail + n;
+    ts->used -= n;
+}
+
+static void timeshift_write(VideoState *is, AVPacket *pkt) {
+    TimeshiftRing *ts = &is->tshift;
+    int64_t n = FFALIGN((int64_t) sizeof(TimeshiftRecord) + pkt->size, 8);
+    int64_t pkt_ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    double t = pkt_ts != AV_NOPTS_VALUE ? pkt_ts * av_q2d(is->ic->streams[pkt->stream_index]->time_base) : NAN;
+    TimeshiftRecord *rec;
+    int key = 0;
+
+    if (n > ts->size / 4) {
+        ts->nb_dropped++;
+        return;
+    }
+    // 有视频时索引关键帧, 只有音频时每隔TIMESHIFT_AUDIO_KEY_INTERVAL秒索引一个包
+    if (!isnan(t)) {
+        if (is->video_stream >= 0)
+            key = pkt->stream_index == is->video_stream && (pkt->flags & AV_PKT_FLAG_KEY);
+        else if (pkt->stream_index == is->audio_stream)
+            key = !(t >= ts->last_audio_key && t - ts->last_audio_key < TIMESHIFT_AUDIO_KEY_INTERVAL);
+        if (key && is->video_stream < 0)
+            ts->last_audio_key = t;
+    }
+
+    pthread_mutex_lock(&ts->pmutex);
+    if (ts->size - ts->head < n) {
+        /* the rest of the ring is skipped */
+        int64_t rest = ts->size - ts->head;
+
+        while (ts->size - ts->used < rest)
+            timeshift_evict(ts);
+        if (rest >= (int64_t) sizeof(TimeshiftRecord))
+            reinterpret_cast<TimeshiftRecord *>(ts->base + ts->head)->size = 0;
+        ts->used += rest;
+        ts->unread += rest;
+        ts->head = 0;
+    }
+    while (ts->size - ts->used < n)
+        timeshift_evict(ts);
+    rec = reinterpret_cast<TimeshiftRecord *>(ts->base + ts->head);
+    rec->size = (int32_t) n;
+    rec->stream_index = pkt->stream_index;
+    rec->flags = pkt->flags;
+    rec->data_size = pkt->size;
+    rec->pts = pkt->pts;
+    rec->dts = pkt->dts;
+    rec->duration = pkt->duration;
+    rec->pos = pkt->pos;
+    if (pkt->size)
+        memcpy(rec + 1, pkt->data, pkt->size);
+    if (key) {
+        TimeshiftKey *k;
+
+        if (ts->nb_keys == TIMESHIFT_INDEX_SIZE) {
+            ts->first_key = (ts->first_key + 1) % TIMESHIFT_INDEX_SIZE;
+            ts->nb_keys--;
+        }
+        k = &ts->keys[(ts->first_key + ts->nb_keys++) % TIMESHIFT_INDEX_SIZE];
+        k->offset = ts->head;
+        k->ts = t;
+        k->pos = pkt->pos;
+    }
+    ts->head = ts->head + n == ts->size ? 0 : ts->head + n;
+    ts->used += n;
+    ts->unread += n;
+    ts->nb_records++;
+    pthread_cond_signal(&ts->pcond);
+    pthread_mutex_unlock(&ts->pmutex);
+}
+
+// 输入结束时每个流录一个空包, 播放追上来之后解码器照常收尾
+static void timeshift_write_nullpackets(VideoState *is) {
+    int streams[3] = {is->video_stream, is->audio_stream, is->subtitle_stream};
+    AVPacket pkt1, *pkt = &pkt1;
+
+    for (int i = 0; i < 3; i++) {
+        if (streams[i] < 0)
+            continue;
+        av_init_packet(pkt);
+        pkt->data = nullptr;
+        pkt->size = 0;
+        pkt->stream_index = streams[i];
+        timeshift_write(is, pkt);
+    }
+}
+
+static void timeshift_close(VideoState *is, int level) {
+    TimeshiftRing *ts = &is->tshift;
+
+    if (ts->tid) {
+        SDL_WaitThread(ts->tid, nullptr);
+        ts->tid = nullptr;
+    }
+    if (!ts->base)
+        return;
+    av_log(nullptr, level, "timeshift: records=%" PRId64" dropped=%" PRId64" overruns=%" PRId64" seeks=%" PRId64
+           " window=%0.1fs\n", ts->nb_records, ts->nb_dropped, ts->nb_overruns, ts->nb_seeks,
+           ts->nb_keys ? ts->keys[(ts->first_key + ts->nb_keys - 1) % TIMESHIFT_INDEX_SIZE].ts -
+                         ts->keys[ts->first_key].ts : 0.0);
+    munmap(ts->base, ts->size);
+    close(ts->fd);
+    ts->base = nullptr;
+    av_freep(&ts->keys);
+}
+
+static void stream_close(VideoState *is) {
+    printf("stream_close() start\n");
+    render_thread_stop(is);
+    refresh_report_wakeups(is);
+    seek_bench_stop(is);
+    /* XXX: use a special url_shutdown call to abort parse cleanly */
+    is->abort_request = 1;
+    SDL_WaitThread(is->read_tid, nullptr);
+    timeshift_close(is, perf_stats ? AV_LOG_INFO : AV_LOG_VERBOSE);
+    present_scheduler_report(&is->present, AV_LOG_VERBOSE);
+    if (is->jitbuf_enabled)
+        jitter_buffer_destroy(is);
+
+    reverse_destroy(&is->rev, perf_stats ? AV_LOG_INFO : AV_LOG_VERBOSE);
+
+    /* close each stream */
+    if (is->video_stream >= 0) {
+        stream_component_close(is, is->video_stream);
+    }
+    if (is->audio_stream >= 0) {
+        stream_component_close(is, is->audio_stream);
+    }
+    if (is->subtitle_stream >= 0) {
+        stream_component_close(is, is->subtitle_stream);
+    }
+
+    if (is->ic) {
+        avformat_close_input(&is->ic);
+        is->ic = nullptr;
+    }
+
+    packet_queue_spill_report(&is->videoq, "video", perf_stats ? AV_LOG_INFO : AV_LOG_VERBOSE);
+    packet_queue_spill_report(&is->audioq, "audio", perf_stats ? AV_LOG_INFO : AV_LOG_VERBOSE);
+    packet_queue_spill_report(&is->subtitleq, "subtitle", perf_stats ? AV_LOG_INFO : AV_LOG_VERBOSE);
+    packet_queue_destroy(&is->videoq);
+    packet_queue_destroy(&is->audioq);
+    packet_queue_destroy(&is->subtitleq);
+
+    /* free all pictures */
+    frame_queue_destory(&is->pictq);
+    frame_queue_destory(&is->sampq);
+    frame_queue_destory(&is->subpq);
+    /* all frames are released now, the pools can go */
+    seek_stats_report(&is->seek_stats, perf_stats ? AV_LOG_INFO : AV_LOG_VERBOSE);
+    frame_pool_report(&is->video_pool, "video", AV_LOG_VERBOSE);
+    frame_pool_report(&is->audio_pool, "audio", AV_LOG_VERBOSE);
+    frame_pool_destroy(&is->video_pool);
+    frame_pool_destroy(&is->audio_pool);
+    pthread_cond_destroy(&is->pcontinue_read_thread);
+    pthread_mutex_destroy(&is->render_mutex);
+    for (int i = 0; i < SWS_BANDS_MAX; i++) {
+        sws_freeContext(is->img_convert_ctx[i]);
+        sws_freeContext(is->sub_convert_ctx[i]);
+    }
+    av_free(is->filename);
+    if (is->vis_texture) {
+        SDL_DestroyTexture(is->vis_texture);
+    }
+    if (is->vid_texture) {
+        SDL_DestroyTexture(is->vid_texture);
+    }
+    if (is->sub_texture) {
+        SDL_DestroyTexture(is->sub_texture);
+    }
+    av_freep(&is->sample_array);
+    if (is) {
+        free(is);
+        is = nullptr;
+    }
+    video_state = nullptr;
+    printf("stream_close() end\n");
+}
+
+// 本地回环发送端: 把输入文件按时间戳实时地封装成mpegts, 经udp发给自己, 并模拟网络抖动和丢包
+typedef struct LoopbackDatagram {
+    uint8_t data[LOOPBACK_PACKET_SIZE];
+    int size;
+    int64_t send_time;
+    struct LoopbackDatagram *next;
+} LoopbackDatagram;
+
+typedef struct LoopbackSender {
+    char *filename;
+    char *url;
+    int fd;
+    struct sockaddr_in addr;
+    // 按send_time排序
+    LoopbackDatagram *pending;
+    int64_t nb_sent;
+    int64_t nb_dropped;
+    int abort_request;
+    SDL_Thread *tid;
+} LoopbackSender;
+
+static LoopbackSender loopback_sender;
+
+static int loopback_write_packet(void *opaque, uint8_t *buf, int buf_size) {
+    LoopbackSender *ls = static_cast<LoopbackSender *>(opaque);
+    LoopbackDatagram *dg, **next;
+
+    if (rand() < loopback_loss / 100.0 * RAND_MAX) {
+        ls->nb_dropped++;
+        return buf_size;
+    }
+    if (!(dg = static_cast<LoopbackDatagram *>(av_malloc(sizeof(LoopbackDatagram)))))
+        return AVERROR(ENOMEM);
+    dg->size = FFMIN(buf_size, LOOPBACK_PACKET_SIZE);
+    memcpy(dg->data, buf, dg->size);
+    /* a random network delay, datagrams overtake each other when it exceeds their spacing */
+    dg->send_time = av_gettime_relative() + (int64_t) (loopback_jitter * 1000.0 * rand() / RAND_MAX);
+    for (next = &ls->pending; *next && (*next)->send_time <= dg->send_time; next = &(*next)->next);
+    dg->next = *next;
+    *next = dg;
+    return buf_size;
+}
+
+static void loopback_send_due(LoopbackSender *ls, int64_t now) {
+    while (ls->pending && ls->pending->send_time <= now) {
+        LoopbackDatagram *dg = ls->pending;
+        ls->pending = dg->next;
+        if (sendto(ls->fd, dg->data, dg->size, 0, (struct sockaddr *) &ls->addr, sizeof(ls->addr)) == dg->size)
+            ls->nb_sent++;
+        av_free(dg);
+    }
+}
+
+static int loopback_sender_thread(void *arg) {
+    printf("loopback_sender_thread() start\n");
+    LoopbackSender *ls = static_cast<LoopbackSender *>(arg);
+    AVFormatContext *ifmt_ctx = nullptr, *ofmt_ctx = nullptr;
+    uint8_t *avio_buf = nullptr;
+    AVPacket pkt;
+    int64_t start, first_ts = AV_NOPTS_VALUE;
+    int ret;
+
+    if ((ret = avformat_open_input(&ifmt_ctx, ls->filename, nullptr, nullptr)) < 0 ||
+        (ret = avformat_find_stream_info(ifmt_ctx, nullptr)) < 0 ||
+        (ret = avformat_alloc_output_context2(&ofmt_ctx, nullptr, "mpegts", nullptr)) < 0) {
+        print_error(ls->filename, ret);
+        goto end;
+    }
+    for (int i = 0; i < ifmt_ctx->nb_streams; i++) {
+        AVStream *out = avformat_new_stream(ofmt_ctx, nullptr);
+        if (!out || (ret = avcodec_parameters_copy(out->codecpar, ifmt_ctx->streams[i]->codecpar)) < 0)
+            goto end;
+        out->codecpar->codec_tag = 0;
+    }
+    if (!(avio_buf = static_cast<uint8_t *>(av_malloc(LOOPBACK_PACKET_SIZE))) ||
+        !(ofmt_ctx->pb = avio_alloc_context(avio_buf, LOOPBACK_PACKET_SIZE, 1, ls,
+                                            nullptr, loopback_write_packet, nullptr)))
+        goto end;
+    avio_buf = nullptr;
+    if ((ret = avformat_write_header(ofmt_ctx, nullptr)) < 0) {
+        print_error("loopback", ret);
+        goto end;
+    }
+
+    av_usleep(LOOPBACK_START_DELAY);
+    start = av_gettime_relative();
+    while (!ls->abort_request && av_read_frame(ifmt_ctx, &pkt) >= 0) {
+        AVStream *in = ifmt_ctx->streams[pkt.stream_index];
+        int64_t ts = pkt.dts != AV_NOPTS_VALUE ? pkt.dts : pkt.pts;
+        int64_t now;
+
+        if (ts != AV_NOPTS_VALUE) {
+            ts = av_rescale_q(ts, in->time_base, AV_TIME_BASE_Q);
+            if (first_ts == AV_NOPTS_VALUE)
+                first_ts = ts;
+            /* pace the packets like a live source */
+            while (!ls->abort_request && (now = av_gettime_relative()) < start + ts - first_ts) {
+                loopback_send_due(ls, now);
+                av_usleep(1000);
+            }
+        }
+        av_packet_rescale_ts(&pkt, in->time_base, ofmt_ctx->streams[pkt.stream_index]->time_base);
+        pkt.pos = -1;
+        if (av_interleaved_write_frame(ofmt_ctx, &pkt) < 0)
+            break;
+        loopback_send_due(ls, av_gettime_relative());
+    }
+    av_write_trailer(ofmt_ctx);
+    avio_flush(ofmt_ctx->pb);
+    /* let the delayed datagrams out on time */
+    while (!ls->abort_request && ls->pending) {
+        loopback_send_due(ls, av_gettime_relative());
+        av_usleep(1000);
+    }
 
-                        sub_rect->x = av_clip(sub_rect->x, 0, sp->width);
-                        sub_rect->y = av_clip(sub_rect->y, 0, sp->height);
-                        sub_rect->w = av_clip(sub_rect->w, 0, sp->width - sub_rect->x);
-                        sub_rect->h = av_clip(sub_rect->h, 0, sp->height - sub_rect->y);
+    end:
+    loopback_send_due(ls, INT64_MAX);
+    av_log(nullptr, AV_LOG_VERBOSE, "loopback sender: sent=%" PRId64" dropped=%" PRId64"\n",
+           ls->nb_sent, ls->nb_dropped);
+    if (ofmt_ctx) {
+        avio_context_free(&ofmt_ctx->pb);
+        avformat_free_context(ofmt_ctx);
+    }
+    av_free(avio_buf);
+    avformat_close_input(&ifmt_ctx);
+    printf("loopback_sender_thread() end\n");
+    return 0;
+}
 
-                        is->sub_convert_ctx = sws_getCachedContext(is->sub_convert_ctx,
-                                                                   sub_rect->w, sub_rect->h, AV_PIX_FMT_PAL8,
-                                                                   sub_rect->w, sub_rect->h, AV_PIX_FMT_BGRA,
-                                                                   0, nullptr, nullptr, nullptr);
-                        if (!is->sub_convert_ctx) {
-                            av_log(nullptr, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
-                            return;
-                        }
-                        if (!SDL_LockTexture(is->sub_texture, (SDL_Rect *) sub_rect, (void **) pixels, pitch)) {
-                            sws_scale(is->sub_convert_ctx, (const uint8_t *const *) sub_rect->data, sub_rect->linesize,
-                                      0, sub_rect->h, pixels, pitch);
-                            SDL_UnlockTexture(is->sub_texture);
-                        }
-                    }
-                    sp->uploaded = 1;
-                }
-            } else
-                sp = nullptr;
-        }
+static int loopback_sender_start(const char *filename, int port) {
+    LoopbackSender *ls = &loopback_sender;
+
+    if ((ls->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "Could not create the loopback socket\n");
+        return AVERROR(errno);
     }
-    // endregion
+    memset(&ls->addr, 0, sizeof(ls->addr));
+    ls->addr.sin_family = AF_INET;
+    ls->addr.sin_port = htons(port);
+    ls->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ls->filename = av_strdup(filename);
+    ls->url = av_asprintf("udp://127.0.0.1:%d", port);
+    if (!ls->filename || !ls->url)
+        return AVERROR(ENOMEM);
+    srand(1);
+    if (!(ls->tid = SDL_CreateThread(loopback_sender_thread, "loopback_sender", ls))) {
+        av_log(nullptr, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    av_log(nullptr, AV_LOG_INFO, "Sending %s to %s, jitter %0.1fms, loss %0.1f%%\n",
+           filename, ls->url, loopback_jitter, loopback_loss);
+    return 0;
+}
 
-    calculate_display_rect(&rect, is->xleft, is->ytop, is->width, is->height, vp->width, vp->height, vp->sar);
-    // 如果是重复显示上一帧，那么uploaded就是1
-    if (!vp->uploaded) {
-        // 渲染
-        if (upload_texture(&is->vid_texture, vp->frame, &is->img_convert_ctx) < 0) {
-            return;
-        }
-        vp->uploaded = 1;
-        vp->flip_v = vp->frame->linesize[0] < 0;
+static void loopback_sender_stop(void) {
+    LoopbackSender *ls = &loopback_sender;
+
+    if (ls->tid) {
+        ls->abort_request = 1;
+        SDL_WaitThread(ls->tid, nullptr);
+        ls->tid = nullptr;
+        close(ls->fd);
     }
+    av_freep(&ls->filename);
+    av_freep(&ls->url);
+}
 
-    // region SDL_RenderCopyEx
-    set_sdl_yuv_conversion_mode(vp->frame);
-    SDL_RenderCopyEx(renderer, is->vid_texture, nullptr, &rect, 0, nullptr,
-                     static_cast<const SDL_RendererFlip>(vp->flip_v ? SDL_FLIP_VERTICAL : 0));
-    set_sdl_yuv_conversion_mode(nullptr);
-    // endregion
+// -perf_stats: 整个进程(包括之后创建的线程)的cache访问, cache miss和上下文切换计数
+enum {
+    PERF_COUNTER_CACHE_REFERENCES,
+    PERF_COUNTER_CACHE_MISSES,
+    PERF_COUNTER_CONTEXT_SWITCHES,
+    PERF_COUNTER_NB,
+};
 
-    // region sp is null
-    if (sp) {
-#if USE_ONEPASS_SUBTITLE_RENDER
-        SDL_RenderCopy(renderer, is->sub_texture, nullptr, &rect);
+static int perf_fds[PERF_COUNTER_NB] = {-1, -1, -1};
+static int64_t perf_start_time;
+
+/* must run before the player threads are created, they inherit the counters */
+static void perf_stats_start(void) {
+#ifdef __linux__
+    static const uint32_t types[PERF_COUNTER_NB] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+    static const uint64_t configs[PERF_COUNTER_NB] = {PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES,
+                                                      PERF_COUNT_SW_CONTEXT_SWITCHES};
+    struct perf_event_attr attr;
+
+    perf_start_time = av_gettime_relative();
+    for (int i = 0; i < PERF_COUNTER_NB; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = types[i];
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        perf_fds[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (perf_fds[i] < 0)
+            av_log(nullptr, AV_LOG_WARNING, "Could not open perf counter %d: %s\n", i, strerror(errno));
+    }
 #else
-        int i;
-        double xratio = (double)rect.w / (double)sp->width;
-        double yratio = (double)rect.h / (double)sp->height;
-        for (i = 0; i < sp->sub.num_rects; i++) {
-            SDL_Rect *sub_rect = (SDL_Rect*)sp->sub.rects[i];
-            SDL_Rect target = {.x = rect.x + sub_rect->x * xratio,
-                               .y = rect.y + sub_rect->y * yratio,
-                               .w = sub_rect->w * xratio,
-                               .h = sub_rect->h * yratio};
-            SDL_RenderCopy(renderer, is->sub_texture, sub_rect, &target);
-        }
+    perf_start_time = av_gettime_relative();
+    av_log(nullptr, AV_LOG_WARNING, "-perf_stats needs Linux perf events\n");
 #endif
+}
+
+/* the counts include the threads that already exited, so call this after stream_close() */
+static void perf_stats_stop(void) {
+    uint64_t values[PERF_COUNTER_NB] = {0};
+    double elapsed = FFMAX((av_gettime_relative() - perf_start_time) / 1000000.0, 0.001);
+    struct rusage ru;
+
+    for (int i = 0; i < PERF_COUNTER_NB; i++) {
+        if (perf_fds[i] < 0)
+            continue;
+        if (read(perf_fds[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+            values[i] = 0;
+        close(perf_fds[i]);
+        perf_fds[i] = -1;
+    }
+    if (values[PERF_COUNTER_CACHE_REFERENCES])
+        av_log(nullptr, AV_LOG_INFO, "perf: cache-references=%" PRIu64" cache-misses=%" PRIu64" (%0.2f%%)\n",
+               values[PERF_COUNTER_CACHE_REFERENCES], values[PERF_COUNTER_CACHE_MISSES],
+               100.0 * values[PERF_COUNTER_CACHE_MISSES] / values[PERF_COUNTER_CACHE_REFERENCES]);
+    /* compare runs with and without -worker_pool: fewer switches for the same frames per cpu second */
+    if (!getrusage(RUSAGE_SELF, &ru)) {
+        double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+        if (!values[PERF_COUNTER_CONTEXT_SWITCHES])
+            values[PERF_COUNTER_CONTEXT_SWITCHES] = ru.ru_nvcsw + ru.ru_nivcsw;
+        av_log(nullptr, AV_LOG_INFO,
+               "perf: context-switches=%" PRIu64" (%0.0f/s) frames=%" PRId64" (%0.1f/s) cpu=%0.2fs (%0.2f ms/frame)\n",
+               values[PERF_COUNTER_CONTEXT_SWITCHES], values[PERF_COUNTER_CONTEXT_SWITCHES] / elapsed,
+               perf_frames_shown, perf_frames_shown / elapsed, cpu,
+               perf_frames_shown ? 1000.0 * cpu / perf_frames_shown : 0.0);
     }
-    // endregion
 }
 
-static inline int compute_mod(int a, int b) {
-    return a < 0 ? a % b + b : a % b;
+static int zap_interrupt_cb(void *ctx) {
+    ZapChannel *ch = static_cast<ZapChannel *>(ctx);
+    return ch->abort_request;
 }
 
-static void video_audio_display(VideoState *s) {
-    int i, i_start, x, y1, y, ys, delay, n, nb_display_channels;
-    int ch, channels, h, h2;
-    int64_t time_diff;
-    int rdft_bits, nb_freq;
+static void zap_gop_flush(ZapChannel *ch) {
+    MyAVPacketList *n, *next;
 
-    for (rdft_bits = 1; (1 << rdft_bits) < 2 * s->height; rdft_bits++);
-    nb_freq = 1 << (rdft_bits - 1);
+    for (n = ch->gop_first; n; n = next) {
+        next = n->next;
+        av_packet_unref(&n->pkt);
+        av_free(n);
+    }
+    ch->gop_first = ch->gop_last = nullptr;
+    ch->gop_size = 0;
+}
 
-    /* compute display index : center on currently output samples */
-    channels = s->audio_tgt.channels;
-    nb_display_channels = channels;
-    if (!s->paused) {
-        int data_used = s->show_mode == VideoState::SHOW_MODE_WAVES ? s->width : (2 * nb_freq);
-        n = 2 * channels;
-        delay = s->audio_write_buf_size;
-        delay /= n;
+// 有视频时从关键帧开始攒, 下一个关键帧来了就换掉; 只有音频时保留最近ZAP_AUDIO_BUFFER秒
+static void zap_gop_add(ZapChannel *ch, AVPacket *pkt) {
+    int video = ch->stream_index[AVMEDIA_TYPE_VIDEO];
+    int audio = ch->stream_index[AVMEDIA_TYPE_AUDIO];
+    MyAVPacketList *n;
 
-        /* to be more precise, we take into account the time spent since
-           the last buffer computation */
-        if (audio_callback_time) {
-            time_diff = av_gettime_relative() - audio_callback_time;
-            delay -= (time_diff * s->audio_tgt.freq) / 1000000;
+    if (pkt->stream_index != video && pkt->stream_index != audio) {
+        av_packet_unref(pkt);
+        return;
+    }
+    if (video >= 0) {
+        if (pkt->stream_index == video && (pkt->flags & AV_PKT_FLAG_KEY))
+            zap_gop_flush(ch);
+        else if (!ch->gop_first || ch->gop_size > ZAP_GOP_MAX_SIZE) {
+            /* too long a GOP is dropped, the next one may fit */
+            zap_gop_flush(ch);
+            av_packet_unref(pkt);
+            return;
         }
-
-        delay += 2 * data_used;
-        if (delay < data_used)
-            delay = data_used;
-
-        i_start = x = compute_mod(s->sample_array_index - delay * channels, SAMPLE_ARRAY_SIZE);
-        if (s->show_mode == VideoState::SHOW_MODE_WAVES) {
-            h = INT_MIN;
-            for (i = 0; i < 1000; i += channels) {
-                int idx = (SAMPLE_ARRAY_SIZE + x - i) % SAMPLE_ARRAY_SIZE;
-                int a = s->sample_array[idx];
-                int b = s->sample_array[(idx + 4 * channels) % SAMPLE_ARRAY_SIZE];
-                int c = s->sample_array[(idx + 5 * channels) % SAMPLE_ARRAY_SIZE];
-                int d = s->sample_array[(idx + 9 * channels) % SAMPLE_ARRAY_SIZE];
-                int score = a - d;
-                if (h < score && (b ^ c) < 0) {
-                    h = score;
-                    i_start = idx;
-                }
-            }
+    } else {
+        AVRational tb = ch->ic->streams[audio]->time_base;
+        int64_t window = av_rescale_q((int64_t) (ZAP_AUDIO_BUFFER * AV_TIME_BASE), AV_TIME_BASE_Q, tb);
+
+        while ((n = ch->gop_first) && pkt->pts != AV_NOPTS_VALUE && n->pkt.pts != AV_NOPTS_VALUE &&
+               pkt->pts - n->pkt.pts > window) {
+            ch->gop_first = n->next;
+            if (!ch->gop_first)
+                ch->gop_last = nullptr;
+            ch->gop_size -= n->pkt.size + sizeof(*n);
+            av_packet_unref(&n->pkt);
+            av_free(n);
         }
+    }
+    if (!(n = static_cast<MyAVPacketList *>(av_malloc(sizeof(MyAVPacketList))))) {
+        av_packet_unref(pkt);
+        return;
+    }
+    n->pkt = *pkt;
+    n->next = nullptr;
+    n->serial = 0;
+    n->spill_offset = -1;
+    if (ch->gop_last)
+        ch->gop_last->next = n;
+    else
+        ch->gop_first = n;
+    ch->gop_last = n;
+    ch->gop_size += pkt->size + sizeof(*n);
+}
 
-        s->last_i_start = i_start;
-    } else {
-        i_start = s->last_i_start;
+// 和stream_component_open一样选解码器和选项, 只是不用帧池和线程调整, 那两个属于VideoState
+static int zap_open_decoder(ZapChannel *ch, int stream_index) {
+    AVStream *st = ch->ic->streams[stream_index];
+    AVCodecContext *avctx = avcodec_alloc_context3(nullptr);
+    const char *forced_codec_name = nullptr;
+    AVDictionary *opts = nullptr;
+    AVCodec *codec;
+    int stream_lowres = lowres;
+    int ret;
+
+    if (!avctx)
+        return AVERROR(ENOMEM);
+    if ((ret = avcodec_parameters_to_context(avctx, st->codecpar)) < 0)
+        goto fail;
+    avctx->pkt_timebase = st->time_base;
+    if (avctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        forced_codec_name = video_codec_name;
+    else if (avctx->codec_type == AVMEDIA_TYPE_AUDIO)
+        forced_codec_name = audio_codec_name;
+    codec = forced_codec_name ? avcodec_find_decoder_by_name(forced_codec_name) : avcodec_find_decoder(avctx->codec_id);
+    if (!codec) {
+        ret = AVERROR_DECODER_NOT_FOUND;
+        goto fail;
     }
+    avctx->codec_id = codec->id;
+    stream_lowres = FFMIN(stream_lowres, codec->max_lowres);
+    avctx->lowres = stream_lowres;
+    if (fast)
+        avctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    opts = filter_codec_opts(codec_opts, avctx->codec_id, ch->ic, st, codec);
+    if (!av_dict_get(opts, "threads", nullptr, 0))
+        av_dict_set(&opts, "threads", "auto", 0);
+    if (stream_lowres)
+        av_dict_set_int(&opts, "lowres", stream_lowres, 0);
+    av_dict_set(&opts, "refcounted_frames", "1", 0);
+    if ((ret = avcodec_open2(avctx, codec, &opts)) < 0)
+        goto fail;
+    av_dict_free(&opts);
+    ch->avctx[avctx->codec_type] = avctx;
+    return 0;
 
-    if (s->show_mode == VideoState::SHOW_MODE_WAVES) {
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    fail:
+    av_dict_free(&opts);
+    avcodec_free_context(&avctx);
+    return ret;
+}
 
-        /* total height for one channel */
-        h = s->height / nb_display_channels;
-        /* graph height / 2 */
-        h2 = (h * 9) / 20;
-        for (ch = 0; ch < nb_display_channels; ch++) {
-            i = i_start + ch;
-            y1 = s->ytop + ch * h + (h / 2); /* position of center line */
-            for (x = 0; x < s->width; x++) {
-                y = (s->sample_array[i] * h2) >> 15;
-                if (y < 0) {
-                    y = -y;
-                    ys = y1 - y;
-                } else {
-                    ys = y1;
-                }
-                fill_rectangle(s->xleft + x, ys, 1, y);
-                i += channels;
-                if (i >= SAMPLE_ARRAY_SIZE)
-                    i -= SAMPLE_ARRAY_SIZE;
-            }
-        }
+// 打开输入, 探测, 选流, 打开解码器, 也就是换台时create_avformat_context和stream_component_open最慢的部分
+static int zap_standby_open(ZapChannel *ch) {
+    AVFormatContext *ic = avformat_alloc_context();
+    AVDictionary *opts = nullptr;
+    int64_t start = av_gettime_relative();
+    int ret;
 
-        SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
+    if (!ic)
+        return AVERROR(ENOMEM);
+    ic->interrupt_callback.callback = zap_interrupt_cb;
+    ic->interrupt_callback.opaque = ch;
+    av_dict_copy(&opts, format_opts, 0);
+    av_dict_set(&opts, "scan_all_pmts", "1", AV_DICT_DONT_OVERWRITE);
+    /* avformat_open_input frees ic when it fails */
+    ret = avformat_open_input(&ic, ch->url, file_iformat, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
+    ch->ic = ic;
+    if (genpts)
+        ic->flags |= AVFMT_FLAG_GENPTS;
+    av_format_inject_global_side_data(ic);
+    if (find_stream_info) {
+        AVDictionary **sopts = setup_find_stream_info_opts(ic, codec_opts);
+        int orig_nb_streams = ic->nb_streams;
 
-        for (ch = 1; ch < nb_display_channels; ch++) {
-            y = s->ytop + ch * h;
-            fill_rectangle(s->xleft, y, s->width, 1);
+        ret = avformat_find_stream_info(ic, sopts);
+        for (int i = 0; i < orig_nb_streams; i++)
+            av_dict_free(&sopts[i]);
+        av_freep(&sopts);
+        if (ret < 0)
+            return ret;
+    }
+    for (unsigned i = 0; i < ic->nb_streams; i++)
+        ic->streams[i]->discard = AVDISCARD_ALL;
+    ch->stream_index[AVMEDIA_TYPE_VIDEO] = video_disable ? -1 :
+            av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    ch->stream_index[AVMEDIA_TYPE_AUDIO] = audio_disable ? -1 :
+            av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO, -1, ch->stream_index[AVMEDIA_TYPE_VIDEO], nullptr, 0);
+    if (ch->stream_index[AVMEDIA_TYPE_VIDEO] < 0 && ch->stream_index[AVMEDIA_TYPE_AUDIO] < 0)
+        return AVERROR_STREAM_NOT_FOUND;
+    for (int type = AVMEDIA_TYPE_VIDEO; type <= AVMEDIA_TYPE_AUDIO; type++) {
+        int index = ch->stream_index[type];
+
+        if (index < 0)
+            continue;
+        if ((ret = zap_open_decoder(ch, index)) < 0) {
+            av_log(nullptr, AV_LOG_WARNING, "zap: %s: cannot open the %s decoder\n", ch->url,
+                   av_get_media_type_string(static_cast<AVMediaType>(type)));
+            ch->stream_index[type] = -1;
+            continue;
         }
-    } else {
-        if (realloc_texture(&s->vis_texture, SDL_PIXELFORMAT_ARGB8888, s->width, s->height, SDL_BLENDMODE_NONE, 1) < 0)
-            return;
+        ic->streams[index]->discard = AVDISCARD_DEFAULT;
+    }
+    if (ch->stream_index[AVMEDIA_TYPE_VIDEO] < 0 && ch->stream_index[AVMEDIA_TYPE_AUDIO] < 0)
+        return AVERROR_DECODER_NOT_FOUND;
+    ch->connect_time = av_gettime_relative() - start;
+    return 0;
+}
 
-        nb_display_channels = FFMIN(nb_display_channels, 2);
-        if (rdft_bits != s->rdft_bits) {
-            av_rdft_end(s->rdft);
-            av_free(s->rdft_data);
-            s->rdft = av_rdft_init(rdft_bits, DFT_R2C);
-            s->rdft_bits = rdft_bits;
-            s->rdft_data = static_cast<FFTSample *>(av_malloc_array(nb_freq, 4 * sizeof(*s->rdft_data)));
-        }
-        if (!s->rdft || !s->rdft_data) {
-            av_log(nullptr, AV_LOG_ERROR, "Failed to allocate buffers for RDFT, switching to waves display\n");
-            s->show_mode = VideoState::SHOW_MODE_WAVES;
-        } else {
-            FFTSample *data[2];
-            SDL_Rect rect = {.x = s->xpos, .y = 0, .w = 1, .h = s->height};
-            uint32_t *pixels;
-            int pitch;
-            for (ch = 0; ch < nb_display_channels; ch++) {
-                data[ch] = s->rdft_data + 2 * nb_freq * ch;
-                i = i_start + ch;
-                for (x = 0; x < 2 * nb_freq; x++) {
-                    double w = (x - nb_freq) * (1.0 / nb_freq);
-                    data[ch][x] = s->sample_array[i] * (1.0 - w * w);
-                    i += channels;
-                    if (i >= SAMPLE_ARRAY_SIZE)
-                        i -= SAMPLE_ARRAY_SIZE;
-                }
-                av_rdft_calc(s->rdft, data[ch]);
-            }
-            /* Least efficient way to do this, we should of course
-             * directly access it but it is more than fast enough. */
-            if (!SDL_LockTexture(s->vis_texture, &rect, (void **) &pixels, &pitch)) {
-                pitch >>= 2;
-                pixels += pitch * s->height;
-                for (y = 0; y < s->height; y++) {
-                    double w = 1 / sqrt(nb_freq);
-                    int a = sqrt(w * sqrt(data[0][2 * y + 0] * data[0][2 * y + 0] +
-                                          data[0][2 * y + 1] * data[0][2 * y + 1]));
-                    int b = (nb_display_channels == 2)
-                            ? sqrt(w * hypot(data[1][2 * y + 0], data[1][2 * y + 1]))
-                            : a;
-                    a = FFMIN(a, 255);
-                    b = FFMIN(b, 255);
-                    pixels -= pitch;
-                    *pixels = (a << 16) + (b << 8) + ((a + b) >> 1);
-                }
-                SDL_UnlockTexture(s->vis_texture);
+// 释放standby的读线程留下的东西, 已经交给stream_open的部分这时是nullptr
+static void zap_standby_close(ZapChannel *ch) {
+    zap_gop_flush(ch);
+    for (int i = 0; i < AVMEDIA_TYPE_NB; i++) {
+        avcodec_free_context(&ch->avctx[i]);
+        ch->stream_index[i] = -1;
+    }
+    if (ch->ic)
+        avformat_close_input(&ch->ic);
+    ch->state = ZAP_CONNECTING;
+}
+
+// 重连之前等ZAP_RETRY_DELAY, 停止请求会叫醒它
+static void zap_standby_retry_wait(ZapChannel *ch) {
+    struct timespec abstime;
+    int64_t wait_us;
+
+    /* pthread_cond_timedwait wants the realtime clock */
+    wait_us = av_gettime() + ZAP_RETRY_DELAY;
+    abstime.tv_sec = wait_us / 1000000;
+    abstime.tv_nsec = (wait_us % 1000000) * 1000;
+    pthread_mutex_lock(&ch->pmutex);
+    if (!ch->stop_req)
+        pthread_cond_timedwait(&ch->pcond, &ch->pmutex, &abstime);
+    pthread_mutex_unlock(&ch->pmutex);
+}
+
+static int zap_standby_thread(void *arg) {
+    ZapChannel *ch = static_cast<ZapChannel *>(arg);
+    AVPacket pkt;
+    int ret;
+
+    while (!ch->stop_req) {
+        if (ch->state != ZAP_READY) {
+            if ((ret = zap_standby_open(ch)) >= 0) {
+                av_log(nullptr, AV_LOG_VERBOSE, "zap: %s ready after %0.1f ms\n", ch->url, ch->connect_time / 1000.0);
+                ch->state = ZAP_READY;
+                continue;
             }
-            SDL_RenderCopy(renderer, s->vis_texture, nullptr, nullptr);
+            if (ch->stop_req)
+                break;
+            print_error(ch->url, ret);
+            zap_standby_close(ch);
+            ch->state = ZAP_FAILED;
+            zap_standby_retry_wait(ch);
+            continue;
         }
-        if (!s->paused)
-            s->xpos++;
-        if (s->xpos >= s->width)
-            s->xpos = s->xleft;
+        ret = av_read_frame(ch->ic, &pkt);
+        if (ret == AVERROR(EAGAIN)) {
+            av_usleep(10000);
+            continue;
+        }
+        if (ret < 0) {
+            if (ch->stop_req)
+                break;
+            /* a live channel that ended or dropped the connection is opened again, not in a tight loop
+             * when the server keeps refusing right after the open */
+            av_log(nullptr, AV_LOG_VERBOSE, "zap: %s: lost the input, reconnecting\n", ch->url);
+            zap_standby_close(ch);
+            ch->state = ZAP_FAILED;
+            zap_standby_retry_wait(ch);
+            continue;
+        }
+        zap_gop_add(ch, &pkt);
     }
+    pthread_mutex_lock(&ch->pmutex);
+    ch->stopped = 1;
+    pthread_cond_signal(&ch->pcond);
+    pthread_mutex_unlock(&ch->pmutex);
+    return 0;
 }
 
-static void stream_component_close(VideoState *is, int stream_index) {
-    AVFormatContext *ic = is->ic;
-    AVCodecParameters *codecpar;
-
-    if (stream_index < 0 || stream_index >= ic->nb_streams)
-        return;
-    codecpar = ic->streams[stream_index]->codecpar;
+static int zap_standby_start(ZapChannel *ch) {
+    ch->abort_request = 0;
+    ch->stop_req = 0;
+    ch->stopped = 0;
+    ch->state = ZAP_CONNECTING;
+    if (!(ch->tid = thread_create(zap_standby_thread, "zap_standby", ch, THREAD_ROLE_DEMUX))) {
+        av_log(nullptr, AV_LOG_WARNING, "zap: cannot start the standby reader of %s: %s\n", ch->url, SDL_GetError());
+        return -1;
+    }
+    return 0;
+}
 
-    switch (codecpar->codec_type) {
-        case AVMEDIA_TYPE_AUDIO:
-            decoder_abort(&is->auddec, &is->sampq);
-            SDL_CloseAudioDevice(audio_dev);
-            decoder_destroy(&is->auddec);
-            swr_free(&is->swr_ctx);
-            av_freep(&is->audio_buf1);
-            is->audio_buf1_size = 0;
-            is->audio_buf = nullptr;
+// keep为1时读线程最好在两个包之间停下, 输入还能接着用; 等不到才打断正在进行的I/O
+static void zap_standby_stop(ZapChannel *ch, int keep) {
+    struct timespec abstime;
+    int64_t wait_us;
 
-            if (is->rdft) {
-                av_rdft_end(is->rdft);
-                av_freep(&is->rdft_data);
-                is->rdft = nullptr;
-                is->rdft_bits = 0;
-            }
-            break;
-        case AVMEDIA_TYPE_VIDEO:
-            decoder_abort(&is->viddec, &is->pictq);
-            decoder_destroy(&is->viddec);
-            break;
-        case AVMEDIA_TYPE_SUBTITLE:
-            decoder_abort(&is->subdec, &is->subpq);
-            decoder_destroy(&is->subdec);
-            break;
-        default:
-            break;
+    if (!ch->tid)
+        return;
+    pthread_mutex_lock(&ch->pmutex);
+    ch->stop_req = 1;
+    pthread_cond_signal(&ch->pcond);
+    if (keep) {
+        /* pthread_cond_timedwait wants the realtime clock */
+        wait_us = av_gettime() + ZAP_HANDOVER_TIMEOUT;
+        abstime.tv_sec = wait_us / 1000000;
+        abstime.tv_nsec = (wait_us % 1000000) * 1000;
+        while (!ch->stopped)
+            if (pthread_cond_timedwait(&ch->pcond, &ch->pmutex, &abstime) == ETIMEDOUT)
+                break;
     }
+    if (!ch->stopped)
+        ch->abort_request = 1;
+    pthread_mutex_unlock(&ch->pmutex);
+    SDL_WaitThread(ch->tid, nullptr);
+    ch->tid = nullptr;
+    if (ch->abort_request && ch->ic && ch->ic->pb) {
+        /* the interrupted read left these behind, the next reader starts over */
+        ch->ic->pb->error = 0;
+        ch->ic->pb->eof_reached = 0;
+    }
+}
 
-    ic->streams[stream_index]->discard = AVDISCARD_ALL;
-    switch (codecpar->codec_type) {
-        case AVMEDIA_TYPE_AUDIO:
-            is->audio_st = nullptr;
-            is->audio_stream = -1;
-            break;
-        case AVMEDIA_TYPE_VIDEO:
-            is->video_st = nullptr;
-            is->video_stream = -1;
-            break;
-        case AVMEDIA_TYPE_SUBTITLE:
-            is->subtitle_st = nullptr;
-            is->subtitle_stream = -1;
-            break;
-        default:
-            break;
+// 当前频道前后各zap_standby个频道保持连接, 其它的断开
+static void zap_update_standby(void) {
+    for (int i = 0; i < zap.nb_channels; i++) {
+        ZapChannel *ch = &zap.channels[i];
+        int d = FFABS(i - zap.current);
+
+        d = FFMIN(d, zap.nb_channels - d);
+        if (d && d <= zap_standby) {
+            if (!ch->tid)
+                zap_standby_start(ch);
+        } else if (ch->tid) {
+            zap_standby_stop(ch, 0);
+            zap_standby_close(ch);
+        }
     }
 }
 
-static void stream_close(VideoState *is) {
-    printf("stream_close() start\n");
-    /* XXX: use a special url_shutdown call to abort parse cleanly */
-    is->abort_request = 1;
-    SDL_WaitThread(is->read_tid, nullptr);
+// 频道列表一行一个URL, 空行和#开头的行跳过
+static int zap_load(const char *filename) {
+    char line[4096];
+    FILE *f = fopen(filename, "r");
 
-    /* close each stream */
-    if (is->video_stream >= 0) {
-        stream_component_close(is, is->video_stream);
+    if (!f) {
+        av_log(nullptr, AV_LOG_ERROR, "Cannot open channel list %s\n", filename);
+        return AVERROR(errno);
     }
-    if (is->audio_stream >= 0) {
-        stream_component_close(is, is->audio_stream);
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        ZapChannel *ch;
+
+        while (len && av_isspace(line[len - 1]))
+            line[--len] = 0;
+        if (!len || line[0] == '#')
+            continue;
+        if (av_reallocp_array(&zap.channels, zap.nb_channels + 1, sizeof(*zap.channels)) < 0) {
+            fclose(f);
+            return AVERROR(ENOMEM);
+        }
+        ch = &zap.channels[zap.nb_channels];
+        memset(ch, 0, sizeof(*ch));
+        if (!(ch->url = av_strdup(line))) {
+            fclose(f);
+            return AVERROR(ENOMEM);
+        }
+        ch->pmutex = PTHREAD_MUTEX_INITIALIZER;
+        ch->pcond = PTHREAD_COND_INITIALIZER;
+        for (int i = 0; i < AVMEDIA_TYPE_NB; i++)
+            ch->stream_index[i] = -1;
+        zap.nb_channels++;
     }
-    if (is->subtitle_stream >= 0) {
-        stream_component_close(is, is->subtitle_stream);
+    fclose(f);
+    if (!zap.nb_channels) {
+        av_log(nullptr, AV_LOG_ERROR, "Channel list %s is empty\n", filename);
+        return AVERROR(EINVAL);
     }
+    return 0;
+}
 
-    if (is->ic) {
-        avformat_close_input(&is->ic);
-        is->ic = nullptr;
+static void zap_destroy(int level) {
+    for (int i = 0; i < zap.nb_channels; i++) {
+        zap_standby_stop(&zap.channels[i], 0);
+        zap_standby_close(&zap.channels[i]);
+        av_freep(&zap.channels[i].url);
     }
+    av_freep(&zap.channels);
+    if (zap.nb_warm + zap.nb_cold)
+        av_log(nullptr, level, "zap: warm=%" PRId64" avg=%0.1fms max=%0.1fms cold=%" PRId64
+               " avg=%0.1fms max=%0.1fms\n",
+               zap.nb_warm, zap.nb_warm ? zap.warm_time / 1000.0 / zap.nb_warm : 0.0, zap.max_warm_time / 1000.0,
+               zap.nb_cold, zap.nb_cold ? zap.cold_time / 1000.0 / zap.nb_cold : 0.0, zap.max_cold_time / 1000.0);
+    zap.nb_channels = 0;
+}
 
-    packet_queue_destroy(&is->videoq);
-    packet_queue_destroy(&is->audioq);
-    packet_queue_destroy(&is->subtitleq);
+// 换台后新频道的第一帧显示(没有视频时第一段音频播放)时调用
+static void zap_first_frame(VideoState *is) {
+    int64_t t = av_gettime_relative() - is->zap_start;
 
-    /* free all pictures */
-    frame_queue_destory(&is->pictq);
-    frame_queue_destory(&is->sampq);
-    frame_queue_destory(&is->subpq);
-    pthread_cond_destroy(&is->pcontinue_read_thread);
-    sws_freeContext(is->img_convert_ctx);
-    sws_freeContext(is->sub_convert_ctx);
-    av_free(is->filename);
-    if (is->vis_texture) {
-        SDL_DestroyTexture(is->vis_texture);
-    }
-    if (is->vid_texture) {
-        SDL_DestroyTexture(is->vid_texture);
-    }
-    if (is->sub_texture) {
-        SDL_DestroyTexture(is->sub_texture);
-    }
-    if (is) {
-        av_free(is);
-        is = nullptr;
+    is->zap_start = 0;
+    if (is->zap_warm) {
+        zap.nb_warm++;
+        zap.warm_time += t;
+        zap.max_warm_time = FFMAX(zap.max_warm_time, t);
+    } else {
+        zap.nb_cold++;
+        zap.cold_time += t;
+        zap.max_cold_time = FFMAX(zap.max_cold_time, t);
     }
-    video_state = nullptr;
-    printf("stream_close() end\n");
+    av_log(nullptr, perf_stats ? AV_LOG_INFO : AV_LOG_VERBOSE, "zap: %s first frame after %0.1f ms (%s)\n",
+           is->filename, t / 1000.0, is->zap_warm ? "warm" : "cold");
 }
 
 static void do_exit(VideoState *is) {
@@ -1433,6 +5174,14 @@ static void do_exit(VideoState *is) {
     if (is) {
         stream_close(is);
     }
+    zap_destroy(perf_stats ? AV_LOG_INFO : AV_LOG_VERBOSE);
+    loopback_sender_stop();
+    worker_pool_stop();
+    /* the event loop thread, when it renders */
+    thread_role_leave();
+    thread_role_report();
+    if (perf_stats)
+        perf_stats_stop();
     if (renderer)
         SDL_DestroyRenderer(renderer);
     if (window)
@@ -1466,12 +5215,8 @@ static void set_default_window_size(int width, int height, AVRational sar) {
     default_height = rect.h;
 }
 
-static int video_open(VideoState *is) {
-    int w, h;
-    w = screen_width ? screen_width : default_width;
-    h = screen_height ? screen_height : default_height;
-    is->width = w;
-    is->height = h;
+// 窗口只能在创建它的线程(main, 也就是event_loop)里操作
+static void video_window_show(int w, int h) {
     if (!window_title) {
         window_title = input_filename;
     }
@@ -1482,6 +5227,26 @@ static int video_open(VideoState *is) {
         SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN_DESKTOP);
     }
     SDL_ShowWindow(window);
+}
+
+static int video_open(VideoState *is) {
+    int w, h;
+    w = screen_width ? screen_width : default_width;
+    h = screen_height ? screen_height : default_height;
+    is->width = w;
+    is->height = h;
+    if (render_thread_enable) {
+        // 在render_thread里, 画面先按这个大小画, 窗口交给event_loop去显示
+        SDL_Event event;
+
+        event.type = FF_WINDOW_EVENT;
+        event.user.data1 = is;
+        event.user.code = w;
+        event.user.data2 = (void *) (intptr_t) h;
+        SDL_PushEvent(&event);
+    } else {
+        video_window_show(w, h);
+    }
     return 0;
 }
 
@@ -1501,26 +5266,77 @@ static void video_display(VideoState *is) {
         video_image_display(is);
     }
     SDL_RenderPresent(renderer);
+    is->nb_displays++;
+    present_scheduler_update(&is->present);
 }
 
-static double get_clock(Clock *c) {
+/* writers exclude each other by making the sequence odd, readers never block them */
+static void clock_write_begin(Clock *c) {
+    for (;;) {
+        int seq = SDL_AtomicGet(&c->seq);
+        if (!(seq & 1) && SDL_AtomicCAS(&c->seq, seq, seq + 1))
+            return;
+    }
+}
+
+static void clock_write_end(Clock *c) {
+    SDL_AtomicAdd(&c->seq, 1);
+}
+
+/* copy a consistent snapshot of the clock, retrying if a writer got in between */
+static void clock_read(Clock *c, Clock *snapshot) {
+    int seq;
+
+    do {
+        while ((seq = SDL_AtomicGet(&c->seq)) & 1)
+            ;
+        snapshot->pts = c->pts;
+        snapshot->pts_drift = c->pts_drift;
+        snapshot->last_updated = c->last_updated;
+        snapshot->speed = c->speed;
+        snapshot->serial = c->serial;
+        snapshot->paused = c->paused;
+        snapshot->queue_serial = c->queue_serial;
+        SDL_MemoryBarrierAcquire();
+    } while (SDL_AtomicGet(&c->seq) != seq);
+}
+
+/* value of a snapshot, or of a clock held by the writer */
+static double clock_value(const Clock *c, double time) {
     if (*c->queue_serial != c->serial)
         return NAN;
-    if (c->paused) {
+    if (c->paused)
         return c->pts;
-    } else {
-        double time = av_gettime_relative() / 1000000.0;
-        return c->pts_drift + time - (time - c->last_updated) * (1.0 - c->speed);
-    }
+    return c->pts_drift + time - (time - c->last_updated) * (1.0 - c->speed);
 }
 
-static void set_clock_at(Clock *c, double pts, int serial, double time) {
+static double get_clock(Clock *c) {
+    Clock snapshot;
+
+    clock_read(c, &snapshot);
+    return clock_value(&snapshot, av_gettime_relative() / 1000000.0);
+}
+
+static int get_clock_serial(Clock *c) {
+    Clock snapshot;
+
+    clock_read(c, &snapshot);
+    return snapshot.serial;
+}
+
+static void set_clock_at_locked(Clock *c, double pts, int serial, double time) {
     c->pts = pts;
     c->last_updated = time;
     c->pts_drift = c->pts - time;
     c->serial = serial;
 }
 
+static void set_clock_at(Clock *c, double pts, int serial, double time) {
+    clock_write_begin(c);
+    set_clock_at_locked(c, pts, serial, time);
+    clock_write_end(c);
+}
+
 static void set_clock(Clock *c, double pts, int serial) {
     //printf("set_clock() pts = %lf\n", pts);
     double time = av_gettime_relative() / 1000000.0;
@@ -1528,12 +5344,32 @@ static void set_clock(Clock *c, double pts, int serial) {
 }
 
 static void set_clock_speed(Clock *c, double speed) {
-    set_clock(c, get_clock(c), c->serial);
+    double time = av_gettime_relative() / 1000000.0;
+
+    clock_write_begin(c);
+    set_clock_at_locked(c, clock_value(c, time), c->serial, time);
     c->speed = speed;
+    clock_write_end(c);
+}
+
+/* restart the clock from its current value */
+static void restart_clock(Clock *c) {
+    double time = av_gettime_relative() / 1000000.0;
+
+    clock_write_begin(c);
+    set_clock_at_locked(c, clock_value(c, time), c->serial, time);
+    clock_write_end(c);
+}
+
+static void set_clock_paused(Clock *c, int paused) {
+    clock_write_begin(c);
+    c->paused = paused;
+    clock_write_end(c);
 }
 
 static void init_clock(Clock *c, int *queue_serial) {
     printf("init_clock() queue_serial = %d\n", *queue_serial);
+    SDL_AtomicSet(&c->seq, 0);
     c->speed = 1.0;
     c->paused = 0;
     c->queue_serial = queue_serial;
@@ -1541,10 +5377,105 @@ static void init_clock(Clock *c, int *queue_serial) {
 }
 
 static void sync_clock_to_slave(Clock *c, Clock *slave) {
+    Clock snapshot;
+    double time = av_gettime_relative() / 1000000.0;
     double clock = get_clock(c);
-    double slave_clock = get_clock(slave);
+    double slave_clock;
+
+    clock_read(slave, &snapshot);
+    slave_clock = clock_value(&snapshot, time);
     if (!isnan(slave_clock) && (isnan(clock) || fabs(clock - slave_clock) > AV_NOSYNC_THRESHOLD))
-        set_clock(c, slave_clock, slave->serial);
+        set_clock_at(c, slave_clock, snapshot.serial, time);
+}
+
+#define CLOCK_STRESS_WRITERS 2
+#define CLOCK_STRESS_READERS 4
+
+typedef struct ClockStressThread {
+    Clock *clock;
+    int index;
+    int *abort_request;
+    int64_t nb_ops;
+    int64_t nb_torn;            /* inconsistent snapshots through clock_read() */
+    int64_t nb_torn_unlocked;   /* inconsistent plain reads, shows the test can see tearing */
+} ClockStressThread;
+
+/* every write keeps last_updated == 2 * pts, serial == (int) pts and pts_drift == pts - last_updated */
+static int clock_stress_consistent(double pts, double pts_drift, double last_updated, int serial) {
+    return last_updated == 2 * pts && serial == (int) pts && pts_drift == pts - last_updated;
+}
+
+static int clock_stress_writer(void *arg) {
+    ClockStressThread *t = static_cast<ClockStressThread *>(arg);
+
+    while (!*t->abort_request) {
+        double pts = (double) (t->nb_ops++ % 1000000 * CLOCK_STRESS_WRITERS + t->index);
+        set_clock_at(t->clock, pts, (int) pts, 2 * pts);
+        if (!(t->nb_ops % 64))
+            set_clock_paused(t->clock, (int) (t->nb_ops / 64) & 1);
+    }
+    return 0;
+}
+
+static int clock_stress_reader(void *arg) {
+    ClockStressThread *t = static_cast<ClockStressThread *>(arg);
+    Clock *c = t->clock;
+    Clock snapshot;
+
+    while (!*t->abort_request) {
+        clock_read(c, &snapshot);
+        if (!clock_stress_consistent(snapshot.pts, snapshot.pts_drift, snapshot.last_updated, snapshot.serial))
+            t->nb_torn++;
+        if (!clock_stress_consistent(c->pts, c->pts_drift, c->last_updated, c->serial))
+            t->nb_torn_unlocked++;
+        t->nb_ops++;
+    }
+    return 0;
+}
+
+/* hammer one clock from concurrent writers and readers, return < 0 if a reader saw a torn snapshot */
+static int clock_stress_test(double duration) {
+    ClockStressThread threads[CLOCK_STRESS_WRITERS + CLOCK_STRESS_READERS];
+    SDL_Thread *tids[CLOCK_STRESS_WRITERS + CLOCK_STRESS_READERS];
+    int64_t nb_writes = 0, nb_reads = 0, nb_torn = 0, nb_torn_unlocked = 0;
+    int queue_serial = 0;
+    int abort_request = 0;
+    Clock clock;
+
+    memset(&clock, 0, sizeof(Clock));
+    init_clock(&clock, &queue_serial);
+    set_clock_at(&clock, 0, 0, 0);
+    for (int i = 0; i < FF_ARRAY_ELEMS(threads); i++) {
+        threads[i].clock = &clock;
+        threads[i].index = i;
+        threads[i].abort_request = &abort_request;
+        threads[i].nb_ops = threads[i].nb_torn = threads[i].nb_torn_unlocked = 0;
+        tids[i] = SDL_CreateThread(i < CLOCK_STRESS_WRITERS ? clock_stress_writer : clock_stress_reader,
+                                   "clock_stress", &threads[i]);
+        if (!tids[i]) {
+            av_log(nullptr, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+            abort_request = 1;
+            for (int j = 0; j < i; j++)
+                SDL_WaitThread(tids[j], nullptr);
+            return AVERROR(ENOMEM);
+        }
+    }
+    av_usleep((unsigned) (duration * 1000000));
+    abort_request = 1;
+    for (int i = 0; i < FF_ARRAY_ELEMS(threads); i++) {
+        SDL_WaitThread(tids[i], nullptr);
+        if (i < CLOCK_STRESS_WRITERS) {
+            nb_writes += threads[i].nb_ops;
+        } else {
+            nb_reads += threads[i].nb_ops;
+            nb_torn += threads[i].nb_torn;
+            nb_torn_unlocked += threads[i].nb_torn_unlocked;
+        }
+    }
+    av_log(nullptr, nb_torn ? AV_LOG_ERROR : AV_LOG_INFO,
+           "clock stress: writes=%" PRId64" reads=%" PRId64" torn=%" PRId64" (unsynchronized reads torn=%" PRId64")\n",
+           nb_writes, nb_reads, nb_torn, nb_torn_unlocked);
+    return nb_torn ? AVERROR_BUG : 0;
 }
 
 static int get_master_sync_type(VideoState *is) {
@@ -1578,35 +5509,322 @@ static double get_master_clock(VideoState *is) {
             val = get_clock(&is->extclk);
             break;
     }
-    return val;
+    return val;
+}
+
+static void check_external_clock_speed(VideoState *is) {
+    if (is->video_stream >= 0 && is->videoq.nb_packets <= EXTERNAL_CLOCK_MIN_FRAMES ||
+        is->audio_stream >= 0 && is->audioq.nb_packets <= EXTERNAL_CLOCK_MIN_FRAMES) {
+        set_clock_speed(&is->extclk, FFMAX(EXTERNAL_CLOCK_SPEED_MIN, is->extclk.speed - EXTERNAL_CLOCK_SPEED_STEP));
+    } else if ((is->video_stream < 0 || is->videoq.nb_packets > EXTERNAL_CLOCK_MAX_FRAMES)
+               && (is->audio_stream < 0 || is->audioq.nb_packets > EXTERNAL_CLOCK_MAX_FRAMES)) {
+        set_clock_speed(&is->extclk, FFMIN(EXTERNAL_CLOCK_SPEED_MAX, is->extclk.speed + EXTERNAL_CLOCK_SPEED_STEP));
+    } else {
+        double speed = is->extclk.speed;
+        if (speed != 1.0) {
+            set_clock_speed(&is->extclk, speed + EXTERNAL_CLOCK_SPEED_STEP * (1.0 - speed) / fabs(1.0 - speed));
+        }
+    }
+}
+
+// seek之后新位置的第一帧显示(没有视频时开始播放)了
+// -seek_bench: read_thread执行了要测的seek, 之后的包和帧按serial对应到它
+static void seek_bench_start(VideoState *is, int hit) {
+    SeekBench *sb = &is->seek_bench;
+
+    if (!sb->armed)
+        return;
+    sb->armed = 0;
+    sb->cur.hit = hit;
+    /* served from the buffer, the packets are there already */
+    sb->packet_pending = !hit;
+    if (hit)
+        sb->cur.packet_time = av_gettime_relative() - sb->request_time;
+    SDL_AtomicSet(&sb->serial, is->video_stream >= 0 ? is->videoq.serial : is->audioq.serial);
+}
+
+static void seek_bench_packet(VideoState *is, int stream_index) {
+    SeekBench *sb = &is->seek_bench;
+
+    if (sb->packet_pending && stream_index == (is->video_stream >= 0 ? is->video_stream : is->audio_stream)) {
+        sb->packet_pending = 0;
+        sb->cur.packet_time = av_gettime_relative() - sb->request_time;
+    }
+}
+
+static void seek_bench_frame(VideoState *is, int serial) {
+    SeekBench *sb = &is->seek_bench;
+
+    if (SDL_AtomicGet(&sb->serial) == serial && !sb->cur.frame_time)
+        sb->cur.frame_time = av_gettime_relative() - sb->request_time;
+}
+
+static void seek_bench_display(VideoState *is, int serial, double pts) {
+    SeekBench *sb = &is->seek_bench;
+
+    if (SDL_AtomicGet(&sb->serial) != serial || !SDL_AtomicCAS(&sb->serial, serial, -1))
+        return;
+    sb->cur.display_time = av_gettime_relative() - sb->request_time;
+    sb->cur.landed_pts = pts;
+    SDL_AtomicSet(&sb->done, 1);
+}
+
+static void seek_stats_frame(VideoState *is, int serial) {
+    SeekStats *ss = &is->seek_stats;
+    int64_t t;
+
+    if (SDL_AtomicGet(&ss->pending_serial) != serial || !SDL_AtomicCAS(&ss->pending_serial, serial, -1))
+        return;
+    t = av_gettime_relative() - ss->request_time;
+    if (ss->hit) {
+        ss->nb_hits++;
+        ss->hit_time += t;
+        ss->max_hit_time = FFMAX(ss->max_hit_time, t);
+    } else {
+        ss->nb_misses++;
+        ss->miss_time += t;
+        ss->max_miss_time = FFMAX(ss->max_miss_time, t);
+    }
+    av_log(nullptr, AV_LOG_DEBUG, "seek %s the buffer: first frame after %0.1f ms\n", ss->hit ? "in" : "outside",
+           t / 1000.0);
+}
+
+/* seek in the stream */
+static void stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes) {
+    printf("stream_seek() pos = %ld rel = %ld seek_by_bytes = %d\n", (long) pos, (long) rel, seek_by_bytes);
+    pthread_mutex_lock(&is->seek_mutex);
+    /* the latest target wins, the latency still counts from the first request */
+    if (is->seek_req)
+        is->seek_stats.nb_coalesced++;
+    else
+        is->seek_req_time = av_gettime_relative();
+    is->seek_stats.nb_requests++;
+    is->seek_pos = pos;
+    is->seek_rel = rel;
+    is->seek_flags &= ~AVSEEK_FLAG_BYTE;
+    if (seek_by_bytes)
+        is->seek_flags |= AVSEEK_FLAG_BYTE;
+    is->seek_req = 1;
+    SDL_AtomicAdd(&is->seek_gen, 1);
+    pthread_mutex_unlock(&is->seek_mutex);
+    pthread_cond_signal(&is->pcontinue_read_thread);
+}
+
+// 拖动进度条时的seek: 只读关键帧, 每个位置很快出一幅画面
+static void stream_seek_preview(VideoState *is, int64_t pos, int seek_by_bytes) {
+    is->seek_preview = 1;
+    is->seek_preview_pos = pos;
+    is->seek_preview_by_bytes = seek_by_bytes;
+    stream_seek(is, pos, 0, seek_by_bytes);
+}
+
+// 松开鼠标后在最后的位置正常seek一次
+static void stream_seek_preview_end(VideoState *is) {
+    if (!is->seek_preview)
+        return;
+    is->seek_preview = 0;
+    stream_seek(is, is->seek_preview_pos, 0, is->seek_preview_by_bytes);
+}
+
+// -seek_bench_script的每一行是一个秒数或者时长的百分比, #后面是注释
+static int seek_bench_read_script(VideoState *is, const char *filename) {
+    SeekBench *sb = &is->seek_bench;
+    double duration = is->ic->duration > 0 ? is->ic->duration / (double) AV_TIME_BASE : NAN;
+    double start = is->ic->start_time != AV_NOPTS_VALUE ? is->ic->start_time / (double) AV_TIME_BASE : 0;
+    char line[256], *end;
+    FILE *f = fopen(filename, "r");
+
+    if (!f) {
+        av_log(nullptr, AV_LOG_ERROR, "Cannot open seek script %s\n", filename);
+        return AVERROR(errno);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        double target = strtod(line, &end);
+
+        if (end == line)
+            continue;
+        if (*end == '%') {
+            if (isnan(duration)) {
+                av_log(nullptr, AV_LOG_WARNING, "Seek script: %s needs a known duration, skipped\n", line);
+                continue;
+            }
+            target = target / 100 * duration;
+        }
+        if (av_reallocp_array(&sb->targets, sb->nb_targets + 1, sizeof(*sb->targets)) < 0) {
+            fclose(f);
+            return AVERROR(ENOMEM);
+        }
+        sb->targets[sb->nb_targets++] = start + target;
+    }
+    fclose(f);
+    return 0;
+}
+
+// 随机的目标在时长的前95%里均匀分布, 同一个种子每次得到同样的序列
+static int seek_bench_random_targets(VideoState *is, int nb_seeks, int seed) {
+    SeekBench *sb = &is->seek_bench;
+    double start = is->ic->start_time != AV_NOPTS_VALUE ? is->ic->start_time / (double) AV_TIME_BASE : 0;
+    uint64_t state = (uint64_t) seed;
+
+    if (is->ic->duration <= 0) {
+        av_log(nullptr, AV_LOG_ERROR, "Random seeks need an input with a known duration\n");
+        return AVERROR(EINVAL);
+    }
+    if (!(sb->targets = static_cast<double *>(av_malloc_array(nb_seeks, sizeof(*sb->targets)))))
+        return AVERROR(ENOMEM);
+    for (int i = 0; i < nb_seeks; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        sb->targets[i] = start + (state >> 11) * (1.0 / 9007199254740992.0) * 0.95 * is->ic->duration / AV_TIME_BASE;
+    }
+    sb->nb_targets = nb_seeks;
+    return 0;
+}
+
+static int seek_bench_cmp(const void *a, const void *b) {
+    double da = *static_cast<const double *>(a), db = *static_cast<const double *>(b);
+    return (da > db) - (da < db);
+}
+
+// CSV字段总是加双引号, 里面的双引号写两遍; 文件名和"mov,mp4,m4a,..."这样的容器名都可能带逗号
+static void csv_write_field(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"')
+            fputc('"', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// 每一项的分布, 超时的seek不算在里面; -seek_bench_log把每次seek追加到CSV, 不同文件的结果按容器合在一起比较
+static void seek_bench_report(VideoState *is) {
+    static const char *const names[] = {"first packet", "first frame", "first display", "|error|"};
+    SeekBench *sb = &is->seek_bench;
+    const char *format = is->ic->iformat->name;
+    double *v = static_cast<double *>(av_malloc_array(FFMAX(sb->nb_results, 1), sizeof(double)));
+    int nb_hits = 0, nb_timed_out = 0, nb_before = 0, nb_after = 0;
+
+    if (!v)
+        return;
+    for (int i = 0; i < sb->nb_results; i++) {
+        SeekBenchResult *r = &sb->results[i];
+        nb_hits += r->hit;
+        nb_timed_out += r->timed_out;
+        if (!r->timed_out) {
+            nb_before += r->landed_pts < r->target;
+            nb_after += r->landed_pts > r->target;
+        }
+    }
+    av_log(nullptr, AV_LOG_INFO, "seek bench (%s): seeks=%d buffer hits=%d timed out=%d landed before=%d after=%d\n",
+           format, sb->nb_results, nb_hits, nb_timed_out, nb_before, nb_after);
+    for (int m = 0; m < FF_ARRAY_ELEMS(names); m++) {
+        double sum = 0;
+        int n = 0;
+
+        for (int i = 0; i < sb->nb_results; i++) {
+            SeekBenchResult *r = &sb->results[i];
+            if (r->timed_out)
+                continue;
+            switch (m) {
+                case 0: v[n] = r->packet_time / 1000.0; break;
+                case 1: v[n] = r->frame_time / 1000.0; break;
+                case 2: v[n] = r->display_time / 1000.0; break;
+                default: v[n] = fabs(r->landed_pts - r->target) * 1000.0; break;
+            }
+            sum += v[n++];
+        }
+        if (!n)
+            continue;
+        qsort(v, n, sizeof(*v), seek_bench_cmp);
+        av_log(nullptr, AV_LOG_INFO, "  %-13s ms: min=%0.1f p50=%0.1f p90=%0.1f p99=%0.1f max=%0.1f avg=%0.1f\n",
+               names[m], v[0], v[(n - 1) / 2], v[(int) ((n - 1) * 0.9)], v[(int) ((n - 1) * 0.99)], v[n - 1],
+               sum / n);
+    }
+    av_free(v);
+
+    if (seek_bench_log) {
+        FILE *f = fopen(seek_bench_log, "a");
+        if (!f) {
+            av_log(nullptr, AV_LOG_ERROR, "Cannot open %s\n", seek_bench_log);
+            return;
+        }
+        if (!ftell(f))
+            fprintf(f, "format,input,target,hit,timed_out,packet_ms,frame_ms,display_ms,landed,error_ms\n");
+        for (int i = 0; i < sb->nb_results; i++) {
+            SeekBenchResult *r = &sb->results[i];
+            csv_write_field(f, format);
+            fputc(',', f);
+            csv_write_field(f, is->filename);
+            fprintf(f, ",%0.3f,%d,%d,%0.2f,%0.2f,%0.2f,%0.3f,%0.2f\n", r->target, r->hit, r->timed_out,
+                    r->packet_time / 1000.0, r->frame_time / 1000.0, r->display_time / 1000.0, r->landed_pts, r->timed_out ? 0.0 : (r->landed_pts - r->target) * 1000.0);
+        }
+        fclose(f);
+    }
 }
 
-static void check_external_clock_speed(VideoState *is) {
-    if (is->video_stream >= 0 && is->videoq.nb_packets <= EXTERNAL_CLOCK_MIN_FRAMES ||
-        is->audio_stream >= 0 && is->audioq.nb_packets <= EXTERNAL_CLOCK_MIN_FRAMES) {
-        set_clock_speed(&is->extclk, FFMAX(EXTERNAL_CLOCK_SPEED_MIN, is->extclk.speed - EXTERNAL_CLOCK_SPEED_STEP));
-    } else if ((is->video_stream < 0 || is->videoq.nb_packets > EXTERNAL_CLOCK_MAX_FRAMES)
-               && (is->audio_stream < 0 || is->audioq.nb_packets > EXTERNAL_CLOCK_MAX_FRAMES)) {
-        set_clock_speed(&is->extclk, FFMIN(EXTERNAL_CLOCK_SPEED_MAX, is->extclk.speed + EXTERNAL_CLOCK_SPEED_STEP));
-    } else {
-        double speed = is->extclk.speed;
-        if (speed != 1.0) {
-            set_clock_speed(&is->extclk, speed + EXTERNAL_CLOCK_SPEED_STEP * (1.0 - speed) / fabs(1.0 - speed));
+// 等第一帧出来后依次seek到每个目标, 每次都走stream_seek()和read_thread, 等到新位置的第一帧显示
+static int seek_bench_thread(void *arg) {
+    VideoState *is = static_cast<VideoState *>(arg);
+    SeekBench *sb = &is->seek_bench;
+    int64_t start = av_gettime_relative();
+    SDL_Event event;
+
+    while (!sb->abort_request && !(is->video_st ? is->pictq.rindex_shown : is->audio_clock_serial >= 0)) {
+        if (av_gettime_relative() - start > SEEK_BENCH_TIMEOUT) {
+            av_log(nullptr, AV_LOG_ERROR, "Seek bench: playback didn't start\n");
+            goto end;
+        }
+        av_usleep(10000);
+    }
+    if (sb->abort_request ||
+        (seek_bench_script ? seek_bench_read_script(is, seek_bench_script)
+                           : seek_bench_random_targets(is, seek_bench, seek_bench_seed)) < 0 ||
+        !(sb->results = static_cast<SeekBenchResult *>(av_calloc(FFMAX(sb->nb_targets, 1), sizeof(*sb->results)))))
+        goto end;
+
+    for (int i = 0; i < sb->nb_targets && !sb->abort_request; i++) {
+        memset(&sb->cur, 0, sizeof(sb->cur));
+        sb->cur.target = sb->targets[i];
+        SDL_AtomicSet(&sb->done, 0);
+        sb->request_time = av_gettime_relative();
+        sb->armed = 1;
+        stream_seek(is, (int64_t) (sb->targets[i] * AV_TIME_BASE), 0, 0);
+        while (!sb->abort_request && !SDL_AtomicGet(&sb->done)) {
+            if (av_gettime_relative() - sb->request_time > SEEK_BENCH_TIMEOUT) {
+                sb->armed = 0;
+                SDL_AtomicSet(&sb->serial, -1);
+                sb->cur.timed_out = 1;
+                break;
+            }
+            av_usleep(1000);
         }
+        sb->results[sb->nb_results++] = sb->cur;
+        av_log(nullptr, AV_LOG_VERBOSE, "seek bench %d/%d: %0.3f -> %0.3f in %0.1f ms\n", i + 1, sb->nb_targets,
+               sb->cur.target, sb->cur.landed_pts, sb->cur.display_time / 1000.0);
+        av_usleep(SEEK_BENCH_SETTLE);
     }
+    if (!sb->abort_request)
+        seek_bench_report(is);
+
+    end:
+    if (!sb->abort_request) {
+        event.type = FF_QUIT_EVENT;
+        event.user.data1 = is;
+        SDL_PushEvent(&event);
+    }
+    return 0;
 }
 
-/* seek in the stream */
-static void stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes) {
-    printf("stream_seek() pos = %ld rel = %ld seek_by_bytes = %d\n", (long) pos, (long) rel, seek_by_bytes);
-    if (!is->seek_req) {
-        is->seek_req = 1;
-        is->seek_pos = pos;
-        is->seek_rel = rel;
-        is->seek_flags &= ~AVSEEK_FLAG_BYTE;
-        if (seek_by_bytes)
-            is->seek_flags |= AVSEEK_FLAG_BYTE;
-        pthread_cond_signal(&is->pcontinue_read_thread);
+static void seek_bench_begin(VideoState *is) {
+    SeekBench *sb = &is->seek_bench;
+
+    SDL_AtomicSet(&sb->serial, -1);
+    is->muted = 1;
+    /* like the clock stress test, not a playback thread with a role */
+    sb->tid = SDL_CreateThread(seek_bench_thread, "seek_bench", is);
+    if (!sb->tid) {
+        av_log(nullptr, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+        do_exit(is);
     }
 }
 
@@ -1614,14 +5832,19 @@ static void stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_by
 static void stream_toggle_pause(VideoState *is) {
     printf("stream_toggle_pause() before is->paused = %d\n", is->paused);
     if (is->paused) {
-        is->frame_timer += av_gettime_relative() / 1000000.0 - is->vidclk.last_updated;
+        Clock vidclk;
+        clock_read(&is->vidclk, &vidclk);
+        is->frame_timer += av_gettime_relative() / 1000000.0 - vidclk.last_updated;
         if (is->read_pause_return != AVERROR(ENOSYS)) {
-            is->vidclk.paused = 0;
+            set_clock_paused(&is->vidclk, 0);
         }
-        set_clock(&is->vidclk, get_clock(&is->vidclk), is->vidclk.serial);
+        restart_clock(&is->vidclk);
     }
-    set_clock(&is->extclk, get_clock(&is->extclk), is->extclk.serial);
-    is->paused = is->audclk.paused = is->vidclk.paused = is->extclk.paused = !is->paused;
+    restart_clock(&is->extclk);
+    is->paused = !is->paused;
+    set_clock_paused(&is->audclk, is->paused);
+    set_clock_paused(&is->vidclk, is->paused);
+    set_clock_paused(&is->extclk, is->paused);
     printf("stream_toggle_pause() after  is->paused = %d\n", is->paused);
 }
 
@@ -1649,6 +5872,140 @@ static void step_to_next_frame(VideoState *is) {
     is->step = 1;
 }
 
+// 从屏幕上的帧开始倒放或向后单步, 正向播放先暂停
+static void reverse_start(VideoState *is, int mode) {
+    ReversePlayer *rp = &is->rev;
+    Frame *lastvp;
+
+    if (!is->video_st || (is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC) || is->realtime ||
+        !is->pictq.rindex_shown)
+        return;
+    lastvp = frame_queue_peek_last(&is->pictq);
+    if (isnan(lastvp->pts))
+        return;
+
+    rp->was_paused = is->paused;
+    if (!is->paused)
+        stream_toggle_pause(is);
+    is->step = 0;
+    rp->start_pts = lastvp->pts;
+    rp->frame_duration = av_q2d(av_inv_q(av_guess_frame_rate(is->ic, is->video_st, nullptr)));
+    if (!(rp->frame_duration > 0) || rp->frame_duration > is->max_frame_duration)
+        rp->frame_duration = 0.04;
+    rp->max_size = (int64_t) reverse_cache * 1024 * 1024;
+    rp->abort_request = 0;
+    rp->eof = 0;
+    rp->mode = mode;
+    rp->step_req = 1;
+    rp->frame_timer = av_gettime_relative() / 1000000.0;
+    rp->tid = thread_create(reverse_thread, "reverse", is, THREAD_ROLE_VIDEO);
+    if (!rp->tid) {
+        av_log(nullptr, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        rp->mode = REVERSE_OFF;
+        if (!rp->was_paused)
+            stream_toggle_pause(is);
+    }
+}
+
+// 回到正向播放; resume时seek到最后显示的帧, 没有显示过倒放的帧就留在原来的位置
+static void reverse_stop(VideoState *is, int resume) {
+    ReversePlayer *rp = &is->rev;
+
+    reverse_thread_stop(rp);
+    reverse_flush(rp);
+    rp->mode = REVERSE_OFF;
+    if (rp->shown.frame->buf[0]) {
+        if (resume) {
+            rp->resume_pts = rp->shown.pts;
+            /* a negative rel makes read_thread take the keyframe before the frame */
+            stream_seek(is, (int64_t) (rp->shown.pts * AV_TIME_BASE), -2, 0);
+            rp->resume_gen = SDL_AtomicGet(&is->seek_gen);
+            rp->resume_req = 1;
+        }
+        pthread_mutex_lock(&rp->pmutex);
+        av_frame_unref(rp->shown.frame);
+        pthread_mutex_unlock(&rp->pmutex);
+        /* the texture holds the last reverse frame now */
+        frame_queue_peek_last(&is->pictq)->uploaded = 0;
+    }
+    if (!rp->was_paused && is->paused)
+        stream_toggle_pause(is);
+    is->force_refresh = 1;
+}
+
+static void reverse_command(VideoState *is, int mode) {
+    ReversePlayer *rp = &is->rev;
+
+    if (rp->mode == REVERSE_OFF) {
+        reverse_start(is, mode);
+    } else if (mode == REVERSE_STEP) {
+        rp->mode = REVERSE_STEP;
+        rp->step_req = 1;
+    } else if (rp->mode == REVERSE_PLAY) {
+        reverse_stop(is, 1);
+    } else {
+        rp->mode = REVERSE_PLAY;
+        rp->frame_timer = av_gettime_relative() / 1000000.0;
+    }
+}
+
+// 倒放时代替pictq: 到时间就从缓存取下一帧(pts更小的), 单步时每个请求取一帧
+static void reverse_refresh(VideoState *is, double *remaining_time) {
+    ReversePlayer *rp = &is->rev;
+    ReverseFrame *rf;
+    double time = av_gettime_relative() / 1000000.0;
+    double delay;
+
+    pthread_mutex_lock(&rp->pmutex);
+    rf = rp->first;
+    if (rf && rp->mode == REVERSE_PLAY && rp->shown.frame->buf[0]) {
+        delay = rp->shown.pts - rf->pts;
+        if (isnan(delay) || delay <= 0 || delay > is->max_frame_duration)
+            delay = rp->frame_duration;
+        if (time < rp->frame_timer + delay) {
+            *remaining_time = FFMIN(*remaining_time, rp->frame_timer + delay - time);
+            rf = nullptr;
+        } else {
+            rp->frame_timer += delay;
+            if (time - rp->frame_timer > AV_SYNC_THRESHOLD_MAX)
+                rp->frame_timer = time;
+        }
+    } else if (rf && rp->mode == REVERSE_STEP && !rp->step_req) {
+        rf = nullptr;
+    }
+    if (rf) {
+        rp->first = rf->next;
+        if (!rp->first)
+            rp->last = nullptr;
+        rp->queued_size -= rf->size;
+        pthread_cond_signal(&rp->pcond);
+    } else if (rp->eof && !rp->first && rp->mode == REVERSE_PLAY) {
+        /* nothing before this frame, wait on it like a backward step would */
+        rp->mode = REVERSE_STEP;
+    }
+    pthread_mutex_unlock(&rp->pmutex);
+    if (!rf)
+        return;
+
+    if (rp->mode == REVERSE_PLAY && !rp->shown.frame->buf[0])
+        rp->frame_timer = time;
+    /* event_loop reads shown for relative seeks */
+    pthread_mutex_lock(&rp->pmutex);
+    av_frame_unref(rp->shown.frame);
+    av_frame_move_ref(rp->shown.frame, rf->frame);
+    rp->shown.pts = rf->pts;
+    rp->shown.width = rp->shown.frame->width;
+    rp->shown.height = rp->shown.frame->height;
+    rp->shown.format = rp->shown.frame->format;
+    rp->shown.sar = rp->shown.frame->sample_aspect_ratio;
+    rp->shown.uploaded = 0;
+    pthread_mutex_unlock(&rp->pmutex);
+    rp->step_req = 0;
+    rp->nb_shown_frames++;
+    reverse_frame_free(&rf);
+    is->force_refresh = 1;
+}
+
 static double compute_target_delay(double delay, VideoState *is) {
     double sync_threshold, diff = 0;
 
@@ -1709,7 +6066,8 @@ static void video_refresh(void *opaque, double *remaining_time) {
     // endregion
 
     // region 第一个条件不满足
-    if (is->show_mode != VideoState::SHOW_MODE_VIDEO && !display_disable && is->audio_st) {
+    if (is->show_mode != VideoState::SHOW_MODE_VIDEO && !display_disable && is->audio_st
+        && !(SDL_GetWindowFlags(window) & (SDL_WINDOW_HIDDEN | SDL_WINDOW_MINIMIZED))) {
         time = av_gettime_relative() / 1000000.0;
         if (is->force_refresh || is->last_vis_time + rdftspeed < time) {
             video_display(is);
@@ -1721,6 +6079,10 @@ static void video_refresh(void *opaque, double *remaining_time) {
 
     // region is->video_st
     if (is->video_st) {
+        if (is->rev.mode != REVERSE_OFF) {
+            reverse_refresh(is, remaining_time);
+            goto display;
+        }
         retry:
         if (frame_queue_nb_remaining(&is->pictq) == 0) {
             // nothing to do, no picture to display in the queue
@@ -1742,7 +6104,11 @@ static void video_refresh(void *opaque, double *remaining_time) {
 
             if (vp->serial != lastvp->serial) {
                 is->frame_timer = av_gettime_relative() / 1000000.0;
+                seek_stats_frame(is, vp->serial);
+                seek_bench_display(is, vp->serial, vp->pts);
             }
+            if (is->zap_start)
+                zap_first_frame(is);
 
             // 如果是暂停操作,则进行重复播放最后一帧画面
             if (is->paused) {
@@ -1757,8 +6123,10 @@ static void video_refresh(void *opaque, double *remaining_time) {
             // 获取当前时间
             time = av_gettime_relative() / 1000000.0;
             // 如果当前时间小于需要播放的时间.意味着将要显示的帧还没有到时间播放.故需要继续播放上一帧画面，继续延迟remaining_time时间
-            if (time < is->frame_timer + delay) {
-                *remaining_time = FFMIN(is->frame_timer + delay - time, *remaining_time);
+            // 开启vsync时以离播放时间最近的vblank为准
+            if (present_time_until_due(&is->present, is->frame_timer + delay, time) > 0) {
+                *remaining_time = FFMIN(present_time_until_due(&is->present, is->frame_timer + delay, time),
+                                        *remaining_time);
                 goto display;
             }
 
@@ -1787,6 +6155,8 @@ static void video_refresh(void *opaque, double *remaining_time) {
 
             // region is->subtitle_st
             if (is->subtitle_st) {
+                Clock vidclk;
+                clock_read(&is->vidclk, &vidclk);
                 while (frame_queue_nb_remaining(&is->subpq) > 0) {
                     sp = frame_queue_peek(&is->subpq);
 
@@ -1796,8 +6166,8 @@ static void video_refresh(void *opaque, double *remaining_time) {
                         sp2 = nullptr;
 
                     if (sp->serial != is->subtitleq.serial
-                        || (is->vidclk.pts > (sp->pts + ((float) sp->sub.end_display_time / 1000)))
-                        || (sp2 && is->vidclk.pts > (sp2->pts + ((float) sp2->sub.start_display_time / 1000)))) {
+                        || (vidclk.pts > (sp->pts + ((float) sp->sub.end_display_time / 1000)))
+                        || (sp2 && vidclk.pts > (sp2->pts + ((float) sp2->sub.start_display_time / 1000)))) {
                         if (sp->uploaded) {
                             int i;
                             for (i = 0; i < sp->sub.num_rects; i++) {
@@ -1822,120 +6192,751 @@ static void video_refresh(void *opaque, double *remaining_time) {
             }// subtitle
             // endregion
 
+            if (time - is->frame_timer > FFMAX(REFRESH_RATE, is->present.enabled ? is->present.period : 0))
+                is->frame_deadline_misses++;
             frame_queue_next(&is->pictq);
             is->force_refresh = 1;
+            is->present.frame_slot = present_next_vsync(&is->present, av_gettime_relative() / 1000000.0);
 
             if (is->step && !is->paused) {
                 stream_toggle_pause(is);
             }
         }
 
-        display:
-        /* display picture */
-        if (!display_disable
-            && is->force_refresh
-            && is->show_mode == VideoState::SHOW_MODE_VIDEO
-            && is->pictq.rindex_shown) {
-            video_display(is);
-        }
+        display:
+        /* display picture */
+        if (!display_disable
+            && is->force_refresh
+            && is->show_mode == VideoState::SHOW_MODE_VIDEO
+            && is->pictq.rindex_shown) {
+            video_display(is);
+        }
+    }
+    // endregion
+
+    is->force_refresh = 0;
+
+    // region 只是输出有关视频信息
+    /*if (show_status) {// -1
+        AVBPrint buf;
+        static int64_t last_time;
+        int64_t cur_time;
+        int aqsize, vqsize, sqsize;
+        double av_diff;
+
+        cur_time = av_gettime_relative();
+        if (!last_time || (cur_time - last_time) >= 30000) {
+            aqsize = 0;
+            vqsize = 0;
+            sqsize = 0;
+            if (is->audio_st) {
+                aqsize = is->audioq.size;
+            }
+            if (is->video_st) {
+                vqsize = is->videoq.size;
+            }
+            if (is->subtitle_st) {
+                sqsize = is->subtitleq.size;
+            }
+            av_diff = 0;
+            if (is->audio_st && is->video_st) {
+                av_diff = get_clock(&is->audclk) - get_clock(&is->vidclk);
+            } else if (is->video_st) {
+                av_diff = get_master_clock(is) - get_clock(&is->vidclk);
+            } else if (is->audio_st) {
+                av_diff = get_master_clock(is) - get_clock(&is->audclk);
+            }
+
+            av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
+            av_bprintf(&buf,
+                       "%7.2f %s:%7.3f fd=%4d pd=%4" PRId64" dl=%d aq=%5dKB vq=%5dKB sq=%5dB f=%" PRId64"/%" PRId64"   \r\n",
+                       get_master_clock(is),
+                       (is->audio_st && is->video_st) ? "A-V" : (is->video_st ? "M-V" : (is->audio_st ? "M-A" : "   ")),
+                       av_diff,
+                       is->frame_drops_early + is->frame_drops_late,
+                       is->pktdrop.nb_dropped_late + is->pktdrop.nb_dropped_queue,
+                       is->ladder.level,
+                       aqsize / 1024,
+                       vqsize / 1024,
+                       sqsize,
+                       is->video_st ? is->viddec.avctx->pts_correction_num_faulty_dts : 0,
+                       is->video_st ? is->viddec.avctx->pts_correction_num_faulty_pts : 0);
+
+            if (show_status == 1 && AV_LOG_INFO > av_log_get_level()) {
+                fprintf(stderr, "%s\n", buf.str);
+            } else {
+                av_log(nullptr, AV_LOG_INFO, "%s\n", buf.str);
+            }
+
+            fflush(stderr);
+            av_bprint_finalize(&buf, nullptr);
+
+            last_time = cur_time;
+        }
+    }*/
+    // endregion
+}
+
+static int queue_picture(VideoState *is, AVFrame *src_frame, double pts, double duration, int64_t pos, int serial) {
+    Frame *vp;
+    int64_t start = av_gettime_relative();
+
+#if defined(DEBUG_SYNC)
+    printf("frame_type=%c pts=%0.3f\n",
+           av_get_picture_type_char(src_frame->pict_type), pts);
+#endif
+
+    if (!(vp = frame_queue_peek_writable(&is->pictq)))
+        return -1;
+    is->viddec.blocked_time += av_gettime_relative() - start;
+
+    vp->sar = src_frame->sample_aspect_ratio;
+    vp->uploaded = 0;
+
+    vp->width = src_frame->width;
+    vp->height = src_frame->height;
+    vp->format = src_frame->format;
+
+    vp->pts = pts;
+    vp->duration = duration;
+    vp->pos = pos;
+    vp->serial = serial;
+
+    set_default_window_size(vp->width, vp->height, vp->sar);
+
+    av_frame_move_ref(vp->frame, src_frame);
+    frame_queue_push(&is->pictq);
+    /* the refresh loop sleeps long while it has nothing to show */
+    if (frame_queue_nb_remaining(&is->pictq) == 1)
+        refresh_wakeup(is);
+    return 0;
+}
+
+static void packet_dropper_init(PacketDropper *pd, const AVCodecParameters *par) {
+    memset(pd, 0, sizeof(PacketDropper));
+    pd->codec_id = par->codec_id;
+    pd->hevc_max_tid = -1;
+    pd->reorder = par->video_delay > 0;
+    if (par->extradata_size >= 7 && par->extradata[0] == 1) {
+        if (par->codec_id == AV_CODEC_ID_H264) {
+            pd->nal_length_size = (par->extradata[4] & 3) + 1;
+        } else if (par->codec_id == AV_CODEC_ID_HEVC && par->extradata_size >= 23) {
+            pd->nal_length_size = (par->extradata[21] & 3) + 1;
+            /* numTemporalLayers, 0 means unknown */
+            pd->hevc_max_tid = ((par->extradata[21] >> 3) & 7) - 1;
+        }
+    }
+}
+
+// 取出包中的下一个NAL单元; 起始码格式时size是到包末尾的长度, 只用来判断NAL头是否完整
+static const uint8_t *packet_next_nal(const uint8_t **pp, const uint8_t *end, int nal_length_size, int *size) {
+    const uint8_t *p = *pp;
+
+    if (nal_length_size) {
+        uint32_t len = 0;
+        if (end - p < nal_length_size)
+            return nullptr;
+        for (int i = 0; i < nal_length_size; i++)
+            len = len << 8 | *p++;
+        if (!len || len > end - p)
+            return nullptr;
+        *pp = p + len;
+        *size = len;
+        return p;
+    }
+
+    for (; end - p > 3; p++) {
+        if (!p[0] && !p[1] && p[2] == 1) {
+            *pp = p + 4;
+            *size = static_cast<int>(end - p - 3);
+            return p + 3;
+        }
+    }
+    return nullptr;
+}
+
+// 包中的图像是否没有别的图像参考它, 拿不准时返回0
+static int packet_is_disposable(PacketDropper *pd, const AVPacket *pkt) {
+    const uint8_t *p = pkt->data;
+    const uint8_t *end = pkt->data + pkt->size;
+    const uint8_t *nal;
+    int size;
+
+    if (pkt->flags & AV_PKT_FLAG_DISCARDABLE)
+        return 1;
+    switch (pd->codec_id) {
+        case AV_CODEC_ID_H264:
+            while ((nal = packet_next_nal(&p, end, pd->nal_length_size, &size))) {
+                int type = nal[0] & 0x1f;
+                /* all slices of a picture have the same nal_ref_idc, the first one decides */
+                if (type >= 1 && type <= 5)
+                    return type != 5 && !(nal[0] & 0x60);
+            }
+            return 0;
+        case AV_CODEC_ID_HEVC:
+            while ((nal = packet_next_nal(&p, end, pd->nal_length_size, &size))) {
+                if (size < 2)
+                    return 0;
+                int type = (nal[0] >> 1) & 0x3f;
+                int tid = (nal[1] & 7) - 1;
+                if (type == 32 && size >= 4) {
+                    /* VPS: vps_max_sub_layers_minus1 */
+                    pd->hevc_max_tid = (nal[3] >> 1) & 7;
+                } else if (type < 32) {
+                    /* sub-layer non-reference pictures (even types below 16) may still be
+                     * referenced by higher sub-layers, so only the highest one can go */
+                    return type < 16 && !(type & 1) && pd->hevc_max_tid >= 0 && tid >= pd->hevc_max_tid;
+                }
+            }
+            return 0;
+        case AV_CODEC_ID_MPEG1VIDEO:
+        case AV_CODEC_ID_MPEG2VIDEO:
+            /* picture_coding_type of the first picture header, 3 is a B picture */
+            for (; end - p >= 6; p++)
+                if (!p[0] && !p[1] && p[2] == 1 && p[3] == 0x00)
+                    return ((p[5] >> 3) & 7) == 3;
+            return 0;
+        case AV_CODEC_ID_MPEG4:
+            /* vop_coding_type of the first VOP, 2 is a B-VOP */
+            for (; end - p >= 5; p++)
+                if (!p[0] && !p[1] && p[2] == 1 && p[3] == 0xb6)
+                    return (p[4] >> 6) == 2;
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+// 包是否是IDR或闭合GOP的开头: 之后的帧(包括显示顺序在它前面的)都不参考它前面的帧, 拿不准时返回0
+static int packet_is_switch_point(PacketDropper *pd, const AVPacket *pkt) {
+    const uint8_t *p = pkt->data;
+    const uint8_t *end = pkt->data + pkt->size;
+    const uint8_t *nal;
+    int size;
+
+    if (!(pkt->flags & AV_PKT_FLAG_KEY))
+        return 0;
+    switch (pd->codec_id) {
+        case AV_CODEC_ID_H264:
+            /* keyframes flagged from a recovery point SEI are not IDR pictures */
+            while ((nal = packet_next_nal(&p, end, pd->nal_length_size, &size))) {
+                int type = nal[0] & 0x1f;
+                if (type >= 1 && type <= 5)
+                    return type == 5;
+            }
+            return 0;
+        case AV_CODEC_ID_HEVC:
+            /* IDR and BLA, a CRA can have leading pictures that reference the previous GOP */
+            while ((nal = packet_next_nal(&p, end, pd->nal_length_size, &size))) {
+                int type = (nal[0] >> 1) & 0x3f;
+                if (type < 32)
+                    return type >= 16 && type <= 20;
+            }
+            return 0;
+        case AV_CODEC_ID_MPEG1VIDEO:
+        case AV_CODEC_ID_MPEG2VIDEO:
+            /* closed_gop of the group_of_pictures header */
+            for (; end - p >= 8; p++)
+                if (!p[0] && !p[1] && p[2] == 1 && p[3] == 0xb8)
+                    return (p[7] >> 6) & 1;
+            return !pd->reorder;
+        case AV_CODEC_ID_MPEG4:
+            /* closed_gov of the group_of_vop header */
+            for (; end - p >= 7; p++)
+                if (!p[0] && !p[1] && p[2] == 1 && p[3] == 0xb3)
+                    return (p[6] >> 5) & 1;
+            return !pd->reorder;
+        default:
+            /* other codecs flag only frames that reset the references as keyframes */
+            return 1;
+    }
+}
+
+static int video_packet_switch_point(void *opaque, const AVPacket *pkt) {
+    VideoState *is = static_cast<VideoState *>(opaque);
+
+    return packet_is_switch_point(&is->pktdrop, pkt);
+}
+
+// viddec的packet_filter: 视频已经落后于主时钟, 或者实时流的包队列太长时, 在解码之前丢掉非参考帧
+static int video_packet_filter(void *opaque, AVPacket *pkt) {
+    VideoState *is = static_cast<VideoState *>(opaque);
+    PacketDropper *pd = &is->pktdrop;
+    int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    double diff = NAN;
+    int deep = 0;
+
+    /* learn the number of sub-layers from the VPS in front of a keyframe */
+    if (pd->codec_id == AV_CODEC_ID_HEVC && pd->hevc_max_tid < 0 && (pkt->flags & AV_PKT_FLAG_KEY))
+        packet_is_disposable(pd, pkt);
+
+    if (is->paused || !(framedrop > 0 || (framedrop && get_master_sync_type(is) != AV_SYNC_VIDEO_MASTER)))
+        return 0;
+    if (is->realtime)
+        deep = is->videoq.duration * av_q2d(is->video_st->time_base) > PACKET_DROP_QUEUE_DURATION;
+    if (!deep) {
+        if (ts != AV_NOPTS_VALUE && is->viddec.pkt_serial == get_clock_serial(&is->vidclk))
+            diff = get_master_clock(is) - ts * av_q2d(is->video_st->time_base);
+        if (isnan(diff) || diff > AV_NOSYNC_THRESHOLD || diff < PACKET_DROP_LATE_THRESHOLD + is->frame_last_filter_delay)
+            return 0;
+    }
+    if (!packet_is_disposable(pd, pkt))
+        return 0;
+
+    if (deep)
+        pd->nb_dropped_queue++;
+    else
+        pd->nb_dropped_late++;
+    return 1;
+}
+
+static void decode_unit_free(DecodeUnit **pu) {
+    DecodeUnit *u = *pu;
+
+    if (!u)
+        return;
+    for (int i = 0; i < u->nb_pkts; i++)
+        av_packet_unref(&u->pkts[i]);
+    for (int i = 0; i < u->nb_frames; i++)
+        av_frame_free(&u->frames[i]);
+    av_freep(&u->pkts);
+    av_freep(&u->frames);
+    av_freep(pu);
+}
+
+static int decode_unit_add_packet(DecodeUnit *u, AVPacket *pkt) {
+    AVPacket *pkts = static_cast<AVPacket *>(av_realloc_array(u->pkts, u->nb_pkts + 1, sizeof(AVPacket)));
+
+    if (!pkts)
+        return AVERROR(ENOMEM);
+    u->pkts = pkts;
+    av_packet_move_ref(&u->pkts[u->nb_pkts++], pkt);
+    return 0;
+}
+
+// 工作线程解出一帧, 在pmutex下调用
+static int decode_unit_add_frame(DecodeUnit *u, AVFrame *frame) {
+    AVFrame **frames = static_cast<AVFrame **>(av_realloc_array(u->frames, u->nb_frames + 1, sizeof(AVFrame *)));
+
+    if (!frames)
+        return AVERROR(ENOMEM);
+    u->frames = frames;
+    if (!(u->frames[u->nb_frames] = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    av_frame_move_ref(u->frames[u->nb_frames++], frame);
+    return 0;
+}
+
+// 每个工作线程有自己的解码器上下文, 取走队列中最早的一个单位从关键帧开始解码, 解到单位结束后冲刷解码器
+static int parallel_decoder_worker(void *arg) {
+    ParallelDecoderWorker *w = static_cast<ParallelDecoderWorker *>(arg);
+    VideoState *is = w->is;
+    ParallelDecoder *pd = &is->pdec;
+    AVFrame *frame = av_frame_alloc();
+    DecodeUnit *u;
+    int64_t start;
+    int ret;
+
+    if (!frame)
+        return AVERROR(ENOMEM);
+    pthread_mutex_lock(&pd->pmutex);
+    for (;;) {
+        for (u = pd->first; u && u->state != PDEC_UNIT_QUEUED; u = u->next);
+        if (pd->abort_request)
+            break;
+        if (!u) {
+            pthread_cond_wait(&pd->work_cond, &pd->pmutex);
+            continue;
+        }
+        u->state = PDEC_UNIT_DECODING;
+        pthread_mutex_unlock(&pd->pmutex);
+
+        start = av_gettime_relative();
+        /* the packets belong to the unit until it is done, the video thread doesn't touch them */
+        for (int i = 0; i <= u->nb_pkts;) {
+            int got = 0, again;
+
+            if (pd->abort_request || u->serial != is->videoq.serial)
+                break;
+            ret = avcodec_send_packet(w->avctx, i < u->nb_pkts ? &u->pkts[i] : nullptr);
+            /* EAGAIN: the same packet goes again once the frames in the way are out */
+            if (!(again = ret == AVERROR(EAGAIN)))
+                i++;
+            while ((ret = avcodec_receive_frame(w->avctx, frame)) >= 0) {
+                got = 1;
+                if (decoder_reorder_pts == -1)
+                    frame->pts = frame->best_effort_timestamp;
+                else if (!decoder_reorder_pts)
+                    frame->pts = frame->pkt_dts;
+                pthread_mutex_lock(&pd->pmutex);
+                if (decode_unit_add_frame(u, frame) < 0)
+                    av_frame_unref(frame);
+                pd->nb_decoded_frames++;
+                pthread_cond_signal(&pd->done_cond);
+                /* a long GOP would otherwise pile up all its frames before the video thread reaches it */
+                while (u->nb_frames - u->rindex >= PDEC_UNIT_MAX_FRAMES && !pd->abort_request &&
+                       u->serial == is->videoq.serial)
+                    pthread_cond_wait(&pd->read_cond, &pd->pmutex);
+                pthread_mutex_unlock(&pd->pmutex);
+            }
+            if (again && !got) {
+                /* both calls want the other one first, skip the packet rather than spin */
+                i++;
+            }
+        }
+        avcodec_flush_buffers(w->avctx);
+
+        pthread_mutex_lock(&pd->pmutex);
+        pd->busy_time += av_gettime_relative() - start;
+        pd->nb_decoded_units++;
+        u->state = PDEC_UNIT_DONE;
+        pthread_cond_signal(&pd->done_cond);
     }
-    // endregion
+    pthread_mutex_unlock(&pd->pmutex);
+    av_frame_free(&frame);
+    return 0;
+}
 
-    is->force_refresh = 0;
+// 把收集好的单位排到队尾交给工作线程
+static void parallel_decoder_dispatch(ParallelDecoder *pd, DecodeUnit **pu) {
+    DecodeUnit *u = *pu;
 
-    // region 只是输出有关视频信息
-    /*if (show_status) {// -1
-        AVBPrint buf;
-        static int64_t last_time;
-        int64_t cur_time;
-        int aqsize, vqsize, sqsize;
-        double av_diff;
+    if (!u)
+        return;
+    *pu = nullptr;
+    if (!u->nb_pkts) {
+        decode_unit_free(&u);
+        return;
+    }
+    u->state = PDEC_UNIT_QUEUED;
+    pthread_mutex_lock(&pd->pmutex);
+    if (pd->last)
+        pd->last->next = u;
+    else
+        pd->first = u;
+    pd->last = u;
+    pd->nb_units++;
+    pthread_cond_signal(&pd->work_cond);
+    pthread_mutex_unlock(&pd->pmutex);
+}
 
-        cur_time = av_gettime_relative();
-        if (!last_time || (cur_time - last_time) >= 30000) {
-            aqsize = 0;
-            vqsize = 0;
-            sqsize = 0;
-            if (is->audio_st) {
-                aqsize = is->audioq.size;
-            }
-            if (is->video_st) {
-                vqsize = is->videoq.size;
-            }
-            if (is->subtitle_st) {
-                sqsize = is->subtitleq.size;
-            }
-            av_diff = 0;
-            if (is->audio_st && is->video_st) {
-                av_diff = get_clock(&is->audclk) - get_clock(&is->vidclk);
-            } else if (is->video_st) {
-                av_diff = get_master_clock(is) - get_clock(&is->vidclk);
-            } else if (is->audio_st) {
-                av_diff = get_master_clock(is) - get_clock(&is->audclk);
-            }
+// 按模式把包分成单位: intra每个包一个单位, gop在每个IDR或闭合GOP处开始新的单位
+static void parallel_decoder_put_packet(VideoState *is, AVPacket *pkt, int serial) {
+    ParallelDecoder *pd = &is->pdec;
+    Decoder *d = &is->viddec;
 
-            av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
-            av_bprintf(&buf,
-                       "%7.2f %s:%7.3f fd=%4d aq=%5dKB vq=%5dKB sq=%5dB f=%" PRId64"/%" PRId64"   \r\n",
-                       get_master_clock(is),
-                       (is->audio_st && is->video_st) ? "A-V" : (is->video_st ? "M-V" : (is->audio_st ? "M-A" : "   ")),
-                       av_diff,
-                       is->frame_drops_early + is->frame_drops_late,
-                       aqsize / 1024,
-                       vqsize / 1024,
-                       sqsize,
-                       is->video_st ? is->viddec.avctx->pts_correction_num_faulty_dts : 0,
-                       is->video_st ? is->viddec.avctx->pts_correction_num_faulty_pts : 0);
+    if (serial != d->queue->serial) {
+        av_packet_unref(pkt);
+        return;
+    }
+    if (pkt->data == flush_pkt.data) {
+        /* a seek: the units of the old serial are skipped by the workers and the collector */
+        decode_unit_free(&pd->open);
+        pthread_mutex_lock(&pd->pmutex);
+        pthread_cond_broadcast(&pd->read_cond);
+        pthread_mutex_unlock(&pd->pmutex);
+        pd->eof_serial = -1;
+        d->finished = 0;
+        return;
+    }
+    if (!pkt->data) {
+        /* end of stream, the last unit is complete */
+        parallel_decoder_dispatch(pd, &pd->open);
+        pd->eof_serial = serial;
+        return;
+    }
+    if (d->packet_filter && d->packet_filter(d->packet_filter_opaque, pkt)) {
+        av_packet_unref(pkt);
+        return;
+    }
+    /* frames after an open GOP keyframe (CRA, recovery point) may reference the previous GOP,
+     * the unit only ends where nothing reaches back */
+    if (pd->mode == PDEC_GOP && pd->open && packet_is_switch_point(&is->pktdrop, pkt))
+        parallel_decoder_dispatch(pd, &pd->open);
+    if (!pd->open) {
+        if (!(pkt->flags & AV_PKT_FLAG_KEY) && pd->mode == PDEC_GOP) {
+            /* nothing to decode it from */
+            pd->nb_skipped_packets++;
+            av_packet_unref(pkt);
+            return;
+        }
+        if (!(pd->open = static_cast<DecodeUnit *>(av_mallocz(sizeof(DecodeUnit))))) {
+            av_packet_unref(pkt);
+            return;
+        }
+        pd->open->serial = serial;
+    }
+    if (decode_unit_add_packet(pd->open, pkt) < 0)
+        av_packet_unref(pkt);
+    if (pd->mode == PDEC_INTRA)
+        parallel_decoder_dispatch(pd, &pd->open);
+}
 
-            if (show_status == 1 && AV_LOG_INFO > av_log_get_level()) {
-                fprintf(stderr, "%s\n", buf.str);
-            } else {
-                av_log(nullptr, AV_LOG_INFO, "%s\n", buf.str);
+// 代替decoder_decode_frame: 按单位的顺序输出解好的帧, 同时从videoq读包分成单位, 保持每个工作线程都有活干
+static int parallel_decoder_get_frame(VideoState *is, AVFrame *frame) {
+    ParallelDecoder *pd = &is->pdec;
+    Decoder *d = &is->viddec;
+    int max_units = pd->nb_workers * PDEC_UNITS_PER_WORKER;
+    struct timespec abstime;
+    int64_t wait_us;
+    DecodeUnit *u;
+    AVPacket pkt;
+    int serial;
+    int nb_units;
+    int got;
+
+    for (;;) {
+        if (d->queue->abort_request)
+            return -1;
+
+        pthread_mutex_lock(&pd->pmutex);
+        while ((u = pd->first) && (u->serial != d->queue->serial ||
+                                   (u->state == PDEC_UNIT_DONE && u->rindex == u->nb_frames))) {
+            if (u->state == PDEC_UNIT_DECODING)
+                break;
+            /* finished or obsolete, and no worker holds it */
+            if (!(pd->first = u->next))
+                pd->last = nullptr;
+            pd->nb_units--;
+            decode_unit_free(&u);
+        }
+        if (u && u->serial == d->queue->serial && u->rindex < u->nb_frames) {
+            av_frame_move_ref(frame, u->frames[u->rindex]);
+            av_frame_free(&u->frames[u->rindex++]);
+            pthread_cond_broadcast(&pd->read_cond);
+            pthread_mutex_unlock(&pd->pmutex);
+            d->pkt_serial = u->serial;
+            return 1;
+        }
+        nb_units = pd->nb_units;
+        pthread_mutex_unlock(&pd->pmutex);
+
+        if (!nb_units && pd->eof_serial == d->queue->serial && d->finished != pd->eof_serial) {
+            d->pkt_serial = pd->eof_serial;
+            d->finished = pd->eof_serial;
+            return 0;
+        }
+        if (nb_units < max_units && (pd->eof_serial != d->queue->serial || !nb_units)) {
+            if (d->queue->nb_packets == 0)
+                pthread_cond_signal(d->pempty_queue_cond);
+            /* only block on the queue when no unit is being decoded */
+            got = packet_queue_get(d->queue, &pkt, !nb_units, &serial);
+            if (got < 0)
+                return -1;
+            if (got) {
+                parallel_decoder_put_packet(is, &pkt, serial);
+                continue;
             }
+        }
 
-            fflush(stderr);
-            av_bprint_finalize(&buf, nullptr);
+        pthread_mutex_lock(&pd->pmutex);
+        if (pd->nb_units && !(pd->first->rindex < pd->first->nb_frames)) {
+            /* pthread_cond_timedwait wants the realtime clock */
+            wait_us = av_gettime() + 10000;
+            abstime.tv_sec = wait_us / 1000000;
+            abstime.tv_nsec = (wait_us % 1000000) * 1000;
+            pthread_cond_timedwait(&pd->done_cond, &pd->pmutex, &abstime);
+        }
+        pthread_mutex_unlock(&pd->pmutex);
+    }
+}
 
-            last_time = cur_time;
+static void parallel_decoder_init(VideoState *is) {
+    ParallelDecoder *pd = &is->pdec;
+    AVCodecContext *avctx = is->viddec.avctx;
+    const AVCodecDescriptor *desc = avcodec_descriptor_get(avctx->codec_id);
+    int intra_only = desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+    int mode = parallel_decode;
+    int nb_workers;
+    int threads;
+
+    memset(pd, 0, sizeof(ParallelDecoder));
+    pd->eof_serial = -1;
+    if (mode == PDEC_AUTO)
+        mode = intra_only && !(avctx->codec->capabilities & AV_CODEC_CAP_FRAME_THREADS) ? PDEC_INTRA : PDEC_OFF;
+    if (mode == PDEC_INTRA && !intra_only) {
+        av_log(nullptr, AV_LOG_WARNING, "%s is not an intra-only codec, not decoding in parallel\n",
+               avctx->codec->name);
+        mode = PDEC_OFF;
+    }
+    if (mode == PDEC_OFF)
+        return;
+
+    nb_workers = av_clip(parallel_decoders > 0 ? parallel_decoders : av_cpu_count(), 1, PDEC_MAX_WORKERS);
+    /* the cores are shared out between the contexts, each one only slices its own frames */
+    threads = FFMAX(1, av_cpu_count() / nb_workers);
+    pd->pmutex = PTHREAD_MUTEX_INITIALIZER;
+    pd->work_cond = PTHREAD_COND_INITIALIZER;
+    pd->done_cond = PTHREAD_COND_INITIALIZER;
+    pd->read_cond = PTHREAD_COND_INITIALIZER;
+    pd->mode = mode;
+    for (int i = 0; i < nb_workers; i++) {
+        ParallelDecoderWorker *w = &pd->workers[i];
+
+        w->is = is;
+        if (codec_context_clone(&w->avctx, avctx, avctx->lowres, threads, "slice") < 0)
+            break;
+        if (!(w->tid = thread_create(parallel_decoder_worker, "parallel_decoder", w, THREAD_ROLE_VIDEO))) {
+            av_log(nullptr, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+            avcodec_free_context(&w->avctx);
+            break;
         }
-    }*/
-    // endregion
+        pd->nb_workers++;
+    }
+    if (!pd->nb_workers) {
+        av_log(nullptr, AV_LOG_WARNING, "Could not open parallel decoders, decoding serially\n");
+        pd->mode = PDEC_OFF;
+        return;
+    }
+    pd->start_time = av_gettime_relative();
+    av_log(nullptr, AV_LOG_VERBOSE, "parallel decoding by %s with %d decoders of %d threads\n",
+           mode == PDEC_GOP ? "gop" : "frame", pd->nb_workers, threads);
 }
 
-static int queue_picture(VideoState *is, AVFrame *src_frame, double pts, double duration, int64_t pos, int serial) {
-    Frame *vp;
+static void parallel_decoder_destroy(VideoState *is) {
+    ParallelDecoder *pd = &is->pdec;
+    double elapsed;
 
-#if defined(DEBUG_SYNC)
-    printf("frame_type=%c pts=%0.3f\n",
-           av_get_picture_type_char(src_frame->pict_type), pts);
-#endif
+    if (pd->mode == PDEC_OFF)
+        return;
+    pthread_mutex_lock(&pd->pmutex);
+    pd->abort_request = 1;
+    pthread_cond_broadcast(&pd->work_cond);
+    pthread_cond_broadcast(&pd->read_cond);
+    pthread_mutex_unlock(&pd->pmutex);
+    for (int i = 0; i < pd->nb_workers; i++) {
+        SDL_WaitThread(pd->workers[i].tid, nullptr);
+        avcodec_free_context(&pd->workers[i].avctx);
+    }
+    while (pd->first) {
+        DecodeUnit *u = pd->first;
+        pd->first = u->next;
+        decode_unit_free(&u);
+    }
+    pd->last = nullptr;
+    decode_unit_free(&pd->open);
+
+    elapsed = (av_gettime_relative() - pd->start_time) / 1000000.0;
+    av_log(nullptr, AV_LOG_VERBOSE,
+           "parallel decoding: decoders=%d units=%" PRId64" frames=%" PRId64" skipped=%" PRId64" busy=%0.1f%%\n",
+           pd->nb_workers, pd->nb_decoded_units, pd->nb_decoded_frames, pd->nb_skipped_packets,
+           elapsed > 0 ? 100.0 * pd->busy_time / 1000000.0 / (elapsed * pd->nb_workers) : 0.0);
+    pthread_mutex_destroy(&pd->pmutex);
+    pthread_cond_destroy(&pd->work_cond);
+    pthread_cond_destroy(&pd->done_cond);
+    pthread_cond_destroy(&pd->read_cond);
+    pd->mode = PDEC_OFF;
+}
 
-    if (!(vp = frame_queue_peek_writable(&is->pictq)))
-        return -1;
+static void decode_ladder_init(VideoState *is, AVRational frame_rate) {
+    DecodeLadder *dl = &is->ladder;
+    AVCodecContext *avctx = is->viddec.avctx;
+
+    memset(dl, 0, sizeof(DecodeLadder));
+    /* the parallel decoder contexts are opened once and not reopened at another lowres */
+    dl->enabled = is->pdec.mode == PDEC_OFF &&
+                  (decoder_degrade > 0 ||
+                   (decoder_degrade < 0 &&
+                    (framedrop > 0 || (framedrop && get_master_sync_type(is) != AV_SYNC_VIDEO_MASTER))));
+    dl->max_level = avctx->codec->max_lowres > avctx->lowres ? DEGRADE_LOWRES : DEGRADE_SKIP_BIDIR;
+    dl->frame_duration = frame_rate.num && frame_rate.den ? av_q2d((AVRational) {frame_rate.den, frame_rate.num}) : 0.04;
+    dl->last_pts = NAN;
+    dl->level_start = av_gettime_relative() / 1000000.0;
+    dl->recover_delay = DEGRADE_RECOVER_TIME;
+    dl->base_skip_loop_filter = avctx->skip_loop_filter;
+    dl->base_skip_idct = avctx->skip_idct;
+    dl->base_skip_frame = avctx->skip_frame;
+    dl->base_lowres = avctx->lowres;
+    dl->last_busy = is->viddec.busy_time;
+}
 
-    vp->sar = src_frame->sample_aspect_ratio;
-    vp->uploaded = 0;
+// 把当前级别的设置写到解码器上, 只在video_thread中调用, 解码器在下一个包时生效
+static void decode_ladder_apply(VideoState *is) {
+    DecodeLadder *dl = &is->ladder;
+    AVCodecContext *avctx = is->viddec.avctx;
+    int level = dl->level;
+
+    avctx->skip_loop_filter = FFMAX(dl->base_skip_loop_filter,
+                                    level >= DEGRADE_SKIP_LOOP_FILTER ? AVDISCARD_ALL : AVDISCARD_DEFAULT);
+    avctx->skip_idct = FFMAX(dl->base_skip_idct, level >= DEGRADE_SKIP_IDCT ? AVDISCARD_NONREF : AVDISCARD_DEFAULT);
+    avctx->skip_frame = FFMAX(dl->base_skip_frame,
+                              level >= DEGRADE_SKIP_BIDIR ? AVDISCARD_BIDIR :
+                              level >= DEGRADE_SKIP_NONREF ? AVDISCARD_NONREF : AVDISCARD_DEFAULT);
+    is->viddec.lowres_request = FFMIN(level >= DEGRADE_LOWRES ? dl->base_lowres + 1 : dl->base_lowres,
+                                      avctx->codec->max_lowres);
+}
 
-    vp->width = src_frame->width;
-    vp->height = src_frame->height;
-    vp->format = src_frame->format;
+static void decode_ladder_set(VideoState *is, int level, double now) {
+    DecodeLadder *dl = &is->ladder;
+    int step = level > dl->level ? 1 : -1;
 
-    vp->pts = pts;
-    vp->duration = duration;
-    vp->pos = pos;
-    vp->serial = serial;
+    if (step > 0 && dl->last_step < 0) {
+        /* the last step down did not hold, wait longer before trying again */
+        if (now - dl->level_start < dl->recover_delay * 2)
+            dl->recover_delay = FFMIN(dl->recover_delay * 2, DEGRADE_RECOVER_TIME_MAX);
+        else
+            dl->recover_delay = DEGRADE_RECOVER_TIME;
+    }
+    av_log(nullptr, AV_LOG_DEBUG, "decoder degradation: %s -> %s, load=%0.2f\n",
+           degrade_level_names[dl->level], degrade_level_names[level], dl->load);
+    dl->level_time[dl->level] += now - dl->level_start;
+    dl->level_start = now;
+    dl->level = level;
+    dl->last_step = step;
+    if (step > 0)
+        dl->nb_steps_up++;
+    else
+        dl->nb_steps_down++;
+    decode_ladder_apply(is);
+}
 
-    set_default_window_size(vp->width, vp->height, vp->sar);
+// 每解出一帧调用一次, 负载是解码器中花的时间除以这段时间解出的媒体时长
+static void decode_ladder_update(VideoState *is, double pts) {
+    DecodeLadder *dl = &is->ladder;
+    double now = av_gettime_relative() / 1000000.0;
+    double busy = (is->viddec.busy_time - dl->last_busy) / 1000000.0;
+    double media_time = pts - dl->last_pts;
+    double load;
+
+    dl->last_busy = is->viddec.busy_time;
+    dl->last_pts = pts;
+    /* skipped frames make the pts step larger, which is what keeps the load honest at the skip levels */
+    if (isnan(media_time) || media_time <= 0 || media_time > 1.0)
+        media_time = dl->frame_duration;
+    load = busy / media_time;
+    dl->load = dl->nb_frames++ ? dl->load + DEGRADE_LOAD_SMOOTHING * (load - dl->load) : load;
+
+    if (!dl->enabled || is->paused)
+        return;
+    if (dl->load > DEGRADE_LOAD_HIGH && dl->level < dl->max_level && now - dl->level_start > DEGRADE_HOLD_TIME)
+        decode_ladder_set(is, dl->level + 1, now);
+    else if (dl->load < DEGRADE_LOAD_LOW && dl->level > DEGRADE_NONE && now - dl->level_start > dl->recover_delay)
+        decode_ladder_set(is, dl->level - 1, now);
+}
 
-    av_frame_move_ref(vp->frame, src_frame);
-    frame_queue_push(&is->pictq);
-    return 0;
+static void decode_ladder_report(DecodeLadder *dl, int level) {
+    AVBPrint buf;
+
+    if (!dl->enabled || !dl->nb_frames)
+        return;
+    dl->level_time[dl->level] += av_gettime_relative() / 1000000.0 - dl->level_start;
+    dl->level_start = av_gettime_relative() / 1000000.0;
+    av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
+    for (int i = 0; i <= dl->max_level; i++)
+        av_bprintf(&buf, " %s=%0.1fs", degrade_level_names[i], dl->level_time[i]);
+    av_log(nullptr, level, "decoder degradation: level=%s load=%0.2f up=%" PRId64" down=%" PRId64"%s\n",
+           degrade_level_names[dl->level], dl->load, dl->nb_steps_up, dl->nb_steps_down, buf.str);
+    av_bprint_finalize(&buf, nullptr);
 }
 
 static int get_video_frame(VideoState *is, AVFrame *frame) {
     int got_picture;
 
-    if ((got_picture = decoder_decode_frame(&is->viddec, frame, nullptr)) < 0)
+    if (is->pdec.mode != PDEC_OFF)
+        got_picture = parallel_decoder_get_frame(is, frame);
+    else
+        got_picture = decoder_decode_frame(&is->viddec, frame, nullptr);
+    if (got_picture < 0)
         return -1;
 
     if (got_picture) {
@@ -1943,6 +6944,16 @@ static int get_video_frame(VideoState *is, AVFrame *frame) {
 
         if (frame->pts != AV_NOPTS_VALUE)
             dpts = av_q2d(is->video_st->time_base) * frame->pts;
+        seek_bench_frame(is, is->viddec.pkt_serial);
+        if (SDL_AtomicGet(&is->rev.resume_serial) == is->viddec.pkt_serial) {
+            if (!isnan(dpts) && dpts < is->rev.resume_pts) {
+                av_frame_unref(frame);
+                return 0;
+            }
+            SDL_AtomicSet(&is->rev.resume_serial, -1);
+        }
+        decode_ladder_update(is, dpts);
+        thread_tune_update(is);
 
         frame->sample_aspect_ratio = av_guess_sample_aspect_ratio(is->ic, is->video_st, frame);
 
@@ -1951,7 +6962,7 @@ static int get_video_frame(VideoState *is, AVFrame *frame) {
                 double diff = dpts - get_master_clock(is);
                 if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD &&
                     diff - is->frame_last_filter_delay < 0 &&
-                    is->viddec.pkt_serial == is->vidclk.serial &&
+                    is->viddec.pkt_serial == get_clock_serial(&is->vidclk) &&
                     is->videoq.nb_packets) {
                     is->frame_drops_early++;
                     av_frame_unref(frame);
@@ -1966,6 +6977,129 @@ static int get_video_frame(VideoState *is, AVFrame *frame) {
 
 #if CONFIG_AVFILTER
 
+static void filter_stats_add_build(FilterGraphStats *fs, int64_t start, const char *name) {
+    double build_time = (av_gettime_relative() - start) / 1000000.0;
+
+    fs->nb_builds++;
+    fs->build_time_sum += build_time;
+    fs->build_time_max = FFMAX(fs->build_time_max, build_time);
+    av_log(nullptr, AV_LOG_DEBUG, "%s filter graph built in %0.1f ms\n", name, build_time * 1000.0);
+}
+
+static void filter_stats_report(FilterGraphStats *fs, const char *name, int level) {
+    if (!fs->nb_builds && !fs->nb_reuses)
+        return;
+    av_log(nullptr, level, "%s filter graphs: built=%" PRId64" avg=%0.1fms max=%0.1fms reused=%" PRId64
+           " prebuilt=%" PRId64"\n", name, fs->nb_builds,
+           fs->nb_builds ? fs->build_time_sum * 1000.0 / fs->nb_builds : 0.0, fs->build_time_max * 1000.0,
+           fs->nb_reuses, fs->nb_prebuilt);
+}
+
+// 表达式里用到n, t, pos或者pts时, 输出取决于滤镜已经处理过的帧或者时间, seek之后不能接着用
+static int filter_expr_is_stateless(const char *expr) {
+    static const char *const time_vars[] = {"n", "t", "pos", "pts", nullptr};
+    const char *p = expr;
+
+    while (*p) {
+        const char *start = p;
+        if (av_isdigit(*p) || *p == '.') {
+            /* a number, 1e-3 included */
+            while (av_isalnum(*p) || *p == '.' || ((*p == '-' || *p == '+') && (p[-1] == 'e' || p[-1] == 'E')))
+                p++;
+        } else if (av_isalpha(*p) || *p == '_') {
+            while (av_isalnum(*p) || *p == '_')
+                p++;
+            for (int i = 0; time_vars[i]; i++)
+                if (strlen(time_vars[i]) == (size_t) (p - start) && !strncmp(start, time_vars[i], p - start))
+                    return 0;
+        } else {
+            p++;
+        }
+    }
+    return 1;
+}
+
+/* all the expression options of a filter must be free of time variables */
+static int filter_exprs_are_stateless(AVFilterContext *ctx, const char *const *opts) {
+    for (int i = 0; opts[i]; i++) {
+        uint8_t *expr = nullptr;
+        int stateless;
+
+        if (av_opt_get(ctx, opts[i], AV_OPT_SEARCH_CHILDREN, &expr) < 0)
+            return 0;
+        stateless = !expr || filter_expr_is_stateless(reinterpret_cast<const char *>(expr));
+        av_free(expr);
+        if (!stateless)
+            return 0;
+    }
+    return 1;
+}
+
+// aresample改变采样率时resampler里留着滤波器延迟的样本, async/min_comp/first_pts会按以前的时间戳补偿
+static int filter_aresample_is_stateless(AVFilterContext *ctx) {
+    double async, min_comp;
+    int64_t first_pts;
+
+    if (!ctx->nb_inputs || !ctx->nb_outputs || ctx->inputs[0]->sample_rate != ctx->outputs[0]->sample_rate)
+        return 0;
+    if (av_opt_get_double(ctx, "async", AV_OPT_SEARCH_CHILDREN, &async) < 0 ||
+        av_opt_get_double(ctx, "min_comp", AV_OPT_SEARCH_CHILDREN, &min_comp) < 0 ||
+        av_opt_get_int(ctx, "first_pts", AV_OPT_SEARCH_CHILDREN, &first_pts) < 0)
+        return 0;
+    return async == 0 && min_comp >= FLT_MAX && first_pts == AV_NOPTS_VALUE;
+}
+
+// 图里的滤镜按配置好的参数都无状态时, seek之后不用重建: 每个输入帧马上变成输出帧, 旧位置的帧最多留在buffersink里.
+// 只认识下面这些滤镜, 其余的一律当作有状态
+static int filtergraph_is_stateless(AVFilterGraph *graph) {
+    static const char *const no_opts[] = {nullptr};
+    static const char *const scale_opts[] = {"w", "h", nullptr};
+    static const char *const rotate_opts[] = {"angle", "out_w", "out_h", nullptr};
+    static const char *const crop_opts[] = {"out_w", "out_h", "x", "y", nullptr};
+    static const char *const pad_opts[] = {"width", "height", "x", "y", nullptr};
+    static const char *const setsar_opts[] = {"r", nullptr};
+    static const char *const eq_opts[] = {"contrast", "brightness", "saturation", "gamma", "gamma_r", "gamma_g",
+                                          "gamma_b", "gamma_weight", nullptr};
+    static const char *const hue_opts[] = {"h", "s", "H", "b", nullptr};
+    static const char *const lut_opts[] = {"c0", "c1", "c2", "c3", nullptr};
+    static const char *const volume_opts[] = {"volume", nullptr};
+    static const struct {
+        const char *name;
+        const char *const *exprs;   /* expression options, checked for time variables */
+    } filters[] = {
+            {"buffer", no_opts}, {"buffersink", no_opts}, {"abuffer", no_opts}, {"abuffersink", no_opts},
+            {"format", no_opts}, {"aformat", no_opts}, {"null", no_opts}, {"anull", no_opts},
+            {"transpose", no_opts}, {"hflip", no_opts}, {"vflip", no_opts}, {"negate", no_opts},
+            {"scale", scale_opts}, {"rotate", rotate_opts}, {"crop", crop_opts}, {"pad", pad_opts},
+            {"setsar", setsar_opts}, {"setdar", setsar_opts}, {"eq", eq_opts}, {"hue", hue_opts},
+            {"lut", lut_opts}, {"lutrgb", lut_opts}, {"lutyuv", lut_opts}, {"volume", volume_opts},
+            {"aresample", nullptr},
+    };
+
+    for (unsigned i = 0; i < graph->nb_filters; i++) {
+        AVFilterContext *ctx = graph->filters[i];
+        int j;
+
+        for (j = 0; j < FF_ARRAY_ELEMS(filters) && strcmp(ctx->filter->name, filters[j].name); j++);
+        if (j == FF_ARRAY_ELEMS(filters))
+            return 0;
+        if (!filters[j].exprs ? !filter_aresample_is_stateless(ctx) : !filter_exprs_are_stateless(ctx, filters[j].exprs))
+            return 0;
+    }
+    return 1;
+}
+
+// 丢掉buffersink中还没取走的帧, 图就可以接着给新的serial用
+static void filtergraph_drain(AVFilterContext *sink) {
+    AVFrame *frame = av_frame_alloc();
+
+    if (!frame)
+        return;
+    while (av_buffersink_get_frame_flags(sink, frame, 0) >= 0)
+        av_frame_unref(frame);
+    av_frame_free(&frame);
+}
+
 static int configure_filtergraph(AVFilterGraph *graph, const char *filtergraph,
                                  AVFilterContext *source_ctx, AVFilterContext *sink_ctx) {
     int ret, i;
@@ -2008,7 +7142,26 @@ static int configure_filtergraph(AVFilterGraph *graph, const char *filtergraph,
     return ret;
 }
 
-static int configure_video_filters(AVFilterGraph *graph, VideoState *is, const char *vfilters, AVFrame *frame) {
+// 只缩小不放大: 有窗口时是min(iw,窗口宽), 还没有窗口时保持原大小
+static const char *downscale_expr(char *buf, int size, const char *in, int box) {
+    if (box > 0)
+        snprintf(buf, size, "min(%s,%d)", in, box);
+    else
+        av_strlcpy(buf, in, size);
+    return buf;
+}
+
+// 把-downscale的scale滤镜改成按新的窗口大小缩放, 下一帧生效
+static void downscale_set_filter(AVFilterContext *filter, int box_w, int box_h) {
+    char w_expr[32], h_expr[32];
+
+    avfilter_process_command(filter, "w", downscale_expr(w_expr, sizeof(w_expr), "iw", box_w), nullptr, 0, 0);
+    avfilter_process_command(filter, "h", downscale_expr(h_expr, sizeof(h_expr), "ih", box_h), nullptr, 0, 0);
+}
+
+// 在vfg->graph中建图, 结果写到vfg中而不是VideoState里, 所以也能在预建线程中调用
+static int configure_video_filters(VideoFilterGraph *vfg, VideoState *is, const char *vfilters, AVFrame *frame) {
+    AVFilterGraph *graph = vfg->graph;
     enum AVPixelFormat pix_fmts[FF_ARRAY_ELEMS(sdl_texture_format_map)];
     char sws_flags_str[512] = "";
     char buffersrc_args[256];
@@ -2065,6 +7218,7 @@ static int configure_video_filters(AVFilterGraph *graph, VideoState *is, const c
         goto fail;
 
     last_filter = filt_out;
+    vfg->downscale = nullptr;
 
 /* Note: this macro adds a filter before the lastly added filter, so the
  * processing order of the filters is in reverse */
@@ -2084,6 +7238,17 @@ static int configure_video_filters(AVFilterGraph *graph, VideoState *is, const c
     last_filter = filt_ctx;                                                  \
 } while (0)
 
+    /* inserted first so it runs last, after rotation and the user filters, on what is actually shown */
+    if (downscale) {
+        char scale_buf[128], w_expr[32], h_expr[32];
+
+        snprintf(scale_buf, sizeof(scale_buf), "w=%s:h=%s:force_original_aspect_ratio=decrease",
+                 downscale_expr(w_expr, sizeof(w_expr), "iw", vfg->box_w),
+                 downscale_expr(h_expr, sizeof(h_expr), "ih", vfg->box_h));
+        INSERT_FILT("scale", scale_buf);
+        vfg->downscale = last_filter;
+    }
+
     if (autorotate) {
         double theta = get_rotation(is->video_st);
 
@@ -2104,8 +7269,8 @@ static int configure_video_filters(AVFilterGraph *graph, VideoState *is, const c
     if ((ret = configure_filtergraph(graph, vfilters, filt_src, last_filter)) < 0)
         goto fail;
 
-    is->in_video_filter = filt_src;
-    is->out_video_filter = filt_out;
+    vfg->in = filt_src;
+    vfg->out = filt_out;
 
     fail:
     return ret;
@@ -2120,12 +7285,13 @@ static int configure_audio_filters(VideoState *is, const char *afilters, int for
     char aresample_swr_opts[512] = "";
     AVDictionaryEntry *e = nullptr;
     char asrc_args[256];
+    int64_t start = av_gettime_relative();
     int ret;
 
     avfilter_graph_free(&is->agraph);
     if (!(is->agraph = avfilter_graph_alloc()))
         return AVERROR(ENOMEM);
-    is->agraph->nb_threads = filter_nbthreads;
+    worker_pool_attach_graph(is->agraph);
 
     while ((e = av_dict_get(swr_opts, "", e, AV_DICT_IGNORE_SUFFIX)))
         av_strlcatf(aresample_swr_opts, sizeof(aresample_swr_opts), "%s=%s:", e->key, e->value);
@@ -2161,38 +7327,210 @@ static int configure_audio_filters(VideoState *is, const char *afilters, int for
     if ((ret = av_opt_set_int(filt_asink, "all_channel_counts", 1, AV_OPT_SEARCH_CHILDREN)) < 0)
         goto end;
 
-    if (force_output_format) {
-        channel_layouts[0] = is->audio_tgt.channel_layout;
-        channels[0] = is->audio_tgt.channels;
-        sample_rates[0] = is->audio_tgt.freq;
-        if ((ret = av_opt_set_int(filt_asink, "all_channel_counts", 0, AV_OPT_SEARCH_CHILDREN)) < 0)
-            goto end;
-        if ((ret = av_opt_set_int_list(filt_asink, "channel_layouts", channel_layouts, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
-            goto end;
-        if ((ret = av_opt_set_int_list(filt_asink, "channel_counts", channels, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
-            goto end;
-        if ((ret = av_opt_set_int_list(filt_asink, "sample_rates", sample_rates, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
-            goto end;
+    if (force_output_format) {
+        channel_layouts[0] = is->audio_tgt.channel_layout;
+        channels[0] = is->audio_tgt.channels;
+        sample_rates[0] = is->audio_tgt.freq;
+        if ((ret = av_opt_set_int(filt_asink, "all_channel_counts", 0, AV_OPT_SEARCH_CHILDREN)) < 0)
+            goto end;
+        if ((ret = av_opt_set_int_list(filt_asink, "channel_layouts", channel_layouts, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+            goto end;
+        if ((ret = av_opt_set_int_list(filt_asink, "channel_counts", channels, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+            goto end;
+        if ((ret = av_opt_set_int_list(filt_asink, "sample_rates", sample_rates, -1, AV_OPT_SEARCH_CHILDREN)) < 0)
+            goto end;
+    }
+
+
+    if ((ret = configure_filtergraph(is->agraph, afilters, filt_asrc, filt_asink)) < 0)
+        goto end;
+
+    is->in_audio_filter = filt_asrc;
+    is->out_audio_filter = filt_asink;
+    filter_stats_add_build(&is->afilter_stats, start, "audio");
+
+    end:
+    if (ret < 0)
+        avfilter_graph_free(&is->agraph);
+    return ret;
+}
+
+static int video_filter_graph_matches(const VideoFilterGraph *vfg, int width, int height, int format) {
+    return vfg->width == width && vfg->height == height && vfg->format == format;
+}
+
+// 按vfilters_list[idx]为frame这样的输入建图, vfg中的box_w/box_h要先设好
+static int video_filter_graph_build(VideoFilterGraph *vfg, VideoState *is, int idx, AVFrame *frame,
+                                    FilterGraphStats *fs) {
+    int64_t start = av_gettime_relative();
+    int ret;
+
+    vfg->width = frame->width;
+    vfg->height = frame->height;
+    vfg->format = frame->format;
+    if (!(vfg->graph = avfilter_graph_alloc()))
+        return AVERROR(ENOMEM);
+    worker_pool_attach_graph(vfg->graph);
+    if ((ret = configure_video_filters(vfg, is, vfilters_list ? vfilters_list[idx] : nullptr, frame)) < 0) {
+        avfilter_graph_free(&vfg->graph);
+        return ret;
+    }
+    vfg->stateless = filtergraph_is_stateless(vfg->graph);
+    filter_stats_add_build(fs, start, "video");
+    return 0;
+}
+
+static int filter_prebuild_thread(void *arg) {
+    printf("filter_prebuild_thread() start\n");
+    VideoState *is = static_cast<VideoState *>(arg);
+    FilterPrebuilder *fp = &is->vfilter_prebuilder;
+    AVFrame *frame = av_frame_alloc();
+    VideoFilterGraph vfg;
+    int ret;
+
+    if (!frame)
+        return AVERROR(ENOMEM);
+
+    pthread_mutex_lock(&fp->pmutex);
+    while (!fp->abort_request) {
+        int idx = -1;
+
+        for (int i = 0; fp->width && i < nb_vfilters && idx < 0; i++) {
+            VideoFilterGraph *g = &fp->graphs[i];
+            if (i != fp->current &&
+                !((g->graph || g->failed) && video_filter_graph_matches(g, fp->width, fp->height, fp->format)))
+                idx = i;
+        }
+        if (idx < 0) {
+            pthread_cond_wait(&fp->pcond, &fp->pmutex);
+            continue;
+        }
+
+        memset(&vfg, 0, sizeof(vfg));
+        frame->width = fp->width;
+        frame->height = fp->height;
+        frame->format = fp->format;
+        vfg.box_w = is->downscale_w;
+        vfg.box_h = is->downscale_h;
+        pthread_mutex_unlock(&fp->pmutex);
+        ret = video_filter_graph_build(&vfg, is, idx, frame, &fp->stats);
+        pthread_mutex_lock(&fp->pmutex);
+
+        /* the input changed or the video thread switched to this entry while we were building */
+        if (idx == fp->current || !video_filter_graph_matches(&vfg, fp->width, fp->height, fp->format)) {
+            avfilter_graph_free(&vfg.graph);
+            continue;
+        }
+        if (ret < 0) {
+            av_log(nullptr, AV_LOG_DEBUG, "Could not prebuild video filter graph %d\n", idx);
+            vfg.failed = 1;
+        }
+        avfilter_graph_free(&fp->graphs[idx].graph);
+        fp->graphs[idx] = vfg;
+    }
+    pthread_mutex_unlock(&fp->pmutex);
+    av_frame_free(&frame);
+    printf("filter_prebuild_thread() end\n");
+    return 0;
+}
+
+// 有多个-vf时才需要预建
+static void filter_prebuilder_start(VideoState *is) {
+    FilterPrebuilder *fp = &is->vfilter_prebuilder;
+
+    memset(fp, 0, sizeof(FilterPrebuilder));
+    if (nb_vfilters < 2)
+        return;
+    if (!(fp->graphs = static_cast<VideoFilterGraph *>(av_mallocz_array(nb_vfilters, sizeof(VideoFilterGraph)))))
+        return;
+    fp->pmutex = PTHREAD_MUTEX_INITIALIZER;
+    fp->pcond = PTHREAD_COND_INITIALIZER;
+    fp->current = -1;
+    if (!(fp->tid = thread_create(filter_prebuild_thread, "filter_prebuild", is, THREAD_ROLE_FILTER))) {
+        av_log(nullptr, AV_LOG_WARNING, "SDL_CreateThread(): %s\n", SDL_GetError());
+        av_freep(&fp->graphs);
     }
+}
 
+static void filter_prebuilder_stop(VideoState *is) {
+    FilterPrebuilder *fp = &is->vfilter_prebuilder;
 
-    if ((ret = configure_filtergraph(is->agraph, afilters, filt_asrc, filt_asink)) < 0)
-        goto end;
+    if (!fp->tid)
+        return;
+    pthread_mutex_lock(&fp->pmutex);
+    fp->abort_request = 1;
+    pthread_cond_signal(&fp->pcond);
+    pthread_mutex_unlock(&fp->pmutex);
+    SDL_WaitThread(fp->tid, nullptr);
+    fp->tid = nullptr;
+
+    for (int i = 0; i < nb_vfilters; i++)
+        avfilter_graph_free(&fp->graphs[i].graph);
+    av_freep(&fp->graphs);
+    pthread_mutex_destroy(&fp->pmutex);
+    pthread_cond_destroy(&fp->pcond);
+    filter_stats_report(&fp->stats, "prebuilt video", AV_LOG_VERBOSE);
+}
 
-    is->in_audio_filter = filt_asrc;
-    is->out_audio_filter = filt_asink;
+// video_thread换了输入或者滤镜链: 让预建线程按新的输入准备其他的滤镜链
+static void filter_prebuilder_request(VideoState *is, AVFrame *frame, int current) {
+    FilterPrebuilder *fp = &is->vfilter_prebuilder;
 
-    end:
-    if (ret < 0)
-        avfilter_graph_free(&is->agraph);
-    return ret;
+    if (!fp->tid)
+        return;
+    pthread_mutex_lock(&fp->pmutex);
+    fp->width = frame->width;
+    fp->height = frame->height;
+    fp->format = frame->format;
+    fp->current = current;
+    pthread_cond_signal(&fp->pcond);
+    pthread_mutex_unlock(&fp->pmutex);
+}
+
+// 取出为idx预建好的图, 没有适合frame的返回0
+static int filter_prebuilder_take(VideoState *is, VideoFilterGraph *vfg, int idx, AVFrame *frame) {
+    FilterPrebuilder *fp = &is->vfilter_prebuilder;
+    VideoFilterGraph *g;
+    int found = 0;
+
+    if (!fp->tid)
+        return 0;
+    pthread_mutex_lock(&fp->pmutex);
+    g = &fp->graphs[idx];
+    if (g->graph && video_filter_graph_matches(g, frame->width, frame->height, frame->format)) {
+        *vfg = *g;
+        memset(g, 0, sizeof(VideoFilterGraph));
+        found = 1;
+    }
+    fp->current = idx;
+    pthread_mutex_unlock(&fp->pmutex);
+    return found;
+}
+
+// 不再用的图: 无状态而且输入没变的交给预建线程留着, 切换回来时直接用, 其他的释放
+static void filter_prebuilder_give_back(VideoState *is, VideoFilterGraph *vfg, int idx, AVFrame *frame) {
+    FilterPrebuilder *fp = &is->vfilter_prebuilder;
+
+    if (fp->tid && vfg->graph && vfg->stateless &&
+        video_filter_graph_matches(vfg, frame->width, frame->height, frame->format)) {
+        pthread_mutex_lock(&fp->pmutex);
+        if (!fp->graphs[idx].graph) {
+            fp->graphs[idx] = *vfg;
+            vfg->graph = nullptr;
+        }
+        pthread_mutex_unlock(&fp->pmutex);
+    }
+    avfilter_graph_free(&vfg->graph);
+    memset(vfg, 0, sizeof(VideoFilterGraph));
 }
 
 #endif  /* CONFIG_AVFILTER */
 
 static int decoder_start(Decoder *d, int (*fn)(void *), const char *thread_name, void *arg) {
     packet_queue_start(d->queue);
-    if (!(d->decoder_tid = SDL_CreateThread(fn, thread_name, arg))) {
+    int role = d->avctx->codec_type == AVMEDIA_TYPE_AUDIO ? THREAD_ROLE_AUDIO : THREAD_ROLE_VIDEO;
+
+    if (!(d->decoder_tid = thread_create(fn, thread_name, arg, role))) {
         av_log(nullptr, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
         return AVERROR(ENOMEM);
     }
@@ -2225,6 +7563,17 @@ static int audio_thread(void *arg) {
 
         if (got_frame) {
             tb = (AVRational) {1, frame->sample_rate};
+            if (is->video_stream < 0)
+                seek_bench_frame(is, is->auddec.pkt_serial);
+            // 退出倒放后从关键帧开始读, 和视频一样丢掉最后显示的那一帧之前的声音
+            if (SDL_AtomicGet(&is->rev.audio_resume_serial) == is->auddec.pkt_serial) {
+                if (frame->pts != AV_NOPTS_VALUE &&
+                    (frame->pts + frame->nb_samples) * av_q2d(tb) <= is->rev.resume_pts) {
+                    av_frame_unref(frame);
+                    continue;
+                }
+                SDL_AtomicSet(&is->rev.audio_resume_serial, -1);
+            }
 
 #if CONFIG_AVFILTER
             dec_channel_layout = get_valid_channel_layout(frame->channel_layout, frame->channels);
@@ -2233,8 +7582,18 @@ static int audio_thread(void *arg) {
                     cmp_audio_fmts(is->audio_filter_src.fmt, is->audio_filter_src.channels,
                                    static_cast<AVSampleFormat>(frame->format), frame->channels) ||
                     is->audio_filter_src.channel_layout != dec_channel_layout ||
-                    is->audio_filter_src.freq != frame->sample_rate ||
-                    is->auddec.pkt_serial != last_serial;
+                    is->audio_filter_src.freq != frame->sample_rate;
+
+            if (!reconfigure && is->auddec.pkt_serial != last_serial) {
+                /* a seek with the same input format: a stateless graph is flushed and kept */
+                if (is->agraph && filtergraph_is_stateless(is->agraph)) {
+                    filtergraph_drain(is->out_audio_filter);
+                    is->afilter_stats.nb_reuses++;
+                    last_serial = is->auddec.pkt_serial;
+                } else {
+                    reconfigure = 1;
+                }
+            }
 
             if (reconfigure) {
                 char buf1[1024], buf2[1024];
@@ -2286,6 +7645,7 @@ static int audio_thread(void *arg) {
     printf("audio_thread() end\n");
 
     the_end:
+    filter_stats_report(&is->afilter_stats, "audio", AV_LOG_VERBOSE);
 #if CONFIG_AVFILTER
     avfilter_graph_free(&is->agraph);
 #endif
@@ -2293,13 +7653,49 @@ static int audio_thread(void *arg) {
     return ret;
 }
 
+// 选择解码后仍不小于显示区域的最大lowres, 在下一个关键帧处生效
+static void downscale_update_lowres(VideoState *is) {
+    AVCodecParameters *par = is->video_st->codecpar;
+    int max_lowres = is->viddec.avctx->codec->max_lowres;
+    int w = par->width;
+    int h = par->height;
+    int n = lowres;
+    double theta = get_rotation(is->video_st);
+    SDL_Rect rect;
+
+    if (is->downscale_w <= 0 || is->downscale_h <= 0 || w <= 0 || h <= 0 || max_lowres <= lowres ||
+        is->pdec.mode != PDEC_OFF)
+        return;
+    if (fabs(theta - 90) < 1.0 || fabs(theta - 270) < 1.0)
+        FFSWAP(int, w, h);
+    calculate_display_rect(&rect, 0, 0, is->downscale_w, is->downscale_h, w, h, par->sample_aspect_ratio);
+    while (n < max_lowres && (w >> (n + 1)) >= rect.w && (h >> (n + 1)) >= rect.h)
+        n++;
+    if (n != is->ladder.base_lowres) {
+        av_log(nullptr, AV_LOG_VERBOSE, "downscale: lowres %d for a %dx%d display\n", n, rect.w, rect.h);
+        is->ladder.base_lowres = n;
+        decode_ladder_apply(is);
+    }
+}
+
+// 窗口大小变了: 用命令修改scale滤镜的输出大小, 不重建滤镜图, 已经排队的帧照常显示
+static void downscale_update(VideoState *is) {
+    is->downscale_w = is->width;
+    is->downscale_h = is->height;
+    downscale_update_lowres(is);
+#if CONFIG_AVFILTER
+    if (is->downscale_filter)
+        downscale_set_filter(is->downscale_filter, is->downscale_w, is->downscale_h);
+#endif
+}
+
 static int video_thread(void *arg) {
     AVFrame *frame = av_frame_alloc();
     if (!frame)
         return AVERROR(ENOMEM);
 
 #if CONFIG_AVFILTER
-    AVFilterGraph *graph = nullptr;
+    VideoFilterGraph vfg = {0};
     AVFilterContext *filt_out = nullptr, *filt_in = nullptr;
     int last_w = 0;
     int last_h = 0;
@@ -2317,6 +7713,11 @@ static int video_thread(void *arg) {
     AVRational frame_rate = av_guess_frame_rate(is->ic, is->video_st, nullptr);
 
     printf("video_thread() start\n");
+    parallel_decoder_init(is);
+    decode_ladder_init(is, frame_rate);
+#if CONFIG_AVFILTER
+    filter_prebuilder_start(is);
+#endif
     for (;;) {
         ret = get_video_frame(is, frame);
         if (ret < 0)
@@ -2324,6 +7725,9 @@ static int video_thread(void *arg) {
         if (!ret)
             continue;
 
+        if (downscale && (is->width != is->downscale_w || is->height != is->downscale_h))
+            downscale_update(is);
+
 #if CONFIG_AVFILTER
         if (last_w != frame->width
             || last_h != frame->height
@@ -2337,23 +7741,37 @@ static int video_thread(void *arg) {
                    frame->width, frame->height,
                    (const char *) av_x_if_null(av_get_pix_fmt_name(static_cast<AVPixelFormat>(frame->format)), "none"),
                    is->viddec.pkt_serial);
-            avfilter_graph_free(&graph);
-            graph = avfilter_graph_alloc();
-            if (!graph) {
-                ret = AVERROR(ENOMEM);
-                goto the_end;
+            if (vfg.graph && vfg.stateless && last_vfilter_idx == is->vfilter_idx &&
+                video_filter_graph_matches(&vfg, frame->width, frame->height, frame->format)) {
+                /* only the serial changed, nothing in the graph remembers the old position */
+                filtergraph_drain(vfg.out);
+                is->vfilter_stats.nb_reuses++;
+            } else {
+                filter_prebuilder_give_back(is, &vfg, last_vfilter_idx, frame);
+                if (filter_prebuilder_take(is, &vfg, is->vfilter_idx, frame)) {
+                    filtergraph_drain(vfg.out);
+                    is->vfilter_stats.nb_prebuilt++;
+                } else {
+                    vfg.box_w = is->downscale_w;
+                    vfg.box_h = is->downscale_h;
+                    if ((ret = video_filter_graph_build(&vfg, is, is->vfilter_idx, frame, &is->vfilter_stats)) < 0) {
+                        SDL_Event event;
+                        event.type = FF_QUIT_EVENT;
+                        event.user.data1 = is;
+                        SDL_PushEvent(&event);
+                        goto the_end;
+                    }
+                }
+                filter_prebuilder_request(is, frame, is->vfilter_idx);
             }
-            graph->nb_threads = filter_nbthreads;
-            if ((ret = configure_video_filters(graph, is,
-                                               vfilters_list ? vfilters_list[is->vfilter_idx] : nullptr, frame)) < 0) {
-                SDL_Event event;
-                event.type = FF_QUIT_EVENT;
-                event.user.data1 = is;
-                SDL_PushEvent(&event);
-                goto the_end;
+            filt_in = is->in_video_filter = vfg.in;
+            filt_out = is->out_video_filter = vfg.out;
+            is->downscale_filter = vfg.downscale;
+            if (vfg.downscale && (vfg.box_w != is->downscale_w || vfg.box_h != is->downscale_h)) {
+                downscale_set_filter(vfg.downscale, is->downscale_w, is->downscale_h);
+                vfg.box_w = is->downscale_w;
+                vfg.box_h = is->downscale_h;
             }
-            filt_in = is->in_video_filter;
-            filt_out = is->out_video_filter;
             last_w = frame->width;
             last_h = frame->height;
             last_format = static_cast<AVPixelFormat>(frame->format);
@@ -2398,8 +7816,16 @@ static int video_thread(void *arg) {
     printf("video_thread() end\n");
 
     the_end:
+    parallel_decoder_destroy(is);
+    decode_ladder_report(&is->ladder, AV_LOG_VERBOSE);
+    if (is->pktdrop.nb_dropped_late || is->pktdrop.nb_dropped_queue)
+        av_log(nullptr, AV_LOG_VERBOSE, "packets dropped before decoding: late=%" PRId64" queue=%" PRId64"\n",
+               is->pktdrop.nb_dropped_late, is->pktdrop.nb_dropped_queue);
+    filter_stats_report(&is->vfilter_stats, "video", AV_LOG_VERBOSE);
 #if CONFIG_AVFILTER
-    avfilter_graph_free(&graph);
+    filter_prebuilder_stop(is);
+    is->downscale_filter = nullptr;
+    avfilter_graph_free(&vfg.graph);
 #endif
     av_frame_free(&frame);
     return 0;
@@ -2461,46 +7887,45 @@ static void update_sample_display(VideoState *is, short *samples, int samples_si
 
 /* return the wanted number of samples to get better sync if sync_type is video
  * or external master clock */
-static int synchronize_audio(VideoState *is, int nb_samples) {
+static int synchronize_audio(VideoState *is, int nb_samples, int serial) {
     int wanted_nb_samples = nb_samples;
 
     /* if not master, then we try to remove or add samples to correct the clock */
     if (get_master_sync_type(is) != AV_SYNC_AUDIO_MASTER) {
-        double diff, avg_diff;
-        int min_nb_samples, max_nb_samples;
+        double diff, correction;
 
         diff = get_clock(&is->audclk) - get_master_clock(is);
-
-        if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD) {
-            is->audio_diff_cum = diff + is->audio_diff_avg_coef * is->audio_diff_cum;
-            if (is->audio_diff_avg_count < AUDIO_DIFF_AVG_NB) {
-                /* not enough measures to have a correct estimate */
-                is->audio_diff_avg_count++;
-            } else {
-                /* estimate the A-V difference */
-                avg_diff = is->audio_diff_cum * (1.0 - is->audio_diff_avg_coef);
-
-                if (fabs(avg_diff) >= is->audio_diff_threshold) {
-                    wanted_nb_samples = nb_samples + (int) (diff * is->audio_src.freq);
-                    min_nb_samples = ((nb_samples * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100));
-                    max_nb_samples = ((nb_samples * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100));
-                    wanted_nb_samples = av_clip(wanted_nb_samples, min_nb_samples, max_nb_samples);
-                }
-                av_log(nullptr, AV_LOG_TRACE, "diff=%f adiff=%f sample_diff=%d apts=%0.3f %f\n",
-                       diff, avg_diff, wanted_nb_samples - nb_samples,
-                       is->audio_clock, is->audio_diff_threshold);
-            }
-        } else {
-            /* too big difference : may be initial PTS errors, so
-               reset A-V filter */
-            is->audio_diff_avg_count = 0;
-            is->audio_diff_cum = 0;
-        }
+        correction = avsync_update(&is->avsync, diff, (double) nb_samples / is->audio_src.freq, serial);
+        wanted_nb_samples = nb_samples + (int) lrint(nb_samples * correction);
+        av_log(nullptr, AV_LOG_TRACE,
+               "avsync: diff=%f error=%f integral=%f correction=%f fast_lock=%d sample_diff=%d apts=%0.3f\n",
+               diff, is->avsync.error, is->avsync.integral, correction, is->avsync.fast_lock,
+               wanted_nb_samples - nb_samples, is->audio_clock);
     }
 
     return wanted_nb_samples;
 }
 
+/* stretch or shrink a frame that is already in the output format by repeating
+ * or dropping evenly spaced samples, return the new size in bytes */
+static int compensate_without_resampling(VideoState *is, AVFrame *frame, int wanted_nb_samples) {
+    int frame_size = is->audio_tgt.frame_size;
+    int out_size = wanted_nb_samples * frame_size;
+    const uint8_t *src = frame->data[0];
+    uint8_t *dst;
+
+    av_fast_malloc(&is->audio_buf1, &is->audio_buf1_size, out_size);
+    if (!is->audio_buf1)
+        return AVERROR(ENOMEM);
+    dst = is->audio_buf1;
+    for (int i = 0; i < wanted_nb_samples; i++) {
+        int src_index = (int) ((int64_t) i * frame->nb_samples / wanted_nb_samples);
+        memcpy(dst + i * frame_size, src + src_index * frame_size, frame_size);
+    }
+    is->audio_buf = is->audio_buf1;
+    return out_size;
+}
+
 /**
  * Decode one audio frame and return its uncompressed size.
  *
@@ -2530,6 +7955,12 @@ static int audio_decode_frame(VideoState *is) {
             return -1;
         frame_queue_next(&is->sampq);
     } while (af->serial != is->audioq.serial);
+    if (!is->video_st) {
+        seek_stats_frame(is, af->serial);
+        seek_bench_display(is, af->serial, af->pts);
+        if (is->zap_start)
+            zap_first_frame(is);
+    }
 
     data_size = av_samples_get_buffer_size(nullptr, af->frame->channels,
                                            af->frame->nb_samples,
@@ -2539,26 +7970,27 @@ static int audio_decode_frame(VideoState *is) {
             (af->frame->channel_layout &&
              af->frame->channels == av_get_channel_layout_nb_channels(af->frame->channel_layout)) ?
             af->frame->channel_layout : av_get_default_channel_layout(af->frame->channels);
-    wanted_nb_samples = synchronize_audio(is, af->frame->nb_samples);
+    wanted_nb_samples = synchronize_audio(is, af->frame->nb_samples, af->serial);
 
     if (af->frame->format != is->audio_src.fmt ||
         dec_channel_layout != is->audio_src.channel_layout ||
-        af->frame->sample_rate != is->audio_src.freq ||
-        (wanted_nb_samples != af->frame->nb_samples && !is->swr_ctx)) {
-        swr_free(&is->swr_ctx);
-        is->swr_ctx = swr_alloc_set_opts(nullptr,
-                                         is->audio_tgt.channel_layout, is->audio_tgt.fmt, is->audio_tgt.freq,
-                                         dec_channel_layout, static_cast<AVSampleFormat>(af->frame->format),
-                                         af->frame->sample_rate,
-                                         0, nullptr);
-        if (!is->swr_ctx || swr_init(is->swr_ctx) < 0) {
-            av_log(nullptr, AV_LOG_ERROR,
-                   "Cannot create sample rate converter for conversion of %d Hz %s %d channels to %d Hz %s %d channels!\n",
-                   af->frame->sample_rate, av_get_sample_fmt_name(static_cast<AVSampleFormat>(af->frame->format)),
-                   af->frame->channels,
-                   is->audio_tgt.freq, av_get_sample_fmt_name(is->audio_tgt.fmt), is->audio_tgt.channels);
-            swr_free(&is->swr_ctx);
-            return -1;
+        af->frame->sample_rate != is->audio_src.freq) {
+        if (af->frame->format == is->audio_tgt.fmt &&
+            dec_channel_layout == is->audio_tgt.channel_layout &&
+            af->frame->sample_rate == is->audio_tgt.freq) {
+            /* nothing to convert, sync compensation is done without a resampler */
+            is->swr_ctx = nullptr;
+        } else {
+            is->swr_ctx = swr_cache_get(is, dec_channel_layout,
+                                        static_cast<AVSampleFormat>(af->frame->format), af->frame->sample_rate);
+            if (!is->swr_ctx) {
+                av_log(nullptr, AV_LOG_ERROR,
+                       "Cannot create sample rate converter for conversion of %d Hz %s %d channels to %d Hz %s %d channels!\n",
+                       af->frame->sample_rate, av_get_sample_fmt_name(static_cast<AVSampleFormat>(af->frame->format)),
+                       af->frame->channels,
+                       is->audio_tgt.freq, av_get_sample_fmt_name(is->audio_tgt.fmt), is->audio_tgt.channels);
+                return -1;
+            }
         }
         is->audio_src.channel_layout = dec_channel_layout;
         is->audio_src.channels = af->frame->channels;
@@ -2569,7 +8001,9 @@ static int audio_decode_frame(VideoState *is) {
     if (is->swr_ctx) {
         const uint8_t **in = (const uint8_t **) af->frame->extended_data;
         uint8_t **out = &is->audio_buf1;
-        int out_count = (int64_t) wanted_nb_samples * is->audio_tgt.freq / af->frame->sample_rate + 256;
+        /* include whatever the resampler still buffers from the previous frame */
+        int64_t in_count = swr_get_delay(is->swr_ctx, af->frame->sample_rate) + wanted_nb_samples;
+        int out_count = (int) (in_count * is->audio_tgt.freq / af->frame->sample_rate + 256);
         int out_size = av_samples_get_buffer_size(nullptr, is->audio_tgt.channels, out_count, is->audio_tgt.fmt, 0);
         int len2;
         if (out_size < 0) {
@@ -2593,12 +8027,15 @@ static int audio_decode_frame(VideoState *is) {
             return -1;
         }
         if (len2 == out_count) {
+            /* the remaining samples stay buffered in the resampler and come out with the next frame */
             av_log(nullptr, AV_LOG_WARNING, "audio buffer is probably too small\n");
-            if (swr_init(is->swr_ctx) < 0)
-                swr_free(&is->swr_ctx);
         }
         is->audio_buf = is->audio_buf1;
         resampled_data_size = len2 * is->audio_tgt.channels * av_get_bytes_per_sample(is->audio_tgt.fmt);
+    } else if (wanted_nb_samples != af->frame->nb_samples) {
+        resampled_data_size = compensate_without_resampling(is, af->frame, wanted_nb_samples);
+        if (resampled_data_size < 0)
+            return resampled_data_size;
     } else {
         is->audio_buf = af->frame->data[0];
         resampled_data_size = data_size;
@@ -2623,16 +8060,24 @@ static int audio_decode_frame(VideoState *is) {
     return resampled_data_size;
 }
 
-/* prepare a new audio buffer */
-static void sdl_audio_callback(void *opaque, Uint8 *stream, int len) {
-    //printf("sdl_audio_callback() start\n");
-    VideoState *is = static_cast<VideoState *>(opaque);
+/* -audio_clock_test: silence, with the audio clock running as if it had been decoded */
+static void audio_clock_test_fill(VideoState *is, Uint8 *stream, int len) {
+    memset(stream, 0, len);
+    audio_clock_test_bytes += len;
+    is->audio_clock = (double) audio_clock_test_bytes / is->audio_tgt.bytes_per_sec;
+    is->audio_write_buf_size = 0;
+}
+
+/* fill stream with len bytes of decoded audio, or silence if nothing is available */
+static void audio_fill_buffer(VideoState *is, Uint8 *stream, int len) {
     int audio_size, len1;
 
-    audio_callback_time = av_gettime_relative();
+    if (audio_clock_test > 0) {
+        audio_clock_test_fill(is, stream, len);
+        return;
+    }
 
     while (len > 0) {
-        //printf("sdl_audio_callback() while\n");
         if (is->audio_buf_index >= is->audio_buf_size) {
             audio_size = audio_decode_frame(is);
             if (audio_size < 0) {
@@ -2662,17 +8107,76 @@ static void sdl_audio_callback(void *opaque, Uint8 *stream, int len) {
         is->audio_buf_index += len1;
     }
     is->audio_write_buf_size = is->audio_buf_size - is->audio_buf_index;
-    /* Let's assume the audio driver that is used by SDL has two periods. */
+}
+
+/* device_delay is the number of bytes handed to the device but not played yet */
+static void update_audio_clock(VideoState *is, int device_delay) {
+    is->audio_device_delay = (double) device_delay / is->audio_tgt.bytes_per_sec;
     if (!isnan(is->audio_clock)) {
         set_clock_at(&is->audclk,
                      is->audio_clock -
-                     (double) (2 * is->audio_hw_buf_size + is->audio_write_buf_size) / is->audio_tgt.bytes_per_sec,
+                     (double) (device_delay + is->audio_write_buf_size) / is->audio_tgt.bytes_per_sec,
                      is->audio_clock_serial,
                      audio_callback_time / 1000000.0);
         sync_clock_to_slave(&is->extclk, &is->audclk);
     }
 }
 
+/* prepare a new audio buffer */
+static void sdl_audio_callback(void *opaque, Uint8 *stream, int len) {
+    //printf("sdl_audio_callback() start\n");
+    VideoState *is = static_cast<VideoState *>(opaque);
+
+    /* the thread belongs to SDL */
+    if (thread_role_current < 0)
+        thread_role_enter(THREAD_ROLE_AUDIO);
+    audio_callback_time = av_gettime_relative();
+    audio_fill_buffer(is, stream, len);
+    /* Let's assume the audio driver that is used by SDL has two periods. */
+    update_audio_clock(is, SDL_AUDIO_DRIVER_PERIODS * is->audio_hw_buf_size);
+    // 另一个线程读不到这个线程的CPU时钟(pthread_getcpuclockid不是到处都有), 在这里取, 关设备时记下最后一次
+    is->audio_cb_cpu_time = thread_cpu_time(CLOCK_THREAD_CPUTIME_ID);
+}
+
+/* push mode: keep the SDL queue filled and derive the clock from the measured queue size */
+static int audio_push_thread(void *arg) {
+    VideoState *is = static_cast<VideoState *>(arg);
+    int period = is->audio_hw_buf_size;
+    Uint32 target = audio_latency_modes[audio_latency_mode].push_queue_periods * period;
+    int64_t period_us = 1000000LL * period / is->audio_tgt.bytes_per_sec;
+    uint8_t *buf = static_cast<uint8_t *>(av_malloc(period));
+    if (!buf)
+        return AVERROR(ENOMEM);
+
+    printf("audio_push_thread() start period = %d target = %u\n", period, target);
+    while (!is->audio_push_abort) {
+        if (SDL_GetQueuedAudioSize(audio_dev) >= target) {
+            av_usleep(FFMAX(period_us / 4, 1000));
+            continue;
+        }
+        audio_callback_time = av_gettime_relative();
+        audio_fill_buffer(is, buf, period);
+        if (SDL_QueueAudio(audio_dev, buf, period) < 0) {
+            av_log(nullptr, AV_LOG_ERROR, "SDL_QueueAudio(): %s\n", SDL_GetError());
+            break;
+        }
+        /* the queue plus the period SDL has already moved into the device buffer */
+        update_audio_clock(is, SDL_GetQueuedAudioSize(audio_dev) + period);
+    }
+    av_free(buf);
+    printf("audio_push_thread() end\n");
+    return 0;
+}
+
+static int audio_push_start(VideoState *is) {
+    is->audio_push_abort = 0;
+    if (!(is->audio_push_tid = thread_create(audio_push_thread, "audio_push", is, THREAD_ROLE_AUDIO))) {
+        av_log(nullptr, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
 static int audio_open(void *opaque, int64_t wanted_channel_layout, int wanted_nb_channels, int wanted_sample_rate,
                       struct AudioParams *audio_hw_params) {
     SDL_AudioSpec wanted_spec, spec;
@@ -2701,9 +8205,11 @@ static int audio_open(void *opaque, int64_t wanted_channel_layout, int wanted_nb
         next_sample_rate_idx--;
     wanted_spec.format = AUDIO_S16SYS;
     wanted_spec.silence = 0;
-    wanted_spec.samples = FFMAX(SDL_AUDIO_MIN_BUFFER_SIZE,
-                                2 << av_log2(wanted_spec.freq / SDL_AUDIO_MAX_CALLBACKS_PER_SEC));
-    wanted_spec.callback = sdl_audio_callback;
+    wanted_spec.samples = FFMAX(audio_latency_modes[audio_latency_mode].min_buffer_size,
+                                2 << av_log2(wanted_spec.freq /
+                                             audio_latency_modes[audio_latency_mode].max_callbacks_per_sec));
+    /* without a callback SDL expects the data through SDL_QueueAudio */
+    wanted_spec.callback = audio_push ? nullptr : sdl_audio_callback;
     wanted_spec.userdata = opaque;
     while (!(audio_dev = SDL_OpenAudioDevice(nullptr, 0, &wanted_spec, &spec,
                                              SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE))) {
@@ -2804,6 +8310,16 @@ static int stream_component_open(VideoState *is, int stream_index) {
         default:
             break;
     }
+    // 换台时用standby频道已经打开的解码器
+    if (is->zap && avctx->codec_type >= 0 && is->zap->avctx[avctx->codec_type] &&
+        is->zap->stream_index[avctx->codec_type] == stream_index) {
+        AVCodecContext **padopted = &is->zap->avctx[avctx->codec_type];
+
+        avcodec_free_context(&avctx);
+        avctx = *padopted;
+        *padopted = nullptr;
+        goto opened;
+    }
     if (forced_codec_name) {
         printf("create_avformat_context() forced_codec_name = %s\n", forced_codec_name);
         codec = avcodec_find_decoder_by_name(forced_codec_name);
@@ -2831,12 +8347,21 @@ static int stream_component_open(VideoState *is, int stream_index) {
         avctx->flags2 |= AV_CODEC_FLAG2_FAST;
 
     opts = filter_codec_opts(codec_opts, avctx->codec_id, ic, ic->streams[stream_index], codec);
-    if (!av_dict_get(opts, "threads", nullptr, 0))
-        av_dict_set(&opts, "threads", "auto", 0);
+    if (!av_dict_get(opts, "threads", nullptr, 0)) {
+        if (thread_tune && avctx->codec_type == AVMEDIA_TYPE_VIDEO)
+            thread_tune_open(is, ic->streams[stream_index], avctx, codec, &opts);
+        else
+            av_dict_set(&opts, "threads", "auto", 0);
+    }
     if (stream_lowres)
         av_dict_set_int(&opts, "lowres", stream_lowres, 0);
     if (avctx->codec_type == AVMEDIA_TYPE_VIDEO || avctx->codec_type == AVMEDIA_TYPE_AUDIO)
         av_dict_set(&opts, "refcounted_frames", "1", 0);
+    if (frame_pool && (avctx->codec_type == AVMEDIA_TYPE_VIDEO || avctx->codec_type == AVMEDIA_TYPE_AUDIO)) {
+        avctx->opaque = avctx->codec_type == AVMEDIA_TYPE_VIDEO ? &is->video_pool : &is->audio_pool;
+        // 从4.4起get_buffer2必须线程安全, 帧级多线程的各个解码线程会同时调用它
+        avctx->get_buffer2 = frame_pool_get_buffer2;
+    }
     if ((ret = avcodec_open2(avctx, codec, &opts)) < 0) {
         goto fail;
     }
@@ -2846,6 +8371,7 @@ static int stream_component_open(VideoState *is, int stream_index) {
         goto fail;
     }
 
+    opened:
     is->eof = 0;
     ic->streams[stream_index]->discard = AVDISCARD_DEFAULT;
     switch (avctx->codec_type) {
@@ -2854,6 +8380,11 @@ static int stream_component_open(VideoState *is, int stream_index) {
             is->video_st = ic->streams[stream_index];
 
             decoder_init(&is->viddec, avctx, &is->videoq, &is->pcontinue_read_thread);
+            packet_queue_set_history(&is->videoq, is->video_st->time_base, is->tshift.base ? 0 : seek_buffer);
+            packet_dropper_init(&is->pktdrop, is->video_st->codecpar);
+            is->viddec.packet_filter = video_packet_filter;
+            is->viddec.packet_switch_point = video_packet_switch_point;
+            is->viddec.packet_filter_opaque = is;
             /*if ((ret = decoder_start(&is->viddec, video_thread, "video_decoder", is)) < 0)
                 goto out;*/
             is->queue_attachments_req = 1;
@@ -2931,17 +8462,16 @@ static int stream_component_open(VideoState *is, int stream_index) {
             is->audio_buf_size = 0;
             is->audio_buf_index = 0;
 
-            /* init averaging filter */
-            is->audio_diff_avg_coef = exp(log(0.01) / AUDIO_DIFF_AVG_NB);
-            is->audio_diff_avg_count = 0;
             /* since we do not have a precise anough audio FIFO fullness,
                we correct audio sync only if larger than this threshold */
             is->audio_diff_threshold = (double) (is->audio_hw_buf_size) / is->audio_tgt.bytes_per_sec;
+            avsync_init(&is->avsync, is->audio_diff_threshold);
 
             is->audio_stream = stream_index;
             is->audio_st = ic->streams[stream_index];
 
             decoder_init(&is->auddec, avctx, &is->audioq, &is->pcontinue_read_thread);
+            packet_queue_set_history(&is->audioq, is->audio_st->time_base, is->tshift.base ? 0 : seek_buffer);
             if ((is->ic->iformat->flags & (AVFMT_NOBINSEARCH | AVFMT_NOGENSEARCH | AVFMT_NO_BYTE_SEEK)) &&
                 !is->ic->iformat->read_seek) {
                 is->auddec.start_pts = is->audio_st->start_time;
@@ -3010,6 +8540,7 @@ static int stream_component_open(VideoState *is, int stream_index) {
             is->subtitle_st = ic->streams[stream_index];
 
             decoder_init(&is->subdec, avctx, &is->subtitleq, &is->pcontinue_read_thread);
+            packet_queue_set_history(&is->subtitleq, is->subtitle_st->time_base, is->tshift.base ? 0 : seek_buffer);
             /*if ((ret = decoder_start(&is->subdec, subtitle_thread, "subtitle_decoder", is)) < 0)
                 goto out;*/
             break;
@@ -3019,6 +8550,8 @@ static int stream_component_open(VideoState *is, int stream_index) {
     goto out;
 
     fail:
+    if (avctx && avctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        thread_budget_resize(&is->vtune.reserved, 0);
     avcodec_free_context(&avctx);
     out:
     av_dict_free(&opts);
@@ -3028,7 +8561,9 @@ static int stream_component_open(VideoState *is, int stream_index) {
 
 static int decode_interrupt_cb(void *ctx) {
     VideoState *is = static_cast<VideoState *>(ctx);
-    return is->abort_request;
+    /* a newer seek request cancels the seek or read in progress; with -timeshift seeks don't touch the input */
+    return is->abort_request ||
+           (is->seek_req && !is->tshift.base && SDL_AtomicGet(&is->seek_gen) != is->seek_exec_gen);
 }
 
 static int stream_has_enough_packets(AVStream *st, int stream_id, PacketQueue *queue) {
@@ -3060,6 +8595,305 @@ static int is_realtime(AVFormatContext *s) {
     return 0;
 }
 
+// 在保留的包和队列里的包中找seek的起点: ts<=target的最后一个(key_only时只找关键帧), 不能早于min;
+// 没有时取target之后的第一个, 不能晚于max. *last_ts是最后一个有时间戳的包的时间
+static MyAVPacketList *seek_buffer_locate(PacketQueue *q, double target, double min, double max, int key_only,
+                                          double *pos_ts, double *last_ts) {
+    MyAVPacketList *best = nullptr, *after = nullptr;
+    double best_ts = NAN, after_ts = NAN;
+
+    *last_ts = NAN;
+    for (MyAVPacketList *n = packet_queue_node_next(q, nullptr); n; n = packet_queue_node_next(q, n)) {
+        double ts = packet_queue_node_ts(q, n);
+
+        if (isnan(ts))
+            continue;
+        *last_ts = isnan(*last_ts) ? ts : FFMAX(*last_ts, ts);
+        if (key_only && !(n->pkt.flags & AV_PKT_FLAG_KEY))
+            continue;
+        if (ts <= target) {
+            best = n;
+            best_ts = ts;
+        } else if (!after) {
+            after = n;
+            after_ts = ts;
+        }
+    }
+    if (best && best_ts >= min) {
+        *pos_ts = best_ts;
+        return best;
+    }
+    if (after && after_ts <= max) {
+        *pos_ts = after_ts;
+        return after;
+    }
+    return nullptr;
+}
+
+// pos之前的包留在保留列表里, 从pos开始的包以新的serial重新排队, 前面放一个flush_pkt; 和seek之后的队列一样
+static void packet_queue_rewind(PacketQueue *q, MyAVPacketList *pos, MyAVPacketList *flush_node) {
+    MyAVPacketList *hist_first = nullptr, *hist_last = nullptr, *last = flush_node;
+    MyAVPacketList *n, *next;
+    int requeue = 0;
+
+    q->serial++;
+    flush_node->pkt = flush_pkt;
+    flush_node->serial = q->serial;
+    flush_node->next = nullptr;
+    flush_node->spill_offset = -1;
+    q->hist_nb_packets = 0;
+    q->hist_size = 0;
+    q->nb_packets = 1;
+    q->size = sizeof(*flush_node);
+    q->duration = 0;
+
+    for (n = packet_queue_node_next(q, nullptr); n; n = next) {
+        next = packet_queue_node_next(q, n);
+        n->next = nullptr;
+        if (n == pos)
+            requeue = 1;
+        if (!requeue) {
+            if (hist_last)
+                hist_last->next = n;
+            else
+                hist_first = n;
+            hist_last = n;
+            q->hist_nb_packets++;
+            q->hist_size += n->pkt.size + sizeof(*n);
+        } else if (!n->pkt.data || n->pkt.data == flush_pkt.data) {
+            /* read_thread queues the end of stream again */
+            av_free(n);
+        } else {
+            n->serial = q->serial;
+            last->next = n;
+            last = n;
+            q->nb_packets++;
+            q->size += n->pkt.size + sizeof(*n);
+            q->duration += n->pkt.duration;
+        }
+    }
+    q->hist_first = hist_first;
+    q->hist_last = hist_last;
+    q->first_pkt = flush_node;
+    q->last_pkt = last;
+    pthread_cond_signal(&q->pcond);
+}
+
+// -seek_buffer: 目标在保留的包和队列里的包的范围内时, 不调用avformat_seek_file, 只在这些包里重新定位
+static int seek_buffer_seek(VideoState *is, int64_t seek_target, int64_t seek_min, int64_t seek_max) {
+    PacketQueue *queues[3];
+    int stream_indices[3] = {is->video_stream, is->audio_stream, is->subtitle_stream};
+    MyAVPacketList *pos[3] = {nullptr};
+    MyAVPacketList *flush_nodes[3] = {nullptr};
+    double target = seek_target / (double) AV_TIME_BASE;
+    double min = seek_min == INT64_MIN ? -INFINITY : seek_min / (double) AV_TIME_BASE;
+    double max = seek_max == INT64_MAX ? INFINITY : seek_max / (double) AV_TIME_BASE;
+    double start_ts = NAN, pos_ts, last_ts;
+    int ref = is->video_stream >= 0 ? 0 : 1;
+    int hit = 1;
+
+    if (seek_buffer <= 0 || (is->seek_flags & AVSEEK_FLAG_BYTE) || is->jitbuf_enabled ||
+        (is->video_st && (is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC)) ||
+        (is->video_stream < 0 && is->audio_stream < 0))
+        return 0;
+    queues[0] = &is->videoq;
+    queues[1] = &is->audioq;
+    queues[2] = &is->subtitleq;
+    for (int i = 0; i < 3; i++) {
+        if (stream_indices[i] >= 0 &&
+            !(flush_nodes[i] = static_cast<MyAVPacketList *>(av_malloc(sizeof(MyAVPacketList))))) {
+            hit = 0;
+            break;
+        }
+    }
+
+    /* the decoders wait on the queues until all of them are repositioned */
+    for (int i = 0; i < 3; i++)
+        if (stream_indices[i] >= 0)
+            pthread_mutex_lock(&queues[i]->pmutex);
+
+    /* packets in the spill files are only read back in order */
+    for (int i = 0; i < 3; i++)
+        if (stream_indices[i] >= 0 && queues[i]->spill_bytes)
+            hit = 0;
+    if (hit) {
+        /* video starts on a keyframe, the other streams at the last packet before it */
+        pos[ref] = seek_buffer_locate(queues[ref], target, min, max, ref == 0, &start_ts, &last_ts);
+        hit = pos[ref] && target <= last_ts;
+    }
+    for (int i = 0; i < 3 && hit; i++) {
+        if (i == ref || stream_indices[i] < 0)
+            continue;
+        pos[i] = seek_buffer_locate(queues[i], start_ts, -INFINITY, start_ts + SEEK_BUFFER_SLACK, 0, &pos_ts, &last_ts);
+        if (!pos[i] && i == 2) {
+            /* subtitles are sparse, requeue all of them */
+            pos[i] = packet_queue_node_next(queues[i], nullptr);
+        } else if (!pos[i]) {
+            hit = 0;
+        }
+    }
+    if (hit) {
+        for (int i = 0; i < 3; i++) {
+            if (stream_indices[i] >= 0) {
+                packet_queue_rewind(queues[i], pos[i], flush_nodes[i]);
+                flush_nodes[i] = nullptr;
+            }
+        }
+        av_log(nullptr, AV_LOG_DEBUG, "seek to %0.3f served from the buffer, starting at %0.3f\n", target, start_ts);
+    }
+
+    for (int i = 2; i >= 0; i--)
+        if (stream_indices[i] >= 0)
+            pthread_mutex_unlock(&queues[i]->pmutex);
+    for (int i = 0; i < 3; i++)
+        av_free(flush_nodes[i]);
+    return hit;
+}
+
+// 记下seek执行的结果, 新位置的第一帧出来时(seek_stats_frame)算延迟
+static void seek_stats_start(VideoState *is, int hit) {
+    SeekStats *ss = &is->seek_stats;
+
+    ss->request_time = is->seek_req_time;
+    ss->hit = hit;
+    SDL_AtomicSet(&ss->pending_serial, is->video_stream >= 0 ? is->videoq.serial : is->audioq.serial);
+    seek_bench_start(is, hit);
+}
+
+// 在环里seek: 跳到不晚于目标的最后一个关键帧; 比环里最早的还早时从最早的开始, 超过直播时从最新的开始
+static void timeshift_seek(VideoState *is) {
+    TimeshiftRing *ts = &is->tshift;
+    TimeshiftKey key;
+    int found = 0;
+
+    pthread_mutex_lock(&is->seek_mutex);
+    int64_t seek_target = is->seek_pos;
+    int by_bytes = is->seek_flags & AVSEEK_FLAG_BYTE;
+    int seek_gen = SDL_AtomicGet(&is->seek_gen);
+    is->seek_exec_gen = seek_gen;
+    pthread_mutex_unlock(&is->seek_mutex);
+
+    pthread_mutex_lock(&ts->pmutex);
+    for (int i = ts->nb_keys - 1; i >= 0; i--) {
+        key = ts->keys[(ts->first_key + i) % TIMESHIFT_INDEX_SIZE];
+        found = 1;
+        if (by_bytes ? key.pos <= seek_target : key.ts * AV_TIME_BASE <= seek_target)
+            break;
+    }
+    if (found) {
+        ts->read = key.offset;
+        ts->unread = ts->used - (key.offset - ts->tail + ts->size) % ts->size;
+        ts->need_key = 0;
+        ts->nb_seeks++;
+    }
+    pthread_mutex_unlock(&ts->pmutex);
+
+    if (found) {
+        if (is->video_stream >= 0) {
+            packet_queue_flush(&is->videoq);
+            packet_queue_put(&is->videoq, &flush_pkt);
+        }
+        if (is->audio_stream >= 0) {
+            packet_queue_flush(&is->audioq);
+            packet_queue_put(&is->audioq, &flush_pkt);
+        }
+        if (is->subtitle_stream >= 0) {
+            packet_queue_flush(&is->subtitleq);
+            packet_queue_put(&is->subtitleq, &flush_pkt);
+        }
+        set_clock(&is->extclk, by_bytes ? NAN : key.ts, 0);
+        seek_stats_start(is, 1);
+    }
+    if (is->rev.resume_req && is->rev.resume_gen == seek_gen) {
+        SDL_AtomicSet(&is->rev.resume_serial, is->videoq.serial);
+        if (is->audio_stream >= 0)
+            SDL_AtomicSet(&is->rev.audio_resume_serial, is->audioq.serial);
+        is->rev.resume_req = 0;
+    }
+    pthread_mutex_lock(&is->seek_mutex);
+    if (SDL_AtomicGet(&is->seek_gen) == seek_gen)
+        is->seek_req = 0;
+    pthread_mutex_unlock(&is->seek_mutex);
+    refresh_wakeup(is);
+    if (is->paused)
+        step_to_next_frame(is);
+}
+
+// 按播放进度从环里读包放进PacketQueue, seek也在这里执行; read_thread只管录
+static int timeshift_thread(void *arg) {
+    VideoState *is = static_cast<VideoState *>(arg);
+    TimeshiftRing *ts = &is->tshift;
+    AVPacket pkt1, *pkt = &pkt1;
+    struct timespec abstime;
+    int64_t wait_us;
+
+    while (!is->abort_request) {
+        TimeshiftRecord *rec;
+        int skip;
+
+        if (is->seek_req) {
+            timeshift_seek(is);
+            continue;
+        }
+        pthread_mutex_lock(&ts->pmutex);
+        /* whatever -infbuf says, the ring is the buffer; the queues only hold what the decoders need next */
+        if (!ts->unread ||
+            (stream_has_enough_packets(is->audio_st, is->audio_stream, &is->audioq) &&
+             stream_has_enough_packets(is->video_st, is->video_stream, &is->videoq) &&
+             stream_has_enough_packets(is->subtitle_st, is->subtitle_stream, &is->subtitleq))) {
+            /* wait 10 ms for the recorder or the decoders */
+            wait_us = av_gettime() + 10000;
+            abstime.tv_sec = wait_us / 1000000;
+            abstime.tv_nsec = (wait_us % 1000000) * 1000;
+            pthread_cond_timedwait(&ts->pcond, &ts->pmutex, &abstime);
+            pthread_mutex_unlock(&ts->pmutex);
+            continue;
+        }
+        if (timeshift_wraps(ts, ts->read)) {
+            ts->unread -= ts->size - ts->read;
+            ts->read = 0;
+            pthread_mutex_unlock(&ts->pmutex);
+            continue;
+        }
+        rec = reinterpret_cast<TimeshiftRecord *>(ts->base + ts->read);
+        if (ts->need_key && rec->stream_index == is->video_stream && (rec->flags & AV_PKT_FLAG_KEY))
+            ts->need_key = 0;
+        skip = ts->need_key && is->video_stream >= 0;
+        if (!skip) {
+            av_init_packet(pkt);
+            pkt->data = nullptr;
+            pkt->size = 0;
+            if (rec->data_size && av_new_packet(pkt, rec->data_size) < 0) {
+                pthread_mutex_unlock(&ts->pmutex);
+                break;
+            }
+            if (rec->data_size)
+                memcpy(pkt->data, rec + 1, rec->data_size);
+            pkt->stream_index = rec->stream_index;
+            pkt->flags = rec->flags;
+            pkt->pts = rec->pts;
+            pkt->dts = rec->dts;
+            pkt->duration = rec->duration;
+            pkt->pos = rec->pos;
+        }
+        ts->unread -= rec->size;
+        ts->read = ts->read + rec->size == ts->size ? 0 : ts->read + rec->size;
+        pthread_mutex_unlock(&ts->pmutex);
+        if (skip)
+            continue;
+
+        if (pkt->stream_index == is->video_stream)
+            packet_queue_put(&is->videoq, pkt);
+        else if (pkt->stream_index == is->audio_stream)
+            packet_queue_put(&is->audioq, pkt);
+        else if (pkt->stream_index == is->subtitle_stream)
+            packet_queue_put(&is->subtitleq, pkt);
+        else
+            av_packet_unref(pkt);
+    }
+    return 0;
+}
+
 static int read_thread(void *arg) {
     printf("read_thread() start\n");
     VideoState *is = static_cast<VideoState *>(arg);
@@ -3068,6 +8902,10 @@ static int read_thread(void *arg) {
     int64_t stream_start_time;
     int64_t pkt_ts;
     int pkt_in_play_range = 0;
+    // -seek_preview时这次seek之后的关键帧已经放进队列
+    int preview_done = 0;
+    // av_read_frame被seek打断过(丢了读到一半的包), 或者拖动时只留了视频关键帧: 缓冲的包有缺口, 下一次seek必须交给demuxer
+    int read_interrupted = 0;
     int ret;
     pthread_mutex_t wait_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -3114,7 +8952,8 @@ static int read_thread(void *arg) {
         // endregion
 
         // region is->paused != is->last_paused
-        if (is->paused != is->last_paused) {
+        // 时移时暂停的只是播放, 录制照常
+        if (is->paused != is->last_paused && !is->tshift.base) {
             printf("read_thread() is->paused = %d is->last_paused = %d\n", is->paused, is->last_paused);
             is->last_paused = is->paused;
             if (is->paused) {
@@ -3129,7 +8968,7 @@ static int read_thread(void *arg) {
 
         // region CONFIG_RTSP_DEMUXER || CONFIG_MMSH_PROTOCOL
 #if CONFIG_RTSP_DEMUXER || CONFIG_MMSH_PROTOCOL
-        if (is->paused &&
+        if (is->paused && !is->tshift.base &&
             (!strcmp(pAvFormatContext->iformat->name, "rtsp") ||
              (pAvFormatContext->pb && !strncmp(input_filename, "mmsh:", 5)))) {
             printf("read_thread() SDL_Delay(10)\n");
@@ -3142,25 +8981,45 @@ static int read_thread(void *arg) {
         // endregion
 
         // region is->seek_req
-        if (is->seek_req) {
+        // 时移时由timeshift_thread在环里seek
+        if (is->seek_req && !is->tshift.base) {
             printf("read_thread() is->seek_req\n");
             // INT64_MIN -9223372036854775808
             // INT64_MAX  9223372036854775807
+            pthread_mutex_lock(&is->seek_mutex);
             int64_t seek_target = is->seek_pos;
             int64_t seek_min = is->seek_rel > 0 ? seek_target - is->seek_rel + 2 : INT64_MIN;
             int64_t seek_max = is->seek_rel < 0 ? seek_target - is->seek_rel - 2 : INT64_MAX;
+            int seek_flags = is->seek_flags;
+            int seek_gen = SDL_AtomicGet(&is->seek_gen);
+            is->seek_exec_gen = seek_gen;
+            pthread_mutex_unlock(&is->seek_mutex);
             // FIXME the +-2 is due to rounding being not done in the correct direction in generation
             //      of the seek_pos/seek_rel variables
             printf("read_thread()    seek_min = %ld\n", (long) seek_min);
             printf("read_thread() seek_target = %ld\n", (long) seek_target);
             printf("read_thread()    seek_max = %ld\n", (long) seek_max);
 
-            ret = avformat_seek_file(is->ic, -1, seek_min, seek_target, seek_max, is->seek_flags);
-            printf("read_thread()         ret = %d\n", ret);
-            if (ret < 0) {
+            /* a preview seek lands on a keyframe the demuxer finds faster, and its packets must not be retained */
+            if (!read_interrupted && !is->seek_preview && seek_buffer_seek(is, seek_target, seek_min, seek_max)) {
+                set_clock(&is->extclk, seek_target / (double) AV_TIME_BASE, 0);
+                seek_stats_start(is, 1);
+            } else if ((ret = avformat_seek_file(is->ic, -1, seek_min, seek_target, seek_max, seek_flags)) < 0
+                       || SDL_AtomicGet(&is->seek_gen) != seek_gen) {
+                if (SDL_AtomicGet(&is->seek_gen) != seek_gen) {
+                    /* a newer target came in, seek there right away instead of flushing for this one */
+                    is->seek_stats.nb_cancelled++;
+                    if (pAvFormatContext->pb) {
+                        pAvFormatContext->pb->error = 0;
+                        pAvFormatContext->pb->eof_reached = 0;
+                    }
+                    continue;
+                }
                 av_log(nullptr, AV_LOG_ERROR,
                        "%s: error while seeking\n", is->ic->url);
             } else {
+                if (is->jitbuf_enabled)
+                    jitter_buffer_flush(is, 0);
                 if (is->video_stream >= 0) {
                     packet_queue_flush(&is->videoq);
                     packet_queue_put(&is->videoq, &flush_pkt);
@@ -3173,15 +9032,31 @@ static int read_thread(void *arg) {
                     packet_queue_flush(&is->subtitleq);
                     packet_queue_put(&is->subtitleq, &flush_pkt);
                 }
-                if (is->seek_flags & AVSEEK_FLAG_BYTE) {
+                /* the flushes dropped the history up to the hole along with the rest */
+                read_interrupted = 0;
+                if (seek_flags & AVSEEK_FLAG_BYTE) {
                     set_clock(&is->extclk, NAN, 0);
                 } else {
                     set_clock(&is->extclk, seek_target / (double) AV_TIME_BASE, 0);
                 }
+                seek_stats_start(is, 0);
+            }
+            if (is->rev.resume_req && is->rev.resume_gen == seek_gen) {
+                /* the video thread drops the frames before the one reverse playback stopped on */
+                SDL_AtomicSet(&is->rev.resume_serial, is->videoq.serial);
+                if (is->audio_stream >= 0)
+                    SDL_AtomicSet(&is->rev.audio_resume_serial, is->audioq.serial);
+                is->rev.resume_req = 0;
             }
-            is->seek_req = 0;
+            preview_done = 0;
+            pthread_mutex_lock(&is->seek_mutex);
+            /* a request that came in meanwhile is executed on the next iteration */
+            if (SDL_AtomicGet(&is->seek_gen) == seek_gen)
+                is->seek_req = 0;
+            pthread_mutex_unlock(&is->seek_mutex);
             is->queue_attachments_req = 1;
             is->eof = 0;
+            refresh_wakeup(is);
             if (is->paused)
                 step_to_next_frame(is);
         }
@@ -3202,11 +9077,14 @@ static int read_thread(void *arg) {
         // endregion
 
         // region if the queue are full, no need to read more
-        if (infinite_buffer < 1 &&
-            (//is->audioq.size + is->videoq.size + is->subtitleq.size > MAX_QUEUE_SIZE ||
-                    (stream_has_enough_packets(is->audio_st, is->audio_stream, &is->audioq) &&
-                     stream_has_enough_packets(is->video_st, is->video_stream, &is->videoq) &&
-                     stream_has_enough_packets(is->subtitle_st, is->subtitle_stream, &is->subtitleq)))) {
+        if (!is->tshift.base &&
+            ((infinite_buffer < 1 &&
+              (//is->audioq.size + is->videoq.size + is->subtitleq.size > MAX_QUEUE_SIZE ||
+                      (stream_has_enough_packets(is->audio_st, is->audio_stream, &is->audioq) &&
+                       stream_has_enough_packets(is->video_st, is->video_stream, &is->videoq) &&
+                       stream_has_enough_packets(is->subtitle_st, is->subtitle_stream, &is->subtitleq)))) ||
+             /* one picture per position is enough while dragging */
+             (is->seek_preview && preview_done))) {
             //printf("read_thread() SDL_CondWaitTimeout(10)\n");
             /* wait 10 ms */
             pthread_mutex_lock(&wait_mutex);
@@ -3239,19 +9117,37 @@ static int read_thread(void *arg) {
         // endregion
 
         ret = av_read_frame(pAvFormatContext, pkt);
+        if (ret < 0 && is->seek_req && !is->tshift.base && !is->abort_request) {
+            /* interrupted by a seek request, the seek leaves the demuxer in a clean state as long as it
+             * really goes to the demuxer: reading on after a buffered seek would skip the lost packet */
+            is->seek_stats.nb_reads_interrupted++;
+            read_interrupted = 1;
+            if (pAvFormatContext->pb) {
+                pAvFormatContext->pb->error = 0;
+                pAvFormatContext->pb->eof_reached = 0;
+            }
+            continue;
+        }
         if (ret < 0) {
             // region
             if ((ret == AVERROR_EOF || avio_feof(pAvFormatContext->pb)) && !is->eof) {
-                if (is->video_stream >= 0) {
-                    packet_queue_put_nullpacket(&is->videoq, is->video_stream);
-                }
-                if (is->audio_stream >= 0) {
-                    packet_queue_put_nullpacket(&is->audioq, is->audio_stream);
-                }
-                if (is->subtitle_stream >= 0) {
-                    packet_queue_put_nullpacket(&is->subtitleq, is->subtitle_stream);
+                if (is->tshift.base) {
+                    timeshift_write_nullpackets(is);
+                } else {
+                    if (is->jitbuf_enabled)
+                        jitter_buffer_flush(is, 1);
+                    if (is->video_stream >= 0) {
+                        packet_queue_put_nullpacket(&is->videoq, is->video_stream);
+                    }
+                    if (is->audio_stream >= 0) {
+                        packet_queue_put_nullpacket(&is->audioq, is->audio_stream);
+                    }
+                    if (is->subtitle_stream >= 0) {
+                        packet_queue_put_nullpacket(&is->subtitleq, is->subtitle_stream);
+                    }
                 }
                 is->eof = 1;
+                refresh_wakeup(is);
             }
             if (pAvFormatContext->pb && pAvFormatContext->pb->error) {
                 break;
@@ -3281,8 +9177,36 @@ static int read_thread(void *arg) {
                 (double) (start_time != AV_NOPTS_VALUE ? start_time : 0) / 1000000
                 <= ((double) duration / 1000000);
 
+        seek_bench_packet(is, pkt->stream_index);
+
+        if (is->tshift.base) {
+            // 录进环里, timeshift_thread按播放进度读出来
+            if (pkt_in_play_range &&
+                (pkt->stream_index == is->audio_stream || pkt->stream_index == is->subtitle_stream ||
+                 (pkt->stream_index == is->video_stream &&
+                  !(is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC))))
+                timeshift_write(is, pkt);
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        /* keyframes only while dragging, the rest would be decoded for nothing */
+        if (is->seek_preview && is->video_stream >= 0
+            && !(is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+            if (pkt->stream_index != is->video_stream || !(pkt->flags & AV_PKT_FLAG_KEY)) {
+                av_packet_unref(pkt);
+                read_interrupted = 1;
+                continue;
+            }
+            preview_done = 1;
+        }
+
         // region save AVPacket
-        if (pkt->stream_index == is->audio_stream && pkt_in_play_range) {
+        if (is->jitbuf_enabled && pkt_in_play_range
+            && !(is->video_st && is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC)
+            && jitter_buffer_put(is, pkt) == 0) {
+            // 由jitter_buffer_thread放入PacketQueue
+        } else if (pkt->stream_index == is->audio_stream && pkt_in_play_range) {
             packet_queue_put(&is->audioq, pkt);
         } else if (pkt->stream_index == is->video_stream
                    && pkt_in_play_range
@@ -3324,6 +9248,15 @@ static int create_avformat_context(void *arg) {
     memset(st_index, -1, sizeof(st_index));
     is->eof = 0;
 
+    // 换台时直接用standby频道打开并探测好的输入
+    if (is->zap && is->zap->ic) {
+        ic = is->zap->ic;
+        is->zap->ic = nullptr;
+        ic->interrupt_callback.callback = decode_interrupt_cb;
+        ic->interrupt_callback.opaque = is;
+        goto adopted;
+    }
+
     if (!(ic = avformat_alloc_context())) {
         av_log(nullptr, AV_LOG_FATAL, "Could not allocate context.\n");
         ret = AVERROR(ENOMEM);
@@ -3350,6 +9283,7 @@ static int create_avformat_context(void *arg) {
         ret = AVERROR_OPTION_NOT_FOUND;
         goto fail;
     }
+    adopted:
     is->ic = ic;
 
     media_duration = (long) (ic->duration / AV_TIME_BASE);
@@ -3376,7 +9310,7 @@ static int create_avformat_context(void *arg) {
     av_format_inject_global_side_data(ic);
 
     printf("create_avformat_context() find_stream_info = %d\n", find_stream_info);// 1
-    if (find_stream_info) {
+    if (find_stream_info && !is->zap) {
         AVDictionary **opts = setup_find_stream_info_opts(ic, codec_opts);
         int orig_nb_streams = ic->nb_streams;
 
@@ -3529,17 +9463,128 @@ static int create_avformat_context(void *arg) {
     if (ret != 0) {
         SDL_Event event;
 
-        event.type = FF_QUIT_EVENT;
-        event.user.data1 = is;
-        SDL_PushEvent(&event);
+        event.type = FF_QUIT_EVENT;
+        event.user.data1 = is;
+        SDL_PushEvent(&event);
+    }
+    printf("create_avformat_context() ret = %d\n", ret);
+    printf("create_avformat_context() end\n");
+    return ret;
+    //return 0;
+}
+
+/* av_malloc() may align less than a cache line, which VideoState relies on */
+static VideoState *video_state_alloc(void) {
+    void *ptr = nullptr;
+
+    if (posix_memalign(&ptr, CACHE_LINE_SIZE, sizeof(VideoState)))
+        return nullptr;
+    memset(ptr, 0, sizeof(VideoState));
+    return static_cast<VideoState *>(ptr);
+}
+
+/* clock samples taken by -audio_clock_test, microseconds apart */
+#define AUDIO_CLOCK_TEST_INTERVAL 10000
+/* largest drift of the audio clock against the consumed samples that passes, in ppm */
+#define AUDIO_CLOCK_TEST_MAX_DRIFT 2000
+
+// -audio_clock_test: 按一种延迟模式和回调/推送方式打开音频设备喂静音, 音频时钟和设备消耗的样本比较;
+// SDL_AUDIODRIVER=disk时消耗的样本就是已经写进SDL_DISKAUDIOFILE的字节, 其他(dummy)设备按实时消耗算
+static int audio_clock_test_run(int mode, int push, double duration) {
+    VideoState *is = video_state_alloc();
+    const char *driver;
+    const char *disk_file = nullptr;
+    int queue_serial = 0;
+    int64_t start = 0, now, end;
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+    double consumed, clock, x, y, drift, jitter, offset, period;
+    struct stat st;
+    int ret;
+
+    if (!is)
+        return AVERROR(ENOMEM);
+    audio_latency_mode = mode;
+    audio_push = push;
+    audio_clock_test_bytes = 0;
+    init_clock(&is->audclk, &queue_serial);
+    init_clock(&is->extclk, &queue_serial);
+    is->audio_clock = NAN;
+    if ((ret = audio_open(is, AV_CH_LAYOUT_STEREO, 2, 48000, &is->audio_tgt)) < 0) {
+        free(is);
+        return ret;
+    }
+    is->audio_hw_buf_size = ret;
+    period = (double) is->audio_hw_buf_size / is->audio_tgt.bytes_per_sec;
+    driver = SDL_GetCurrentAudioDriver();
+    if (driver && !strcmp(driver, "disk"))
+        disk_file = (const char *) av_x_if_null(SDL_getenv("SDL_DISKAUDIOFILE"), "sdlaudio.raw");
+    if (push && (ret = audio_push_start(is)) < 0) {
+        SDL_CloseAudioDevice(audio_dev);
+        free(is);
+        return ret;
+    }
+    SDL_PauseAudioDevice(audio_dev, 0);
+
+    end = av_gettime_relative() + (int64_t) (duration * 1000000);
+    while (av_gettime_relative() < end) {
+        av_usleep(AUDIO_CLOCK_TEST_INTERVAL);
+        now = av_gettime_relative();
+        clock = get_clock(&is->audclk);
+        if (isnan(clock))
+            continue;
+        if (!start)
+            start = now;
+        if (disk_file)
+            consumed = stat(disk_file, &st) ? NAN : (double) st.st_size / is->audio_tgt.bytes_per_sec;
+        else
+            consumed = (now - start) / 1000000.0;
+        if (isnan(consumed))
+            continue;
+        /* offset of the clock from the samples consumed, over time */
+        x = (now - start) / 1000000.0;
+        y = clock - consumed;
+        n++;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        syy += y * y;
+    }
+
+    audio_push_stop(is);
+    SDL_CloseAudioDevice(audio_dev);
+    free(is);
+    if (n < 2 || n * sxx - sx * sx <= 0) {
+        av_log(nullptr, AV_LOG_ERROR, "audio clock test: %s %s: the audio clock never started\n",
+               audio_latency_modes[mode].name, push ? "push" : "callback");
+        return AVERROR(EIO);
     }
-    printf("create_avformat_context() ret = %d\n", ret);
-    printf("create_avformat_context() end\n");
+    /* least squares line through the offsets: the slope is the drift, the residuals the jitter */
+    drift = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    offset = sy / n;
+    jitter = sqrt(FFMAX((syy - sy * sy / n) - drift * (sxy - sx * sy / n), 0) / n);
+    ret = fabs(drift) * 1000000 <= AUDIO_CLOCK_TEST_MAX_DRIFT && jitter <= period ? 0 : AVERROR_BUG;
+    av_log(nullptr, ret < 0 ? AV_LOG_ERROR : AV_LOG_INFO,
+           "audio clock test: %-9s %-8s driver=%s period=%0.1fms offset=%0.1fms drift=%0.0fppm jitter=%0.2fms %s\n",
+           audio_latency_modes[mode].name, push ? "push" : "callback", (const char *) av_x_if_null(driver, "none"),
+           period * 1000, offset * 1000, drift * 1000000, jitter * 1000, ret < 0 ? "FAILED" : "ok");
     return ret;
-    //return 0;
 }
 
-static VideoState *stream_open(const char *filename, AVInputFormat *iformat) {
+static int audio_clock_test_all(double duration) {
+    int saved_mode = audio_latency_mode, saved_push = audio_push;
+    int failed = 0;
+
+    for (int mode = 0; mode < AUDIO_LATENCY_NB; mode++)
+        for (int push = 0; push <= 1; push++)
+            if (audio_clock_test_run(mode, push, duration) < 0)
+                failed++;
+    audio_latency_mode = saved_mode;
+    audio_push = saved_push;
+    return failed ? AVERROR_BUG : 0;
+}
+
+static VideoState *stream_open(const char *filename, AVInputFormat *iformat, ZapChannel *standby) {
     printf("stream_open() start\n");
     printf("stream_open() filename: %s\n", filename);
 
@@ -3547,12 +9592,15 @@ static VideoState *stream_open(const char *filename, AVInputFormat *iformat) {
     media_duration = -1;
 
     VideoState *is;
-    is = static_cast<VideoState *>(av_mallocz(sizeof(VideoState)));
+    is = video_state_alloc();
     if (!is)
         return nullptr;
     video_state = is;
     int ret = 0;
 
+    if (!(is->sample_array = static_cast<int16_t *>(av_mallocz_array(SAMPLE_ARRAY_SIZE, sizeof(int16_t)))))
+        goto fail;
+
     //filename为需要拷贝的字符串
     //av_strdup返回一个指向新分配的内存，该内存拷贝了一份字符串，如果无法分配出空间，则返回nullptr
     //需要调用av_free释放空间
@@ -3566,6 +9614,17 @@ static VideoState *stream_open(const char *filename, AVInputFormat *iformat) {
     is->ytop = 0;
     is->xleft = 0;
     is->audio_clock_serial = -1;
+    is->audio_cb_cpu_time = -1;
+    SDL_AtomicSet(&is->seek_stats.pending_serial, -1);
+    is->seek_mutex = PTHREAD_MUTEX_INITIALIZER;
+    is->rev.pmutex = PTHREAD_MUTEX_INITIALIZER;
+    is->rev.pcond = PTHREAD_COND_INITIALIZER;
+    is->tshift.pmutex = PTHREAD_MUTEX_INITIALIZER;
+    is->tshift.pcond = PTHREAD_COND_INITIALIZER;
+    SDL_AtomicSet(&is->rev.resume_serial, -1);
+    SDL_AtomicSet(&is->rev.audio_resume_serial, -1);
+    if (!(is->rev.shown.frame = av_frame_alloc()))
+        goto fail;
     is->iformat = iformat;
     if (!is->iformat) {
         printf("stream_open() is->iformat is nullptr\n");
@@ -3589,6 +9648,9 @@ static VideoState *stream_open(const char *filename, AVInputFormat *iformat) {
     init_clock(&is->vidclk, &is->videoq.serial);
     init_clock(&is->audclk, &is->audioq.serial);
     init_clock(&is->extclk, &is->extclk.serial);
+    present_scheduler_init(&is->present);
+    frame_pool_init(&is->video_pool);
+    frame_pool_init(&is->audio_pool);
 
     printf("stream_open() 1 startup_volume = %d\n", startup_volume);// 100
     if (startup_volume < 0)
@@ -3601,6 +9663,13 @@ static VideoState *stream_open(const char *filename, AVInputFormat *iformat) {
     printf("stream_open() 2 startup_volume = %d\n", startup_volume);// 128
     is->muted = 0;
     is->av_sync_type = av_sync_type;
+    is->render_mutex = PTHREAD_MUTEX_INITIALIZER;
+    is->zap = standby;
+    if (zap.switch_time) {
+        is->zap_start = zap.switch_time;
+        is->zap_warm = standby != nullptr;
+        zap.switch_time = 0;
+    }
 
     if ((ret = create_avformat_context(is)) < 0) {
         printf("stream_open() create_avformat_context(is) < 0\n");
@@ -3609,10 +9678,21 @@ static VideoState *stream_open(const char *filename, AVInputFormat *iformat) {
 
     ///////////////////////创建线程///////////////////////
 
-    if (!(is->read_tid = SDL_CreateThread(read_thread, "read_thread", is))) {
-        av_log(nullptr, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
-        ret = -1;
-        goto fail;
+    // 直播(没有时长)才时移, 环建不起来时照常播放
+    if (timeshift > 0 && (is->realtime || is->ic->duration == AV_NOPTS_VALUE) && timeshift_open(is) < 0)
+        av_log(nullptr, AV_LOG_WARNING, "timeshift: disabled\n");
+
+    // -infbuf时队列不限长度, 超过spill_mem的部分放到磁盘上; 时移时队列不会长, 数据已经在环里
+    if (infinite_buffer == 1 && spill_mem > 0 && !is->tshift.base)
+        is->videoq.spill_limit = is->audioq.spill_limit = is->subtitleq.spill_limit = (int64_t) spill_mem << 20;
+
+    /* -jitbuf defaults to on for realtime inputs, decided per stream since a zap can open another kind;
+     * with -timeshift the ring already absorbs the jitter */
+    if ((jitter_buffer < 0 ? is->realtime : jitter_buffer) && !is->tshift.base) {
+        jitter_buffer_init(is);
+        is->jitbuf_enabled = 1;
+        if ((ret = jitter_buffer_start(is)) < 0)
+            goto fail;
     }
 
     if (is->video_stream >= 0) {
@@ -3623,6 +9703,8 @@ static VideoState *stream_open(const char *filename, AVInputFormat *iformat) {
     if (is->audio_stream >= 0) {
         if (ret = decoder_start(&is->auddec, audio_thread, "audio_decoder", is) < 0)
             goto fail;
+        if (audio_push && (ret = audio_push_start(is)) < 0)
+            goto fail;
         SDL_PauseAudioDevice(audio_dev, 0);
     }
 
@@ -3631,9 +9713,41 @@ static VideoState *stream_open(const char *filename, AVInputFormat *iformat) {
             goto fail;
     }
 
+    // standby频道缓存的GOP在decoder_start放进flush_pkt之后入队, 属于新的serial
+    if (standby) {
+        MyAVPacketList *n, *next;
+
+        for (n = standby->gop_first; n; n = next) {
+            next = n->next;
+            if (n->pkt.stream_index == is->video_stream)
+                packet_queue_put(&is->videoq, &n->pkt);
+            else if (n->pkt.stream_index == is->audio_stream)
+                packet_queue_put(&is->audioq, &n->pkt);
+            else
+                av_packet_unref(&n->pkt);
+            av_free(n);
+        }
+        standby->gop_first = standby->gop_last = nullptr;
+        standby->gop_size = 0;
+        is->zap = nullptr;
+    }
+
+    if (is->tshift.base && !(is->tshift.tid = thread_create(timeshift_thread, "timeshift", is, THREAD_ROLE_DEMUX))) {
+        av_log(nullptr, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+        ret = -1;
+        goto fail;
+    }
+
+    if (!(is->read_tid = thread_create(read_thread, "read_thread", is, THREAD_ROLE_DEMUX))) {
+        av_log(nullptr, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+        ret = -1;
+        goto fail;
+    }
+
     ret = 0;
     fail:
     if (ret < 0) {
+        is->zap = nullptr;
         stream_close(is);
         return nullptr;
     }
@@ -3713,7 +9827,15 @@ static void stream_cycle_channel(VideoState *is, int codec_type) {
            old_index,
            stream_index);
 
+    /* the render thread keeps drawing video while only the audio stream changes */
+    int render_locked = is->render_tid &&
+                        (codec_type != AVMEDIA_TYPE_AUDIO || is->show_mode != VideoState::SHOW_MODE_VIDEO);
+    // 只有关流要挡住video_refresh; 打开和read_thread启动时一样可以和画面同时进行, 打开解码器和音频设备时照常刷新
+    if (render_locked)
+        pthread_mutex_lock(&is->render_mutex);
     stream_component_close(is, old_index);
+    if (render_locked)
+        pthread_mutex_unlock(&is->render_mutex);
     stream_component_open(is, stream_index);
 }
 
@@ -3735,55 +9857,72 @@ static void toggle_audio_display(VideoState *is) {
     }
 }
 
+/* how long the refresh loop may sleep when video_refresh() has no earlier deadline */
+static double refresh_timeout(VideoState *is) {
+    double remaining_time = EVENT_WAIT_TIMEOUT / 1000.0;
+
+    // 鼠标还显示着时, 到时间要隐藏它
+    if (!cursor_hidden)
+        remaining_time = FFMIN(remaining_time,
+                               (cursor_last_shown + CURSOR_HIDE_DELAY - av_gettime_relative()) / 1000000.0);
+    // 有待显示的帧时和原来一样最多等待REFRESH_RATE, 队列空时由video_thread唤醒
+    if (is->video_st && !is->paused && frame_queue_nb_remaining(&is->pictq) > 0)
+        remaining_time = FFMIN(remaining_time, REFRESH_RATE);
+    return FFMAX(remaining_time, 0.0);
+}
+
 /***
  * 显示视频
  *
  * 循环检测并优先处理用户输入事件
- * 内置刷新率控制，约10ms刷新一次
+ * 阻塞在SDL_WaitEventTimeout上直到下一帧的显示时间, 有帧待显示时最多10ms刷新一次,
+ * 暂停, 没有可视化的纯音频或者窗口隐藏时只在有事件或者FF_WAKEUP_EVENT时醒来
  */
 static void refresh_loop_wait_event(VideoState *is, SDL_Event *event) {
     double remaining_time = 0.0;
+    int64_t displays;
+    int timed_out = 0;
+
+    if (!is || is->render_tid) {
+        // 由render_thread刷新画面(或者正在换台, 没有画面可刷新), 这里只等待输入事件
+        while (!SDL_WaitEventTimeout(event, EVENT_WAIT_TIMEOUT)) {
+            if (!cursor_hidden && av_gettime_relative() - cursor_last_shown > CURSOR_HIDE_DELAY) {
+                SDL_ShowCursor(0);
+                cursor_hidden = 1;
+            }
+        }
+        return;
+    }
+
     /* 从输入设备收集事件并放到事件队列中 */
     SDL_PumpEvents();
     //printf("refresh_loop_wait_event() start\n");
-    while (1) {
-        // region
-        /***
-         * SDL_PeepEvents接受到键盘,鼠标有关事件后就会跳出while循环处理其他事情,然后又进入循环
-         *
-         * SDL_PeepEvents
-         * 从事件队列中提取事件，由于这里使用的是SDL_GETEVENT, 所以获取事件时会从队列中移除
-         * 如果有事件发生，返回事件数量，则while循环不执行。
-         * 如果出错，返回负数的错误码，则while循环不执行。
-         * 如果当前没有事件发生，且没有出错，返回0，进入while循环。
-         */
-        if (!SDL_PeepEvents(event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT)) {
-        } else {
-            break;
-        }
+    while (!SDL_PeepEvents(event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT)) {
         // 鼠标显示着,但过了一段时间后,就隐藏鼠标
         if (!cursor_hidden && av_gettime_relative() - cursor_last_shown > CURSOR_HIDE_DELAY) {
             // 隐藏鼠标
             SDL_ShowCursor(0);
             cursor_hidden = 1;
         }
-        // endregion
 
-        // region
-        /* 默认屏幕刷新率控制，REFRESH_RATE = 10ms */
-        if (remaining_time > 0.0) {
-            av_usleep((int64_t) (remaining_time * 1000000.0));
-        }
-        remaining_time = REFRESH_RATE;
+        remaining_time = refresh_timeout(is);
+        displays = is->nb_displays;
         //printf("refresh_loop_wait_event() paused = %d force_refresh = %d\n", is->paused, is->force_refresh);
-        if (is->show_mode != VideoState::SHOW_MODE_NONE && (!is->paused || is->force_refresh)) {
+        if (is->show_mode != VideoState::SHOW_MODE_NONE && (!is->paused || is->force_refresh || is->rev.mode != REVERSE_OFF)) {
             //printf("video_refresh() remaining_time = %d\n", remaining_time);
             video_refresh(is, &remaining_time);
         }
-        // endregion
+        refresh_count_wakeup(is, timed_out && displays == is->nb_displays);
 
-        /* 再次检测输入事件 */
-        SDL_PumpEvents();
+        /* 等待输入事件, 最多等到下一帧的显示时间 */
+        if (!SDL_WaitEventTimeout(event, (int) ceil(FFMAX(remaining_time, 0.0) * 1000.0))) {
+            timed_out = 1;
+            continue;
+        }
+        if (event->type != FF_WAKEUP_EVENT)
+            break;
+        SDL_AtomicSet(&is->wakeup_pending, 0);
+        timed_out = 0;
     }
     //printf("refresh_loop_wait_event() end\n");
 }
@@ -3814,7 +9953,272 @@ static void seek_chapter(VideoState *is, int incr) {
                                  AV_TIME_BASE_Q), 0, 0);
 }
 
+static int render_command_push(RenderCommandQueue *q, const RenderCommand *cmd) {
+    int windex = SDL_AtomicGet(&q->windex);
+
+    if (windex - SDL_AtomicGet(&q->rindex) >= RENDER_COMMAND_QUEUE_SIZE)
+        return -1;
+    q->cmds[windex & (RENDER_COMMAND_QUEUE_SIZE - 1)] = *cmd;
+    /* publish the command only after it is written */
+    SDL_AtomicSet(&q->windex, windex + 1);
+    return 0;
+}
+
+static int render_command_pop(RenderCommandQueue *q, RenderCommand *cmd) {
+    int rindex = SDL_AtomicGet(&q->rindex);
+
+    if (rindex == SDL_AtomicGet(&q->windex))
+        return 0;
+    *cmd = q->cmds[rindex & (RENDER_COMMAND_QUEUE_SIZE - 1)];
+    SDL_AtomicSet(&q->rindex, rindex + 1);
+    return 1;
+}
+
+static void render_command_exec(VideoState *is, const RenderCommand *cmd) {
+    int latency = (int) (SDL_GetTicks() - cmd->event_ticks);
+
+    is->nb_render_commands++;
+    is->render_latency_sum += latency;
+    is->render_latency_max = FFMAX(is->render_latency_max, latency);
+
+    switch (cmd->type) {
+        case RENDER_CMD_RESIZE:
+            is->width = (int) cmd->pos;
+            is->height = (int) cmd->rel;
+            if (is->vis_texture) {
+                SDL_DestroyTexture(is->vis_texture);
+                is->vis_texture = nullptr;
+            }
+            is->force_refresh = 1;
+            break;
+        case RENDER_CMD_REFRESH:
+            is->force_refresh = 1;
+            break;
+        case RENDER_CMD_TOGGLE_PAUSE:
+            if (is->rev.mode == REVERSE_PLAY) {
+                is->rev.mode = REVERSE_STEP;
+            } else if (is->rev.mode == REVERSE_STEP) {
+                /* play forward from the frame on screen */
+                is->rev.was_paused = 0;
+                reverse_stop(is, 1);
+            } else {
+                toggle_pause(is);
+            }
+            break;
+        case RENDER_CMD_STEP:
+            if (is->rev.mode != REVERSE_OFF) {
+                /* the seek back to the frame on screen steps onto it */
+                is->rev.was_paused = 1;
+                reverse_stop(is, 1);
+            } else {
+                step_to_next_frame(is);
+            }
+            break;
+        case RENDER_CMD_SEEK:
+            if (is->rev.mode != REVERSE_OFF)
+                reverse_stop(is, 0);
+            stream_seek(is, cmd->pos, cmd->rel, cmd->arg);
+            break;
+        case RENDER_CMD_SEEK_CHAPTER:
+            if (is->rev.mode != REVERSE_OFF)
+                reverse_stop(is, 0);
+            seek_chapter(is, cmd->arg);
+            break;
+        case RENDER_CMD_SEEK_PREVIEW:
+            if (is->rev.mode != REVERSE_OFF)
+                reverse_stop(is, 0);
+            stream_seek_preview(is, cmd->pos, cmd->arg);
+            break;
+        case RENDER_CMD_SEEK_PREVIEW_END:
+            stream_seek_preview_end(is);
+            break;
+        case RENDER_CMD_REVERSE:
+            reverse_command(is, cmd->arg);
+            break;
+        case RENDER_CMD_TOGGLE_AUDIO_DISPLAY:
+#if CONFIG_AVFILTER
+            if (is->show_mode == VideoState::SHOW_MODE_VIDEO && is->vfilter_idx < nb_vfilters - 1) {
+                if (++is->vfilter_idx >= nb_vfilters)
+                    is->vfilter_idx = 0;
+            } else {
+                is->vfilter_idx = 0;
+                toggle_audio_display(is);
+            }
+#else
+            toggle_audio_display(is);
+#endif
+            break;
+        default:
+            break;
+    }
+}
+
+/* hand a command to the render thread, or run it right away without one */
+static void render_command(VideoState *is, const SDL_Event *event, int type, int64_t pos, int64_t rel, int arg) {
+    RenderCommand cmd;
+
+    cmd.type = type;
+    cmd.pos = pos;
+    cmd.rel = rel;
+    cmd.arg = arg;
+    cmd.event_ticks = event->common.timestamp;
+    if (!is->render_tid) {
+        render_command_exec(is, &cmd);
+    } else if (render_command_push(&is->render_cmdq, &cmd) < 0) {
+        is->nb_render_commands_dropped++;
+    } else {
+        SDL_SemPost(is->render_wakeup);
+    }
+}
+
+// renderer和窗口一样在main里创建, 到do_exit才销毁; -render_thread时只由render_thread用它画
+static int renderer_open(void) {
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (!renderer) {
+        av_log(nullptr, AV_LOG_WARNING, "Failed to initialize a hardware accelerated renderer: %s\n",
+               SDL_GetError());
+        renderer = SDL_CreateRenderer(window, -1, 0);
+    }
+    if (renderer) {
+        if (!SDL_GetRendererInfo(renderer, &renderer_info))
+            av_log(nullptr, AV_LOG_VERBOSE, "Initialized %s renderer.\n", renderer_info.name);
+    }
+    if (!renderer || !renderer_info.num_texture_formats) {
+        av_log(nullptr, AV_LOG_FATAL, "Failed to create renderer: %s\n", SDL_GetError());
+        return -1;
+    }
+    return 0;
+}
+
+/* the textures are created by the uploads, they go away on the thread that drew with them */
+static void render_textures_free(VideoState *is) {
+    if (is->vis_texture) {
+        SDL_DestroyTexture(is->vis_texture);
+        is->vis_texture = nullptr;
+    }
+    if (is->vid_texture) {
+        SDL_DestroyTexture(is->vid_texture);
+        is->vid_texture = nullptr;
+    }
+    if (is->sub_texture) {
+        SDL_DestroyTexture(is->sub_texture);
+        is->sub_texture = nullptr;
+    }
+}
+
+// 渲染线程: 执行event_loop发来的命令并刷新画面
+static int render_thread(void *arg) {
+    printf("render_thread() start\n");
+    VideoState *is = static_cast<VideoState *>(arg);
+    double remaining_time = 0.0;
+    int64_t displays;
+    int timed_out = 0;
+    RenderCommand cmd;
+
+    // 这个线程只上传纹理, 画和present; 窗口的操作都在event_loop里
+    while (!is->render_abort) {
+        while (render_command_pop(&is->render_cmdq, &cmd))
+            render_command_exec(is, &cmd);
+
+        remaining_time = refresh_timeout(is);
+        displays = is->nb_displays;
+        pthread_mutex_lock(&is->render_mutex);
+        if (is->show_mode != VideoState::SHOW_MODE_NONE && (!is->paused || is->force_refresh || is->rev.mode != REVERSE_OFF))
+            video_refresh(is, &remaining_time);
+        pthread_mutex_unlock(&is->render_mutex);
+        refresh_count_wakeup(is, timed_out && displays == is->nb_displays);
+
+        /* a command or a new picture wakes the thread up before the next frame is due */
+        if (remaining_time >= 0.001)
+            timed_out = SDL_SemWaitTimeout(is->render_wakeup, (Uint32) ceil(remaining_time * 1000.0)) != 0;
+        else if (remaining_time > 0.0)
+            av_usleep((int64_t) (remaining_time * 1000000.0));
+    }
+    render_textures_free(is);
+    printf("render_thread() end\n");
+    return 0;
+}
+
+static int render_thread_start(VideoState *is) {
+    if (!(is->render_wakeup = SDL_CreateSemaphore(0))) {
+        av_log(nullptr, AV_LOG_ERROR, "SDL_CreateSemaphore(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    if (!(is->render_tid = thread_create(render_thread, "render_thread", is, THREAD_ROLE_RENDER))) {
+        av_log(nullptr, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+// 换台线程: 目标频道在standby时接过它的输入, 解码器和GOP, 否则和启动时一样冷打开; 打不开就回到原来的频道
+static int zap_switch_thread(void *arg) {
+    ZapChannel *ch = &zap.channels[zap.switch_target];
+    ZapChannel *standby = nullptr;
+    VideoState *is;
+    SDL_Event event;
+
+    if (ch->tid) {
+        zap_standby_stop(ch, 1);
+        if (ch->state == ZAP_READY)
+            standby = ch;
+    }
+    zap.current = zap.switch_target;
+    input_filename = ch->url;
+    is = stream_open(ch->url, file_iformat, standby);
+    zap_standby_close(ch);
+    if (!is) {
+        /* create_avformat_context asked to quit, the previous channel is still worth a try */
+        SDL_FlushEvent(FF_QUIT_EVENT);
+        av_log(nullptr, AV_LOG_ERROR, "zap: cannot open %s, back to %s\n", ch->url, zap.channels[zap.switch_prev].url);
+        zap.current = zap.switch_prev;
+        input_filename = zap.channels[zap.switch_prev].url;
+        is = stream_open(input_filename, file_iformat, nullptr);
+    }
+    event.type = FF_ZAP_EVENT;
+    event.user.data1 = is;
+    SDL_PushEvent(&event);
+    return 0;
+}
+
 /* handle an event sent by the GUI */
+// 换到前一个或后一个频道: 这里只关掉当前的频道, 打开新频道的连接和探测在zap_switch_thread里做,
+// 完成后event_loop收到FF_ZAP_EVENT再调用zap_switch_done; 期间界面照常处理窗口事件
+static int zap_switch(VideoState *is, int dir) {
+    int target = ((zap.current + dir) % zap.nb_channels + zap.nb_channels) % zap.nb_channels;
+
+    if (target == zap.current)
+        return 0;
+    zap.switch_time = av_gettime_relative();
+    zap.switch_target = target;
+    zap.switch_prev = zap.current;
+    zap.switch_width = is->width;
+    zap.switch_height = is->height;
+    // 没有render_thread时纹理属于这个线程, 所以在这里关
+    stream_close(is);
+    if (!(zap.switch_tid = thread_create(zap_switch_thread, "zap_switch", nullptr, THREAD_ROLE_DEMUX))) {
+        av_log(nullptr, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+        do_exit(nullptr);
+    }
+    return 1;
+}
+
+static VideoState *zap_switch_done(VideoState *is) {
+    SDL_WaitThread(zap.switch_tid, nullptr);
+    zap.switch_tid = nullptr;
+    if (!is)
+        do_exit(nullptr);
+    // 窗口保持原来的大小和位置, 不用等video_open
+    is->width = zap.switch_width;
+    is->height = zap.switch_height;
+    if (window)
+        SDL_SetWindowTitle(window, input_filename);
+    if (render_thread_enable && render_thread_start(is) < 0)
+        do_exit(is);
+    zap_update_standby();
+    return is;
+}
+
 static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
     printf("event_loop()     seek_interval = %f\n", seek_interval);
     printf("event_loop()     seek_by_bytes = %d\n", seek_by_bytes);
@@ -3823,11 +10227,31 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
 
     SDL_Event event;
     double incr, pos, frac;
+    int seek_cmd;
+    int quit_pending = 0;
+
+    // 从这里开始只由render_thread画
+    if (render_thread_enable && render_thread_start(is) < 0)
+        do_exit(is);
+    if (!render_thread_enable)
+        thread_role_enter(THREAD_ROLE_RENDER);
     printf("event_loop() for start\n");
     for (;;) {
         double x;
         refresh_loop_wait_event(is, &event);
         //printf("event_loop() event.type = %d\n", event.type);
+        if (!is) {
+            // 正在换台: 旧的频道已经关了, 输入事件没有对象; 退出请求等新频道打开以后再执行
+            if (event.type == SDL_QUIT || (event.type == SDL_KEYDOWN &&
+                                           (event.key.keysym.sym == SDLK_ESCAPE || event.key.keysym.sym == SDLK_q)))
+                quit_pending = 1;
+            if (event.type == FF_ZAP_EVENT) {
+                is = zap_switch_done(static_cast<VideoState *>(event.user.data1));
+                if (quit_pending)
+                    do_exit(is);
+            }
+            continue;
+        }
         switch (event.type) {
             case SDL_KEYDOWN:// 768
                 //printf("event_loop()         SDL_KEYDOWN = %d\n", SDL_KEYDOWN);
@@ -3847,12 +10271,12 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
                     case SDLK_f:
                         // 进入全屏 退出全屏
                         toggle_full_screen(is);
-                        is->force_refresh = 1;
+                        render_command(is, &event, RENDER_CMD_REFRESH, 0, 0, 0);
                         break;
                     case SDLK_p:
                     case SDLK_SPACE:
                         // 暂停 播放
-                        toggle_pause(is);
+                        render_command(is, &event, RENDER_CMD_TOGGLE_PAUSE, 0, 0, 0);
                         break;
                     case SDLK_m:
                         // 静音 出音
@@ -3868,7 +10292,26 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
                         break;
                     case SDLK_s: // S: Step to next frame
                         // 按一下"s"键播放一帧
-                        step_to_next_frame(is);
+                        render_command(is, &event, RENDER_CMD_STEP, 0, 0, 0);
+                        break;
+                    case SDLK_r:
+                        // 倒放 正向播放
+                        render_command(is, &event, RENDER_CMD_REVERSE, 0, 0, REVERSE_PLAY);
+                        break;
+                    case SDLK_b:
+                        // 按一下"b"键往回退一帧
+                        render_command(is, &event, RENDER_CMD_REVERSE, 0, 0, REVERSE_STEP);
+                        break;
+                    case SDLK_l:
+                        // 追直播: 目标在环的末尾之后, 落在最新的关键帧上
+                        if (is->tshift.base)
+                            render_command(is, &event, RENDER_CMD_SEEK, INT64_MAX / 2, 0, 0);
+                        break;
+                    case SDLK_LEFTBRACKET:
+                    case SDLK_RIGHTBRACKET:
+                        // 换台
+                        if (zap.nb_channels > 1 && zap_switch(is, event.key.keysym.sym == SDLK_RIGHTBRACKET ? 1 : -1))
+                            is = nullptr;
                         break;
                     case SDLK_a:
                         stream_cycle_channel(is, AVMEDIA_TYPE_AUDIO);
@@ -3885,24 +10328,14 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
                         stream_cycle_channel(is, AVMEDIA_TYPE_SUBTITLE);
                         break;
                     case SDLK_w:
-#if CONFIG_AVFILTER
-                        if (is->show_mode == VideoState::SHOW_MODE_VIDEO && is->vfilter_idx < nb_vfilters - 1) {
-                            if (++is->vfilter_idx >= nb_vfilters)
-                                is->vfilter_idx = 0;
-                        } else {
-                            is->vfilter_idx = 0;
-                            toggle_audio_display(is);
-                        }
-#else
-                        toggle_audio_display(cur_stream);
-#endif
+                        render_command(is, &event, RENDER_CMD_TOGGLE_AUDIO_DISPLAY, 0, 0, 0);
                         break;
                     case SDLK_PAGEUP: {
                         if (is->ic->nb_chapters <= 1) {
                             incr = 600.0;
                             goto do_seek;
                         }
-                        seek_chapter(is, 1);
+                        render_command(is, &event, RENDER_CMD_SEEK_CHAPTER, 0, 0, 1);
                         break;
                     }
                     case SDLK_PAGEDOWN: {
@@ -3910,7 +10343,7 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
                             incr = -600.0;
                             goto do_seek;
                         }
-                        seek_chapter(is, -1);
+                        render_command(is, &event, RENDER_CMD_SEEK_CHAPTER, 0, 0, -1);
                         break;
                     }
                     case SDLK_LEFT: {
@@ -3953,9 +10386,17 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
                                 incr *= 180000.0;
                             pos += incr;
                             printf("event_loop()  pos = %lf incr = %lf seek_by_bytes = %d\n", pos, incr, seek_by_bytes);
-                            stream_seek(is, pos, incr, 1);
+                            render_command(is, &event, RENDER_CMD_SEEK, pos, incr, 1);
                         } else {
                             pos = get_master_clock(is);
+                            /* held keys add up on the target that is still pending */
+                            if (is->seek_req && !(is->seek_flags & AVSEEK_FLAG_BYTE))
+                                pos = is->seek_pos / (double) AV_TIME_BASE;
+                            /* the clocks stay where reverse playback started */
+                            pthread_mutex_lock(&is->rev.pmutex);
+                            if (is->rev.mode != REVERSE_OFF && is->rev.shown.frame->buf[0])
+                                pos = is->rev.shown.pts;
+                            pthread_mutex_unlock(&is->rev.pmutex);
                             if (isnan(pos))
                                 pos = (double) is->seek_pos / AV_TIME_BASE;
                             pos += incr;
@@ -3963,7 +10404,8 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
                                 && pos < is->ic->start_time / (double) AV_TIME_BASE)
                                 pos = is->ic->start_time / (double) AV_TIME_BASE;
                             printf("event_loop()  pos = %lf incr = %lf seek_by_bytes = %d\n", pos, incr, seek_by_bytes);
-                            stream_seek(is, (int64_t) (pos * AV_TIME_BASE), (int64_t) (incr * AV_TIME_BASE), 0);
+                            render_command(is, &event, RENDER_CMD_SEEK,
+                                           (int64_t) (pos * AV_TIME_BASE), (int64_t) (incr * AV_TIME_BASE), 0);
                         }
                         break;
                     default:
@@ -3981,7 +10423,7 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
                     static int64_t last_mouse_left_click = 0;
                     if (av_gettime_relative() - last_mouse_left_click <= 500000) {
                         toggle_full_screen(is);
-                        is->force_refresh = 1;
+                        render_command(is, &event, RENDER_CMD_REFRESH, 0, 0, 0);
                         last_mouse_left_click = 0;
                     } else {
                         last_mouse_left_click = av_gettime_relative();
@@ -4004,9 +10446,11 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
                         break;
                     x = event.motion.x;
                 }
+                /* dragging with the right button previews keyframes, the button up seeks for real */
+                seek_cmd = event.type == SDL_MOUSEMOTION && seek_preview ? RENDER_CMD_SEEK_PREVIEW : RENDER_CMD_SEEK;
                 if (seek_by_bytes || is->ic->duration <= 0) {
                     uint64_t size = avio_size(is->ic->pb);
-                    stream_seek(is, size * x / is->width, 0, 1);
+                    render_command(is, &event, seek_cmd, size * x / is->width, 0, 1);
                 } else {
                     int64_t ts;
                     int ns, hh, mm, ss;
@@ -4026,23 +10470,25 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
                     ts = frac * is->ic->duration;
                     if (is->ic->start_time != AV_NOPTS_VALUE)
                         ts += is->ic->start_time;
-                    stream_seek(is, ts, 0, 0);
+                    render_command(is, &event, seek_cmd, ts, 0, 0);
                 }
                 break;
+            case SDL_MOUSEBUTTONUP:
+                if (event.button.button == SDL_BUTTON_RIGHT)
+                    render_command(is, &event, RENDER_CMD_SEEK_PREVIEW_END, 0, 0, 0);
+                break;
             case SDL_WINDOWEVENT:// 512
                 //printf("event_loop()     SDL_WINDOWEVENT = %d\n", SDL_WINDOWEVENT);
                 switch (event.window.event) {
                     case SDL_WINDOWEVENT_SIZE_CHANGED:
                         printf("event_loop() SDL_WINDOWEVENT SDL_WINDOWEVENT_SIZE_CHANGED\n");
-                        screen_width = is->width = event.window.data1;
-                        screen_height = is->height = event.window.data2;
-                        if (is->vis_texture) {
-                            SDL_DestroyTexture(is->vis_texture);
-                            is->vis_texture = nullptr;
-                        }
+                        screen_width = event.window.data1;
+                        screen_height = event.window.data2;
+                        render_command(is, &event, RENDER_CMD_RESIZE, event.window.data1, event.window.data2, 0);
+                        break;
                     case SDL_WINDOWEVENT_EXPOSED:
                         printf("event_loop() SDL_WINDOWEVENT SDL_WINDOWEVENT_EXPOSED\n");
-                        is->force_refresh = 1;
+                        render_command(is, &event, RENDER_CMD_REFRESH, 0, 0, 0);
                     default:
                         break;
                 }
@@ -4055,6 +10501,15 @@ static void event_loop(VideoState *is) {// 原来的参数名: cur_stream
                 printf("event_loop()       FF_QUIT_EVENT = %d\n", FF_QUIT_EVENT);
                 do_exit(is);
                 break;
+            case FF_WAKEUP_EVENT:
+                // 在refresh_loop_wait_event的SDL_PeepEvents中取到的
+                SDL_AtomicSet(&is->wakeup_pending, 0);
+                break;
+            case FF_WINDOW_EVENT:
+                // 换台之前的频道发来的不用管, 窗口已经显示了
+                if (event.user.data1 == is)
+                    video_window_show(event.user.code, (int) (intptr_t) event.user.data2);
+                break;
             default:
                 break;
         }
@@ -4105,6 +10560,125 @@ static int opt_sync(void *optctx, const char *opt, const char *arg) {
     return 0;
 }
 
+static int opt_audio_latency(void *optctx, const char *opt, const char *arg) {
+    for (int i = 0; i < AUDIO_LATENCY_NB; i++) {
+        if (!strcmp(arg, audio_latency_modes[i].name)) {
+            audio_latency_mode = i;
+            return 0;
+        }
+    }
+    av_log(nullptr, AV_LOG_ERROR, "Unknown value for %s: %s\n", opt, arg);
+    exit(1);
+}
+
+static int opt_parallel_decode(void *optctx, const char *opt, const char *arg) {
+    if (!strcmp(arg, "off"))
+        parallel_decode = PDEC_OFF;
+    else if (!strcmp(arg, "intra"))
+        parallel_decode = PDEC_INTRA;
+    else if (!strcmp(arg, "gop"))
+        parallel_decode = PDEC_GOP;
+    else if (!strcmp(arg, "auto"))
+        parallel_decode = PDEC_AUTO;
+    else {
+        av_log(nullptr, AV_LOG_ERROR, "Unknown value for %s: %s\n", opt, arg);
+        exit(1);
+    }
+    return 0;
+}
+
+static int opt_thread_role(const char *opt, const char *arg, const char **value) {
+    const char *eq = strchr(arg, '=');
+    int role = eq ? thread_role_find(arg, eq - arg) : -1;
+
+    if (role < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "%s wants role=value with a role of audio, render, video, demux or filter: %s\n",
+               opt, arg);
+        exit(1);
+    }
+    *value = eq + 1;
+    return role;
+}
+
+// role=fifo:N, rr:N, nice:N, 或SDL的优先级low, normal, high, critical
+static int opt_thread_sched(void *optctx, const char *opt, const char *arg) {
+    static const char *const sdl_names[] = {"low", "normal", "high", "critical"};
+    const char *spec;
+    ThreadRole *r = &thread_roles[opt_thread_role(opt, arg, &spec)];
+    char *tail = nullptr;
+
+    if (!strncmp(spec, "fifo:", 5) || !strncmp(spec, "rr:", 3) || !strncmp(spec, "nice:", 5)) {
+        r->sched = spec[0] == 'f' ? THREAD_SCHED_FIFO : spec[0] == 'r' ? THREAD_SCHED_RR : THREAD_SCHED_NICE;
+        r->priority = (int) strtol(strchr(spec, ':') + 1, &tail, 10);
+    } else if (!strcmp(spec, "default")) {
+        r->sched = THREAD_SCHED_DEFAULT;
+        return 0;
+    } else {
+        for (int i = 0; i < FF_ARRAY_ELEMS(sdl_names); i++) {
+            if (!strcmp(spec, sdl_names[i])) {
+                r->sched = THREAD_SCHED_SDL;
+                r->priority = SDL_THREAD_PRIORITY_LOW + i;
+                return 0;
+            }
+        }
+    }
+    if (!tail || *tail || tail == strchr(spec, ':') + 1) {
+        av_log(nullptr, AV_LOG_ERROR, "Unknown value for %s: %s\n", opt, arg);
+        exit(1);
+    }
+    return 0;
+}
+
+// role=cpu列表, 如0,2-3
+static int opt_thread_affinity(void *optctx, const char *opt, const char *arg) {
+    const char *p;
+    ThreadRole *r = &thread_roles[opt_thread_role(opt, arg, &p)];
+    uint64_t mask = 0;
+    char *tail;
+
+    while (*p) {
+        long first = strtol(p, &tail, 10), last = first;
+        if (tail == p)
+            break;
+        if (*tail == '-')
+            last = strtol(tail + 1, &tail, 10);
+        if (first < 0 || last < first || last >= 64)
+            break;
+        for (long i = first; i <= last; i++)
+            mask |= 1ULL << i;
+        p = tail;
+        if (*p == ',')
+            p++;
+        else if (*p)
+            break;
+    }
+    if (*p || !mask) {
+        av_log(nullptr, AV_LOG_ERROR, "Unknown value for %s: %s\n", opt, arg);
+        exit(1);
+    }
+#ifdef __linux__
+    r->cpu_mask = mask;
+#else
+    // 只有Linux能给单个线程设置可用的CPU
+    av_log(nullptr, AV_LOG_WARNING, "-%s is not supported on this platform, ignored\n", opt);
+#endif
+    return 0;
+}
+
+static int opt_resample_quality(void *optctx, const char *opt, const char *arg) {
+    if (!strcmp(arg, "fast"))
+        resample_quality = RESAMPLE_QUALITY_FAST;
+    else if (!strcmp(arg, "normal"))
+        resample_quality = RESAMPLE_QUALITY_NORMAL;
+    else if (!strcmp(arg, "high"))
+        resample_quality = RESAMPLE_QUALITY_HIGH;
+    else {
+        av_log(nullptr, AV_LOG_ERROR, "Unknown value for %s: %s\n", opt, arg);
+        exit(1);
+    }
+    return 0;
+}
+
 static int opt_seek(void *optctx, const char *opt, const char *arg) {
     start_time = parse_time_or_die(opt, arg, 1);
     return 0;
@@ -4199,6 +10773,102 @@ static const OptionDef options[] = {
         {"lowres", OPT_INT | HAS_ARG | OPT_EXPERT, {&lowres}, "", ""},
         {"sync", HAS_ARG | OPT_EXPERT, {.func_arg = opt_sync}, "set audio-video sync. type (type=audio/video/ext)",
          "type"},
+        {"audio_latency", HAS_ARG | OPT_AUDIO | OPT_EXPERT, {.func_arg = opt_audio_latency},
+         "set audio output latency mode (mode=ultralow/normal/powersave)", "mode"},
+        {"audio_push", OPT_BOOL | OPT_AUDIO | OPT_EXPERT, {&audio_push},
+         "queue audio with SDL_QueueAudio and use the measured queue size for the audio clock", ""},
+        {"render_thread", OPT_BOOL | OPT_EXPERT, {&render_thread_enable},
+         "draw video on a dedicated thread instead of the event loop", ""},
+        {"present_sched", OPT_BOOL | OPT_EXPERT, {&present_sched},
+         "align video frames to the display refresh when the renderer uses vsync", ""},
+        {"jitbuf", OPT_BOOL | OPT_EXPERT, {&jitter_buffer},
+         "jitter buffer for realtime inputs (default auto: on for rtp/rtsp/udp)", ""},
+        {"jitbuf_min", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&jitter_min_delay},
+         "minimum jitter buffer delay", "msecs"},
+        {"jitbuf_max", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&jitter_max_delay},
+         "maximum jitter buffer delay", "msecs"},
+        {"loopback_port", OPT_INT | HAS_ARG | OPT_EXPERT, {&loopback_port},
+         "stream the input as mpegts to udp://127.0.0.1:port and play that instead", "port"},
+        {"loopback_jitter", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&loopback_jitter},
+         "maximum random delay of the loopback sender", "msecs"},
+        {"loopback_loss", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&loopback_loss},
+         "datagram loss of the loopback sender", "percent"},
+        {"avsync_kp", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&avsync_kp},
+         "proportional gain of the A-V drift controller, per second", "gain"},
+        {"avsync_ki", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&avsync_ki},
+         "integral gain of the A-V drift controller, per second squared", "gain"},
+        {"avsync_max_correction", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&avsync_max_correction},
+         "maximum audio speed change for A-V sync, in percent", "percent"},
+        {"downscale", OPT_BOOL | OPT_EXPERT, {&downscale},
+         "decode (lowres) and filter video no larger than the window shows it", ""},
+        {"degrade", OPT_BOOL | OPT_EXPERT, {&decoder_degrade},
+         "lower the decoding quality step by step when decoding can't keep up (default auto: with framedrop)", ""},
+        {"parallel_decode", HAS_ARG | OPT_VIDEO | OPT_EXPERT, {.func_arg = opt_parallel_decode},
+         "decode video units on several decoder contexts at once (off, intra, gop; default auto: intra-only codecs "
+         "without frame threading)", "mode"},
+        {"parallel_decoders", OPT_INT | HAS_ARG | OPT_VIDEO | OPT_EXPERT, {&parallel_decoders},
+         "number of parallel decoder contexts (0 = one per cpu)", "count"},
+        {"thread_tune", OPT_BOOL | OPT_VIDEO | OPT_EXPERT, {&thread_tune},
+         "choose video decoding thread type and count (slice threads for live inputs) unless -threads is given", ""},
+        {"thread_budget", OPT_INT | HAS_ARG | OPT_EXPERT, {&thread_budget},
+         "threads shared by all decoders and the worker pool (0 = one per cpu)", "count"},
+        {"thread_probe", OPT_DOUBLE | HAS_ARG | OPT_VIDEO | OPT_EXPERT, {&thread_probe},
+         "measure the decoding speed this long and reopen the video decoder with better thread settings (0 = off)",
+         "secs"},
+        {"thread_sched", HAS_ARG | OPT_EXPERT, {.func_arg = opt_thread_sched},
+         "scheduling of the audio, render, video, demux or filter threads: role=fifo:N, rr:N, nice:N, "
+         "low, normal, high or critical", "role=policy"},
+        {"thread_affinity", HAS_ARG | OPT_EXPERT, {.func_arg = opt_thread_affinity},
+         "cpus the threads of a role run on: role=0,2-3", "role=cpus"},
+        {"seek_buffer", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&seek_buffer},
+         "keep this many seconds of played packets to serve short seeks without the demuxer (0 = off)", "secs"},
+        {"zap_list", OPT_STRING | HAS_ARG, {&zap_list},
+         "switch between the live channels listed in a file, one URL per line, with [ and ]", "file"},
+        {"zap_standby", OPT_INT | HAS_ARG | OPT_EXPERT, {&zap_standby},
+         "keep this many channels on each side of the current one connected", "n"},
+        {"timeshift", OPT_INT | HAS_ARG, {&timeshift},
+         "record live inputs into a disk ring of this size for pause, rewind and catch-up", "MiB"},
+        {"timeshift_file", OPT_STRING | HAS_ARG | OPT_EXPERT, {&timeshift_file},
+         "file for the timeshift ring, an unlinked temporary file by default", "file"},
+        {"spill_mem", OPT_INT | HAS_ARG | OPT_EXPERT, {&spill_mem},
+         "with -infbuf, packet data kept in memory per queue before it goes to a spill file, 0 to disable", "MiB"},
+        {"spill_size", OPT_INT | HAS_ARG | OPT_EXPERT, {&spill_size},
+         "size of the spill file per queue", "MiB"},
+        {"spill_dir", OPT_STRING | HAS_ARG | OPT_EXPERT, {&spill_dir},
+         "directory for the spill files, they are unlinked right after creation", "dir"},
+        {"seek_bench", OPT_INT | HAS_ARG | OPT_EXPERT, {&seek_bench},
+         "benchmark this many random seeks without display, then exit", "count"},
+        {"seek_bench_seed", OPT_INT | HAS_ARG | OPT_EXPERT, {&seek_bench_seed},
+         "seed of the random -seek_bench targets", "seed"},
+        {"seek_bench_script", OPT_STRING | HAS_ARG | OPT_EXPERT, {&seek_bench_script},
+         "benchmark the seeks listed in a file, one target per line in seconds or percent", "file"},
+        {"seek_bench_log", OPT_STRING | HAS_ARG | OPT_EXPERT, {&seek_bench_log},
+         "append every benchmarked seek to a CSV file", "file"},
+        {"seek_preview", OPT_BOOL | OPT_EXPERT, {&seek_preview},
+         "show only keyframes while seeking by dragging with the right mouse button"},
+        {"reverse_cache", OPT_INT | HAS_ARG | OPT_EXPERT, {&reverse_cache},
+         "memory for decoded frames during reverse playback and backward stepping", "MiB"},
+        {"worker_pool", OPT_BOOL | OPT_EXPERT, {&worker_pool_enable},
+         "run filter slices, sws conversions and the rdft display on one shared pool of half the -thread_budget threads", ""},
+        {"frame_pool", OPT_BOOL | OPT_EXPERT, {&frame_pool},
+         "allocate decoded frames from pooled, aligned buffers", ""},
+        {"frame_pool_thp", OPT_BOOL | OPT_EXPERT, {&frame_pool_thp},
+         "back large pooled frame buffers with transparent huge pages", ""},
+        {"perf_stats", OPT_BOOL | OPT_EXPERT, {&perf_stats},
+         "count cache references and misses, context switches and cpu time per frame of the whole playback", ""},
+        {"clock_stress", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&clock_stress},
+         "run concurrent clock readers and writers for the given time, check for torn reads and exit", "secs"},
+        {"audio_clock_test", OPT_DOUBLE | HAS_ARG | OPT_AUDIO | OPT_EXPERT, {&audio_clock_test},
+         "play silence for the given time in every latency mode, check the audio clock against the samples "
+         "consumed (run with SDL_AUDIODRIVER=disk or dummy) and exit", "secs"},
+        {"avsync_sim", OPT_BOOL | OPT_EXPERT, {&avsync_sim},
+         "simulate the A-V drift controller with synthetic drift and jitter, then exit", ""},
+        {"avsync_sim_drift", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&avsync_sim_drift},
+         "audio device clock drift used by -avsync_sim", "ppm"},
+        {"avsync_sim_jitter", OPT_DOUBLE | HAS_ARG | OPT_EXPERT, {&avsync_sim_jitter},
+         "A-V difference measurement jitter used by -avsync_sim", "msecs"},
+        {"resample_quality", HAS_ARG | OPT_AUDIO | OPT_EXPERT, {.func_arg = opt_resample_quality},
+         "set resampler quality/cost tier (tier=fast/normal/high)", "tier"},
         {"autoexit", OPT_BOOL | OPT_EXPERT, {&autoexit}, "exit at the end", ""},
         {"exitonkeydown", OPT_BOOL | OPT_EXPERT, {&exit_on_keydown}, "exit on key down", ""},
         {"exitonmousedown", OPT_BOOL | OPT_EXPERT, {&exit_on_mousedown}, "exit on mouse down", ""},
@@ -4263,6 +10933,10 @@ void show_help_default(const char *opt, const char *arg) {
            "c                   cycle program\n"
            "w                   cycle video filters or show modes\n"
            "s                   activate frame-step mode\n"
+           "r                   toggle reverse playback\n"
+           "b                   step to the previous frame\n"
+           "[, ]                previous/next channel of -zap_list\n"
+           "l                   jump to the live edge of the -timeshift ring\n"
            "left/right          seek backward/forward 10 seconds or to custom interval if -seek_interval is set\n"
            "down/up             seek backward/forward 1 minute\n"
            "page down/page up   seek backward/forward 10 minutes\n"
@@ -4287,11 +10961,28 @@ int main(int argc, char **argv) {
     printf("main()    audio_disable = %d\n", audio_disable);
     printf("main()    video_disable = %d\n", video_disable);
     printf("main() subtitle_disable = %d\n", subtitle_disable);
+
+    init_dynload();
+    av_log_set_flags(AV_LOG_SKIP_REPEATED);
+    parse_loglevel(argc, argv, options);
+    /* register all codecs, demux and protocols */
+#if CONFIG_AVDEVICE
+    avdevice_register_all();
+#endif
+    avformat_network_init();
+    init_opts();
+    show_banner(argc, argv, options);
+    parse_options(nullptr, argc, argv, options, opt_input_file);
+
     // --------------------------------------------------------SDL初始化
     int flags;
     if (display_disable) {
         video_disable = 1;
     }
+    /* the benchmark measures the pipeline up to the frame that would be shown, not the renderer,
+     * so it keeps decoding video but must not open a window for it */
+    if (seek_bench > 0 || seek_bench_script)
+        display_disable = 1;
     flags = SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER;
     if (audio_disable)
         flags &= ~SDL_INIT_AUDIO;
@@ -4328,36 +11019,27 @@ int main(int argc, char **argv) {
         window = SDL_CreateWindow(program_name, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, default_width,
                                   default_height, flags);
         SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
-        if (window) {
-            renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-            if (!renderer) {
-                av_log(nullptr, AV_LOG_WARNING, "Failed to initialize a hardware accelerated renderer: %s\n",
-                       SDL_GetError());
-                renderer = SDL_CreateRenderer(window, -1, 0);
-            }
-            if (renderer) {
-                if (!SDL_GetRendererInfo(renderer, &renderer_info))
-                    av_log(nullptr, AV_LOG_VERBOSE, "Initialized %s renderer.\n", renderer_info.name);
-            }
-        }
-        if (!window || !renderer || !renderer_info.num_texture_formats) {
-            av_log(nullptr, AV_LOG_FATAL, "Failed to create window or renderer: %s", SDL_GetError());
+        if (!window) {
+            av_log(nullptr, AV_LOG_FATAL, "Failed to create window: %s", SDL_GetError());
             do_exit(nullptr);
         }
     }
     // --------------------------------------------------------
 
-    init_dynload();
-    av_log_set_flags(AV_LOG_SKIP_REPEATED);
-    parse_loglevel(argc, argv, options);
-    /* register all codecs, demux and protocols */
-#if CONFIG_AVDEVICE
-    avdevice_register_all();
-#endif
-    avformat_network_init();
-    init_opts();
-    show_banner(argc, argv, options);
-    parse_options(nullptr, argc, argv, options, opt_input_file);
+    if (avsync_sim) {
+        avsync_simulate();
+        do_exit(nullptr);
+    }
+    if (clock_stress > 0) {
+        if (clock_stress_test(clock_stress) < 0)
+            exit(1);
+        do_exit(nullptr);
+    }
+    if (audio_clock_test > 0) {
+        if (audio_clock_test_all(audio_clock_test) < 0)
+            exit(1);
+        do_exit(nullptr);
+    }
 
     signal(SIGINT, sigterm_handler); /* Interrupt (ANSI).    */
     signal(SIGTERM, sigterm_handler); /* Termination (ANSI).  */
@@ -4385,6 +11067,16 @@ int main(int argc, char **argv) {
     input_filename = "/root/视频/tomcat_video/test.mp4";
     input_filename = "/Users/v_wangliwei/Movies/动态修改UI演示.mov";
     input_filename = "http://183.207.248.71:80/cntv/live1/CCTV-1/cctv-6";
+    if (input_filename && loopback_port > 0) {
+        if (loopback_sender_start(input_filename, loopback_port) < 0)
+            do_exit(nullptr);
+        input_filename = loopback_sender.url;
+    }
+    if (zap_list) {
+        if (zap_load(zap_list) < 0)
+            do_exit(nullptr);
+        input_filename = zap.channels[0].url;
+    }
     if (!input_filename) {
         show_usage();
         av_log(nullptr, AV_LOG_FATAL, "An input file must be specified\n");
@@ -4395,13 +11087,26 @@ int main(int argc, char **argv) {
     av_init_packet(&flush_pkt);
     flush_pkt.data = (uint8_t *) &flush_pkt;
 
+    if (perf_stats)
+        perf_stats_start();
+    thread_role_start_time = av_gettime_relative() / 1000000.0;
+    if (worker_pool_enable)
+        worker_pool_start();
+    // renderer也在这个线程创建, -render_thread时交给render_thread画
+    if (window && renderer_open() < 0)
+        do_exit(nullptr);
+
     // 开始干活
     VideoState *is;
-    is = stream_open(input_filename, file_iformat);
+    is = stream_open(input_filename, file_iformat, nullptr);
     if (!is) {
         av_log(nullptr, AV_LOG_FATAL, "Failed to initialize VideoState!\n");
         do_exit(nullptr);
     }
+    if (seek_bench > 0 || seek_bench_script)
+        seek_bench_begin(is);
+    if (zap_list)
+        zap_update_standby();
 
     event_loop(is);
 